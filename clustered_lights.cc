@@ -0,0 +1,322 @@
+#include "clustered_lights.h"
+
+#include "gl_state.h"
+#include "shader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CLUSTER_SSE 1
+#endif
+
+using namespace std;
+
+const int ClusteredLights::kMaxLights;
+
+// depth slices are log spaced between these (view distance), closer
+// fragments use the first slice and farther ones the last. a cell is 1 unit,
+// so the first slice ends about where the camera can get to a wall
+static const float kFirstSliceEnd = 0.25f;
+static const float kLastSliceStart = 40.0f;
+
+void ClusteredLights::init() {
+    if (ready_) {
+        return;
+    }
+    glGenBuffers(1, &light_buffer_);
+    glGenBuffers(1, &grid_buffer_);
+    glGenBuffers(1, &index_buffer_);
+    glGenTextures(1, &light_tex_);
+    glGenTextures(1, &grid_tex_);
+    glGenTextures(1, &index_tex_);
+
+    // never leave a buffer empty, an empty grid reads back as no lights
+    grid_.assign(kNumClusters * 2, 0);
+    light_data_.assign(8, 0.0f);
+    indices_.assign(1, 0);
+    gl_state().bind_buffer(GL_TEXTURE_BUFFER, light_buffer_);
+    glBufferData(GL_TEXTURE_BUFFER, light_data_.size() * sizeof(float),
+                 light_data_.data(), GL_STREAM_DRAW);
+    gl_state().bind_buffer(GL_TEXTURE_BUFFER, grid_buffer_);
+    glBufferData(GL_TEXTURE_BUFFER, grid_.size() * sizeof(uint32_t), grid_.data(),
+                 GL_STREAM_DRAW);
+    gl_state().bind_buffer(GL_TEXTURE_BUFFER, index_buffer_);
+    glBufferData(GL_TEXTURE_BUFFER, indices_.size() * sizeof(uint16_t),
+                 indices_.data(), GL_STREAM_DRAW);
+    indices_.clear();
+
+    // without texture buffer ranges the textures keep pointing at their
+    // buffer when it is refilled, with them update() moves them into the ring
+    gl_state().bind_texture(UNIT_LIGHT_DATA, GL_TEXTURE_BUFFER, light_tex_);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, light_buffer_);
+    gl_state().bind_texture(UNIT_CLUSTER_GRID, GL_TEXTURE_BUFFER, grid_tex_);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, grid_buffer_);
+    gl_state().bind_texture(UNIT_LIGHT_INDICES, GL_TEXTURE_BUFFER, index_tex_);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R16UI, index_buffer_);
+    ready_ = true;
+}
+
+void ClusteredLights::cleanup() {
+    if (!ready_) {
+        return;
+    }
+    GLuint buffers[3] = {light_buffer_, grid_buffer_, index_buffer_};
+    GLuint textures[3] = {light_tex_, grid_tex_, index_tex_};
+    for (int i = 0; i < 3; i++) {
+        gl_state().forget_buffer(buffers[i]);
+    }
+    for (int i = 0; i < 3; i++) {
+        gl_state().forget_texture(textures[i]);
+    }
+    glDeleteBuffers(3, buffers);
+    glDeleteTextures(3, textures);
+    light_buffer_ = grid_buffer_ = index_buffer_ = 0;
+    light_tex_ = grid_tex_ = index_tex_ = 0;
+    ready_ = false;
+}
+
+void ClusteredLights::build_bounds(const camera_t &cam) {
+    bounds_fov_ = cam.fov;
+    bounds_aspect_ = cam.aspect_ratio;
+    bounds_near_ = cam.near;
+    bounds_far_ = cam.far;
+
+    float z0 = max(kFirstSliceEnd, cam.near);
+    float z1 = max(min(kLastSliceStart, cam.far), z0 * 2.0f);
+    // slice = log(depth) * scale - bias, same formula in fragment.fs
+    slice_scale_ = kSlices / logf(z1 / z0);
+    slice_bias_ = logf(z0) * slice_scale_;
+    for (int k = 0; k < kSlices; k++) {
+        slice_near_[k] = k == 0 ? cam.near : z0 * powf(z1 / z0, (float)k / kSlices);
+        slice_far_[k] = k == kSlices - 1 ? cam.far
+                                          : z0 * powf(z1 / z0, (float)(k + 1) / kSlices);
+    }
+
+    // a tile is a range of ndc x / y, at view depth d that spans
+    // ndc * d * tan(fov / 2) (times the aspect for x). the box around the
+    // slice takes the wider of the two ends
+    float tan_y = tanf(cam.fov * 0.5f);
+    float tan_x = tan_y * cam.aspect_ratio;
+    int per_slice = kTilesX * kTilesY;
+    min_x_.resize(kNumClusters);
+    min_y_.resize(kNumClusters);
+    max_x_.resize(kNumClusters);
+    max_y_.resize(kNumClusters);
+    for (int k = 0; k < kSlices; k++) {
+        float d0 = slice_near_[k], d1 = slice_far_[k];
+        for (int ty = 0; ty < kTilesY; ty++) {
+            float ny0 = -1.0f + 2.0f * ty / kTilesY;
+            float ny1 = -1.0f + 2.0f * (ty + 1) / kTilesY;
+            for (int tx = 0; tx < kTilesX; tx++) {
+                float nx0 = -1.0f + 2.0f * tx / kTilesX;
+                float nx1 = -1.0f + 2.0f * (tx + 1) / kTilesX;
+                int c = k * per_slice + ty * kTilesX + tx;
+                min_x_[c] = min(nx0 * d0, nx0 * d1) * tan_x;
+                max_x_[c] = max(nx1 * d0, nx1 * d1) * tan_x;
+                min_y_[c] = min(ny0 * d0, ny0 * d1) * tan_y;
+                max_y_[c] = max(ny1 * d0, ny1 * d1) * tan_y;
+            }
+        }
+    }
+}
+
+int ClusteredLights::bin_cluster(float min_x, float min_y, float min_z,
+                                 float max_x, float max_y, float max_z) {
+    int num_cand = (int)cand_index_.size();
+    int count = 0;
+#ifdef CLUSTER_SSE
+    // squared distance from each sphere center to the box, 4 lights a step.
+    // the candidate arrays are padded with r2 = -1, which never hits
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 bmin_x = _mm_set1_ps(min_x), bmax_x = _mm_set1_ps(max_x);
+    const __m128 bmin_y = _mm_set1_ps(min_y), bmax_y = _mm_set1_ps(max_y);
+    const __m128 bmin_z = _mm_set1_ps(min_z), bmax_z = _mm_set1_ps(max_z);
+    for (int i = 0; i < num_cand; i += 4) {
+        __m128 x = _mm_loadu_ps(&cand_x_[i]);
+        __m128 y = _mm_loadu_ps(&cand_y_[i]);
+        __m128 z = _mm_loadu_ps(&cand_z_[i]);
+        __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(bmin_x, x), _mm_sub_ps(x, bmax_x)), zero);
+        __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(bmin_y, y), _mm_sub_ps(y, bmax_y)), zero);
+        __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(bmin_z, z), _mm_sub_ps(z, bmax_z)), zero);
+        __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                               _mm_mul_ps(dz, dz));
+        int hits = _mm_movemask_ps(_mm_cmple_ps(d2, _mm_loadu_ps(&cand_r2_[i])));
+        while (hits) {
+            int lane = __builtin_ctz(hits);
+            hits &= hits - 1;
+            if (indices_.size() < (size_t)kMaxIndices) {
+                indices_.push_back(cand_index_[i + lane]);
+                count++;
+            }
+        }
+    }
+#else
+    for (int i = 0; i < num_cand; i++) {
+        float dx = max(max(min_x - cand_x_[i], cand_x_[i] - max_x), 0.0f);
+        float dy = max(max(min_y - cand_y_[i], cand_y_[i] - max_y), 0.0f);
+        float dz = max(max(min_z - cand_z_[i], cand_z_[i] - max_z), 0.0f);
+        if (dx * dx + dy * dy + dz * dz <= cand_r2_[i] &&
+            indices_.size() < (size_t)kMaxIndices) {
+            indices_.push_back(cand_index_[i]);
+            count++;
+        }
+    }
+#endif
+    return count;
+}
+
+void ClusteredLights::update(const camera_t &cam, const glm::mat4 &view,
+                             const vector<point_light_t> &lights, int viewport_w,
+                             int viewport_h) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (cam.fov != bounds_fov_ || cam.aspect_ratio != bounds_aspect_ ||
+        cam.near != bounds_near_ || cam.far != bounds_far_) {
+        build_bounds(cam);
+    }
+
+    num_lights_ = min((int)lights.size(), kMaxLights);
+    int padded = (num_lights_ + 3) & ~3;
+    light_x_.resize(padded);
+    light_y_.resize(padded);
+    light_z_.resize(padded);
+    light_r2_.resize(padded);
+    light_data_.resize(max(num_lights_, 1) * 8);
+    for (int i = 0; i < num_lights_; i++) {
+        const point_light_t &light = lights[i];
+        glm::vec3 p = glm::vec3(view * glm::vec4(light.pos, 1.0f));
+        light_x_[i] = p.x;
+        light_y_[i] = p.y;
+        light_z_[i] = p.z;
+        light_r2_[i] = light.radius * light.radius;
+        float *data = &light_data_[i * 8];
+        data[0] = p.x;
+        data[1] = p.y;
+        data[2] = p.z;
+        data[3] = light.radius;
+        data[4] = light.color.r;
+        data[5] = light.color.g;
+        data[6] = light.color.b;
+        data[7] = 0.0f;
+    }
+
+    // slice by slice: first the lights whose depth range reaches the slice,
+    // then the tiles test only those
+    indices_.clear();
+    grid_.resize(kNumClusters * 2);
+    max_per_cluster_ = 0;
+    num_lit_clusters_ = 0;
+    int per_slice = kTilesX * kTilesY;
+    for (int k = 0; k < kSlices; k++) {
+        // view space z is negative in front of the camera
+        float min_z = -slice_far_[k], max_z = -slice_near_[k];
+        cand_x_.clear();
+        cand_y_.clear();
+        cand_z_.clear();
+        cand_r2_.clear();
+        cand_index_.clear();
+        for (int i = 0; i < num_lights_; i++) {
+            float r = lights[i].radius;
+            if (light_z_[i] - r <= max_z && light_z_[i] + r >= min_z) {
+                cand_x_.push_back(light_x_[i]);
+                cand_y_.push_back(light_y_[i]);
+                cand_z_.push_back(light_z_[i]);
+                cand_r2_.push_back(light_r2_[i]);
+                cand_index_.push_back((uint16_t)i);
+            }
+        }
+        int num_cand = (int)cand_index_.size();
+        if (num_cand == 0) {
+            for (int c = k * per_slice; c < (k + 1) * per_slice; c++) {
+                grid_[c * 2] = (uint32_t)indices_.size();
+                grid_[c * 2 + 1] = 0;
+            }
+            continue;
+        }
+        while (cand_r2_.size() & 3) {
+            cand_x_.push_back(0.0f);
+            cand_y_.push_back(0.0f);
+            cand_z_.push_back(0.0f);
+            cand_r2_.push_back(-1.0f);
+        }
+
+        for (int c = k * per_slice; c < (k + 1) * per_slice; c++) {
+            uint32_t offset = (uint32_t)indices_.size();
+            int count = bin_cluster(min_x_[c], min_y_[c], min_z, max_x_[c],
+                                    max_y_[c], max_z);
+            grid_[c * 2] = offset;
+            grid_[c * 2 + 1] = (uint32_t)count;
+            max_per_cluster_ = max(max_per_cluster_, count);
+            num_lit_clusters_ += count > 0;
+        }
+    }
+    if (indices_.size() >= (size_t)kMaxIndices && !warned_full_) {
+        printf("cluster light lists full (%d entries), dropping lights\n", kMaxIndices);
+        warned_full_ = true;
+    }
+    bin_ms_ = chrono::duration<float, milli>(chrono::steady_clock::now() - start).count();
+
+    if (indices_.empty()) {
+        indices_.push_back(0);
+    }
+    if (frame_ring().texture_ranges()) {
+        // the textures move to this frame's copies in the ring
+        upload_range(UNIT_LIGHT_DATA, light_tex_, GL_RGBA32F, light_data_.data(),
+                     light_data_.size() * sizeof(float));
+        upload_range(UNIT_CLUSTER_GRID, grid_tex_, GL_RG32UI, grid_.data(),
+                     grid_.size() * sizeof(uint32_t));
+        upload_range(UNIT_LIGHT_INDICES, index_tex_, GL_R16UI, indices_.data(),
+                     indices_.size() * sizeof(uint16_t));
+    } else {
+        // orphan and refill
+        gl_state().bind_buffer(GL_TEXTURE_BUFFER, light_buffer_);
+        glBufferData(GL_TEXTURE_BUFFER, light_data_.size() * sizeof(float),
+                     light_data_.data(), GL_STREAM_DRAW);
+        gl_state().bind_buffer(GL_TEXTURE_BUFFER, grid_buffer_);
+        glBufferData(GL_TEXTURE_BUFFER, grid_.size() * sizeof(uint32_t), grid_.data(),
+                     GL_STREAM_DRAW);
+        gl_state().bind_buffer(GL_TEXTURE_BUFFER, index_buffer_);
+        glBufferData(GL_TEXTURE_BUFFER, indices_.size() * sizeof(uint16_t),
+                     indices_.data(), GL_STREAM_DRAW);
+    }
+
+    // LightClusters block in fragment.fs (std140)
+    struct {
+        int32_t dims[4];
+        float scale[4];
+    } params;
+    params.dims[0] = kTilesX;
+    params.dims[1] = kTilesY;
+    params.dims[2] = kSlices;
+    params.dims[3] = num_lights_;
+    params.scale[0] = (float)kTilesX / max(viewport_w, 1);
+    params.scale[1] = (float)kTilesY / max(viewport_h, 1);
+    params.scale[2] = slice_scale_;
+    params.scale[3] = slice_bias_;
+    params_ = frame_ring().upload(&params, sizeof(params), frame_ring().uniform_align());
+}
+
+void ClusteredLights::upload_range(int unit, GLuint texture, GLenum format,
+                                   const void *data, GLsizeiptr size) {
+    ring_chunk_t chunk = frame_ring().upload(data, size, frame_ring().texture_align());
+    gl_state().bind_texture(unit, GL_TEXTURE_BUFFER, texture);
+    glTexBufferRange(GL_TEXTURE_BUFFER, format, chunk.buffer, chunk.offset, chunk.size);
+}
+
+void ClusteredLights::bind() {
+    gl_state().bind_texture(UNIT_LIGHT_DATA, GL_TEXTURE_BUFFER, light_tex_);
+    gl_state().bind_texture(UNIT_CLUSTER_GRID, GL_TEXTURE_BUFFER, grid_tex_);
+    gl_state().bind_texture(UNIT_LIGHT_INDICES, GL_TEXTURE_BUFFER, index_tex_);
+    gl_state().bind_buffer_range(GL_UNIFORM_BUFFER, BLOCK_LIGHT_CLUSTERS, params_.buffer,
+                                 params_.offset, params_.size);
+}
+
+void ClusteredLights::print_stats() const {
+    printf("lights: %d, %d cluster entries, %d of %d clusters lit (max %d), "
+           "binned in %.3f ms\n",
+           num_lights_, (int)indices_.size(), num_lit_clusters_, kNumClusters,
+           max_per_cluster_, bin_ms_);
+}
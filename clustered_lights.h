@@ -0,0 +1,94 @@
+#ifndef CLUSTERED_LIGHTS_H
+#define CLUSTERED_LIGHTS_H
+
+#include "frame_ring.h"
+#include "game_types.h"
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// clustered forward lighting. the view frustum is cut into kTilesX x kTilesY
+// screen tiles and kSlices depth slices (log spaced, so near clusters stay
+// small). every frame the point lights are binned into the clusters their
+// sphere touches on the cpu, 4 lights at a time with sse, and the result goes
+// to the gpu as three texture buffers:
+//   light data    2 rgba32f texels per light, view space pos + radius, color
+//   cluster grid  one (offset, count) pair per cluster into the index list
+//   light indices r16ui, the lights of every cluster back to back
+// fragment.fs finds its cluster from gl_FragCoord and the view depth and only
+// loops over that cluster's lights, so the cost per fragment follows the
+// lights nearby and not the total. texture buffers are core in 3.1, this
+// works on the 3.2 fallback context too
+class ClusteredLights {
+public:
+  static const int kTilesX = 16;
+  static const int kTilesY = 9;
+  static const int kSlices = 24;
+  static const int kNumClusters = kTilesX * kTilesY * kSlices;
+  static const int kMaxLights = 4096;   // indices are 16 bit
+  static const int kMaxIndices = 1 << 20;
+
+  ClusteredLights() = default;
+  ~ClusteredLights() = default;
+
+  // creates the buffers, call once the context is up
+  void init();
+  void cleanup();
+
+  // bins lights (world space) into the clusters of the camera's frustum and
+  // uploads the result. viewport is the size gl_FragCoord runs over
+  void update(const camera_t &cam, const glm::mat4 &view,
+              const vector<point_light_t> &lights, int viewport_w,
+              int viewport_h);
+  // binds the texture buffers and the parameter block for the world shaders
+  void bind();
+
+  int num_lights() const { return num_lights_; }
+  int num_indices() const { return (int)indices_.size(); }
+  void print_stats() const;
+
+private:
+  bool ready_ = false;
+  GLuint light_buffer_ = 0, grid_buffer_ = 0, index_buffer_ = 0;
+  GLuint light_tex_ = 0, grid_tex_ = 0, index_tex_ = 0;
+  // this frame's parameter block in the frame ring
+  ring_chunk_t params_ = {};
+
+  // view space bounds of every cluster, rebuilt when the projection or the
+  // slicing changes. x / y / z min and max in separate arrays
+  float bounds_fov_ = 0.0f, bounds_aspect_ = 0.0f;
+  float bounds_near_ = 0.0f, bounds_far_ = 0.0f;
+  vector<float> min_x_, min_y_, max_x_, max_y_;
+  float slice_near_[kSlices], slice_far_[kSlices];
+  float slice_scale_ = 0.0f, slice_bias_ = 0.0f;
+
+  // lights in view space, structure of arrays padded to a multiple of 4
+  vector<float> light_x_, light_y_, light_z_, light_r2_;
+  vector<float> light_data_;
+  // lights touching the slice being binned
+  vector<float> cand_x_, cand_y_, cand_z_, cand_r2_;
+  vector<uint16_t> cand_index_;
+
+  vector<uint32_t> grid_;    // offset, count per cluster
+  vector<uint16_t> indices_; // light lists
+
+  int num_lights_ = 0;
+  int max_per_cluster_ = 0;
+  int num_lit_clusters_ = 0;
+  float bin_ms_ = 0.0f;
+  bool warned_full_ = false;
+
+  void build_bounds(const camera_t &cam);
+  // copies data into the ring and points the texture at it
+  void upload_range(int unit, GLuint texture, GLenum format, const void *data,
+                    GLsizeiptr size);
+  // appends the candidates whose sphere touches the box to indices_
+  int bin_cluster(float min_x, float min_y, float min_z, float max_x,
+                  float max_y, float max_z);
+};
+
+#endif // CLUSTERED_LIGHTS_H
@@ -0,0 +1,177 @@
+#include "dynamic_resolution.h"
+
+#include "gl_state.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+using namespace std;
+
+constexpr float DynamicResolution::kStep;
+constexpr float DynamicResolution::kSmoothing;
+constexpr float DynamicResolution::kHeadroom;
+constexpr float DynamicResolution::kTolerance;
+
+bool DynamicResolution::is_supported() {
+    return GLAD_GL_VERSION_3_3 || GLAD_GL_ARB_timer_query;
+}
+
+bool DynamicResolution::init(int width, int height) {
+    if (ready_) {
+        return true;
+    }
+    if (!is_supported()) {
+        printf("no timer queries, dynamic resolution not available\n");
+        return false;
+    }
+    width_ = width;
+    height_ = height;
+
+    for (int i = 0; i < kTimers; i++) {
+        glGenQueries(1, &timers_[i].query);
+        timers_[i].pending = false;
+        timers_[i].scale = 0.0f;
+    }
+    glGenVertexArrays(1, &vao_);
+    upscale_shader_ = Shader("shaders/upscale.vs", "shaders/upscale.fs");
+    ready_ = true;
+    return true;
+}
+
+void DynamicResolution::cleanup() {
+    if (vao_ != 0) {
+        gl_state().forget_vertex_array(vao_);
+        glDeleteVertexArrays(1, &vao_);
+    }
+    if (ready_) {
+        for (int i = 0; i < kTimers; i++) {
+            glDeleteQueries(1, &timers_[i].query);
+        }
+        upscale_shader_.cleanUpShader();
+    }
+    vao_ = 0;
+    ready_ = false;
+}
+
+void DynamicResolution::set_enabled(bool enabled) {
+    if (enabled && !ready_) {
+        printf("dynamic resolution needs init(), stays off\n");
+        enabled = false;
+    }
+    enabled_ = enabled;
+    printf("dynamic resolution %s (target %.1f ms, scale %.2f - %.2f)\n",
+           enabled ? "on" : "off", target_ms_, min_scale_, max_scale_);
+}
+
+void DynamicResolution::set_bounds(float min_scale, float max_scale) {
+    min_scale_ = min(max(min_scale, kStep), 1.0f);
+    max_scale_ = min(max(max_scale, min_scale_), 1.0f);
+    scale_ = min(max(scale_, min_scale_), max_scale_);
+    filtered_ms_ = -1.0f;
+    samples_ = 0;
+}
+
+int DynamicResolution::scaled_width() const {
+    return max(1, (int)lroundf(width_ * scale_));
+}
+
+int DynamicResolution::scaled_height() const {
+    return max(1, (int)lroundf(height_ * scale_));
+}
+
+void DynamicResolution::poll_timers() {
+    // oldest first, next_timer_ is the one that was started longest ago
+    for (int i = 0; i < kTimers; i++) {
+        gpu_timer_t &timer = timers_[(next_timer_ + i) % kTimers];
+        if (!timer.pending) {
+            continue;
+        }
+        GLint available = 0;
+        glGetQueryObjectiv(timer.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            break; // later ones can't be done either
+        }
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(timer.query, GL_QUERY_RESULT, &ns);
+        timer.pending = false;
+        // frames rendered before the last change say nothing about this
+        // scale. over a second is a stall (first frame, uploads), not the pass
+        float ms = ns / 1.0e6f;
+        if (timer.scale == scale_ && ms < 1000.0f) {
+            update_scale(ms);
+        }
+    }
+}
+
+void DynamicResolution::update_scale(float gpu_ms) {
+    filtered_ms_ = filtered_ms_ < 0.0f ? gpu_ms : filtered_ms_ + kSmoothing * (gpu_ms - filtered_ms_);
+    samples_++;
+
+    bool over = filtered_ms_ > target_ms_ * (1.0f + kTolerance);
+    bool under = filtered_ms_ < target_ms_ * (1.0f - kHeadroom);
+    // way over budget doesn't wait for the filter to settle
+    bool urgent = gpu_ms > target_ms_ * 1.5f;
+    if ((!over && !under) || (samples_ < kSettleFrames && !urgent)) {
+        return;
+    }
+
+    // the world pass costs about the pixel count, so scale squared
+    float ratio = target_ms_ / max(urgent ? max(gpu_ms, filtered_ms_) : filtered_ms_, 0.01f);
+    float wanted = scale_ * sqrtf(ratio);
+    // drop the whole way, climb half of it so one cheap frame can't push
+    // us back over the budget and start a see saw
+    float next = over || urgent ? wanted : scale_ + 0.5f * (wanted - scale_);
+    next = floorf(next / kStep + 0.001f) * kStep;
+    if (next == scale_) {
+        next = over || urgent ? scale_ - kStep : scale_ + kStep;
+    }
+    next = min(max(next, min_scale_), max_scale_);
+    if (next != scale_) {
+        scale_ = next;
+        filtered_ms_ = -1.0f;
+        samples_ = 0;
+    }
+}
+
+void DynamicResolution::begin_frame() {
+    if (!enabled_) {
+        return;
+    }
+    poll_timers();
+
+    // more than kTimers frames behind, skip timing this one instead of waiting
+    gpu_timer_t &timer = timers_[next_timer_];
+    if (timer.pending) {
+        running_ = -1;
+        return;
+    }
+    glBeginQuery(GL_TIME_ELAPSED, timer.query);
+    timer.scale = scale_;
+    running_ = next_timer_;
+    next_timer_ = (next_timer_ + 1) % kTimers;
+}
+
+void DynamicResolution::end_frame(GLuint scene_tex) {
+    if (!enabled_) {
+        return;
+    }
+    if (running_ >= 0) {
+        glEndQuery(GL_TIME_ELAPSED);
+        timers_[running_].pending = true;
+        running_ = -1;
+    }
+
+    upscale_shader_.useShader();
+    upscale_shader_.setTexNum("scene", 0);
+    // part of the target that holds the frame, and how much to sharpen:
+    // nothing at native, up to half at the lowest scales
+    float used_w = scaled_width() / (float)width_, used_h = scaled_height() / (float)height_;
+    float sharpen = min(1.0f, (1.0f - scale_) * 2.0f) * 0.5f;
+    glUniform4f(glGetUniformLocation(upscale_shader_.getShader(), "region"), used_w, used_h,
+                sharpen, 0.0f);
+    gl_state().bind_texture(0, GL_TEXTURE_2D, scene_tex);
+    gl_state().bind_vertex_array(vao_);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    gl_state().bind_vertex_array(0);
+}
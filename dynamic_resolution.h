@@ -0,0 +1,91 @@
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include "glad/glad.h"
+#include "shader.h"
+
+#include <cstdint>
+
+using namespace std;
+
+// one GL_TIME_ELAPSED query in flight, tagged with the scale it measured
+typedef struct gpu_timer_t {
+  GLuint query;
+  bool pending;
+  float scale;
+} gpu_timer_t;
+
+// the world passes draw into a scene target at a fraction of the window size
+// and the upscale pass (bilinear plus a light sharpen) brings it to the
+// window. the fraction follows the gpu time of the frame's passes, read back
+// from timer queries a few frames late so nothing ever waits on the gpu.
+// the scene target is a full size RenderGraph transient, a lower scale only
+// shrinks the viewport inside it (scaled_width() x scaled_height()), so
+// changing the scale costs nothing. whatever is drawn after end_frame() (the
+// hud, debug text) stays at native resolution
+class DynamicResolution {
+public:
+  static const int kTimers = 4;          // frames the gpu may lag behind
+  static const int kSettleFrames = 4;    // samples at a scale before moving again
+  static constexpr float kStep = 0.05f;  // scales are multiples of this
+  static constexpr float kSmoothing = 0.3f; // weight of a new sample
+  // hold the scale while the time is within this fraction under / over the
+  // target, outside it move towards the scale that would hit it
+  static constexpr float kHeadroom = 0.15f;
+  static constexpr float kTolerance = 0.05f;
+
+  DynamicResolution() = default;
+  ~DynamicResolution() = default;
+
+  // true if the current context has timer queries (gl 3.3)
+  static bool is_supported();
+
+  // creates the queries and the upscale program for a window of width x
+  // height, false if not supported
+  bool init(int width, int height);
+  void cleanup();
+
+  void set_enabled(bool enabled);
+  bool enabled() const { return enabled_; }
+  // gpu budget of the world pass in ms and the range the scale may use
+  void set_target_ms(float ms) { target_ms_ = ms; }
+  void set_bounds(float min_scale, float max_scale);
+  float scale() const { return scale_; }
+  float gpu_ms() const { return filtered_ms_; }
+
+  // part of the scene target the world is drawn to
+  int scaled_width() const;
+  int scaled_height() const;
+
+  // picks up finished timings (the scale may change) and starts timing,
+  // call before anything reads the scale. no-op while disabled, the world
+  // then goes straight to the window
+  void begin_frame();
+  // stops timing and upscales the scene texture into the bound target
+  // (the window), in the upscale pass
+  void end_frame(GLuint scene_tex);
+
+private:
+  bool ready_ = false;
+  bool enabled_ = false;
+  int width_ = 0, height_ = 0;
+  GLuint vao_ = 0; // empty, the triangle comes from gl_VertexID
+  Shader upscale_shader_;
+
+  gpu_timer_t timers_[kTimers];
+  int next_timer_ = 0;
+  int running_ = -1; // timer between begin_frame() and end_frame()
+
+  float target_ms_ = 1000.0f / 60.0f;
+  float min_scale_ = 0.5f, max_scale_ = 1.0f;
+  float scale_ = 1.0f;
+  float filtered_ms_ = -1.0f; // < 0 until a sample at this scale came in
+  int samples_ = 0;
+
+  // collects finished queries without blocking
+  void poll_timers();
+  // one gpu time measured at the current scale
+  void update_scale(float gpu_ms);
+};
+
+#endif // DYNAMIC_RESOLUTION_H
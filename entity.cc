@@ -11,6 +11,7 @@ Entity::Entity() {
     transform_.rotation = glm::vec3(0.0f, 1.0f, 0.0f); // default rotation axis
     transform_.scale = glm::vec3(1.0f);             // no scaling
     transform_.angle = 0.0f;
+    material_ = glm::vec3(1.0f);
 }
 Entity::~Entity() {
     // destructor
@@ -47,26 +48,68 @@ void Entity::init_goal(transform_t transform, model_t* geometry) {
 
 
 
-void Entity::draw(Shader shaderProgram, camera_t& cam) {
-    // up
-    if (geometry_ == nullptr) {
-        printf("No geometry to draw for this entity\n");
-        return;
-    }
+void Entity::init_prop(transform_t transform, model_t* geometry) {
+    transform_ = transform;
+    material_ = glm::vec3(0.8f, 0.8f, 0.8f);
+    textID_ = -1;
+    reflective_ = true; // chrome
+    geometry_ = geometry;
+    type_ = PROP;
+}
 
-    
+void Entity::init_lamp(transform_t transform, model_t* geometry, glm::vec3 color) {
+    transform_ = transform;
+    material_ = color;
+    textID_ = -1;
+    geometry_ = geometry;
+    type_ = LAMP;
+}
 
+unsigned Entity::get_features() {
+    unsigned features = 0;
+    if ((int)textID_ == 0) {
+        features |= FEATURE_TEXTURED;
+    } else if ((int)textID_ == 1) {
+        features |= FEATURE_TEXTURED | FEATURE_TEX1;
+    }
+    if (reflective_) {
+        features |= FEATURE_REFLECTIVE;
+    }
+    if (lightmapped_) {
+        features |= FEATURE_LIGHTMAPPED;
+    }
+    if (probe_lit_) {
+        features |= FEATURE_PROBE_LIT;
+    }
+    return features;
+}
 
-    glm::mat4 model = get_model_matrix();
-    glm::mat4 view = get_view_matrix(cam);
-    glm::mat4 proj = get_proj_matrix(cam);
-    shaderProgram.setUniformColor("inColor", material_);
-    shaderProgram.setUniformMat("model", model);
-    shaderProgram.setUniformMat("view", view);
-    shaderProgram.setUniformMat("proj", proj);
+void Entity::submit(RenderQueue &queue, ShaderVariants &shaders, GLuint vao) {
+    draw_packet_t packet;
+    if (!make_packet(vao, packet)) {
+        return;
+    }
+    packet.program = shaders.get(packet.features).getShader();
+    queue.push(PASS_OPAQUE, packet);
+}
 
-    shaderProgram.setTexNum("texID", textID_);
-    glDrawArrays(GL_TRIANGLES, geometry_->start, geometry_->num_vertices);
+bool Entity::make_packet(GLuint vao, draw_packet_t &packet) {
+    if (geometry_ == nullptr) {
+        printf("No geometry to draw for this entity\n");
+        return false;
+    }
+    packet.features = get_features();
+    packet.program = 0;
+    packet.vao = vao;
+    packet.start = geometry_->start;
+    packet.num_vertices = geometry_->num_vertices;
+    packet.tex_id = (int)textID_;
+    packet.occlusion_id = -1;
+    packet.color = material_;
+    packet.model = get_model_matrix();
+    // a mirroring transform turns the winding around, leave those double sided
+    packet.cull = geometry_->closed && glm::determinant(glm::mat3(packet.model)) > 0.0f;
+    return true;
 }
 
 void Entity::set_angle(float angle) {
@@ -99,6 +142,26 @@ glm::mat4 Entity::get_model_matrix() {
     return transmat * rotmat * scalemat;
 }
 
+aabb_t Entity::get_bounds() {
+    aabb_t res;
+    res.min = glm::vec3(1e30f);
+    res.max = glm::vec3(-1e30f);
+    if (geometry_ == nullptr) {
+        return res;
+    }
+    // transform all 8 corners of the model's box and take their bounds
+    glm::mat4 model = get_model_matrix();
+    for (int i = 0; i < 8; i++) {
+        glm::vec3 corner((i & 1) ? geometry_->bounds.max.x : geometry_->bounds.min.x,
+                         (i & 2) ? geometry_->bounds.max.y : geometry_->bounds.min.y,
+                         (i & 4) ? geometry_->bounds.max.z : geometry_->bounds.min.z);
+        glm::vec3 p = glm::vec3(model * glm::vec4(corner, 1.0f));
+        res.min = glm::min(res.min, p);
+        res.max = glm::max(res.max, p);
+    }
+    return res;
+}
+
 glm::mat4 Entity::get_view_matrix(camera_t& cam) {
     return glm::lookAt(cam.pos, cam.pos + cam.fwd_dir, cam.up);
 }
@@ -3,6 +3,7 @@
 
 #include "game_types.h"
 #include "glm/glm.hpp"
+#include "render_queue.h"
 #include "shader.h"
 #include "stb_image.h"
 
@@ -20,17 +21,37 @@ public:
         // void init_door(transform_t transform, model_t* geometry, char key_id);
         // void init_key(transform_t transform, model_t* geometry, char key_id);
         void init_goal(transform_t transform, model_t* geometry);
-        void draw(Shader shaderProgram, camera_t& cam);
+        // static high poly decoration, see scenes/bench_props.txt
+        void init_prop(transform_t transform, model_t* geometry);
+        // small bulb in the color of the point light GameMap puts there
+        void init_lamp(transform_t transform, model_t* geometry, glm::vec3 color);
+        // queues the entity instead of drawing it right away, with the
+        // shader variant its material needs
+        void submit(RenderQueue &queue, ShaderVariants &shaders, GLuint vao);
+        // the packet submit() would queue, minus the program. touches no gl
+        // or shared state, so any thread can build packets of its own entities
+        bool make_packet(GLuint vao, draw_packet_t &packet);
 
   entity_types_t get_type();
   void set_type(entity_types_t type);
   glm::mat4 get_model_matrix();
+  aabb_t get_bounds(); // world space
   glm::mat4 get_view_matrix(camera_t &cam);
   glm::mat4 get_proj_matrix(camera_t &cam);
   void set_angle(float angle);
   void set_translation(glm::vec3 translation);
   void set_scale(glm::vec3 scale);
   void set_rotation(glm::vec3 rotation);
+  void set_reflective(bool reflective) { reflective_ = reflective; }
+  // static level geometry covered by the map's lightmap
+  void set_lightmapped(bool lightmapped) { lightmapped_ = lightmapped; }
+  // ambient from the map's irradiance probes instead of the constant
+  void set_probe_lit(bool probe_lit) { probe_lit_ = probe_lit; }
+  // shader_feature_t bits for the material
+  unsigned get_features();
+  model_t *get_geometry() { return geometry_; }
+  glm::vec3 get_color() { return material_; }
+  int get_texture() { return (int)textID_; }
 
   // char get_key_id();
   // void set_key_id(char key_id);
@@ -39,6 +60,9 @@ private:
   transform_t transform_;
   glm::vec3 material_; // color
   GLuint textID_ = -1; // no texture by default
+  bool reflective_ = false;
+  bool lightmapped_ = false;
+  bool probe_lit_ = false;
   model_t *geometry_ = nullptr;
   entity_types_t type_;
   char key_id_; // for doors and keys
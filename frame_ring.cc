@@ -0,0 +1,177 @@
+#include "frame_ring.h"
+
+#include "gl_state.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+using namespace std;
+
+const int FrameRing::kFrames;
+const GLsizeiptr FrameRing::kInitialRegionSize;
+
+FrameRing &frame_ring() {
+    static FrameRing ring;
+    return ring;
+}
+
+bool FrameRing::init() {
+    if (ready_) {
+        return true;
+    }
+    persistent_ = GLAD_GL_ARB_buffer_storage != 0;
+    texture_ranges_ = GLAD_GL_ARB_texture_buffer_range != 0;
+    GLint align = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+    uniform_align_ = max(align, 16);
+    if (GLAD_GL_ARB_shader_storage_buffer_object) {
+        glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &align);
+        storage_align_ = max(align, 16);
+    }
+    if (texture_ranges_) {
+        glGetIntegerv(GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, &align);
+        texture_align_ = max(align, 16);
+    }
+    create(kInitialRegionSize);
+    ready_ = true;
+    printf("frame ring: %d x %d KB, %s\n", kFrames, (int)(region_size_ >> 10),
+           persistent_ ? "persistent mapped" : "staged with glBufferSubData");
+    return true;
+}
+
+void FrameRing::create(GLsizeiptr region_size) {
+    region_size_ = region_size;
+    glGenBuffers(1, &buffer_);
+    gl_state().bind_buffer(GL_COPY_WRITE_BUFFER, buffer_);
+    GLsizeiptr total = region_size_ * kFrames;
+    if (persistent_) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_COPY_WRITE_BUFFER, total, nullptr, flags);
+        mapped_ = (char *)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, total, flags);
+    } else {
+        glBufferData(GL_COPY_WRITE_BUFFER, total, nullptr, GL_DYNAMIC_DRAW);
+        staging_.assign(total, 0);
+        mapped_ = staging_.data();
+    }
+    // a new buffer has no readers, nothing left to wait for
+    for (int i = 0; i < kFrames; i++) {
+        if (fences_[i] != nullptr) {
+            glDeleteSync(fences_[i]);
+            fences_[i] = nullptr;
+        }
+    }
+}
+
+void FrameRing::cleanup() {
+    if (!ready_) {
+        return;
+    }
+    for (int i = 0; i < kFrames; i++) {
+        if (fences_[i] != nullptr) {
+            glDeleteSync(fences_[i]);
+            fences_[i] = nullptr;
+        }
+    }
+    retired_.push_back(buffer_);
+    for (size_t i = 0; i < retired_.size(); i++) {
+        gl_state().forget_buffer(retired_[i]);
+    }
+    // deleting unmaps the persistent mapping too
+    glDeleteBuffers((GLsizei)retired_.size(), retired_.data());
+    retired_.clear();
+    retired_staging_.clear();
+    staging_.clear();
+    buffer_ = 0;
+    mapped_ = nullptr;
+    ready_ = false;
+}
+
+void FrameRing::begin_frame() {
+    if (!ready_) {
+        return;
+    }
+    frame_bytes_ = head_;
+    region_ = (region_ + 1) % kFrames;
+    head_ = 0;
+    wait_ms_ = 0.0f;
+    GLsync fence = fences_[region_];
+    if (fence == nullptr) {
+        return;
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    // flush once so the fence gets anywhere, then wait in 1 ms steps
+    GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    while (status == GL_TIMEOUT_EXPIRED) {
+        status = glClientWaitSync(fence, 0, 1000000);
+    }
+    if (status == GL_WAIT_FAILED) {
+        printf("frame ring: fence wait failed\n");
+    }
+    glDeleteSync(fence);
+    fences_[region_] = nullptr;
+    wait_ms_ = chrono::duration<float, milli>(chrono::steady_clock::now() - start).count();
+}
+
+void FrameRing::end_frame() {
+    if (!ready_) {
+        return;
+    }
+    if (fences_[region_] != nullptr) {
+        glDeleteSync(fences_[region_]);
+    }
+    fences_[region_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    if (!retired_.empty()) {
+        // the draws that read them are queued, gl frees them after those
+        for (size_t i = 0; i < retired_.size(); i++) {
+            gl_state().forget_buffer(retired_[i]);
+        }
+        glDeleteBuffers((GLsizei)retired_.size(), retired_.data());
+        retired_.clear();
+        retired_staging_.clear();
+    }
+}
+
+ring_chunk_t FrameRing::alloc(GLsizeiptr size, GLsizeiptr align) {
+    init();
+    GLsizeiptr offset = (head_ + align - 1) & ~(align - 1);
+    if (offset + size > region_size_) {
+        // start over in a buffer twice the size, at the front of the region
+        GLsizeiptr grown = region_size_ * 2;
+        while (grown < size + align) {
+            grown *= 2;
+        }
+        printf("frame ring: region full, growing to %d KB\n", (int)(grown >> 10));
+        // the old buffer stays mapped (and its staging alive) until the
+        // frame ends, chunks from it may not be written yet
+        retired_.push_back(buffer_);
+        retired_staging_.push_back(move(staging_));
+        create(grown);
+        offset = 0;
+    }
+    head_ = offset + size;
+
+    ring_chunk_t chunk;
+    chunk.buffer = buffer_;
+    chunk.offset = region_ * region_size_ + offset;
+    chunk.size = size;
+    chunk.ptr = mapped_ + chunk.offset;
+    return chunk;
+}
+
+void FrameRing::commit(const ring_chunk_t &chunk) {
+    if (persistent_ || chunk.size == 0) {
+        return; // coherent, the gpu sees the writes already
+    }
+    gl_state().bind_buffer(GL_COPY_WRITE_BUFFER, chunk.buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, chunk.offset, chunk.size, chunk.ptr);
+}
+
+ring_chunk_t FrameRing::upload(const void *data, GLsizeiptr size, GLsizeiptr align) {
+    ring_chunk_t chunk = alloc(size, align);
+    memcpy(chunk.ptr, data, size);
+    commit(chunk);
+    return chunk;
+}
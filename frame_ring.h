@@ -0,0 +1,93 @@
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include "glad/glad.h"
+
+#include <vector>
+
+using namespace std;
+
+// a piece of this frame's ring. write through ptr, then commit() it and
+// bind buffer at offset
+typedef struct ring_chunk_t {
+  void *ptr;
+  GLuint buffer;
+  GLintptr offset;
+  GLsizeiptr size;
+} ring_chunk_t;
+
+// one buffer for everything that is rewritten every frame (per draw object
+// blocks, the other uniform blocks, indirect commands and instance data,
+// light lists). it is split into kFrames regions; a frame allocates
+// aligned chunks from its region front to back and writes into them in
+// place, the gpu reads the regions of the frames before it meanwhile. a
+// fence per region keeps the cpu from catching up with the gpu, which only
+// ever waits when the gpu is kFrames frames behind. with buffer storage
+// (gl 4.4) the buffer stays mapped persistent and coherent and a chunk is
+// just memory; without it chunks are staged and commit() hands them to
+// glBufferSubData, one copy but still no re-specification
+class FrameRing {
+public:
+  static const int kFrames = 3;
+  static const GLsizeiptr kInitialRegionSize = 1 << 20; // grows on demand
+
+  FrameRing() = default;
+  ~FrameRing() = default;
+
+  // called on first alloc, needs the context
+  bool init();
+  void cleanup();
+  bool persistent() const { return persistent_; }
+
+  // moves to the next region, waiting for its fence if the gpu still reads it
+  void begin_frame();
+  // fences the region of the frame that was just submitted
+  void end_frame();
+
+  // size bytes at a multiple of align (a power of two). a full region is
+  // replaced by a bigger buffer on the spot, chunks handed out before stay
+  // valid in the old one
+  ring_chunk_t alloc(GLsizeiptr size, GLsizeiptr align);
+  void commit(const ring_chunk_t &chunk);
+  // alloc + copy + commit
+  ring_chunk_t upload(const void *data, GLsizeiptr size, GLsizeiptr align);
+
+  // offset alignments the bind targets need
+  GLsizeiptr uniform_align() const { return uniform_align_; }
+  GLsizeiptr storage_align() const { return storage_align_; }
+  GLsizeiptr texture_align() const { return texture_align_; }
+  // glTexBufferRange is there (gl 4.3)
+  bool texture_ranges() const { return texture_ranges_; }
+
+  // ms the last begin_frame() waited on the gpu, bytes the last frame used
+  float wait_ms() const { return wait_ms_; }
+  GLsizeiptr frame_bytes() const { return frame_bytes_; }
+
+private:
+  bool ready_ = false;
+  bool persistent_ = false;
+  bool texture_ranges_ = false;
+  GLuint buffer_ = 0;
+  char *mapped_ = nullptr;          // persistent mapping of the whole buffer
+  vector<char> staging_;            // stands in for it without buffer storage
+  GLsizeiptr region_size_ = 0;
+  int region_ = 0;
+  GLsizeiptr head_ = 0;             // next free byte in the region
+  GLsync fences_[kFrames] = {};
+  vector<GLuint> retired_;          // outgrown buffers, deleted at end_frame()
+  vector<vector<char>> retired_staging_;
+
+  GLsizeiptr uniform_align_ = 256;
+  GLsizeiptr storage_align_ = 256;
+  GLsizeiptr texture_align_ = 256;
+
+  float wait_ms_ = 0.0f;
+  GLsizeiptr frame_bytes_ = 0;
+
+  void create(GLsizeiptr region_size);
+};
+
+// the game only ever has one context, so one ring
+FrameRing &frame_ring();
+
+#endif // FRAME_RING_H
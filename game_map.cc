@@ -1,11 +1,19 @@
 #include "game_map.h"
 
+#include "lightmap_baker.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <fstream>
 using namespace std;
 
+// fewer cells than this in a band and waking a worker costs more than the
+// band takes to build
+static const int kMinCellsPerBand = 64;
+
 void GameMap::init_map(const char* fname) {
+    PROFILE_ZONE("map load");
     std::ifstream mapFile;
     mapFile.open(fname);
     if (!mapFile.is_open()) {
@@ -35,6 +43,7 @@ void GameMap::init_map(const char* fname) {
     model_t* sphere = teapot->next_model;
 
     entities = new Entity[w * h]; // max possible entities
+    grid_.assign(w * h, '0');
     
     transform_t floor_transform{};
     floor_transform.translation = glm::vec3(0, -0.5f, -h / 2.f);
@@ -46,6 +55,7 @@ void GameMap::init_map(const char* fname) {
         for (int j = 0; j < w; j++) {
             mapFile >> ch;
             int idx = i * w + j;
+            grid_[idx] = ch;
             glm::vec3 start_pos = glm::vec3(j - w / 2.0f + 0.5f, 0.5f, i + 0.5f -h);
             if (ch == 'W') {
                transform_t wall_transform{};
@@ -65,7 +75,34 @@ void GameMap::init_map(const char* fname) {
                 goal_transform.rotation = glm::vec3(0.0f, 1.0f, 0.0f);
                 goal_transform.angle = 0.0f;
                 entities[idx].init_goal(goal_transform, sphere);
-            } 
+                dynamic_cells_.push_back(idx);
+            } else if (ch == 'P') {
+                // teapot prop, the model is z up so stand it on the floor
+                transform_t prop_transform{};
+                prop_transform.translation = start_pos;
+                prop_transform.translation.y = 0.245f * 0.8f;
+                prop_transform.scale = glm::vec3(0.8f, 0.8f, 0.8f);
+                prop_transform.rotation = glm::vec3(1.0f, 0.0f, 0.0f);
+                prop_transform.angle = -1.5708f;
+                entities[idx].init_prop(prop_transform, teapot);
+            } else if (ch == 'L') {
+                // lamp hanging in the middle of the cell, a few warm and cool
+                // tints so overlapping lights can be told apart
+                static const glm::vec3 kLampColors[4] = {
+                    glm::vec3(1.0f, 0.75f, 0.4f), glm::vec3(0.4f, 0.6f, 1.0f),
+                    glm::vec3(1.0f, 0.4f, 0.3f), glm::vec3(0.5f, 1.0f, 0.5f)};
+                point_light_t lamp;
+                lamp.pos = glm::vec3(start_pos.x, 0.8f, start_pos.z);
+                lamp.radius = 2.5f;
+                lamp.color = kLampColors[lamps_.size() % 4];
+                lamps_.push_back(lamp);
+
+                transform_t lamp_transform{};
+                lamp_transform.translation = lamp.pos;
+                lamp_transform.scale = glm::vec3(0.1f, 0.1f, 0.1f);
+                lamp_transform.rotation = glm::vec3(0.0f, 1.0f, 0.0f);
+                entities[idx].init_lamp(lamp_transform, sphere, lamp.color);
+            }
             
             // else if(ch >= 97 && ch <= 101) { 
             //     // key 
@@ -90,6 +127,72 @@ void GameMap::init_map(const char* fname) {
     }
     key_held = Entity(); // initialize to none
     mapFile.close();
+    printf("%d lamps\n", (int)lamps_.size());
+
+    // floor top is y = 0 (the slab goes down to -1), walls reach y = 1
+    aabb_t level_bounds;
+    level_bounds.min = glm::vec3(-w / 2.0f, -1.0f, -(float)h);
+    level_bounds.max = glm::vec3(w / 2.0f, 1.0f, 0.0f);
+    shadows_.set_level_bounds(level_bounds);
+    shadows_.invalidate_static();
+
+    // which cells can be seen from where, cached next to the scene file
+    pvs_.load_or_bake(fname, grid_, w, h);
+    occlusion_.build_occluders(grid_, w, h);
+
+    // baked lighting is optional, it only comes from --bake-lightmap
+    string lightmap_file = string(fname) + ".lm";
+    string probes_file = string(fname) + ".probes";
+    if (lightmap_.load(lightmap_file.c_str(), Pvs::hash_grid(grid_, w, h))) {
+        printf("loaded lightmap %s\n", lightmap_file.c_str());
+    }
+    if (probes_.load(probes_file.c_str(), Pvs::hash_grid(grid_, w, h))) {
+        printf("loaded probes %s\n", probes_file.c_str());
+    }
+    mark_baked(lightmap_enabled_);
+}
+
+void GameMap::bake_lightmap(const char *scene_file) {
+    LightmapBaker baker;
+    lightmap_data_t data;
+    baker.bake(grid_, w, h, shadows_.sun_direction(), data);
+    lightmap_.set_data(data);
+    string lightmap_file = string(scene_file) + ".lm";
+    if (lightmap_.save(lightmap_file.c_str())) {
+        printf("wrote lightmap %s\n", lightmap_file.c_str());
+    }
+
+    probe_grid_data_t probe_data;
+    baker.bake_probes(grid_, w, h, shadows_.sun_direction(), probe_data);
+    probes_.set_data(probe_data);
+    string probes_file = string(scene_file) + ".probes";
+    if (probes_.save(probes_file.c_str())) {
+        printf("wrote probes %s\n", probes_file.c_str());
+    }
+    mark_baked(lightmap_enabled_);
+}
+
+void GameMap::mark_baked(bool enabled) {
+    bool lightmapped = enabled && !lightmap_.empty();
+    bool probe_lit = enabled && !probes_.empty();
+    floor.set_lightmapped(lightmapped);
+    for (int i = 0; i < w * h; i++) {
+        if (grid_[i] == 'W') {
+            entities[i].set_lightmapped(lightmapped);
+        } else if (grid_[i] == 'G' || grid_[i] == 'P') {
+            entities[i].set_probe_lit(probe_lit);
+        }
+    }
+}
+
+void GameMap::set_lightmap(bool enabled) {
+    lightmap_enabled_ = enabled;
+    if (lightmap_.empty() && probes_.empty()) {
+        printf("no lightmap for this level, bake one with --bake-lightmap\n");
+        return;
+    }
+    mark_baked(enabled);
+    printf("lightmap %s\n", enabled ? "on" : "off");
 }
 
 void GameMap::set_cube_map_texture(vector<string> faces_fnames) {
@@ -124,39 +227,372 @@ GameMap::~GameMap() {
     delete[] entities;
 }
 
-void GameMap::draw(Shader shaderProgram, camera_t& cam, float delta_time) {
+// picks the cells that can end up on screen and starts testing them against
+// the occlusion buffer on the culler's thread. call it as soon as the camera
+// for the frame is known, prepare() waits for the result
+void GameMap::begin_frame(camera_t& cam) {
+    PROFILE_ZONE("cull pvs");
+    candidates_.clear();
+
+    // only the cells in the camera cell's PVS can show up on screen. if the
+    // camera is somewhere without a set (outside the map) take everything
+    int cam_x, cam_z;
+    get_coord(cam.pos, cam_x, cam_z);
+    const int *cells;
+    int num_cells;
+    if (pvs_.visible_cells(cam_x, cam_z, cells, num_cells)) {
+        for (int i = 0; i < num_cells; i++) {
+            entity_types_t type = entities[cells[i]].get_type();
+            if (type != GROUND && type != NONE) {
+                candidates_.push_back(cells[i]);
+            }
+        }
+    } else {
+        for (int idx = 0; idx < w * h; idx++) {
+            entity_types_t type = entities[idx].get_type();
+            if (type != GROUND && type != NONE) {
+                candidates_.push_back(idx);
+            }
+        }
+    }
+
+    if (occlusion_culling_) {
+        candidate_bounds_.resize(candidates_.size());
+        for (size_t i = 0; i < candidates_.size(); i++) {
+            candidate_bounds_[i] = entities[candidates_[i]].get_bounds();
+        }
+        occlusion_.kick(cam, candidate_bounds_);
+    }
+    frame_started_ = true;
+}
+
+void GameMap::set_occlusion_culling(bool enabled) {
+    occlusion_.wait(); // don't leave a job running
+    occlusion_culling_ = enabled;
+    printf("occlusion culling %s\n", enabled ? "on" : "off");
+}
+
+void GameMap::set_draw_backend(draw_backend_t backend) {
+    if (backend == BACKEND_INDIRECT && !indirect_.init()) {
+        printf("multi draw indirect not supported (needs gl 4.3 + "
+               "ARB_shader_draw_parameters), staying on direct draws\n");
+        backend = BACKEND_DIRECT;
+    }
+    backend_ = backend;
+    printf("draw backend: %s\n", backend_ == BACKEND_INDIRECT ? "indirect" : "direct");
+}
+
+void GameMap::set_backface_culling(bool enabled) {
+    backface_culling_ = enabled;
+    queue_.set_culling(enabled);
+    printf("back face culling %s\n", enabled ? "on" : "off");
+}
+
+void GameMap::set_depth_prepass(bool enabled) {
+    if (enabled && depth_vao_ == 0) {
+        printf("no position only vertex array, depth pre-pass stays off\n");
+        enabled = false;
+    }
+    if (enabled) {
+        depth_program();
+    }
+    depth_prepass_ = enabled;
+    printf("depth pre-pass %s\n", enabled ? "on" : "off");
+}
+
+GLuint GameMap::depth_program() {
+    if (depth_shader_.getShader() == 0) {
+        depth_shader_ = Shader("shaders/depth.vs", "shaders/depth.fs");
+        depth_shader_.setBlockBinding("Object", BLOCK_OBJECT);
+    }
+    return depth_shader_.getShader();
+}
+
+void GameMap::set_shadows(bool enabled) {
+    if (enabled && depth_vao_ == 0) {
+        printf("no position only vertex array, shadows stay off\n");
+        enabled = false;
+    }
+    shadows_enabled_ = enabled;
+    printf("shadows %s\n", enabled ? "on" : "off");
+}
+
+void GameMap::set_occlusion_queries(occlusion_query_mode_t mode) {
+    if (mode != QUERIES_OFF && !gpu_queries_.init()) {
+        mode = QUERIES_OFF;
+    }
+    gpu_queries_.set_mode(mode);
+    printf("occlusion queries: %s\n", OcclusionQueries::mode_name(mode));
+}
+
+void GameMap::set_impostors(bool enabled) {
+    if (enabled && impostor_atlas_.empty()) {
+        if (vao_ == 0) {
+            printf("no vertex array to bake from, impostors stay off\n");
+            enabled = false;
+        } else if (!impostors_.init()) {
+            enabled = false;
+        } else {
+            // the high poly props. the bake has no textures, textured ones
+            // would stay meshes
+            impostor_atlas_.assign(w * h, -1);
+            for (int idx = 0; idx < w * h; idx++) {
+                if (entities[idx].get_type() == PROP && entities[idx].get_texture() < 0) {
+                    impostor_atlas_[idx] = impostors_.bake(entities[idx].get_geometry(),
+                                                           entities[idx].get_color(), vao_);
+                }
+            }
+        }
+    }
+    impostors_.set_enabled(enabled);
+    printf("impostors %s\n", enabled ? "on" : "off");
+}
+
+void GameMap::set_sun_direction(glm::vec3 dir) {
+    shadows_.set_sun_direction(dir);
+    glm::vec3 d = shadows_.sun_direction();
+    printf("sun direction %.2f %.2f %.2f%s\n", d.x, d.y, d.z,
+           shadows_.static_dirty() ? ", static shadows invalidated" : "");
+}
+
+void GameMap::animate(float delta_time) {
+    for (size_t i = 0; i < dynamic_cells_.size(); i++) {
+        if (entities[dynamic_cells_[i]].get_type() == GOAL) {
+            // rotate goal
+            entities[dynamic_cells_[i]].set_angle(-delta_time * 3.14f);
+        }
+    }
+}
+
+void GameMap::build_shadow_queues(ShaderVariants &shaders) {
+    glm::mat4 light_view = shadows_.light_view();
+
+    if (shadows_.static_dirty()) {
+        // everything that never moves. the floor only receives, it is the
+        // bottom of the level and would only shadow what is under it
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        static_shadow_queue_.begin(light_view, shadows_.static_proj(), shadows_.light_pos(),
+                                   shadows_.light_range());
+        for (int idx = 0; idx < w * h; idx++) {
+            entity_types_t type = entities[idx].get_type();
+            if (type == WALL || type == PROP || type == LAMP) {
+                entities[idx].submit(static_shadow_queue_, shaders, vao_);
+            }
+        }
+        static_shadow_queue_.sort();
+        static_queue_ms_ =
+            chrono::duration<float, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    // moving casters get their own small map every frame
+    if (dynamic_cells_.empty()) {
+        return;
+    }
+    aabb_t bounds;
+    bounds.min = glm::vec3(1e30f);
+    bounds.max = glm::vec3(-1e30f);
+    for (size_t i = 0; i < dynamic_cells_.size(); i++) {
+        aabb_t b = entities[dynamic_cells_[i]].get_bounds();
+        bounds.min = glm::min(bounds.min, b.min);
+        bounds.max = glm::max(bounds.max, b.max);
+    }
+    shadow_queue_.begin(light_view, shadows_.fit_dynamic(bounds), shadows_.light_pos(),
+                        shadows_.light_range());
+    for (size_t i = 0; i < dynamic_cells_.size(); i++) {
+        entities[dynamic_cells_[i]].submit(shadow_queue_, shaders, vao_);
+    }
+    shadow_queue_.sort();
+}
+
+void GameMap::update_shadows() {
+    GLuint program = depth_program();
+
+    if (shadows_.static_dirty()) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        shadows_.render_static(static_shadow_queue_, program, depth_vao_);
+        printf("static shadow map rebuilt: %d casters, %.2f ms\n", static_shadow_queue_.size(),
+               static_queue_ms_ +
+                   chrono::duration<float, milli>(chrono::steady_clock::now() - start).count());
+    }
+
+    if (dynamic_cells_.empty()) {
+        shadows_.clear_dynamic();
+        return;
+    }
+    shadows_.render_dynamic(shadow_queue_, program, depth_vao_);
+}
+
+void GameMap::print_overdraw() {
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    int width = viewport[2], height = viewport[3];
+    stencil_.resize(width * height);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(viewport[0], viewport[1], width, height, GL_STENCIL_INDEX,
+                 GL_UNSIGNED_BYTE, stencil_.data());
+
+    long long shaded = 0;
+    int covered = 0, max_count = 0;
+    for (size_t i = 0; i < stencil_.size(); i++) {
+        int count = stencil_[i];
+        if (count > 0) {
+            covered++;
+            shaded += count;
+            max_count = max(max_count, count);
+        }
+    }
+    printf("overdraw: %.2f fragments shaded per covered pixel (max %d), "
+           "%.1f%% of the screen covered, pre-pass %s\n",
+           covered ? (double)shaded / covered : 0.0, max_count,
+           100.0 * covered / max(1, width * height), depth_prepass_ ? "on" : "off");
+}
+
+void GameMap::add_flash(glm::vec3 pos, glm::vec3 color, float radius, float duration) {
+    flash_t flash;
+    flash.light.pos = pos;
+    flash.light.color = color;
+    flash.light.radius = radius;
+    flash.time_left = flash.duration = duration;
+    flashes_.push_back(flash);
+}
+
+void GameMap::update_lights(const camera_t &cam, const glm::mat4 &view, float delta_time,
+                            int width, int height) {
+    PROFILE_ZONE("lights");
+    frame_lights_ = lamps_;
+    size_t kept = 0;
+    for (size_t i = 0; i < flashes_.size(); i++) {
+        flash_t &flash = flashes_[i];
+        flash.time_left -= delta_time;
+        if (flash.time_left <= 0.0f) {
+            continue;
+        }
+        point_light_t light = flash.light;
+        light.color *= flash.time_left / flash.duration;
+        frame_lights_.push_back(light);
+        flashes_[kept++] = flash;
+    }
+    flashes_.resize(kept);
+
+    lights_.init();
+    lights_.update(cam, view, frame_lights_, width, height);
+    lights_.bind();
+}
+
+void GameMap::cleanup() {
+    list_jobs_.stop();
+    gpu_queries_.cleanup();
+    impostors_.cleanup();
+    indirect_.cleanup();
+    lights_.cleanup();
+    shadows_.cleanup();
+    lightmap_.cleanup();
+    probes_.cleanup();
+    sky_.cleanup();
+    if (depth_shader_.getShader() != 0) {
+        depth_shader_.cleanUpShader();
+    }
+}
+
+void GameMap::dump_occlusion_buffer(const char *fname) {
+    occlusion_.wait();
+    occlusion_.dump_depth(fname);
+}
+
+void GameMap::prepare(ShaderVariants &shaders, camera_t& cam, float delta_time, int width,
+                      int height) {
     // draw floor
     // cam.pos = glm::vec3(0, 1, 3);
     // cam.fwd_dir = glm::vec3(0, 0, -1);
-    floor.draw(shaderProgram, cam);
+    // everything goes through the render queue so draws get grouped by
+    // program / material / mesh instead of following the grid
+    glm::mat4 view = glm::lookAt(cam.pos, cam.pos + cam.fwd_dir, cam.up);
+    glm::mat4 proj = glm::perspective(cam.fov, cam.aspect_ratio, cam.near, cam.far);
+    queue_.begin(view, proj, cam.pos, cam.far);
+    impostors_.begin_frame(cam.pos, proj, height);
+
+    floor.submit(queue_, shaders, vao_);
     // draw_floor(shaderProgram, floorVao_, floorTex_);
-    for (int i = 0; i < h; i++) {
-        for (int j = 0; j < w; j++) {
-            int idx = i * w + j;
-            if (entities[idx].get_type() != GROUND && entities[idx].get_type() != NONE) {
-                if (entities[idx].get_type() == GOAL) {
-                    // rotate goal
-                    // printf("rotating goal\n");
-                    entities[idx].set_angle(-delta_time * 3.14f);
-                } 
-                
-                
-                // else if (entities[idx].get_type() == KEY) {
-                //     // rotate key
-                //     // printf("rotating key\n");
-                //     entities[idx].set_angle(delta_time * 3.14f / 2);
-                // } else if (entities[idx].get_type() == DOOR) {
-                //     // maybe animate door opening later
-                //     if ((idx - w >= 0 && entities[idx - w].get_type() == WALL) || (idx + w < h * w && entities[idx + w].get_type() == WALL)) {
-                //         entities[idx].set_angle((float)M_PI /2.f);
-                //         entities[idx].set_rotation(glm::vec3(0.f, 1.f, 0.f));
-                //     }
-                // }
-                entities[idx].draw(shaderProgram, cam);
-            }
+
+    if (!frame_started_) {
+        begin_frame(cam);
+    }
+    frame_started_ = false;
+    gpu_queries_.begin_frame(cam.pos, cam.near);
+
+    // everything that doesn't depend on which cells survive goes first, it
+    // overlaps with the culler instead of waiting behind it
+    // reflective variants read the skybox from unit 1
+    gl_state().bind_texture(1, GL_TEXTURE_CUBE_MAP, cubeMapTexID_);
+    sky_.bind();
+    update_lights(cam, view, delta_time, width, height);
+    shadows_.init();
+    animate(delta_time);
+    if (shadows_enabled_) {
+        build_shadow_queues(shaders);
+    }
+
+    const vector<char> *visible = nullptr;
+    if (occlusion_culling_) {
+        PROFILE_ZONE("occlusion wait");
+        visible = &occlusion_.wait();
+        if (visible->size() != candidates_.size()) {
+            visible = nullptr;
+        }
+    }
+    ProfileZone queue_zone("queue cells");
+    build_lists(shaders, visible);
+    queue_zone.end();
+
+    queue_.sort();
+    shadows_drawn_ = false;
+}
+
+void GameMap::draw_shadows() {
+    if (shadows_enabled_) {
+        update_shadows();
+        shadows_drawn_ = true;
+    }
+}
+
+void GameMap::draw_depth() {
+    queue_.submit_depth(depth_shader_.getShader(), depth_vao_,
+                        gpu_queries_.enabled() ? &gpu_queries_ : nullptr);
+}
+
+void GameMap::draw_world() {
+    shadows_.bind(shadows_drawn_);
+    if (lightmap_enabled_) {
+        lightmap_.upload();
+        lightmap_.bind(shadows_.sun_direction());
+        probes_.upload();
+        probes_.bind(shadows_.sun_direction());
+    }
+
+    if (overdraw_stats_) {
+        // +1 for every fragment that passes the depth test
+        glClearStencil(0);
+        glClear(GL_STENCIL_BUFFER_BIT);
+        gl_state().enable(GL_STENCIL_TEST);
+        glStencilFunc(GL_ALWAYS, 0, 0xFF);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
+    }
+
+    {
+        PROFILE_GPU_ZONE("submit");
+        OcclusionQueries *conditions = gpu_queries_.enabled() ? &gpu_queries_ : nullptr;
+        if (backend_ == BACKEND_INDIRECT) {
+            indirect_.submit(queue_, conditions);
+        } else {
+            queue_.submit(conditions);
         }
     }
 
+    if (overdraw_stats_) {
+        gl_state().disable(GL_STENCIL_TEST);
+        print_overdraw();
+    }
+
     // // if key is being held 
     // if (key_held.get_type() == KEY) {
        
@@ -184,6 +620,109 @@ void GameMap::draw(Shader shaderProgram, camera_t& cam, float delta_time) {
     // }
 }
 
+void GameMap::draw_impostors() {
+    impostors_.draw(impostor_instances_, queue_.view(), queue_.proj());
+}
+
+void GameMap::draw_occlusion_queries() {
+    gpu_queries_.issue(queue_.view(), queue_.proj());
+}
+
+void GameMap::set_list_threads(int num_threads) {
+    list_jobs_.stop();
+    list_threads_ = num_threads;
+}
+
+// candidates_ is in grid order, so a contiguous slice of it is a band of
+// rows. every band turns its visible cells into packets in a list of its
+// own, on whichever thread picks it up; the lists are then merged into the
+// queue here in band order, which hands the queue exactly what a serial loop
+// would. the queue's keys and program lookup stay on the gl thread
+void GameMap::build_lists(ShaderVariants &shaders, const vector<char> *visible) {
+    if (!list_jobs_.started()) {
+        list_jobs_.start(list_threads_);
+        printf("building render lists on %d threads\n", list_jobs_.num_threads());
+    }
+    int n = (int)candidates_.size();
+    int num_bands = min(max(n / kMinCellsPerBand, 1), list_jobs_.num_threads() * 2);
+    if ((int)band_lists_.size() < num_bands) {
+        band_lists_.resize(num_bands);
+        band_impostors_.resize(num_bands);
+    }
+    list_jobs_.run(num_bands, [&](int band) {
+        PROFILE_ZONE("build band");
+        int first = (int)((int64_t)n * band / num_bands);
+        int last = (int)((int64_t)n * (band + 1) / num_bands);
+        vector<draw_packet_t> &list = band_lists_[band];
+        vector<impostor_instance_t> &impostors = band_impostors_[band];
+        list.clear();
+        impostors.clear();
+        for (int i = first; i < last; i++) {
+            if (visible == nullptr || (*visible)[i]) {
+                build_cell(candidates_[i], list, impostors);
+            }
+        }
+    });
+
+    PROFILE_ZONE("merge bands");
+    unsigned features = ~0u;
+    GLuint program = 0;
+    impostor_instances_.clear();
+    for (int band = 0; band < num_bands; band++) {
+        impostor_instances_.insert(impostor_instances_.end(), band_impostors_[band].begin(),
+                                   band_impostors_[band].end());
+        vector<draw_packet_t> &list = band_lists_[band];
+        for (size_t i = 0; i < list.size(); i++) {
+            draw_packet_t &packet = list[i];
+            if (packet.features != features) {
+                features = packet.features;
+                program = shaders.get(features).getShader();
+            }
+            packet.program = program;
+            if (packet.occlusion_id >= 0) {
+                gpu_queries_.add(packet.occlusion_id, entities[packet.occlusion_id].get_bounds());
+            }
+            queue_.push(PASS_OPAQUE, packet);
+        }
+    }
+}
+
+void GameMap::build_cell(int idx, vector<draw_packet_t> &list,
+                         vector<impostor_instance_t> &impostors) {
+    if (entities[idx].get_type() != GROUND && entities[idx].get_type() != NONE) {
+        // the goal turns in animate()
+        // if (entities[idx].get_type() == KEY) {
+        //     // rotate key
+        //     // printf("rotating key\n");
+        //     entities[idx].set_angle(delta_time * 3.14f / 2);
+        // } else if (entities[idx].get_type() == DOOR) {
+        //     // maybe animate door opening later
+        //     if ((idx - w >= 0 && entities[idx - w].get_type() == WALL) || (idx + w < h * w && entities[idx + w].get_type() == WALL)) {
+        //         entities[idx].set_angle((float)M_PI /2.f);
+        //         entities[idx].set_rotation(glm::vec3(0.f, 1.f, 0.f));
+        //     }
+        // }
+        if (impostors_.enabled() && !impostor_atlas_.empty() && impostor_atlas_[idx] >= 0 &&
+            impostors_.use_impostor(entities[idx].get_bounds())) {
+            // small enough on screen for the quad
+            impostor_instance_t impostor;
+            impostor.atlas = impostor_atlas_[idx];
+            impostor.features = entities[idx].get_features();
+            impostor.model = entities[idx].get_model_matrix();
+            impostors.push_back(impostor);
+            return;
+        }
+        draw_packet_t packet;
+        if (entities[idx].make_packet(vao_, packet)) {
+            // the teapot and the knot, not the walls
+            if (gpu_queries_.enabled() && packet.num_vertices >= OcclusionQueries::kMinVertices) {
+                packet.occlusion_id = idx;
+            }
+            list.push_back(packet);
+        }
+    }
+}
+
 // void GameMap::pick_up_key(glm::vec3 pos) {
 //     int x, z;
 //     get_coord(pos, x, z);
@@ -251,5 +790,5 @@ void GameMap::debug(int shaderProgram, camera_t& cam, float delta_time) {
 
     glm::mat4 proj = glm::perspective(glm::radians(45.0f),cam.aspect_ratio, 0.1f, 10.0f); //FOV, aspect, near, far
     glUniformMatrix4fv(uniProj, 1, GL_FALSE, glm::value_ptr(proj));
-    draw_all_models(shaderProgram, models_, delta_time);
+    draw_all_models(shaderProgram, models_, view, delta_time);
 }
\ No newline at end of file
@@ -2,10 +2,25 @@
 #define GAME_MAP_H
 
 // #include "glad/glad.h"
+#include "clustered_lights.h"
 #include "entity.h"
 #include "game_types.h"
+#include "gl_state.h"
+#include "impostors.h"
+#include "indirect_draw.h"
+#include "job_pool.h"
+#include "lightmap.h"
+#include "probe_grid.h"
+#include "profiler.h"
+#include "mesh_check.h"
 #include "glm/glm.hpp"
+#include "occlusion.h"
+#include "occlusion_queries.h"
+#include "pvs.h"
+#include "render_queue.h"
 #include "shader.h"
+#include "shadow_map.h"
+#include "sky_ambient.h"
 #include <cstdio>
 #include <fstream>
 
@@ -24,7 +39,80 @@ GameMap() = default;
 
   ~GameMap();
 
-  void draw(Shader shaderProgram, camera_t &cam, float delta_time);
+  // vao the combined model data (get_model_data()) was uploaded to
+  void set_vertex_array(GLuint vao) { vao_ = vao; }
+  void begin_frame(camera_t &cam);
+  // the world in the passes of the frame's RenderGraph. prepare() fills
+  // and sorts the queue and uploads the lights for a world drawn at width x
+  // height, then the passes: draw_shadows() into the sun's shadow maps (if
+  // on), draw_depth() for the depth pre-pass, draw_world() for the lit
+  // pass. the pass sets the target and the depth state
+  void prepare(ShaderVariants &shaders, camera_t &cam, float delta_time, int width, int height);
+  void draw_shadows();
+  void draw_depth();
+  void draw_world();
+  // bounding boxes of the expensive objects against the world's depth,
+  // after draw_world(), see OcclusionQueries
+  void draw_occlusion_queries();
+  void set_occlusion_culling(bool enabled);
+  bool get_occlusion_culling() { return occlusion_culling_; }
+  void dump_occlusion_buffer(const char *fname);
+  // falls back to BACKEND_DIRECT if the context can't do indirect draws
+  void set_draw_backend(draw_backend_t backend);
+  draw_backend_t get_draw_backend() { return backend_; }
+  // depth only pass over the queue before the lit one, which then tests with
+  // GL_EQUAL so every pixel is shaded once (the graph adds the pass and the
+  // lit pass's state if this is on). draws from the position only vao
+  void set_depth_prepass(bool enabled);
+  bool get_depth_prepass() { return depth_prepass_; }
+  void set_depth_vertex_array(GLuint vao) { depth_vao_ = vao; }
+  // counts the fragments the lit pass shades per pixel in the stencil buffer
+  // and prints a summary every frame
+  void set_overdraw_stats(bool enabled) { overdraw_stats_ = enabled; }
+  // back face culling for the materials whose mesh is closed
+  void set_backface_culling(bool enabled);
+  bool get_backface_culling() { return backface_culling_; }
+  bool get_overdraw_stats() { return overdraw_stats_; }
+  // threads that turn the visible cells into draw packets, counting the gl
+  // thread. 0 = one per core, 1 = everything on the gl thread
+  void set_list_threads(int num_threads);
+  // short lived point light (muzzle flash), fades out over duration seconds
+  void add_flash(glm::vec3 pos, glm::vec3 color, float radius, float duration);
+  void print_light_stats() const { lights_.print_stats(); }
+  // gpu occlusion queries for the high poly meshes, their draws are
+  // conditional on last frame's box. falls back to off without queries
+  void set_occlusion_queries(occlusion_query_mode_t mode);
+  occlusion_query_mode_t get_occlusion_queries() { return gpu_queries_.mode(); }
+  void print_query_stats() const { gpu_queries_.print_stats(); }
+  // far props as octahedral impostors, see Impostors. the first time on
+  // bakes an atlas per prop mesh, so the vertex array has to be set
+  void set_impostors(bool enabled);
+  bool get_impostors() { return impostors_.enabled(); }
+  // a prop whose bounding sphere is smaller than this on screen is drawn
+  // as its impostor
+  void set_impostor_pixels(float pixels) { impostors_.set_switch_pixels(pixels); }
+  void print_impostor_stats() const { impostors_.print_stats(); }
+  // this frame's impostors, after draw_world() in a pass of their own (they
+  // write their depth, the lit pass may only test for equal)
+  void draw_impostors();
+  // sun shadows, see ShadowMaps. the static map is only redrawn after
+  // invalidate_static_shadows() or a sun change
+  void set_shadows(bool enabled);
+  bool get_shadows() { return shadows_enabled_; }
+  void set_sun_direction(glm::vec3 dir);
+  glm::vec3 get_sun_direction() { return shadows_.sun_direction(); }
+  // call after changing what the static map was drawn from (walls, props)
+  void invalidate_static_shadows() { shadows_.invalidate_static(); }
+  // bakes the lightmap and the irradiance probes of the loaded level for the
+  // current sun and writes them next to the scene as <scene>.lm and
+  // <scene>.probes, see LightmapBaker
+  void bake_lightmap(const char *scene_file);
+  // walls and floor read sun and ambient from the lightmap, goal and props
+  // their ambient from the probes, where those were baked
+  void set_lightmap(bool enabled);
+  bool get_lightmap() { return lightmap_enabled_; }
+  // frees the gl objects owned by the map, the context has to be current
+  void cleanup();
   void set_cube_map_texture(vector<string> faces_fnames);
   GLuint get_cube_map_texture();
 
@@ -53,25 +141,25 @@ GameMap() = default;
     GLuint planeVAO, planeVBO;
     glGenVertexArrays(1, &planeVAO);
     glGenBuffers(1, &planeVBO);
-    glBindVertexArray(planeVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, planeVBO);
+    gl_state().bind_vertex_array(planeVAO);
+    gl_state().bind_buffer(GL_ARRAY_BUFFER, planeVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(planeVertices), &planeVertices, GL_STATIC_DRAW);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-    glBindVertexArray(0);
+    gl_state().bind_vertex_array(0);
     return planeVAO;
   }
 
   void draw_floor(Shader shader, GLuint floorVao) {
     GLuint floorTex = load_texture("textures/metal.png");
     shader.setUniformMat("model", glm::mat4(1.0f));
-    glBindVertexArray(floorVao);
-    glBindTexture(GL_TEXTURE_2D, floorTex);
+    gl_state().bind_vertex_array(floorVao);
+    gl_state().bind_texture(0, GL_TEXTURE_2D, floorTex);
     shader.setUniformMat("model", glm::mat4(1.0f));
     glDrawArrays(GL_TRIANGLES, 0, 6);
-    glBindVertexArray(0);
+    gl_state().bind_vertex_array(0);
   }
   // void pick_up_key(glm::vec3 pos);
 
@@ -86,6 +174,80 @@ private:
 
   Entity *entities;
   int w, h;
+  vector<char> grid_; // scene characters, one per cell
+  Pvs pvs_;
+  OcclusionCuller occlusion_;
+  bool occlusion_culling_ = true;
+  OcclusionQueries gpu_queries_;
+  Impostors impostors_;
+  vector<int> impostor_atlas_; // per cell, atlas of its prop or -1. empty before the bake
+
+  // cells with something to draw this frame, filled in by begin_frame()
+  vector<int> candidates_;
+  vector<aabb_t> candidate_bounds_;
+  bool frame_started_ = false;
+  bool shadows_drawn_ = false; // this frame, the maps are sampled only then
+
+  // render list construction, one packet list per band of candidates
+  JobPool list_jobs_;
+  int list_threads_ = 0;
+  vector<vector<draw_packet_t>> band_lists_;
+  vector<vector<impostor_instance_t>> band_impostors_;
+  vector<impostor_instance_t> impostor_instances_;
+
+  RenderQueue queue_;
+  GLuint vao_ = 0; // vertex array holding every model, see set_vertex_array()
+  IndirectRenderer indirect_;
+  draw_backend_t backend_ = BACKEND_DIRECT;
+
+  bool depth_prepass_ = false;
+  GLuint depth_vao_ = 0; // positions only, same vertex order as vao_
+  Shader depth_shader_;
+  bool overdraw_stats_ = false;
+  bool backface_culling_ = true;
+  vector<unsigned char> stencil_; // overdraw readback
+
+  // point lights: one per 'L' cell plus the flashes still burning
+  typedef struct flash_t {
+    point_light_t light;
+    float time_left, duration;
+  } flash_t;
+  vector<point_light_t> lamps_;
+  vector<flash_t> flashes_;
+  vector<point_light_t> frame_lights_;
+  ClusteredLights lights_;
+
+  void update_lights(const camera_t &cam, const glm::mat4 &view, float delta_time, int width,
+                     int height);
+
+  ShadowMaps shadows_;
+  bool shadows_enabled_ = false;
+  RenderQueue static_shadow_queue_; // casters, only filled while the map is dirty
+  RenderQueue shadow_queue_;        // moving casters, every frame
+  float static_queue_ms_ = 0.0f;
+  vector<int> dynamic_cells_; // cells whose entity moves (goal)
+
+  // moves the goal, before its shadow and its draw are queued
+  void animate(float delta_time);
+  // fills the caster queues on the cpu, update_shadows() renders them
+  void build_shadow_queues(ShaderVariants &shaders);
+  void update_shadows();
+
+  Lightmap lightmap_; // empty unless <scene>.lm was baked from this grid
+  ProbeGrid probes_;  // same for <scene>.probes
+  SkyAmbient sky_;    // ambient from the skybox, filled by load_cubemap()
+  bool lightmap_enabled_ = true;
+  // switches the walls and the floor to the lightmapped variants and the
+  // goal and props to the probe lit ones
+  void mark_baked(bool enabled);
+  // depth.vs / depth.fs, built on first use
+  GLuint depth_program();
+
+  void print_overdraw();
+
+  // the cells' packets, built in row bands on the list workers
+  void build_lists(ShaderVariants &shaders, const vector<char> *visible);
+  void build_cell(int idx, vector<draw_packet_t> &list, vector<impostor_instance_t> &impostors);
   
 
 
@@ -95,6 +257,7 @@ private:
   // both load_texture() and load_cubemap() were adapted from:
   // https://github.com/JoeyDeVries/LearnOpenGL/blob/master/src/4.advanced_opengl/6.1.cubemaps_skybox/cubemaps_skybox.cpp
   GLuint load_texture(const char *fname) {
+    PROFILE_ZONE("texture decode");
     GLuint texID;
     glGenTextures(1, &texID);
 
@@ -109,7 +272,7 @@ private:
       else if (nrComponents == 4)
         format = GL_RGBA;
 
-      glBindTexture(GL_TEXTURE_2D, texID);
+      gl_state().bind_texture(0, GL_TEXTURE_2D, texID);
       glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
                    GL_UNSIGNED_BYTE, data);
       glGenerateMipmap(GL_TEXTURE_2D);
@@ -138,18 +301,21 @@ private:
   // +Z (front)
   // -Z (back)
   GLuint load_cubemap(vector<string> faces_fnames) {
+    PROFILE_ZONE("cubemap decode");
     printf("Loading cubemap textures...\n");
     GLuint texID;
     glGenTextures(1, &texID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, texID);
+    gl_state().bind_texture(0, GL_TEXTURE_CUBE_MAP, texID);
 
     int width, height, nrChannels;
+    sky_.begin();
     for (GLuint i = 0; i < faces_fnames.size(); i++) {
       unsigned char *data =
           stbi_load(faces_fnames[i].c_str(), &width, &height, &nrChannels, 0);
       if (data) {
         glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width,
                      height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+        sky_.add_face(i, data, width, height, nrChannels);
         stbi_image_free(data);
       } else {
         printf("Cubemap texture failed to load at path: %s\n",
@@ -157,6 +323,7 @@ private:
         stbi_image_free(data);
       }
     }
+    sky_.finish();
 
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -228,6 +395,24 @@ private:
 
     new_model->name = fname;
     new_model->num_vertices = num_lines / 8;
+
+    // fix the winding up front so the closed meshes can be back face culled
+    mesh_report_t report = validate_mesh(new_model->data, new_model->num_vertices);
+    new_model->closed = report.closed;
+    printf("%s: %d triangles, %d flipped, %d degenerate, %d open edges%s -> %s\n",
+           fname, report.num_triangles, report.flipped, report.degenerate,
+           report.open_edges, report.inverted ? ", was inside out" : "",
+           report.closed ? "closed, culled" : "open, double sided");
+
+    // object space bounds from the positions (first 3 floats of every vertex)
+    new_model->bounds.min = glm::vec3(1e30f);
+    new_model->bounds.max = glm::vec3(-1e30f);
+    for (int v = 0; v < new_model->num_vertices; v++) {
+      glm::vec3 p(new_model->data[v * 8], new_model->data[v * 8 + 1],
+                  new_model->data[v * 8 + 2]);
+      new_model->bounds.min = glm::min(new_model->bounds.min, p);
+      new_model->bounds.max = glm::max(new_model->bounds.max, p);
+    }
     new_model->start = model_list->total_vertices;
     new_model->next_model = nullptr;
     model_list->total_vertices += new_model->num_vertices;
@@ -271,7 +456,7 @@ private:
   }
 
   void draw_all_models(int shaderProgram, model_list_t *models,
-                       float timePast) {
+                       const glm::mat4 &view, float timePast) {
     GLint uniColor = glGetUniformLocation(shaderProgram, "inColor");
     GLint uniTexID = glGetUniformLocation(shaderProgram, "texID");
     GLint uniModel = glGetUniformLocation(shaderProgram, "model");
@@ -293,6 +478,9 @@ private:
 
     glUniformMatrix4fv(uniModel, 1, GL_FALSE,
                        glm::value_ptr(model)); // pass model matrix to shader
+    glm::mat3 normal = RenderQueue::normal_matrix(view * model);
+    glUniformMatrix3fv(glGetUniformLocation(shaderProgram, "normalMatrix"), 1,
+                       GL_FALSE, glm::value_ptr(normal));
 
     // Set which texture to use (-1 = no texture)
     glUniform1i(uniTexID, -1);
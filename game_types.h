@@ -11,12 +11,20 @@ typedef enum  {
     LEFT,
     RIGHT
 }movement_t;
+// axis aligned bounding box
+typedef struct aabb_t {
+    glm::vec3 min;
+    glm::vec3 max;
+} aabb_t;
+
 // node
 typedef struct model_t {
     const char* name;
     int start;
     int num_vertices;
     float* data;
+    aabb_t bounds; // object space
+    bool closed; // watertight with consistent winding, see validate_mesh()
     model_t* next_model;
 } model_t;
 
@@ -27,6 +35,13 @@ typedef struct model_list_t {
     model_t* root;
 } model_list_t;
 
+// point light, world space. lights nothing past radius
+typedef struct point_light_t {
+    glm::vec3 pos;
+    float radius;
+    glm::vec3 color;
+} point_light_t;
+
 typedef struct transform_t {
     glm::vec3 translation ;
     glm::vec3 rotation;
@@ -43,7 +58,7 @@ typedef struct camera_t {
     float fov, aspect_ratio, near, far;
 } camera_t;
 
-typedef enum entity_types { DOOR, WALL, KEY, START, GOAL, GROUND, NONE } entity_types_t;
+typedef enum entity_types { DOOR, WALL, KEY, START, GOAL, PROP, LAMP, GROUND, NONE } entity_types_t;
 // typedef enum state_types { INVALID, VALID, WON } state_types_t;
 
 typedef struct entity_t {
@@ -0,0 +1,282 @@
+#include "gl_state.h"
+
+#include <cstdio>
+
+GlState &gl_state() {
+    static GlState state;
+    return state;
+}
+
+int GlState::buffer_slot(GLenum target) {
+    switch (target) {
+    case GL_ARRAY_BUFFER:
+        return SLOT_ARRAY;
+    case GL_ELEMENT_ARRAY_BUFFER:
+        return SLOT_ELEMENT_ARRAY;
+    case GL_UNIFORM_BUFFER:
+        return SLOT_UNIFORM;
+    case GL_TEXTURE_BUFFER:
+        return SLOT_TEXTURE;
+    case GL_DRAW_INDIRECT_BUFFER:
+        return SLOT_DRAW_INDIRECT;
+    case GL_SHADER_STORAGE_BUFFER:
+        return SLOT_SHADER_STORAGE;
+    case GL_COPY_READ_BUFFER:
+        return SLOT_COPY_READ;
+    case GL_COPY_WRITE_BUFFER:
+        return SLOT_COPY_WRITE;
+    default:
+        return -1; // not tracked, always issued
+    }
+}
+
+int GlState::texture_slot(GLenum target) {
+    switch (target) {
+    case GL_TEXTURE_2D:
+        return TEX_2D;
+    case GL_TEXTURE_CUBE_MAP:
+        return TEX_CUBE_MAP;
+    case GL_TEXTURE_BUFFER:
+        return TEX_BUFFER;
+    case GL_TEXTURE_2D_ARRAY:
+        return TEX_2D_ARRAY;
+    case GL_TEXTURE_3D:
+        return TEX_3D;
+    default:
+        return -1;
+    }
+}
+
+int GlState::cap_slot(GLenum cap) {
+    switch (cap) {
+    case GL_DEPTH_TEST:
+        return CAP_DEPTH_TEST;
+    case GL_BLEND:
+        return CAP_BLEND;
+    case GL_CULL_FACE:
+        return CAP_CULL_FACE;
+    case GL_STENCIL_TEST:
+        return CAP_STENCIL_TEST;
+    case GL_SCISSOR_TEST:
+        return CAP_SCISSOR_TEST;
+    default:
+        return -1;
+    }
+}
+
+void GlState::invalidate() {
+    program_ = kUnknown;
+    vao_ = kUnknown;
+    for (int i = 0; i < NUM_BUFFER_SLOTS; i++) {
+        buffers_[i] = kUnknown;
+    }
+    active_unit_ = kUnknown;
+    for (int u = 0; u < kMaxTextureUnits; u++) {
+        for (int t = 0; t < NUM_TEXTURE_SLOTS; t++) {
+            textures_[u][t] = kUnknown;
+        }
+    }
+    for (int i = 0; i < NUM_CAP_SLOTS; i++) {
+        caps_[i] = kUnknown;
+    }
+    depth_func_ = kUnknown;
+    depth_mask_ = kUnknown;
+    color_mask_ = kUnknown;
+    blend_src_ = kUnknown;
+    blend_dst_ = kUnknown;
+    cull_face_ = kUnknown;
+    framebuffer_ = kUnknown;
+    for (int i = 0; i < 4; i++) {
+        viewport_[i] = kUnknown;
+    }
+}
+
+void GlState::use_program(GLuint program) {
+    if (changed(program_, program)) {
+        glUseProgram(program);
+    }
+}
+
+void GlState::bind_vertex_array(GLuint vao) {
+    if (changed(vao_, vao)) {
+        glBindVertexArray(vao);
+        // the element buffer binding belongs to the vao
+        buffers_[SLOT_ELEMENT_ARRAY] = kUnknown;
+    }
+}
+
+void GlState::bind_buffer(GLenum target, GLuint buffer) {
+    int slot = buffer_slot(target);
+    if (slot < 0) {
+        frame_.issued++;
+        glBindBuffer(target, buffer);
+        return;
+    }
+    if (changed(buffers_[slot], buffer)) {
+        glBindBuffer(target, buffer);
+    }
+}
+
+void GlState::bind_buffer_base(GLenum target, GLuint index, GLuint buffer) {
+    // indexed bindings aren't shadowed, the call always goes out
+    frame_.issued++;
+    glBindBufferBase(target, index, buffer);
+    int slot = buffer_slot(target);
+    if (slot >= 0) {
+        buffers_[slot] = buffer;
+    }
+}
+
+void GlState::bind_buffer_range(GLenum target, GLuint index, GLuint buffer,
+                                GLintptr offset, GLsizeiptr size) {
+    frame_.issued++;
+    glBindBufferRange(target, index, buffer, offset, size);
+    int slot = buffer_slot(target);
+    if (slot >= 0) {
+        buffers_[slot] = buffer;
+    }
+}
+
+void GlState::bind_texture(int unit, GLenum target, GLuint texture) {
+    int slot = texture_slot(target);
+    if (slot < 0 || unit < 0 || unit >= kMaxTextureUnits) {
+        frame_.issued += 2;
+        glActiveTexture(GL_TEXTURE0 + unit);
+        active_unit_ = unit;
+        glBindTexture(target, texture);
+        return;
+    }
+    if (textures_[unit][slot] == texture) {
+        // the unit still has to end up active, callers go on to upload to
+        // what is bound on it
+        if (changed(active_unit_, unit)) {
+            glActiveTexture(GL_TEXTURE0 + unit);
+        }
+        frame_.elided++;
+        return;
+    }
+    if (changed(active_unit_, unit)) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+    changed(textures_[unit][slot], texture);
+    glBindTexture(target, texture);
+}
+
+void GlState::bind_framebuffer(GLuint fbo) {
+    if (changed(framebuffer_, fbo)) {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    }
+}
+
+void GlState::viewport(int x, int y, int width, int height) {
+    if (viewport_[0] == (GLuint)x && viewport_[1] == (GLuint)y &&
+        viewport_[2] == (GLuint)width && viewport_[3] == (GLuint)height) {
+        frame_.elided++;
+        return;
+    }
+    viewport_[0] = x;
+    viewport_[1] = y;
+    viewport_[2] = width;
+    viewport_[3] = height;
+    frame_.issued++;
+    glViewport(x, y, width, height);
+}
+
+void GlState::enable(GLenum cap) {
+    int slot = cap_slot(cap);
+    if (slot < 0) {
+        frame_.issued++;
+        glEnable(cap);
+    } else if (changed(caps_[slot], 1)) {
+        glEnable(cap);
+    }
+}
+
+void GlState::disable(GLenum cap) {
+    int slot = cap_slot(cap);
+    if (slot < 0) {
+        frame_.issued++;
+        glDisable(cap);
+    } else if (changed(caps_[slot], 0)) {
+        glDisable(cap);
+    }
+}
+
+void GlState::depth_func(GLenum func) {
+    if (changed(depth_func_, func)) {
+        glDepthFunc(func);
+    }
+}
+
+void GlState::depth_mask(bool write) {
+    if (changed(depth_mask_, write ? 1 : 0)) {
+        glDepthMask(write ? GL_TRUE : GL_FALSE);
+    }
+}
+
+void GlState::color_mask(bool write) {
+    if (changed(color_mask_, write ? 1 : 0)) {
+        GLboolean w = write ? GL_TRUE : GL_FALSE;
+        glColorMask(w, w, w, w);
+    }
+}
+
+void GlState::blend_func(GLenum src, GLenum dst) {
+    if (blend_src_ == src && blend_dst_ == dst) {
+        frame_.elided++;
+        return;
+    }
+    blend_src_ = src;
+    blend_dst_ = dst;
+    frame_.issued++;
+    glBlendFunc(src, dst);
+}
+
+void GlState::cull_face(GLenum face) {
+    if (changed(cull_face_, face)) {
+        glCullFace(face);
+    }
+}
+
+void GlState::forget_program(GLuint program) {
+    if (program_ == program) {
+        program_ = kUnknown;
+    }
+}
+
+void GlState::forget_vertex_array(GLuint vao) {
+    if (vao_ == vao) {
+        vao_ = kUnknown;
+        buffers_[SLOT_ELEMENT_ARRAY] = kUnknown;
+    }
+}
+
+void GlState::forget_buffer(GLuint buffer) {
+    for (int i = 0; i < NUM_BUFFER_SLOTS; i++) {
+        if (buffers_[i] == buffer) {
+            buffers_[i] = kUnknown;
+        }
+    }
+}
+
+void GlState::forget_texture(GLuint texture) {
+    for (int u = 0; u < kMaxTextureUnits; u++) {
+        for (int t = 0; t < NUM_TEXTURE_SLOTS; t++) {
+            if (textures_[u][t] == texture) {
+                textures_[u][t] = kUnknown;
+            }
+        }
+    }
+}
+
+void GlState::forget_framebuffer(GLuint fbo) {
+    if (framebuffer_ == fbo) {
+        framebuffer_ = kUnknown;
+    }
+}
+
+void GlState::end_frame() {
+    last_frame_ = frame_;
+    frame_.issued = 0;
+    frame_.elided = 0;
+}
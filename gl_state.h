@@ -0,0 +1,134 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include "glad/glad.h"
+
+using namespace std;
+
+// issued vs elided state calls for one frame
+typedef struct gl_state_stats_t {
+  int issued;
+  int elided;
+} gl_state_stats_t;
+
+// thin cache in front of the gl state calls. it shadows what is bound
+// (program, vao, buffers, textures per unit) and the depth / blend / cull
+// state, and drops calls that would not change anything. everything that
+// binds or toggles state has to go through here, otherwise the shadow copy
+// goes stale; call invalidate() after code that talks to gl directly
+class GlState {
+public:
+  static const int kMaxTextureUnits = 16;
+
+  GlState() { invalidate(); }
+
+  void use_program(GLuint program);
+  void bind_vertex_array(GLuint vao);
+  void bind_buffer(GLenum target, GLuint buffer);
+  // indexed binding (ssbo / ubo), also moves the generic binding like gl does
+  void bind_buffer_base(GLenum target, GLuint index, GLuint buffer);
+  void bind_buffer_range(GLenum target, GLuint index, GLuint buffer, GLintptr offset,
+                         GLsizeiptr size);
+  // makes unit the active one and binds texture to target on it
+  void bind_texture(int unit, GLenum target, GLuint texture);
+  // GL_FRAMEBUFFER, draw and read together. 0 is the window
+  void bind_framebuffer(GLuint fbo);
+  // what stands in for the window, 0 unless rendering headless
+  void set_window_framebuffer(GLuint fbo) { window_framebuffer_ = fbo; }
+  GLuint window_framebuffer() const { return window_framebuffer_; }
+  void viewport(int x, int y, int width, int height);
+
+  void enable(GLenum cap);
+  void disable(GLenum cap);
+  void set_enabled(GLenum cap, bool on) { on ? enable(cap) : disable(cap); }
+  void depth_func(GLenum func);
+  void depth_mask(bool write);
+  void color_mask(bool write);
+  void blend_func(GLenum src, GLenum dst);
+  void cull_face(GLenum face);
+
+  // the object is gone, gl reset the bindings that pointed at it
+  void forget_program(GLuint program);
+  void forget_vertex_array(GLuint vao);
+  void forget_buffer(GLuint buffer);
+  void forget_texture(GLuint texture);
+  void forget_framebuffer(GLuint fbo);
+
+  // forget everything we think we know, the next call of each kind is issued
+  void invalidate();
+
+  // closes the frame's counters, stats() returns the frame that just ended
+  void end_frame();
+  gl_state_stats_t stats() const { return last_frame_; }
+  gl_state_stats_t current() const { return frame_; }
+
+private:
+  // unknown state, never equal to anything gl can hand out
+  static const GLuint kUnknown = 0xFFFFFFFFu;
+
+  enum buffer_slot_t {
+    SLOT_ARRAY,
+    SLOT_ELEMENT_ARRAY,
+    SLOT_UNIFORM,
+    SLOT_TEXTURE,
+    SLOT_DRAW_INDIRECT,
+    SLOT_SHADER_STORAGE,
+    SLOT_COPY_READ,
+    SLOT_COPY_WRITE,
+    NUM_BUFFER_SLOTS
+  };
+  enum texture_slot_t {
+    TEX_2D,
+    TEX_CUBE_MAP,
+    TEX_BUFFER,
+    TEX_2D_ARRAY,
+    TEX_3D,
+    NUM_TEXTURE_SLOTS
+  };
+  enum cap_slot_t {
+    CAP_DEPTH_TEST,
+    CAP_BLEND,
+    CAP_CULL_FACE,
+    CAP_STENCIL_TEST,
+    CAP_SCISSOR_TEST,
+    NUM_CAP_SLOTS
+  };
+
+  GLuint program_;
+  GLuint vao_;
+  GLuint buffers_[NUM_BUFFER_SLOTS];
+  GLuint active_unit_;
+  GLuint textures_[kMaxTextureUnits][NUM_TEXTURE_SLOTS];
+  GLuint caps_[NUM_CAP_SLOTS]; // 0 off, 1 on, kUnknown
+  GLuint depth_func_;
+  GLuint depth_mask_;
+  GLuint color_mask_;
+  GLuint blend_src_, blend_dst_;
+  GLuint cull_face_;
+  GLuint framebuffer_;
+  GLuint window_framebuffer_ = 0;
+  GLuint viewport_[4];
+
+  gl_state_stats_t frame_ = {0, 0};
+  gl_state_stats_t last_frame_ = {0, 0};
+
+  // returns true (and counts it) if the call has to be issued
+  bool changed(GLuint &shadow, GLuint value) {
+    if (shadow == value) {
+      frame_.elided++;
+      return false;
+    }
+    shadow = value;
+    frame_.issued++;
+    return true;
+  }
+
+  static int buffer_slot(GLenum target);
+  static int texture_slot(GLenum target);
+  static int cap_slot(GLenum cap);
+};
+
+// the game only ever has one context, so one cache
+GlState &gl_state();
+
+#endif // GL_STATE_H
@@ -0,0 +1,233 @@
+#include "headless.h"
+
+#include "gl_state.h"
+#include "render_device.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#ifdef HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+#endif
+
+using namespace std;
+
+#ifdef HAVE_EGL
+// surfaceless mesa first (no gpu, no display server needed), then the first
+// device (headless nvidia and friends), then whatever the default is
+static EGLDisplay open_display() {
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (get_platform_display != nullptr && extensions != nullptr) {
+        if (strstr(extensions, "EGL_MESA_platform_surfaceless") != nullptr) {
+            EGLDisplay display =
+                get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+            if (display != EGL_NO_DISPLAY && eglInitialize(display, nullptr, nullptr)) {
+                printf("headless: EGL surfaceless platform\n");
+                return display;
+            }
+        }
+        PFNEGLQUERYDEVICESEXTPROC query_devices =
+            (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+        EGLDeviceEXT device;
+        EGLint num_devices = 0;
+        if (strstr(extensions, "EGL_EXT_platform_device") != nullptr && query_devices != nullptr &&
+            query_devices(1, &device, &num_devices) && num_devices > 0) {
+            EGLDisplay display = get_platform_display(EGL_PLATFORM_DEVICE_EXT, device, nullptr);
+            if (display != EGL_NO_DISPLAY && eglInitialize(display, nullptr, nullptr)) {
+                printf("headless: EGL device platform\n");
+                return display;
+            }
+        }
+    }
+    EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display != EGL_NO_DISPLAY && eglInitialize(display, nullptr, nullptr)) {
+        printf("headless: EGL default display\n");
+        return display;
+    }
+    return EGL_NO_DISPLAY;
+}
+#endif
+
+bool HeadlessContext::create(int width, int height) {
+    if (!create_context(width, height)) {
+        return false;
+    }
+#ifdef HAVE_EGL
+    if (!render_device().load_gl((GLADloadproc)eglGetProcAddress)) {
+        printf("headless: failed to load opengl\n");
+        destroy();
+        return false;
+    }
+#endif
+    if (!create_framebuffer(width, height)) {
+        destroy();
+        return false;
+    }
+    return true;
+}
+
+bool HeadlessContext::create_context(int width, int height) {
+#ifdef HAVE_EGL
+    EGLDisplay display = open_display();
+    if (display == EGL_NO_DISPLAY) {
+        printf("headless: no EGL display\n");
+        return false;
+    }
+    display_ = display;
+
+    // the frame goes to our own framebuffer, the config only has to do gl.
+    // the surface type defaults to window, ask for pbuffers (the fallback
+    // below) instead
+    const EGLint config_attribs[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE,
+                                     EGL_OPENGL_BIT, EGL_NONE};
+    EGLConfig config;
+    EGLint num_configs = 0;
+    if (!eglChooseConfig(display, config_attribs, &config, 1, &num_configs) ||
+        num_configs == 0) {
+        printf("headless: no EGL config with desktop gl\n");
+        destroy();
+        return false;
+    }
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        printf("headless: EGL can't do desktop gl\n");
+        destroy();
+        return false;
+    }
+
+    // same versions the window asks sdl for
+    const int versions[2][2] = {{4, 3}, {3, 2}};
+    EGLContext context = EGL_NO_CONTEXT;
+    for (int i = 0; i < 2 && context == EGL_NO_CONTEXT; i++) {
+        const EGLint context_attribs[] = {EGL_CONTEXT_MAJOR_VERSION, versions[i][0],
+                                          EGL_CONTEXT_MINOR_VERSION, versions[i][1],
+                                          EGL_CONTEXT_OPENGL_PROFILE_MASK,
+                                          EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE};
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+    }
+    if (context == EGL_NO_CONTEXT) {
+        printf("headless: eglCreateContext failed (0x%x)\n", eglGetError());
+        destroy();
+        return false;
+    }
+    context_ = context;
+
+    if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        // no EGL_KHR_surfaceless_context, current with a pbuffer nobody
+        // draws to
+        const EGLint pbuffer_attribs[] = {EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE};
+        EGLSurface surface = eglCreatePbufferSurface(display, config, pbuffer_attribs);
+        if (surface == EGL_NO_SURFACE || !eglMakeCurrent(display, surface, surface, context)) {
+            printf("headless: eglMakeCurrent failed (0x%x)\n", eglGetError());
+            if (surface != EGL_NO_SURFACE) {
+                eglDestroySurface(display, surface);
+            }
+            destroy();
+            return false;
+        }
+        surface_ = surface;
+    }
+    return true;
+#else
+    (void)width;
+    (void)height;
+    printf("headless: built without EGL, rebuild with make HEADLESS=1\n");
+    return false;
+#endif
+}
+
+bool HeadlessContext::create_framebuffer(int width, int height) {
+    // same formats as a window would have: rgba8, depth 24 + stencil 8
+    glGenRenderbuffers(1, &color_rb_);
+    glBindRenderbuffer(GL_RENDERBUFFER, color_rb_);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenRenderbuffers(1, &depth_rb_);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth_rb_);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &fbo_);
+    gl_state().bind_framebuffer(fbo_);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_rb_);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER,
+                              depth_rb_);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        printf("headless: %dx%d framebuffer incomplete\n", width, height);
+        return false;
+    }
+    gl_state().set_window_framebuffer(fbo_);
+    gl_state().viewport(0, 0, width, height);
+    printf("headless: rendering %dx%d offscreen\n", width, height);
+    return true;
+}
+
+void HeadlessContext::present() {
+    // nothing throttles an offscreen frame like a swap would, wait for the
+    // gpu here so the frame times are render times and not submit times
+    GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    if (fence == nullptr) {
+        glFinish();
+        return;
+    }
+    GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    while (status == GL_TIMEOUT_EXPIRED) {
+        status = glClientWaitSync(fence, 0, 1000000);
+    }
+    if (status == GL_WAIT_FAILED) {
+        printf("headless: fence wait failed\n");
+    }
+    glDeleteSync(fence);
+}
+
+void HeadlessContext::destroy() {
+    if (fbo_ != 0) {
+        gl_state().forget_framebuffer(fbo_);
+        gl_state().set_window_framebuffer(0);
+        glDeleteFramebuffers(1, &fbo_);
+        GLuint renderbuffers[2] = {color_rb_, depth_rb_};
+        glDeleteRenderbuffers(2, renderbuffers);
+        fbo_ = color_rb_ = depth_rb_ = 0;
+    }
+#ifdef HAVE_EGL
+    if (display_ != nullptr) {
+        eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (surface_ != nullptr) {
+            eglDestroySurface(display_, surface_);
+        }
+        if (context_ != nullptr) {
+            eglDestroyContext(display_, context_);
+        }
+        eglTerminate(display_);
+    }
+#endif
+    display_ = context_ = surface_ = nullptr;
+}
+
+void print_frame_times(const vector<float> &frame_ms, int warmup) {
+    if ((int)frame_ms.size() <= warmup) {
+        printf("frame times: only %d frames, nothing after the %d warmup frames\n",
+               (int)frame_ms.size(), warmup);
+        return;
+    }
+    vector<float> sorted(frame_ms.begin() + warmup, frame_ms.end());
+    sort(sorted.begin(), sorted.end());
+    int n = (int)sorted.size();
+    double sum = 0.0;
+    for (int i = 0; i < n; i++) {
+        sum += sorted[i];
+    }
+    float mean = (float)(sum / n);
+    // nearest rank
+    auto percentile = [&](float p) { return sorted[min(n - 1, (int)(p * n))]; };
+    printf("frame times over %d frames (%d warmup skipped): min %.2f, mean %.2f, "
+           "median %.2f, p95 %.2f, p99 %.2f, max %.2f ms, %.1f fps\n",
+           n, warmup, sorted[0], mean, percentile(0.5f), percentile(0.95f),
+           percentile(0.99f), sorted[n - 1], 1000.0f / mean);
+}
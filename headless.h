@@ -0,0 +1,45 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include "glad/glad.h"
+
+#include <vector>
+
+using namespace std;
+
+// an opengl context with no window and no display, for benchmarking on
+// build boxes (mesa llvmpipe included). EGL on the surfaceless platform, or
+// the first EGL device, or the default display as a last resort. frames go
+// into a framebuffer of the asked for size that stands in for the window.
+// needs a build with -DHAVE_EGL (make HEADLESS=1), without it create() fails
+class HeadlessContext {
+public:
+  HeadlessContext() = default;
+  ~HeadlessContext() = default;
+
+  // makes the context current, loads gl with glad and binds the framebuffer
+  // as the window (GlState::window_framebuffer()). tries 4.3 core, then 3.2
+  bool create(int width, int height);
+  void destroy();
+
+  GLuint framebuffer() const { return fbo_; }
+  // end of a frame, stands in for the swap. waits until the gpu has
+  // finished the frame, so the benchmark times whole frames
+  void present();
+
+private:
+  // EGLDisplay / EGLContext / EGLSurface, void * so the header needs no EGL
+  void *display_ = nullptr;
+  void *context_ = nullptr;
+  void *surface_ = nullptr; // only if the display can't go surfaceless
+  GLuint fbo_ = 0, color_rb_ = 0, depth_rb_ = 0;
+
+  bool create_context(int width, int height);
+  bool create_framebuffer(int width, int height);
+};
+
+// min / mean / percentiles / max of the frame times after the first warmup
+// frames (shader compiles, first uploads)
+void print_frame_times(const vector<float> &frame_ms, int warmup);
+
+#endif // HEADLESS_H
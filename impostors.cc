@@ -0,0 +1,318 @@
+#include "impostors.h"
+
+#include "gl_state.h"
+#include "glm/gtc/matrix_transform.hpp"
+#include "glm/gtc/type_ptr.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+using namespace std;
+
+const int Impostors::kFrames;
+const int Impostors::kFrameSize;
+const int Impostors::kMaxLevel;
+const int Impostors::kDilateSteps;
+constexpr float Impostors::kDefaultSwitchPixels;
+
+// octahedral map of the unit sphere onto [0, 1]^2, z up. the same functions
+// are in fragment.fs
+static glm::vec3 oct_decode(glm::vec2 uv) {
+    glm::vec2 p = uv * 2.0f - 1.0f;
+    glm::vec3 d(p.x, p.y, 1.0f - fabsf(p.x) - fabsf(p.y));
+    if (d.z < 0.0f) {
+        d.x = (1.0f - fabsf(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f);
+        d.y = (1.0f - fabsf(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return glm::normalize(d);
+}
+
+// right and up of the view looking back along v
+static void frame_basis(const glm::vec3 &v, glm::vec3 &right, glm::vec3 &up) {
+    glm::vec3 up_ref = fabsf(v.z) > 0.999f ? glm::vec3(0, 1, 0) : glm::vec3(0, 0, 1);
+    right = glm::normalize(glm::cross(up_ref, v));
+    up = glm::cross(v, right);
+}
+
+bool Impostors::init() {
+    if (ready_) {
+        return true;
+    }
+    color_shader_ = Shader("shaders/impostor_bake.vs", "shaders/impostor_bake.fs");
+    normal_shader_ = Shader("shaders/impostor_bake.vs", "shaders/impostor_bake.fs", nullptr,
+                            "#define NORMAL_DEPTH\n");
+    if (color_shader_.getShader() == 0 || normal_shader_.getShader() == 0) {
+        printf("impostor bake programs failed, impostors stay off\n");
+        return false;
+    }
+    glGenFramebuffers(1, &fbo_);
+    glGenRenderbuffers(1, &depth_rb_);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth_rb_);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, kFrames * kFrameSize,
+                          kFrames * kFrameSize);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glGenVertexArrays(1, &vao_);
+    ready_ = true;
+    return true;
+}
+
+void Impostors::cleanup() {
+    for (size_t i = 0; i < atlases_.size(); i++) {
+        gl_state().forget_texture(atlases_[i].color_tex);
+        gl_state().forget_texture(atlases_[i].normal_tex);
+        glDeleteTextures(1, &atlases_[i].color_tex);
+        glDeleteTextures(1, &atlases_[i].normal_tex);
+    }
+    atlases_.clear();
+    locations_.clear();
+    shaders_.cleanUpShaders();
+    if (!ready_) {
+        return;
+    }
+    gl_state().forget_framebuffer(fbo_);
+    gl_state().forget_vertex_array(vao_);
+    glDeleteFramebuffers(1, &fbo_);
+    glDeleteRenderbuffers(1, &depth_rb_);
+    glDeleteVertexArrays(1, &vao_);
+    fbo_ = depth_rb_ = vao_ = 0;
+    color_shader_.cleanUpShader();
+    normal_shader_.cleanUpShader();
+    ready_ = false;
+}
+
+int Impostors::bake(const model_t *model, glm::vec3 color, GLuint vao) {
+    if (!ready_) {
+        return -1;
+    }
+    for (size_t i = 0; i < atlases_.size(); i++) {
+        if (atlases_[i].model == model && atlases_[i].color == color) {
+            return (int)i;
+        }
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    impostor_atlas_t atlas;
+    atlas.model = model;
+    atlas.color = color;
+    atlas.center = (model->bounds.min + model->bounds.max) * 0.5f;
+    atlas.radius = glm::length(model->bounds.max - model->bounds.min) * 0.5f;
+
+    int size = kFrames * kFrameSize;
+    GLuint textures[2];
+    glGenTextures(2, textures);
+    atlas.color_tex = textures[0];
+    atlas.normal_tex = textures[1];
+    for (int t = 0; t < 2; t++) {
+        gl_state().bind_texture(0, GL_TEXTURE_2D, textures[t]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                     nullptr);
+    }
+
+    // the bake framebuffer stays bound, the render graph binds every pass's
+    // target itself
+    gl_state().bind_framebuffer(fbo_);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_rb_);
+    gl_state().enable(GL_DEPTH_TEST);
+    gl_state().depth_func(GL_LESS);
+    gl_state().depth_mask(true);
+    gl_state().color_mask(true);
+    // the meshes are closed, but a bake is cheap enough to not care
+    gl_state().disable(GL_CULL_FACE);
+    gl_state().bind_vertex_array(vao);
+
+    // ortho camera 2r out on every direction, the sphere fills the frame and
+    // its depth range
+    float r = atlas.radius;
+    glm::mat4 proj = glm::ortho(-r, r, -r, r, r, 3.0f * r);
+    Shader *programs[2] = {&color_shader_, &normal_shader_};
+    for (int t = 0; t < 2; t++) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[t],
+                               0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            printf("impostor bake framebuffer incomplete\n");
+        }
+        gl_state().viewport(0, 0, size, size);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        GLuint program = programs[t]->getShader();
+        gl_state().use_program(program);
+        GLint view_proj_loc = glGetUniformLocation(program, "viewProj");
+        glUniform3fv(glGetUniformLocation(program, "albedo"), 1, glm::value_ptr(color));
+        for (int j = 0; j < kFrames; j++) {
+            for (int i = 0; i < kFrames; i++) {
+                glm::vec3 v = oct_decode(glm::vec2(i, j) / (float)(kFrames - 1));
+                glm::vec3 right, up;
+                frame_basis(v, right, up);
+                glm::mat4 view = glm::lookAt(atlas.center + v * 2.0f * r, atlas.center, up);
+                glm::mat4 view_proj = proj * view;
+                glUniformMatrix4fv(view_proj_loc, 1, GL_FALSE, glm::value_ptr(view_proj));
+                gl_state().viewport(i * kFrameSize, j * kFrameSize, kFrameSize, kFrameSize);
+                glDrawArrays(GL_TRIANGLES, model->start, model->num_vertices);
+            }
+        }
+    }
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    gl_state().bind_vertex_array(0);
+    gl_state().enable(GL_CULL_FACE);
+
+    // fix up the silhouettes on the cpu, then mips for the far ones
+    vector<unsigned char> texels[2];
+    for (int t = 0; t < 2; t++) {
+        texels[t].resize(size * size * 4);
+        gl_state().bind_texture(0, GL_TEXTURE_2D, textures[t]);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels[t].data());
+    }
+    dilate(texels[0], texels[1], size);
+    for (int t = 0; t < 2; t++) {
+        gl_state().bind_texture(0, GL_TEXTURE_2D, textures[t]);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE,
+                        texels[t].data());
+        // past kMaxLevel the views would bleed into each other
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, kMaxLevel);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    atlases_.push_back(atlas);
+    printf("baked impostor of %s: %d views of %dx%d, %.2f ms\n", model->name,
+           kFrames * kFrames, kFrameSize, kFrameSize,
+           chrono::duration<float, milli>(chrono::steady_clock::now() - start).count());
+    return (int)atlases_.size() - 1;
+}
+
+void Impostors::dilate(vector<unsigned char> &color, vector<unsigned char> &normal, int size) {
+    vector<char> filled(size * size);
+    for (int i = 0; i < size * size; i++) {
+        filled[i] = color[i * 4 + 3] != 0;
+    }
+    vector<char> next = filled;
+    static const int kDx[4] = {1, -1, 0, 0};
+    static const int kDy[4] = {0, 0, 1, -1};
+    for (int step = 0; step < kDilateSteps; step++) {
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                int i = y * size + x;
+                if (filled[i]) {
+                    continue;
+                }
+                int sum[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+                int n = 0;
+                for (int k = 0; k < 4; k++) {
+                    // stay inside the view
+                    int nx = x + kDx[k], ny = y + kDy[k];
+                    if (nx / kFrameSize != x / kFrameSize || ny / kFrameSize != y / kFrameSize ||
+                        nx < 0 || ny < 0 || nx >= size || ny >= size) {
+                        continue;
+                    }
+                    int j = ny * size + nx;
+                    if (!filled[j]) {
+                        continue;
+                    }
+                    for (int c = 0; c < 3; c++) {
+                        sum[c] += color[j * 4 + c];
+                    }
+                    for (int c = 0; c < 4; c++) {
+                        sum[4 + c] += normal[j * 4 + c];
+                    }
+                    n++;
+                }
+                if (n == 0) {
+                    continue;
+                }
+                // coverage stays 0
+                for (int c = 0; c < 3; c++) {
+                    color[i * 4 + c] = (unsigned char)(sum[c] / n);
+                }
+                for (int c = 0; c < 4; c++) {
+                    normal[i * 4 + c] = (unsigned char)(sum[4 + c] / n);
+                }
+                next[i] = 1;
+            }
+        }
+        filled = next;
+    }
+}
+
+void Impostors::begin_frame(const glm::vec3 &cam_pos, const glm::mat4 &proj, int height) {
+    cam_pos_ = cam_pos;
+    pixel_scale_ = proj[1][1] * height * 0.5f;
+    drawn_ = 0;
+    vertices_saved_ = 0;
+}
+
+bool Impostors::use_impostor(const aabb_t &bounds) const {
+    glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+    float radius = glm::length(bounds.max - bounds.min) * 0.5f;
+    float dist = glm::length(center - cam_pos_);
+    if (dist <= radius * 2.0f) {
+        return false;
+    }
+    return 2.0f * radius * pixel_scale_ / dist < switch_pixels_;
+}
+
+const Impostors::locations_t &Impostors::locations(GLuint program) {
+    for (size_t i = 0; i < locations_.size(); i++) {
+        if (locations_[i].program == program) {
+            return locations_[i];
+        }
+    }
+    locations_t locs;
+    locs.program = program;
+    locs.view = glGetUniformLocation(program, "view");
+    locs.proj = glGetUniformLocation(program, "proj");
+    locs.model = glGetUniformLocation(program, "model");
+    locs.sphere = glGetUniformLocation(program, "impostorSphere");
+    locs.frames = glGetUniformLocation(program, "impostorFrames");
+    locations_.push_back(locs);
+    return locations_.back();
+}
+
+void Impostors::draw(const vector<impostor_instance_t> &instances, const glm::mat4 &view,
+                     const glm::mat4 &proj) {
+    drawn_ = (int)instances.size();
+    vertices_saved_ = 0;
+    for (size_t i = 0; i < instances.size(); i++) {
+        vertices_saved_ += atlases_[instances[i].atlas].model->num_vertices - 4;
+    }
+    if (instances.empty()) {
+        return;
+    }
+    gl_state().bind_vertex_array(vao_);
+    GLuint program = 0;
+    int atlas = -1;
+    for (size_t i = 0; i < instances.size(); i++) {
+        const impostor_instance_t &instance = instances[i];
+        GLuint next = shaders_.get(instance.features | FEATURE_IMPOSTOR).getShader();
+        const locations_t &locs = locations(next);
+        if (next != program) {
+            program = next;
+            gl_state().use_program(program);
+            glUniformMatrix4fv(locs.view, 1, GL_FALSE, glm::value_ptr(view));
+            glUniformMatrix4fv(locs.proj, 1, GL_FALSE, glm::value_ptr(proj));
+            glUniform1f(locs.frames, (float)kFrames);
+            atlas = -1;
+        }
+        if (instance.atlas != atlas) {
+            atlas = instance.atlas;
+            const impostor_atlas_t &a = atlases_[atlas];
+            gl_state().bind_texture(UNIT_IMPOSTOR_COLOR, GL_TEXTURE_2D, a.color_tex);
+            gl_state().bind_texture(UNIT_IMPOSTOR_NORMAL, GL_TEXTURE_2D, a.normal_tex);
+            glUniform4f(locs.sphere, a.center.x, a.center.y, a.center.z, a.radius);
+        }
+        glUniformMatrix4fv(locs.model, 1, GL_FALSE, glm::value_ptr(instance.model));
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    }
+    gl_state().bind_vertex_array(0);
+}
+
+void Impostors::print_stats() const {
+    printf("impostors: %d drawn as quads (under %.0f px), %d vertices saved, %d atlases\n",
+           drawn_, switch_pixels_, vertices_saved_, num_atlases());
+}
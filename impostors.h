@@ -0,0 +1,109 @@
+#ifndef IMPOSTORS_H
+#define IMPOSTORS_H
+
+#include "game_types.h"
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+#include "shader.h"
+
+#include <vector>
+
+using namespace std;
+
+// one mesh in one color, baked from kFrames x kFrames directions. the
+// frames sit on an octahedral map of the sphere around the mesh (z is the
+// pole, object space), frame (i, j) looks from oct_decode((i, j) /
+// (kFrames - 1)). the color texture holds albedo and coverage, the normal
+// texture the object space normal and the depth across the sphere
+typedef struct impostor_atlas_t {
+  const model_t *model;
+  glm::vec3 color;
+  glm::vec3 center; // of the bounding sphere, object space
+  float radius;
+  GLuint color_tex;  // rgba8, rgb albedo, a coverage
+  GLuint normal_tex; // rgba8, rgb normal * 0.5 + 0.5, a depth (0 = front of the sphere)
+} impostor_atlas_t;
+
+// a mesh drawn as its impostor this frame
+typedef struct impostor_instance_t {
+  int atlas;
+  unsigned features; // the entity's shader_feature_t bits, without FEATURE_IMPOSTOR
+  glm::mat4 model;
+} impostor_instance_t;
+
+// octahedral impostors for the high poly props. bake() renders a mesh from
+// every direction of the octahedral grid into an atlas, once. far away
+// instances are then drawn as a camera facing quad: the fragment shader
+// (fragment.fs, IMPOSTOR) intersects the eye ray with the four baked views
+// around the eye direction, blends albedo, normal and depth between them and
+// lights the result like the mesh, depth included. a mesh switches to its
+// impostor once its bounding sphere covers fewer than switch_pixels() pixels
+// of the screen's height
+class Impostors {
+public:
+  static const int kFrames = 16;     // views per side of the atlas
+  static const int kFrameSize = 64;  // texels per view and side
+  static const int kMaxLevel = 3;    // coarsest mip, 8 texels per view
+  static const int kDilateSteps = 8; // empty texels that get a neighbor's color
+  static constexpr float kDefaultSwitchPixels = 48.0f;
+
+  Impostors() : shaders_("shaders/impostor.vs", "shaders/fragment.fs") {}
+  ~Impostors() = default;
+
+  // loads the bake programs
+  bool init();
+  // frees the atlases and the programs, call while the context is still alive
+  void cleanup();
+
+  void set_enabled(bool enabled) { enabled_ = enabled; }
+  bool enabled() const { return enabled_; }
+  void set_switch_pixels(float pixels) { switch_pixels_ = pixels; }
+  float switch_pixels() const { return switch_pixels_; }
+
+  // atlas of model in color, baked on first use. vao holds the model in the
+  // 8 float layout. -1 if the impostors aren't set up
+  int bake(const model_t *model, glm::vec3 color, GLuint vao);
+  int num_atlases() const { return (int)atlases_.size(); }
+
+  // camera of the frame, the world drawn height pixels high
+  void begin_frame(const glm::vec3 &cam_pos, const glm::mat4 &proj, int height);
+  // true if something with these world space bounds is small enough on
+  // screen for its impostor. no gl, safe on any thread
+  bool use_impostor(const aabb_t &bounds) const;
+  // the frame's impostors, after the world (uses its lights and maps)
+  void draw(const vector<impostor_instance_t> &instances, const glm::mat4 &view,
+            const glm::mat4 &proj);
+
+  void print_stats() const;
+
+private:
+  bool ready_ = false;
+  bool enabled_ = false;
+  float switch_pixels_ = kDefaultSwitchPixels;
+  vector<impostor_atlas_t> atlases_;
+
+  // bake: one program per atlas texture
+  Shader color_shader_, normal_shader_;
+  GLuint fbo_ = 0, depth_rb_ = 0;
+
+  // draw: fragment.fs variants with IMPOSTOR, the quads come from gl_VertexID
+  ShaderVariants shaders_;
+  GLuint vao_ = 0;
+  typedef struct locations_t {
+    GLuint program;
+    GLint view, proj, model, sphere, frames;
+  } locations_t;
+  vector<locations_t> locations_;
+  const locations_t &locations(GLuint program);
+
+  glm::vec3 cam_pos_;
+  float pixel_scale_ = 1.0f; // pixels per world unit at distance 1
+
+  int drawn_ = 0, vertices_saved_ = 0;
+
+  // gives empty texels the average of their filled neighbors so filtering
+  // and mips don't pull black into the silhouette, one step per pass
+  static void dilate(vector<unsigned char> &color, vector<unsigned char> &normal, int size);
+};
+
+#endif // IMPOSTORS_H
@@ -0,0 +1,143 @@
+#include "indirect_draw.h"
+
+#include "gl_state.h"
+#include "occlusion_queries.h"
+#include "glm/gtc/type_ptr.hpp"
+
+#include <cstdio>
+
+using namespace std;
+
+bool IndirectRenderer::is_supported() {
+    if (GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 3)) {
+        // 4.3 has ssbos and multi draw indirect in core, gl_DrawIDARB still
+        // comes from the extension (core only in 4.6)
+        return GLAD_GL_ARB_shader_draw_parameters != 0;
+    }
+    return GLAD_GL_ARB_multi_draw_indirect && GLAD_GL_ARB_shader_storage_buffer_object &&
+           GLAD_GL_ARB_base_instance && GLAD_GL_ARB_shader_draw_parameters;
+}
+
+bool IndirectRenderer::init() {
+    if (ready_) {
+        return true;
+    }
+    if (!is_supported()) {
+        return false;
+    }
+
+    // compiles in the background, the first submit() waits for what it uses
+    shaders_.startAll();
+    ready_ = true;
+    return true;
+}
+
+void IndirectRenderer::cleanup() {
+    if (!ready_) {
+        return;
+    }
+    shaders_.cleanUpShaders();
+    ready_ = false;
+}
+
+void IndirectRenderer::submit(const RenderQueue &queue, OcclusionQueries *conditions) {
+    num_draws_ = queue.size();
+    num_calls_ = 0;
+    if (num_draws_ == 0) {
+        return;
+    }
+
+    // the queue is already sorted, the packets just get copied out in order.
+    // the packet's program is ignored, everything runs through vertex_mdi.vs
+    const glm::mat4 &view = queue.view();
+    commands_.clear();
+    command_vaos_.clear();
+    command_features_.clear();
+    command_cull_.clear();
+    command_condition_.clear();
+    ring_chunk_t data_chunk = frame_ring().alloc(
+        num_draws_ * sizeof(indirect_draw_data_t), frame_ring().storage_align());
+    indirect_draw_data_t *records = (indirect_draw_data_t *)data_chunk.ptr;
+    for (int i = 0; i < num_draws_; i++) {
+        const draw_packet_t &packet = queue.sorted_packet(i);
+
+        indirect_draw_data_t &data = records[i];
+        data.model = packet.model;
+        glm::mat3 normal = RenderQueue::normal_matrix(view * packet.model);
+        for (int c = 0; c < 3; c++) {
+            data.normal[c] = glm::vec4(normal[c], 0.0f);
+        }
+        data.color = glm::vec4(packet.color, 1.0f);
+
+        int condition = conditions != nullptr && conditions->has_condition(packet.occlusion_id)
+                            ? packet.occlusion_id
+                            : -1;
+        // same mesh and variant as the previous packet, one more instance of
+        // its command
+        if (!commands_.empty() && condition < 0 && command_condition_.back() < 0 &&
+            command_vaos_.back() == packet.vao &&
+            command_features_.back() == packet.features &&
+            command_cull_.back() == (char)packet.cull &&
+            commands_.back().first == (GLuint)packet.start &&
+            commands_.back().count == (GLuint)packet.num_vertices) {
+            commands_.back().instance_count++;
+            continue;
+        }
+        draw_arrays_indirect_command_t cmd;
+        cmd.count = packet.num_vertices;
+        cmd.instance_count = 1;
+        cmd.first = packet.start;
+        cmd.base_instance = i;
+        commands_.push_back(cmd);
+        command_vaos_.push_back(packet.vao);
+        command_features_.push_back(packet.features);
+        command_cull_.push_back((char)packet.cull);
+        command_condition_.push_back(condition);
+    }
+
+    frame_ring().commit(data_chunk);
+    gl_state().bind_buffer_range(GL_SHADER_STORAGE_BUFFER, 0, data_chunk.buffer,
+                                 data_chunk.offset, data_chunk.size);
+    // commands only need 4 byte alignment
+    ring_chunk_t command_chunk = frame_ring().upload(
+        commands_.data(), commands_.size() * sizeof(draw_arrays_indirect_command_t), 16);
+    gl_state().bind_buffer(GL_DRAW_INDIRECT_BUFFER, command_chunk.buffer);
+
+    // in practice there is only the one vao, so one call per variant and
+    // culling mode
+    int num_commands = (int)commands_.size();
+    int first = 0;
+    while (first < num_commands) {
+        GLuint vao = command_vaos_[first];
+        unsigned features = command_features_[first];
+        int condition = command_condition_[first];
+        int last = first + 1;
+        while (condition < 0 && last < num_commands && command_condition_[last] < 0 &&
+               command_vaos_[last] == vao &&
+               command_features_[last] == features &&
+               command_cull_[last] == command_cull_[first]) {
+            last++;
+        }
+        GLuint program = shaders_.get(features).getShader();
+        gl_state().use_program(program);
+        glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE,
+                           glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(program, "proj"), 1, GL_FALSE,
+                           glm::value_ptr(queue.proj()));
+        gl_state().bind_vertex_array(vao);
+        gl_state().set_enabled(GL_CULL_FACE, command_cull_[first] != 0);
+        if (condition >= 0) {
+            conditions->begin_conditional(condition);
+        }
+        glMultiDrawArraysIndirect(
+            GL_TRIANGLES,
+            (const void *)(command_chunk.offset +
+                           first * sizeof(draw_arrays_indirect_command_t)),
+            last - first, 0);
+        if (condition >= 0) {
+            conditions->end_conditional();
+        }
+        num_calls_++;
+        first = last;
+    }
+}
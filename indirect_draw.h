@@ -0,0 +1,82 @@
+#ifndef INDIRECT_DRAW_H
+#define INDIRECT_DRAW_H
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+#include "render_queue.h"
+#include "shader.h"
+
+#include <vector>
+
+using namespace std;
+
+typedef enum draw_backend_t {
+  BACKEND_DIRECT = 0,  // one glDrawArrays per packet (RenderQueue::submit)
+  BACKEND_INDIRECT = 1 // whole queue in one glMultiDrawArraysIndirect
+} draw_backend_t;
+
+// layout fixed by gl, see glMultiDrawArraysIndirect
+typedef struct draw_arrays_indirect_command_t {
+  GLuint count;
+  GLuint instance_count;
+  GLuint first;
+  GLuint base_instance;
+} draw_arrays_indirect_command_t;
+
+// per instance record in the ssbo, std430 layout. matches draw_data_t in
+// shaders/vertex_mdi.vs
+typedef struct indirect_draw_data_t {
+  glm::mat4 model;
+  glm::vec4 normal[3]; // mat3 columns, padded to vec4 by std430
+  glm::vec4 color;
+} indirect_draw_data_t;
+
+// multi draw indirect backend for the render queue. the sorted packets are
+// turned into indirect commands plus an ssbo of per instance data, then the
+// whole queue goes out in one call per vao and shader variant. runs of packets with the same
+// mesh (they are next to each other after sorting) become one instanced
+// command, the vertex shader finds its record at gl_BaseInstanceARB +
+// gl_InstanceID. needs gl 4.3 (or the arb extensions) for the ssbo and the
+// draw parameters
+class IndirectRenderer {
+public:
+  IndirectRenderer() : shaders_("shaders/vertex_mdi.vs", "shaders/fragment.fs") {}
+  ~IndirectRenderer() = default;
+
+  // true if the current context can run this path
+  static bool is_supported();
+
+  // starts compiling the programs, false if not supported
+  bool init();
+  bool ready() const { return ready_; }
+  // frees the programs, call while the context is still alive
+  void cleanup();
+
+  // draws everything in the (sorted) queue. packets under an occlusion
+  // query condition get a command and a call of their own
+  void submit(const RenderQueue &queue, OcclusionQueries *conditions = nullptr);
+
+  int num_draws() const { return num_draws_; }
+  int num_commands() const { return (int)commands_.size(); }
+  int num_calls() const { return num_calls_; }
+
+private:
+  bool ready_ = false;
+  ShaderVariants shaders_; // same feature bits as the direct path
+
+  // vao, shader features and culling of each command, consecutive commands
+  // that share all three go out in one call
+  vector<GLuint> command_vaos_;
+  vector<unsigned> command_features_;
+  vector<char> command_cull_;
+  vector<int> command_condition_; // occlusion_id of a conditional command, else -1
+
+  // the instance records go straight into the frame ring, the commands
+  // are collected here first since their number isn't known up front
+  vector<draw_arrays_indirect_command_t> commands_;
+
+  int num_draws_ = 0;
+  int num_calls_ = 0;
+};
+
+#endif // INDIRECT_DRAW_H
@@ -0,0 +1,99 @@
+#include "job_pool.h"
+
+#include "profiler.h"
+
+#include <cstdio>
+
+using namespace std;
+
+JobPool::~JobPool() {
+    stop();
+}
+
+void JobPool::start(int num_threads) {
+    if (started_) {
+        return;
+    }
+    if (num_threads <= 0) {
+        num_threads = (int)thread::hardware_concurrency();
+        if (num_threads <= 0) {
+            num_threads = 1;
+        }
+    }
+    quit_ = false;
+    for (int i = 1; i < num_threads; i++) {
+        // a worker may first get the lock after run() started a batch, so it
+        // is told which batch was the last one before it existed
+        workers_.push_back(thread(&JobPool::worker_loop, this, i, batch_));
+    }
+    started_ = true;
+}
+
+void JobPool::stop() {
+    {
+        lock_guard<mutex> lock(mutex_);
+        quit_ = true;
+    }
+    work_cv_.notify_all();
+    for (size_t i = 0; i < workers_.size(); i++) {
+        workers_[i].join();
+    }
+    workers_.clear();
+    started_ = false;
+}
+
+void JobPool::run(int num_jobs, const function<void(int)> &job) {
+    if (workers_.empty() || num_jobs <= 1) {
+        for (int i = 0; i < num_jobs; i++) {
+            job(i);
+        }
+        return;
+    }
+    {
+        lock_guard<mutex> lock(mutex_);
+        job_ = &job;
+        num_jobs_ = num_jobs;
+        next_job_.store(0);
+        busy_ = (int)workers_.size();
+        batch_++;
+    }
+    work_cv_.notify_all();
+    take_jobs(); // this thread helps out too
+
+    // every worker has to check in, even one that woke up too late to get a
+    // job, before job_ can go away
+    unique_lock<mutex> lock(mutex_);
+    done_cv_.wait(lock, [this]() { return busy_ == 0; });
+    job_ = nullptr;
+}
+
+void JobPool::take_jobs() {
+    while (true) {
+        int i = next_job_++;
+        if (i >= num_jobs_) {
+            break;
+        }
+        (*job_)(i);
+    }
+}
+
+void JobPool::worker_loop(int index, unsigned seen) {
+    char name[32];
+    snprintf(name, sizeof(name), "job worker %d", index);
+    profiler().set_thread_name(name);
+
+    unique_lock<mutex> lock(mutex_);
+    while (true) {
+        work_cv_.wait(lock, [&]() { return quit_ || batch_ != seen; });
+        if (quit_) {
+            return;
+        }
+        seen = batch_;
+        lock.unlock();
+        take_jobs();
+        lock.lock();
+        if (--busy_ == 0) {
+            done_cv_.notify_all();
+        }
+    }
+}
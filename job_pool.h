@@ -0,0 +1,50 @@
+#ifndef JOB_POOL_H
+#define JOB_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// worker threads that stay around for the small jobs of every frame, so
+// nothing gets spawned per frame. run() hands out job indices until they are
+// gone and returns once every job is done; the calling thread takes jobs too
+class JobPool {
+public:
+  JobPool() = default;
+  ~JobPool();
+
+  // num_threads counts the caller, 0 = one per core. 1 runs everything on
+  // the caller. does nothing if the pool is already running
+  void start(int num_threads = 0);
+  void stop();
+  bool started() const { return started_; }
+  int num_threads() const { return (int)workers_.size() + 1; }
+
+  // calls job(0) .. job(num_jobs - 1) spread over the threads, in no
+  // particular order. not reentrant
+  void run(int num_jobs, const function<void(int)> &job);
+
+private:
+  bool started_ = false;
+  vector<thread> workers_;
+  mutex mutex_;
+  condition_variable work_cv_, done_cv_;
+  bool quit_ = false;
+
+  // the batch being run, set under the mutex before the workers wake
+  const function<void(int)> *job_ = nullptr;
+  int num_jobs_ = 0;
+  atomic<int> next_job_{0};
+  unsigned batch_ = 0;
+  int busy_ = 0; // workers that haven't finished the batch yet
+
+  void worker_loop(int index, unsigned seen);
+  void take_jobs();
+};
+
+#endif // JOB_POOL_H
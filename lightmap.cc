@@ -0,0 +1,143 @@
+#include "lightmap.h"
+
+#include "frame_ring.h"
+#include "gl_state.h"
+#include "shader.h"
+
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+const uint16_t Lightmap::kNoFace;
+constexpr float Lightmap::kScale;
+
+// cache layout: "LMP1", w, h, texels per unit, atlas w, atlas h, floor x,
+// floor y, grid hash, sun direction (3 floats), face slots (2 uint16 each),
+// texels (atlas w * atlas h rgba8)
+bool Lightmap::save(const char *fname) const {
+    FILE *fp = fopen(fname, "wb");
+    if (fp == NULL) {
+        printf("can't write lightmap %s\n", fname);
+        return false;
+    }
+    int32_t header[7] = {data_.w, data_.h, data_.texels_per_unit, data_.atlas_w,
+                         data_.atlas_h, data_.floor_x, data_.floor_y};
+    fwrite("LMP1", 1, 4, fp);
+    fwrite(header, sizeof(int32_t), 7, fp);
+    fwrite(&data_.grid_hash, sizeof(uint64_t), 1, fp);
+    fwrite(&data_.sun_dir[0], sizeof(float), 3, fp);
+    fwrite(data_.faces.data(), sizeof(uint16_t), data_.faces.size(), fp);
+    fwrite(data_.texels.data(), 1, data_.texels.size(), fp);
+    fclose(fp);
+    return true;
+}
+
+bool Lightmap::load(const char *fname, uint64_t grid_hash) {
+    FILE *fp = fopen(fname, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+
+    char magic[4];
+    int32_t header[7];
+    lightmap_data_t data;
+    bool ok = fread(magic, 1, 4, fp) == 4 && memcmp(magic, "LMP1", 4) == 0 &&
+              fread(header, sizeof(int32_t), 7, fp) == 7 &&
+              fread(&data.grid_hash, sizeof(uint64_t), 1, fp) == 1 &&
+              data.grid_hash == grid_hash &&
+              fread(&data.sun_dir[0], sizeof(float), 3, fp) == 3 &&
+              header[0] > 0 && header[1] > 0 && header[2] > 0 &&
+              header[3] > 0 && header[4] > 0 && header[3] <= 16384 && header[4] <= 16384;
+    if (ok) {
+        data.w = header[0];
+        data.h = header[1];
+        data.texels_per_unit = header[2];
+        data.atlas_w = header[3];
+        data.atlas_h = header[4];
+        data.floor_x = header[5];
+        data.floor_y = header[6];
+        data.faces.resize(2 * num_face_slots(data.w, data.h));
+        data.texels.resize((size_t)data.atlas_w * data.atlas_h * 4);
+        ok = fread(data.faces.data(), sizeof(uint16_t), data.faces.size(), fp) == data.faces.size() &&
+             fread(data.texels.data(), 1, data.texels.size(), fp) == data.texels.size();
+    }
+    fclose(fp);
+
+    if (!ok) {
+        printf("lightmap %s is stale or corrupt, ignoring it (rebake with --bake-lightmap)\n",
+               fname);
+        return false;
+    }
+    data_ = data;
+    return true;
+}
+
+void Lightmap::upload() {
+    if (empty() || atlas_tex_ != 0) {
+        return;
+    }
+    glGenTextures(1, &atlas_tex_);
+    gl_state().bind_texture(UNIT_LIGHTMAP, GL_TEXTURE_2D, atlas_tex_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, data_.atlas_w, data_.atlas_h, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, data_.texels.data());
+    // no mips, the charts are packed tight and would bleed into each other.
+    // every chart has a one texel gutter for the bilinear taps at its edge
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenBuffers(1, &faces_buffer_);
+    gl_state().bind_buffer(GL_TEXTURE_BUFFER, faces_buffer_);
+    glBufferData(GL_TEXTURE_BUFFER, data_.faces.size() * sizeof(uint16_t), data_.faces.data(),
+                 GL_STATIC_DRAW);
+    glGenTextures(1, &faces_tex_);
+    gl_state().bind_texture(UNIT_LIGHTMAP_FACES, GL_TEXTURE_BUFFER, faces_tex_);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RG16UI, faces_buffer_);
+}
+
+void Lightmap::cleanup() {
+    if (atlas_tex_ == 0) {
+        return;
+    }
+    GLuint textures[2] = {atlas_tex_, faces_tex_};
+    for (int i = 0; i < 2; i++) {
+        gl_state().forget_texture(textures[i]);
+    }
+    gl_state().forget_buffer(faces_buffer_);
+    glDeleteTextures(2, textures);
+    glDeleteBuffers(1, &faces_buffer_);
+    atlas_tex_ = faces_tex_ = faces_buffer_ = 0;
+}
+
+void Lightmap::bind(const glm::vec3 &sun_dir) {
+    if (atlas_tex_ == 0) {
+        return;
+    }
+    // Lightmap block in fragment.fs (std140)
+    struct {
+        int32_t grid[4];
+        float atlas[4];
+        float origin[4];
+    } params;
+    bool on = glm::dot(sun_dir, data_.sun_dir) > 0.9999f;
+    params.grid[0] = data_.w;
+    params.grid[1] = data_.h;
+    params.grid[2] = data_.texels_per_unit;
+    params.grid[3] = on ? 1 : 0;
+    params.atlas[0] = 1.0f / data_.atlas_w;
+    params.atlas[1] = 1.0f / data_.atlas_h;
+    params.atlas[2] = (float)data_.floor_x;
+    params.atlas[3] = (float)data_.floor_y;
+    params.origin[0] = -data_.w / 2.0f;
+    params.origin[1] = -(float)data_.h;
+    params.origin[2] = kScale;
+    params.origin[3] = 0.0f;
+    ring_chunk_t chunk = frame_ring().upload(&params, sizeof(params), frame_ring().uniform_align());
+    gl_state().bind_buffer_range(GL_UNIFORM_BUFFER, BLOCK_LIGHTMAP, chunk.buffer, chunk.offset,
+                                 chunk.size);
+
+    gl_state().bind_texture(UNIT_LIGHTMAP, GL_TEXTURE_2D, atlas_tex_);
+    gl_state().bind_texture(UNIT_LIGHTMAP_FACES, GL_TEXTURE_BUFFER, faces_tex_);
+}
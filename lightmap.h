@@ -0,0 +1,69 @@
+#ifndef LIGHTMAP_H
+#define LIGHTMAP_H
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// baked lighting of the static level, see LightmapBaker. one atlas holds a
+// chart for the floor and one per merged run of wall faces. walls are drawn
+// as instanced cubes without a second uv set, so the shader finds its texel
+// from the world position instead: every possible wall face (a unit square on
+// a grid line, facing one way) has a slot, and the slot holds the atlas texel
+// of the face's corner or kNoFace
+typedef struct lightmap_data_t {
+  int w, h;            // grid the map was baked for
+  int texels_per_unit;
+  int atlas_w, atlas_h;
+  int floor_x, floor_y; // atlas texel of the grid corner (-w / 2, -h) on the floor
+  uint64_t grid_hash;
+  glm::vec3 sun_dir;    // direction the sunlight travels when baked
+  vector<uint16_t> faces;       // 2 per face slot, see face slots below
+  vector<unsigned char> texels; // rgba8, rgb = irradiance / kScale, a = sun seen
+} lightmap_data_t;
+
+class Lightmap {
+public:
+  static constexpr float kScale = 2.0f; // headroom over the [0, 1] of rgba8
+  static const uint16_t kNoFace = 0xFFFF;
+
+  Lightmap() = default;
+  ~Lightmap() = default;
+
+  // cache next to the scene as <scene>.lm, only used if baked from this grid
+  bool load(const char *fname, uint64_t grid_hash);
+  bool save(const char *fname) const;
+  bool empty() const { return data_.texels.empty(); }
+  const lightmap_data_t &data() const { return data_; }
+  void set_data(const lightmap_data_t &data) { data_ = data; }
+
+  // face slots. x faces sit on the grid line x = line (0..w) next to row
+  // cell (0..h-1), z faces on z = line (0..h) next to column cell (0..w-1).
+  // side 1 faces +x / +z. the same numbering is in fragment.fs
+  static int num_face_slots(int w, int h) { return 2 * (w + 1) * h + 2 * (h + 1) * w; }
+  static int x_face_slot(int w, int h, int line, int cell, int side) {
+    return (side * h + cell) * (w + 1) + line;
+  }
+  static int z_face_slot(int w, int h, int line, int cell, int side) {
+    return 2 * (w + 1) * h + (side * w + cell) * (h + 1) + line;
+  }
+
+  // gl side, call with the context current. upload() is a no-op when empty
+  void upload();
+  void cleanup();
+  // binds the atlas and the face table and fills the Lightmap block. the
+  // bake only holds for the sun it was made with, any other sun switches
+  // the lightmapped variants back to runtime lighting
+  void bind(const glm::vec3 &sun_dir);
+
+private:
+  lightmap_data_t data_;
+  GLuint atlas_tex_ = 0;
+  GLuint faces_buffer_ = 0, faces_tex_ = 0;
+};
+
+#endif // LIGHTMAP_H
@@ -0,0 +1,706 @@
+#include "lightmap_baker.h"
+
+#include "profiler.h"
+#include "pvs.h"
+#include "sh_basis.h"
+
+#include "glm/gtc/packing.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define LIGHTMAP_SSE 1
+#endif
+
+using namespace std;
+
+// ray origins are pushed this far off their surface
+static const float kRayOffset = 1e-3f;
+static const float kNoHit = 1e30f;
+
+void LightmapBaker::set_level(const vector<char> &grid, int w, int h,
+                              const glm::vec3 &sun_dir) {
+    grid_ = grid;
+    w_ = w;
+    h_ = h;
+    origin_x_ = -w / 2.0f;
+    origin_z_ = -(float)h;
+    sun_dir_ = glm::normalize(sun_dir);
+    build_boxes();
+}
+
+void LightmapBaker::build_boxes() {
+    // one box per horizontal run of walls, a maze row rarely has more than a
+    // few. walls are the cells' unit cubes from y = 0 to 1
+    boxes_.clear();
+    for (int z = 0; z < h_; z++) {
+        int x = 0;
+        while (x < w_) {
+            if (!is_wall(x, z)) {
+                x++;
+                continue;
+            }
+            int end = x;
+            while (end < w_ && is_wall(end, z)) {
+                end++;
+            }
+            box_t box;
+            box.min[0] = origin_x_ + x;
+            box.min[1] = 0.0f;
+            box.min[2] = origin_z_ + z;
+            box.max[0] = origin_x_ + end;
+            box.max[1] = 1.0f;
+            box.max[2] = origin_z_ + z + 1;
+            boxes_.push_back(box);
+            x = end;
+        }
+    }
+    nodes_.clear();
+    if (!boxes_.empty()) {
+        nodes_.reserve(2 * boxes_.size());
+        nodes_.push_back(bvh_node_t());
+        build_node(0, 0, (int)boxes_.size());
+    }
+}
+
+// builds node index over boxes_[first .. first + count). median split along
+// the longest axis of the centers, up to 4 boxes per leaf
+void LightmapBaker::build_node(int index, int first, int count) {
+    bvh_node_t node;
+    float cmin[3] = {kNoHit, kNoHit, kNoHit}, cmax[3] = {-kNoHit, -kNoHit, -kNoHit};
+    for (int k = 0; k < 3; k++) {
+        node.min[k] = kNoHit;
+        node.max[k] = -kNoHit;
+    }
+    for (int i = first; i < first + count; i++) {
+        for (int k = 0; k < 3; k++) {
+            node.min[k] = min(node.min[k], boxes_[i].min[k]);
+            node.max[k] = max(node.max[k], boxes_[i].max[k]);
+            float c = boxes_[i].min[k] + boxes_[i].max[k];
+            cmin[k] = min(cmin[k], c);
+            cmax[k] = max(cmax[k], c);
+        }
+    }
+    if (count <= 4) {
+        node.first = first;
+        node.count = count;
+        nodes_[index] = node;
+        return;
+    }
+
+    int axis = 0;
+    for (int k = 1; k < 3; k++) {
+        if (cmax[k] - cmin[k] > cmax[axis] - cmin[axis]) {
+            axis = k;
+        }
+    }
+    int mid = first + count / 2;
+    nth_element(boxes_.begin() + first, boxes_.begin() + mid, boxes_.begin() + first + count,
+                [axis](const box_t &a, const box_t &b) {
+                    return a.min[axis] + a.max[axis] < b.min[axis] + b.max[axis];
+                });
+    // the children sit next to each other
+    node.first = (int)nodes_.size();
+    node.count = 0;
+    nodes_[index] = node;
+    nodes_.push_back(bvh_node_t());
+    nodes_.push_back(bvh_node_t());
+    build_node(node.first, first, mid - first);
+    build_node(node.first + 1, mid, first + count - mid);
+}
+
+// lanes in mask whose ray enters the box before its tmax, entry distances in
+// tnear
+static int intersect_box(const LightmapBaker::ray4_t &rays, const float inv[3][4],
+                         const float *bmin, const float *bmax, int mask, float *tnear) {
+#ifdef LIGHTMAP_SSE
+    __m128 lo = _mm_setzero_ps();
+    __m128 hi = _mm_load_ps(rays.tmax);
+    const float *origin[3] = {rays.ox, rays.oy, rays.oz};
+    for (int k = 0; k < 3; k++) {
+        __m128 o = _mm_load_ps(origin[k]);
+        __m128 id = _mm_loadu_ps(inv[k]);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bmin[k]), o), id);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bmax[k]), o), id);
+        lo = _mm_max_ps(lo, _mm_min_ps(t0, t1));
+        hi = _mm_min_ps(hi, _mm_max_ps(t0, t1));
+    }
+    _mm_storeu_ps(tnear, lo);
+    return _mm_movemask_ps(_mm_cmple_ps(lo, hi)) & mask;
+#else
+    const float *origin[3] = {rays.ox, rays.oy, rays.oz};
+    int hit = 0;
+    for (int lane = 0; lane < 4; lane++) {
+        if (!(mask & (1 << lane))) {
+            continue;
+        }
+        float lo = 0.0f, hi = rays.tmax[lane];
+        for (int k = 0; k < 3; k++) {
+            float t0 = (bmin[k] - origin[k][lane]) * inv[k][lane];
+            float t1 = (bmax[k] - origin[k][lane]) * inv[k][lane];
+            lo = max(lo, min(t0, t1));
+            hi = min(hi, max(t0, t1));
+        }
+        tnear[lane] = lo;
+        if (lo <= hi) {
+            hit |= 1 << lane;
+        }
+    }
+    return hit;
+#endif
+}
+
+void LightmapBaker::trace(ray4_t &rays, int mask, bool any_hit, bool floor) const {
+    float inv[3][4];
+    const float *dir[3] = {rays.dx, rays.dy, rays.dz};
+    for (int lane = 0; lane < 4; lane++) {
+        rays.hit[lane] = -1;
+        for (int k = 0; k < 3; k++) {
+            // a huge finite value instead of inf keeps 0 * inv out of nan
+            float d = dir[k][lane];
+            inv[k][lane] = fabsf(d) > 1e-12f ? 1.0f / d : (d < 0.0f ? -1e30f : 1e30f);
+        }
+    }
+
+    int stack[64];
+    int top = 0;
+    if (!nodes_.empty()) {
+        stack[top++] = 0;
+    }
+    float tnear[4];
+    while (top > 0 && mask != 0) {
+        const bvh_node_t &node = nodes_[stack[--top]];
+        if (intersect_box(rays, inv, node.min, node.max, mask, tnear) == 0) {
+            continue;
+        }
+        if (node.count == 0) {
+            stack[top++] = node.first;
+            stack[top++] = node.first + 1;
+            continue;
+        }
+        for (int i = node.first; i < node.first + node.count; i++) {
+            int hit = intersect_box(rays, inv, boxes_[i].min, boxes_[i].max, mask, tnear);
+            for (int lane = 0; lane < 4; lane++) {
+                if (hit & (1 << lane)) {
+                    rays.hit[lane] = i;
+                    rays.tmax[lane] = tnear[lane];
+                    if (any_hit) {
+                        mask &= ~(1 << lane);
+                    }
+                }
+            }
+        }
+    }
+
+    // the floor is the plane y = 0 under the grid, there is nothing below it
+    for (int lane = 0; lane < 4 && floor; lane++) {
+        if (!(mask & (1 << lane)) || rays.dy[lane] >= 0.0f) {
+            continue;
+        }
+        float t = -rays.oy[lane] / rays.dy[lane];
+        float x = rays.ox[lane] + rays.dx[lane] * t - origin_x_;
+        float z = rays.oz[lane] + rays.dz[lane] * t - origin_z_;
+        if (t < rays.tmax[lane] && x >= 0.0f && x <= w_ && z >= 0.0f && z <= h_) {
+            rays.tmax[lane] = t;
+            rays.hit[lane] = kHitFloor;
+        }
+    }
+}
+
+void LightmapBaker::sun_visibility(const glm::vec3 *points, int mask, float *visible) const {
+    // the floor only receives, the same as in the shadow maps, so the rays
+    // only test the walls (the default sun comes up from below)
+    ray4_t rays;
+    for (int lane = 0; lane < 4; lane++) {
+        rays.ox[lane] = points[lane].x;
+        rays.oy[lane] = points[lane].y;
+        rays.oz[lane] = points[lane].z;
+        rays.dx[lane] = -sun_dir_.x;
+        rays.dy[lane] = -sun_dir_.y;
+        rays.dz[lane] = -sun_dir_.z;
+        rays.tmax[lane] = kNoHit;
+    }
+    trace(rays, mask, true, false);
+    for (int lane = 0; lane < 4; lane++) {
+        visible[lane] = (mask & (1 << lane)) && rays.hit[lane] == -1 ? 1.0f : 0.0f;
+    }
+}
+
+// cheap per texel random numbers, the bake has to come out the same every time
+static inline uint32_t hash_u32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+static inline float to_unit(uint32_t x) { return (x >> 8) * (1.0f / 16777216.0f); }
+
+void LightmapBaker::gather(ray4_t &rays, float *radiance) const {
+    trace(rays, 0xF, false, true);
+
+    // light the hit points the way the runtime would, sun plus ambient
+    glm::vec3 points[4];
+    float hit_cos[4] = {0, 0, 0, 0};
+    int sun_mask = 0;
+    for (int lane = 0; lane < 4; lane++) {
+        if (rays.hit[lane] == -1) {
+            radiance[lane] = kAmbient;
+            continue;
+        }
+        float t = rays.tmax[lane];
+        glm::vec3 p(rays.ox[lane] + rays.dx[lane] * t, rays.oy[lane] + rays.dy[lane] * t,
+                    rays.oz[lane] + rays.dz[lane] * t);
+        glm::vec3 n(0.0f, 1.0f, 0.0f);
+        if (rays.hit[lane] >= 0) {
+            // the face of the box the point is on
+            const box_t &box = boxes_[rays.hit[lane]];
+            float best = kNoHit;
+            for (int a = 0; a < 3; a++) {
+                float dmin = fabsf(p[a] - box.min[a]), dmax = fabsf(p[a] - box.max[a]);
+                if (dmin < best) {
+                    best = dmin;
+                    n = glm::vec3(0.0f);
+                    n[a] = -1.0f;
+                }
+                if (dmax < best) {
+                    best = dmax;
+                    n = glm::vec3(0.0f);
+                    n[a] = 1.0f;
+                }
+            }
+        }
+        radiance[lane] = kAlbedo * kAmbient;
+        hit_cos[lane] = glm::dot(n, -sun_dir_);
+        if (hit_cos[lane] > 0.0f) {
+            points[lane] = p + n * kRayOffset;
+            sun_mask |= 1 << lane;
+        }
+    }
+    if (sun_mask != 0) {
+        float visible[4];
+        sun_visibility(points, sun_mask, visible);
+        for (int lane = 0; lane < 4; lane++) {
+            radiance[lane] += kAlbedo * hit_cos[lane] * visible[lane];
+        }
+    }
+}
+
+float LightmapBaker::bake_texel(const chart_t &chart, int i, int j, float &sun) const {
+    const float T = (float)kTexelsPerUnit;
+    glm::vec3 center = chart.corner + chart.u * ((i + 0.5f) / T) + chart.v * ((j + 0.5f) / T) +
+                       chart.normal * kRayOffset;
+    uint32_t seed = hash_u32((uint32_t)(&chart - &charts_[0]) * 0x9e3779b9U ^
+                             hash_u32((uint32_t)(j * 65536 + i)));
+
+    // direct sun, spread over the texel so shadow edges come out smooth
+    float direct = 0.0f;
+    sun = 0.0f;
+    float cos_sun = glm::dot(chart.normal, -sun_dir_);
+    if (cos_sun > 0.0f) {
+        int lit = 0;
+        for (int k = 0; k < kSunRays; k += 4) {
+            glm::vec3 points[4];
+            float visible[4];
+            for (int lane = 0; lane < 4; lane++) {
+                float ju = to_unit(seed = hash_u32(seed)) - 0.5f;
+                float jv = to_unit(seed = hash_u32(seed)) - 0.5f;
+                points[lane] = center + chart.u * (ju / T) + chart.v * (jv / T);
+            }
+            sun_visibility(points, 0xF, visible);
+            for (int lane = 0; lane < 4; lane++) {
+                lit += visible[lane] > 0.0f;
+            }
+        }
+        sun = lit / (float)kSunRays;
+        direct = cos_sun * sun;
+    }
+
+    // sky and one bounce. cosine weighted, so the average is the irradiance
+    // over pi and rays that see the sky just count the ambient term
+    float indirect = 0.0f;
+    float rotate = to_unit(seed = hash_u32(seed));
+    for (int k = 0; k < kHemisphereRays; k += 4) {
+        ray4_t rays;
+        for (int lane = 0; lane < 4; lane++) {
+            int n = k + lane;
+            float u1 = (n + to_unit(seed = hash_u32(seed))) / kHemisphereRays;
+            float u2 = n * 0.618034f + rotate;
+            u2 -= floorf(u2);
+            float r = sqrtf(u1), phi = 6.2831853f * u2;
+            glm::vec3 d = chart.u * (r * cosf(phi)) + chart.v * (r * sinf(phi)) +
+                          chart.normal * sqrtf(max(0.0f, 1.0f - u1));
+            rays.ox[lane] = center.x;
+            rays.oy[lane] = center.y;
+            rays.oz[lane] = center.z;
+            rays.dx[lane] = d.x;
+            rays.dy[lane] = d.y;
+            rays.dz[lane] = d.z;
+            rays.tmax[lane] = kNoHit;
+        }
+        float radiance[4];
+        gather(rays, radiance);
+        indirect += radiance[0] + radiance[1] + radiance[2] + radiance[3];
+    }
+    return direct + indirect / kHemisphereRays;
+}
+
+void LightmapBaker::bake_row(const chart_t &chart, int row, lightmap_data_t &out,
+                             vector<unsigned char> &valid) const {
+    for (int i = 0; i < chart.width; i++) {
+        if (chart.floor) {
+            // floor under a wall is never seen, the dilation fills it in from
+            // the open cells next to it
+            int x = (int)floorf((i + 0.5f) / kTexelsPerUnit);
+            int z = (int)floorf((row + 0.5f) / kTexelsPerUnit);
+            if (is_wall(x, z)) {
+                continue;
+            }
+        }
+        float sun;
+        float e = bake_texel(chart, i, row, sun) / Lightmap::kScale;
+        unsigned char v = (unsigned char)(min(max(e, 0.0f), 1.0f) * 255.0f + 0.5f);
+        size_t idx = (size_t)(chart.y + row) * out.atlas_w + chart.x + i;
+        out.texels[idx * 4 + 0] = v;
+        out.texels[idx * 4 + 1] = v;
+        out.texels[idx * 4 + 2] = v;
+        out.texels[idx * 4 + 3] = (unsigned char)(sun * 255.0f + 0.5f);
+        valid[idx] = 1;
+    }
+}
+
+int LightmapBaker::build_charts(lightmap_data_t &out) {
+    const int T = kTexelsPerUnit;
+    charts_.clear();
+    out.faces.assign(2 * Lightmap::num_face_slots(w_, h_), Lightmap::kNoFace);
+
+    // the floor goes first across the top, the wall strips are packed in
+    // rows under it
+    chart_t floor_chart;
+    floor_chart.x = 1;
+    floor_chart.y = 1;
+    floor_chart.width = w_ * T;
+    floor_chart.height = h_ * T;
+    floor_chart.corner = glm::vec3(origin_x_, 0.0f, origin_z_);
+    floor_chart.u = glm::vec3(1, 0, 0);
+    floor_chart.v = glm::vec3(0, 0, 1);
+    floor_chart.normal = glm::vec3(0, 1, 0);
+    floor_chart.floor = true;
+    charts_.push_back(floor_chart);
+    out.atlas_w = max(floor_chart.width + 2, 512);
+    out.floor_x = floor_chart.x;
+    out.floor_y = floor_chart.y;
+    const int max_run = (out.atlas_w - 2) / T;
+
+    int shelf_x = 0, shelf_y = floor_chart.height + 2;
+    // axis 0 walks the x grid lines (faces facing +-x), axis 1 the z lines
+    for (int axis = 0; axis < 2; axis++) {
+        int lines = axis == 0 ? w_ + 1 : h_ + 1;
+        int cells = axis == 0 ? h_ : w_;
+        for (int side = 0; side < 2; side++) {
+            for (int line = 0; line < lines; line++) {
+                int cell = 0;
+                while (cell < cells) {
+                    // the face is there if the wall is behind it and an open
+                    // cell of the map in front of it
+                    auto has_face = [&](int c) {
+                        int back = side == 1 ? line - 1 : line;
+                        int front = side == 1 ? line : line - 1;
+                        return axis == 0 ? is_wall(back, c) && is_open(front, c)
+                                         : is_wall(c, back) && is_open(c, front);
+                    };
+                    if (!has_face(cell)) {
+                        cell++;
+                        continue;
+                    }
+                    int end = cell;
+                    while (end < cells && end - cell < max_run && has_face(end)) {
+                        end++;
+                    }
+
+                    chart_t chart;
+                    chart.width = (end - cell) * T;
+                    chart.height = T;
+                    if (shelf_x + chart.width + 2 > out.atlas_w) {
+                        shelf_x = 0;
+                        shelf_y += T + 2;
+                    }
+                    chart.x = shelf_x + 1;
+                    chart.y = shelf_y + 1;
+                    shelf_x += chart.width + 2;
+                    float sign = side == 1 ? 1.0f : -1.0f;
+                    if (axis == 0) {
+                        chart.corner = glm::vec3(origin_x_ + line, 0.0f, origin_z_ + cell);
+                        chart.u = glm::vec3(0, 0, 1);
+                        chart.normal = glm::vec3(sign, 0, 0);
+                    } else {
+                        chart.corner = glm::vec3(origin_x_ + cell, 0.0f, origin_z_ + line);
+                        chart.u = glm::vec3(1, 0, 0);
+                        chart.normal = glm::vec3(0, 0, sign);
+                    }
+                    chart.v = glm::vec3(0, 1, 0);
+                    chart.floor = false;
+                    charts_.push_back(chart);
+
+                    for (int c = cell; c < end; c++) {
+                        int slot = axis == 0 ? Lightmap::x_face_slot(w_, h_, line, c, side)
+                                             : Lightmap::z_face_slot(w_, h_, line, c, side);
+                        out.faces[slot * 2] = (uint16_t)(chart.x + (c - cell) * T);
+                        out.faces[slot * 2 + 1] = (uint16_t)chart.y;
+                    }
+                    cell = end;
+                }
+            }
+        }
+    }
+    return shelf_y + (shelf_x > 0 ? T + 2 : 0);
+}
+
+void LightmapBaker::bake(const vector<char> &grid, int w, int h, const glm::vec3 &sun_dir,
+                         lightmap_data_t &out, int num_threads) {
+    if (num_threads <= 0) {
+        num_threads = (int)thread::hardware_concurrency();
+        if (num_threads <= 0) {
+            num_threads = 1;
+        }
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    set_level(grid, w, h, sun_dir);
+
+    out.w = w;
+    out.h = h;
+    out.texels_per_unit = kTexelsPerUnit;
+    out.grid_hash = Pvs::hash_grid(grid, w, h);
+    out.sun_dir = sun_dir_;
+    out.atlas_h = build_charts(out);
+    out.texels.assign((size_t)out.atlas_w * out.atlas_h * 4, 0);
+    vector<unsigned char> valid((size_t)out.atlas_w * out.atlas_h, 0);
+
+    // one work item per chart row
+    vector<pair<int, int>> rows;
+    for (size_t c = 0; c < charts_.size(); c++) {
+        for (int row = 0; row < charts_[c].height; row++) {
+            rows.push_back(make_pair((int)c, row));
+        }
+    }
+    atomic<int> next_row(0);
+    auto worker = [&]() {
+        PROFILE_ZONE("lightmap bake rows");
+        while (true) {
+            int item = next_row++;
+            if (item >= (int)rows.size()) {
+                break;
+            }
+            bake_row(charts_[rows[item].first], rows[item].second, out, valid);
+        }
+    };
+
+    vector<thread> workers;
+    for (int i = 1; i < num_threads; i++) {
+        workers.push_back(thread(worker));
+    }
+    worker(); // this thread helps out too
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+
+    // grow every chart into its gutter (and the floor under the walls) so
+    // the bilinear taps at the edges never pick up black
+    const int kDilate = kTexelsPerUnit / 2;
+    for (int pass = 0; pass < kDilate; pass++) {
+        vector<unsigned char> grown = valid;
+        for (int y = 0; y < out.atlas_h; y++) {
+            for (int x = 0; x < out.atlas_w; x++) {
+                size_t idx = (size_t)y * out.atlas_w + x;
+                if (valid[idx]) {
+                    continue;
+                }
+                int sum = 0, sum_sun = 0, n = 0;
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        int nx = x + dx, ny = y + dy;
+                        if (nx < 0 || ny < 0 || nx >= out.atlas_w || ny >= out.atlas_h) {
+                            continue;
+                        }
+                        size_t nidx = (size_t)ny * out.atlas_w + nx;
+                        if (valid[nidx]) {
+                            sum += out.texels[nidx * 4];
+                            sum_sun += out.texels[nidx * 4 + 3];
+                            n++;
+                        }
+                    }
+                }
+                if (n > 0) {
+                    unsigned char v = (unsigned char)(sum / n);
+                    out.texels[idx * 4 + 0] = out.texels[idx * 4 + 1] = v;
+                    out.texels[idx * 4 + 2] = v;
+                    out.texels[idx * 4 + 3] = (unsigned char)(sum_sun / n);
+                    grown[idx] = 1;
+                }
+            }
+        }
+        valid.swap(grown);
+    }
+
+    float secs = chrono::duration<float>(chrono::steady_clock::now() - start).count();
+    printf("baked lightmap for %dx%d map in %.2fs on %d threads (%d charts, %dx%d atlas, "
+           "%d wall boxes)\n",
+           w, h, secs, num_threads, (int)charts_.size(), out.atlas_w, out.atlas_h,
+           (int)boxes_.size());
+}
+
+void LightmapBaker::bake_probe(const glm::vec3 &pos, uint32_t seed, float *coeffs) const {
+    // spherical fibonacci directions, turned a bit per probe, projected onto
+    // the 9 real sh basis functions. a uniform sphere estimate of the
+    // radiance coefficients is 4 pi / N * sum(L * Y), gather() returns pi * L
+    float sh[9][3] = {};
+    float rotate = 6.2831853f * to_unit(hash_u32(seed));
+    for (int k = 0; k < kProbeRays; k += 4) {
+        ray4_t rays;
+        glm::vec3 dirs[4];
+        for (int lane = 0; lane < 4; lane++) {
+            int n = k + lane;
+            float y = 1.0f - (2.0f * n + 1.0f) / kProbeRays;
+            float r = sqrtf(max(0.0f, 1.0f - y * y));
+            float phi = n * 2.3999632f + rotate;
+            dirs[lane] = glm::vec3(r * cosf(phi), y, r * sinf(phi));
+            rays.ox[lane] = pos.x;
+            rays.oy[lane] = pos.y;
+            rays.oz[lane] = pos.z;
+            rays.dx[lane] = dirs[lane].x;
+            rays.dy[lane] = dirs[lane].y;
+            rays.dz[lane] = dirs[lane].z;
+            rays.tmax[lane] = kNoHit;
+        }
+        float radiance[4];
+        gather(rays, radiance);
+        for (int lane = 0; lane < 4; lane++) {
+            const glm::vec3 &d = dirs[lane];
+            float basis[9];
+            sh_basis(d.x, d.y, d.z, basis);
+            for (int c = 0; c < 9; c++) {
+                // gray light, the same in every channel
+                for (int ch = 0; ch < 3; ch++) {
+                    sh[c][ch] += radiance[lane] * basis[c];
+                }
+            }
+        }
+    }
+    // convolve with the clamped cosine (pi, 2 pi / 3, pi / 4 per band) so the
+    // shader only has to evaluate the sum for its normal
+    for (int c = 0; c < 9; c++) {
+        for (int ch = 0; ch < 3; ch++) {
+            coeffs[c * 3 + ch] = sh[c][ch] * 4.0f / kProbeRays * kShCosineLobe[c];
+        }
+    }
+}
+
+void LightmapBaker::bake_probes(const vector<char> &grid, int w, int h,
+                                const glm::vec3 &sun_dir, probe_grid_data_t &out,
+                                int num_threads) {
+    if (num_threads <= 0) {
+        num_threads = (int)thread::hardware_concurrency();
+        if (num_threads <= 0) {
+            num_threads = 1;
+        }
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    set_level(grid, w, h, sun_dir);
+
+    const int kLayers = ProbeGrid::kLayers, kCoeffs = ProbeGrid::kCoeffs;
+    int num_probes = w * h * kLayers;
+    vector<float> coeffs((size_t)num_probes * kCoeffs, 0.0f);
+    vector<unsigned char> valid(num_probes, 0);
+
+    atomic<int> next_probe(0);
+    auto worker = [&]() {
+        PROFILE_ZONE("probe bake");
+        while (true) {
+            int probe = next_probe++;
+            if (probe >= num_probes) {
+                break;
+            }
+            int x = probe % w, layer = (probe / w) % kLayers, z = probe / (w * kLayers);
+            if (is_wall(x, z)) {
+                continue; // inside the wall, filled in below
+            }
+            glm::vec3 pos(origin_x_ + x + 0.5f, (layer + 0.5f) * ProbeGrid::kLayerHeight,
+                          origin_z_ + z + 0.5f);
+            bake_probe(pos, (uint32_t)probe, &coeffs[(size_t)probe * kCoeffs]);
+            valid[probe] = 1;
+        }
+    };
+
+    vector<thread> workers;
+    for (int i = 1; i < num_threads; i++) {
+        workers.push_back(thread(worker));
+    }
+    worker(); // this thread helps out too
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+
+    // probes in wall cells take the average of their open neighbours, so
+    // interpolating towards a wall doesn't fade to black
+    bool missing = true;
+    for (int pass = 0; pass < w + h && missing; pass++) {
+        missing = false;
+        vector<unsigned char> grown = valid;
+        for (int probe = 0; probe < num_probes; probe++) {
+            if (valid[probe]) {
+                continue;
+            }
+            int x = probe % w, z = probe / (w * kLayers);
+            static const int kSteps[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+            int n = 0;
+            float *dst = &coeffs[(size_t)probe * kCoeffs];
+            for (int s = 0; s < 4; s++) {
+                int nx = x + kSteps[s][0], nz = z + kSteps[s][1];
+                if (nx < 0 || nx >= w || nz < 0 || nz >= h) {
+                    continue;
+                }
+                int neighbour = probe + kSteps[s][0] + kSteps[s][1] * w * kLayers;
+                if (!valid[neighbour]) {
+                    continue;
+                }
+                const float *src = &coeffs[(size_t)neighbour * kCoeffs];
+                for (int c = 0; c < kCoeffs; c++) {
+                    dst[c] += src[c];
+                }
+                n++;
+            }
+            if (n > 0) {
+                for (int c = 0; c < kCoeffs; c++) {
+                    dst[c] /= n;
+                }
+                grown[probe] = 1;
+            } else {
+                missing = true;
+            }
+        }
+        valid.swap(grown);
+    }
+
+    out.w = w;
+    out.h = h;
+    out.grid_hash = Pvs::hash_grid(grid, w, h);
+    out.sun_dir = sun_dir_;
+    out.coeffs.resize(coeffs.size());
+    for (size_t i = 0; i < coeffs.size(); i++) {
+        out.coeffs[i] = glm::packHalf1x16(coeffs[i]);
+    }
+
+    float secs = chrono::duration<float>(chrono::steady_clock::now() - start).count();
+    printf("baked %d irradiance probes for %dx%d map in %.2fs on %d threads (%d KB)\n",
+           num_probes, w, h, secs, num_threads, (int)(out.coeffs.size() * 2 / 1024));
+}
@@ -0,0 +1,114 @@
+#ifndef LIGHTMAP_BAKER_H
+#define LIGHTMAP_BAKER_H
+
+#include "glm/glm.hpp"
+#include "lightmap.h"
+#include "probe_grid.h"
+
+#include <vector>
+
+using namespace std;
+
+// offline lightmap bake for grid mazes, run with --bake-lightmap.
+// every visible wall face and the floor get a chart in the atlas (wall faces
+// along the same grid line are merged into one strip, so bilinear filtering
+// runs across them without seams). for every texel it ray traces
+//   direct sun   kSunRays jittered shadow rays, walls only like ShadowMaps
+//   sky          cosine weighted hemisphere rays that escape the maze, the
+//                ambient term of fragment.fs scaled by how much sky is seen
+//   one bounce   hemisphere rays that hit a surface pick up kAlbedo times the
+//                sun and ambient light at the hit point
+// the walls are axis aligned boxes in a bvh, traced 4 rays at a time with
+// sse, the rows of all charts are spread over every core. bake_probes()
+// traces the irradiance probes (ProbeGrid) for the same level and sun with
+// the same light model, minus the direct sun
+class LightmapBaker {
+public:
+  static const int kTexelsPerUnit = 16;
+  static const int kSunRays = 4;         // multiples of 4, one packet each
+  static const int kHemisphereRays = 32;
+  static constexpr float kAmbient = 0.3f; // same as fragment.fs
+  static constexpr float kAlbedo = 0.45f; // average of the wall and floor textures
+  static const int kProbeRays = 256;      // all directions, multiple of 4
+
+  LightmapBaker() = default;
+  ~LightmapBaker() = default;
+
+  // sun_dir is the direction the sunlight travels. num_threads = 0 uses
+  // every core
+  void bake(const vector<char> &grid, int w, int h, const glm::vec3 &sun_dir,
+            lightmap_data_t &out, int num_threads = 0);
+  void bake_probes(const vector<char> &grid, int w, int h, const glm::vec3 &sun_dir,
+                   probe_grid_data_t &out, int num_threads = 0);
+
+  // 4 rays, structure of arrays. hit is the box index, kHitFloor or -1
+  typedef struct ray4_t {
+    alignas(16) float ox[4];
+    alignas(16) float oy[4];
+    alignas(16) float oz[4];
+    alignas(16) float dx[4];
+    alignas(16) float dy[4];
+    alignas(16) float dz[4];
+    alignas(16) float tmax[4];
+    int hit[4];
+  } ray4_t;
+  static const int kHitFloor = -2;
+
+private:
+  typedef struct box_t {
+    float min[3], max[3];
+  } box_t;
+  // leaf if count > 0 (boxes first .. first + count), otherwise the children
+  // are nodes first and first + 1
+  typedef struct bvh_node_t {
+    float min[3], max[3];
+    int first, count;
+  } bvh_node_t;
+  // a rectangle in the atlas and where it sits in the world. texel (i, j)
+  // of the inside covers corner + u * i / T .. corner + u * (i + 1) / T,
+  // same for v
+  typedef struct chart_t {
+    int x, y;          // atlas texel of the inside, the gutter is around it
+    int width, height; // inside, in texels
+    glm::vec3 corner, u, v, normal;
+    bool floor;
+  } chart_t;
+
+  vector<char> grid_;
+  int w_ = 0, h_ = 0;
+  float origin_x_ = 0.0f, origin_z_ = 0.0f; // world x, z of the grid corner
+  glm::vec3 sun_dir_;
+  vector<box_t> boxes_;
+  vector<bvh_node_t> nodes_;
+  vector<chart_t> charts_;
+
+  bool is_wall(int x, int z) const {
+    return x >= 0 && x < w_ && z >= 0 && z < h_ && grid_[z * w_ + x] == 'W';
+  }
+  bool is_open(int x, int z) const {
+    return x >= 0 && x < w_ && z >= 0 && z < h_ && grid_[z * w_ + x] != 'W';
+  }
+
+  void set_level(const vector<char> &grid, int w, int h, const glm::vec3 &sun_dir);
+  void build_boxes();
+  void build_node(int index, int first, int count);
+  // charts and the face slot table, returns the atlas height
+  int build_charts(lightmap_data_t &out);
+
+  // closest hit for the lanes in mask, or any hit (shadow rays). with floor
+  // off only the walls are tested
+  void trace(ray4_t &rays, int mask, bool any_hit, bool floor) const;
+  // 1 for the lanes of mask whose point sees the sun, 0 otherwise
+  void sun_visibility(const glm::vec3 *points, int mask, float *visible) const;
+  // irradiance, sun is the fraction of the sun rays that got through
+  float bake_texel(const chart_t &chart, int i, int j, float &sun) const;
+  void bake_row(const chart_t &chart, int row, lightmap_data_t &out,
+                vector<unsigned char> &valid) const;
+  // sky and bounce light around pos as irradiance sh, rgb per coefficient
+  void bake_probe(const glm::vec3 &pos, uint32_t seed, float *coeffs) const;
+  // light coming back from the first surface along each of the 4 rays
+  // (sky for the misses), radiance times pi
+  void gather(ray4_t &rays, float *radiance) const;
+};
+
+#endif // LIGHTMAP_BAKER_H
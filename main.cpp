@@ -1,5 +1,7 @@
 
 #include "glad/glad.h" //Include order can matter here
+// make HEADLESS=1 builds without sdl, only --headless and --null-device run
+#ifndef NO_SDL
 #if defined(__APPLE__) || defined(__linux__)
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_opengl.h>
@@ -7,10 +9,15 @@
 #include <SDL.h>
 #include <SDL_opengl.h>
 #endif
+#endif
 
 #define GLM_FORCE_RADIANS
 #define GLM_ENABLE_EXPERIMENTAL
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 
 #include "glm/glm.hpp"
@@ -18,12 +25,21 @@
 #include "glm/gtc/type_ptr.hpp"
 
 // #include "models.h"
+#include "dynamic_resolution.h"
+#include "frame_ring.h"
 #include "game_map.h"
 #include "game_types.h"
+#include "gl_state.h"
+#include "headless.h"
+#include "profiler.h"
+#include "render_device.h"
+#include "render_graph.h"
 #include "shader.h"
 
 #define STB_IMAGE_IMPLEMENTATION // only place once in one .cpp file
 #include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
 
 using namespace std;
 
@@ -34,6 +50,7 @@ bool save_output = true;
 bool DEBUG_ON = false;
 
 bool fullscreen = false;
+bool print_gl_stats = false; // issued / elided gl state calls every frame
 
 float current_time = 0.0f;
 float last_time = 0.0f;
@@ -108,6 +125,7 @@ glm::vec3 get_camera_pos(camera_t &cam, float dis) {
 // both load_texture() and load_cubemap() were adapted from:
 // https://github.com/JoeyDeVries/LearnOpenGL/blob/master/src/4.advanced_opengl/6.1.cubemaps_skybox/cubemaps_skybox.cpp
 GLuint load_texture(const char *fname) {
+  PROFILE_ZONE("texture decode");
   GLuint texID;
   glGenTextures(1, &texID);
 
@@ -122,7 +140,7 @@ GLuint load_texture(const char *fname) {
     else if (nrComponents == 4)
       format = GL_RGBA;
 
-    glBindTexture(GL_TEXTURE_2D, texID);
+    gl_state().bind_texture(0, GL_TEXTURE_2D, texID);
     glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
                  GL_UNSIGNED_BYTE, data);
     glGenerateMipmap(GL_TEXTURE_2D);
@@ -150,46 +168,192 @@ void drawEnviornmentMap(Shader shader, int skyboxModelStart,
   int shaderProg = shader.getShader();
 
   // draw skybox
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTex);
+  gl_state().bind_texture(0, GL_TEXTURE_CUBE_MAP, cubemapTex);
   glDrawArrays(GL_TRIANGLES, skyboxModelStart, skyboxModelNumVerts);
 }
 
 int main(int argc, char *argv[]) {
-  // sdl initiailzation
-  SDL_Init(SDL_INIT_VIDEO);
-  // Print the version of SDL we are using (should be 3.x or higher)
-  const int sdl_linked = SDL_GetVersion();
-  printf("\nCompiled against SDL version %d.%d.%d ...\n",
-         SDL_VERSIONNUM_MAJOR(SDL_VERSION), SDL_VERSIONNUM_MINOR(SDL_VERSION),
-         SDL_VERSIONNUM_MICRO(SDL_VERSION));
-  printf("Linking against SDL version %d.%d.%d.\n",
-         SDL_VERSIONNUM_MAJOR(sdl_linked), SDL_VERSIONNUM_MINOR(sdl_linked),
-         SDL_VERSIONNUM_MICRO(sdl_linked));
-
-  // Ask SDL to get a recent version of OpenGL (3.2 or greater)
-  SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
-  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
-  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 2);
-
-  // Create a window (title, width, height, flags)
-  SDL_Window *window = SDL_CreateWindow("My OpenGL Program", screenWidth,
-                                        screenHeight, SDL_WINDOW_OPENGL);
-  if (!window) {
-    printf("SDL_CreateWindow Error: %s\n", SDL_GetError());
-    SDL_Quit();
-    return 1;
+  // usage: shooter [--bake-pvs] [--bake-lightmap] [--mdi] [--prepass]
+  //                [--shadows] [--dynres] [--dynres-target ms]
+  //                [--dynres-min scale] [--dynres-max scale] [--profile]
+  //                [--list-threads n] [--headless] [--size wxh] [--frames n]
+  //                [--occlusion-queries off|no-wait|wait|by-region]
+  //                [--impostors] [--impostor-pixels px] [--null-device]
+  //                [scene file]
+  const char *scene_file = "scenes/map1.txt";
+  bool bake_only = false;
+  bool bake_lightmap = false;
+  bool use_mdi = false;
+  bool use_prepass = false;
+  bool use_shadows = false;
+  bool use_dynres = false;
+  bool use_profile = false;
+  int list_threads = 0; // one per core
+  occlusion_query_mode_t query_mode = QUERIES_OFF;
+  bool use_impostors = false;
+  float impostor_pixels = Impostors::kDefaultSwitchPixels;
+  // --headless renders --frames frames offscreen, the camera turning once
+  // around on the spot, and prints frame time statistics
+  bool headless = false;
+  int headless_frames = 300;
+  // --null-device is --headless on RenderDevice's null backend: every gl
+  // call is checked and counted but nothing runs, so the frame times are
+  // the engine's cpu cost alone
+  bool null_device = false;
+  float dynres_target_ms = 1000.0f / 60.0f;
+  float dynres_min = 0.5f, dynres_max = 1.0f;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--bake-pvs") == 0) {
+      bake_only = true;
+    } else if (strcmp(argv[i], "--bake-lightmap") == 0) {
+      bake_only = bake_lightmap = true;
+    } else if (strcmp(argv[i], "--mdi") == 0) {
+      use_mdi = true;
+    } else if (strcmp(argv[i], "--prepass") == 0) {
+      use_prepass = true;
+    } else if (strcmp(argv[i], "--shadows") == 0) {
+      use_shadows = true;
+    } else if (strcmp(argv[i], "--profile") == 0) {
+      use_profile = true;
+    } else if (strcmp(argv[i], "--headless") == 0) {
+      headless = true;
+    } else if (strcmp(argv[i], "--null-device") == 0) {
+      headless = null_device = true;
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      headless_frames = max(atoi(argv[++i]), 1);
+    } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+      if (sscanf(argv[++i], "%dx%d", &screenWidth, &screenHeight) != 2 || screenWidth <= 0 ||
+          screenHeight <= 0) {
+        printf("bad --size %s, want e.g. 1280x720\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--list-threads") == 0 && i + 1 < argc) {
+      list_threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--occlusion-queries") == 0 && i + 1 < argc) {
+      const char *mode = argv[++i];
+      if (strcmp(mode, "no-wait") == 0) {
+        query_mode = QUERIES_NO_WAIT;
+      } else if (strcmp(mode, "wait") == 0) {
+        query_mode = QUERIES_WAIT;
+      } else if (strcmp(mode, "by-region") == 0) {
+        query_mode = QUERIES_BY_REGION;
+      } else {
+        query_mode = QUERIES_OFF;
+      }
+    } else if (strcmp(argv[i], "--impostors") == 0) {
+      use_impostors = true;
+    } else if (strcmp(argv[i], "--impostor-pixels") == 0 && i + 1 < argc) {
+      impostor_pixels = (float)atof(argv[++i]);
+    } else if (strcmp(argv[i], "--dynres") == 0) {
+      use_dynres = true;
+    } else if (strcmp(argv[i], "--dynres-target") == 0 && i + 1 < argc) {
+      dynres_target_ms = (float)atof(argv[++i]);
+    } else if (strcmp(argv[i], "--dynres-min") == 0 && i + 1 < argc) {
+      dynres_min = (float)atof(argv[++i]);
+    } else if (strcmp(argv[i], "--dynres-max") == 0 && i + 1 < argc) {
+      dynres_max = (float)atof(argv[++i]);
+    } else {
+      scene_file = argv[i];
+    }
   }
 
-  // Create a context to draw in
-  SDL_GLContext context = SDL_GL_CreateContext(window);
+  // --profile captures from here on, startup included. P stops it and writes
+  // out/trace_<n>.json, the next P starts a new one
+  profiler().set_thread_name("main");
+  if (use_profile) {
+    profiler().start();
+  }
+  int trace_counter = 0;
+  char trace_fname[64];
+
+  if (bake_only) {
+    // offline pass, loading the map (re)bakes <scene>.pvs if it is stale
+    // --bake-lightmap also traces <scene>.lm and <scene>.probes for the
+    // default sun
+    GameMap baker;
+    baker.init_map(scene_file);
+    if (bake_lightmap) {
+      baker.bake_lightmap(scene_file);
+    }
+    if (profiler().capturing()) {
+      profiler().write_trace("out/trace_bake.json");
+    }
+    return 0;
+  }
+
+  ProfileZone startup_zone("startup");
+  ProfileZone sdl_zone("sdl init");
+#ifndef NO_SDL
+  SDL_Window *window = nullptr;
+  SDL_GLContext context = nullptr;
+#endif
+  HeadlessContext headless_context;
+  if (null_device) {
+    // no context of any kind, the null backend stands in for the driver
+    if (!render_device().load_null()) {
+      return 1;
+    }
+  } else if (headless) {
+    // no sdl at all, an EGL context and an offscreen framebuffer
+    if (!headless_context.create(screenWidth, screenHeight)) {
+      return 1;
+    }
+  } else {
+#ifdef NO_SDL
+    printf("built without sdl, only --headless and --null-device can run\n");
+    return 1;
+#else
+    // sdl initiailzation
+    SDL_Init(SDL_INIT_VIDEO);
+    // Print the version of SDL we are using (should be 3.x or higher)
+    const int sdl_linked = SDL_GetVersion();
+    printf("\nCompiled against SDL version %d.%d.%d ...\n",
+           SDL_VERSIONNUM_MAJOR(SDL_VERSION), SDL_VERSIONNUM_MINOR(SDL_VERSION),
+           SDL_VERSIONNUM_MICRO(SDL_VERSION));
+    printf("Linking against SDL version %d.%d.%d.\n",
+           SDL_VERSIONNUM_MAJOR(sdl_linked), SDL_VERSIONNUM_MINOR(sdl_linked),
+           SDL_VERSIONNUM_MICRO(sdl_linked));
+
+    // Ask SDL to get a recent version of OpenGL (3.2 or greater). we try 4.3
+    // first for the multi draw indirect path and settle for 3.2 otherwise
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+    // stencil is only used to count overdraw
+    SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 8);
+
+    // Create a window (title, width, height, flags)
+    window = SDL_CreateWindow("My OpenGL Program", screenWidth,
+                              screenHeight, SDL_WINDOW_OPENGL);
+    if (!window) {
+      printf("SDL_CreateWindow Error: %s\n", SDL_GetError());
+      SDL_Quit();
+      return 1;
+    }
+
+    // Create a context to draw in
+    context = SDL_GL_CreateContext(window);
+    if (!context) {
+      SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+      SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 2);
+      context = SDL_GL_CreateContext(window);
+    }
+    if (!context) {
+      printf("SDL_GL_CreateContext Error: %s\n", SDL_GetError());
+      SDL_Quit();
+      return 1;
+    }
 
-  // Load OpenGL extentions with GLAD
-  if (!gladLoadGLLoader((GLADloadproc)SDL_GL_GetProcAddress)) {
-    printf("ERROR: Failed to initialize OpenGL context.\n");
-    return -1;
+    // Load OpenGL extentions with GLAD
+    if (!render_device().load_gl((GLADloadproc)SDL_GL_GetProcAddress)) {
+      printf("ERROR: Failed to initialize OpenGL context.\n");
+      return -1;
+    }
+#endif
   }
 
+  sdl_zone.end();
+
   // information about OpenGL
   printf("\nOpenGL loaded\n");
   printf("Vendor:   %s\n", glGetString(GL_VENDOR));
@@ -197,8 +361,15 @@ int main(int argc, char *argv[]) {
   printf("Version:  %s\n\n", glGetString(GL_VERSION));
 
   //   /// load shaders
-  Shader skyboxShader("shaders/skybox.vs", "shaders/skybox.fs");
-  Shader shader("shaders/vertex.vs", "shaders/fragment.fs");
+  // every program is handed to the driver here and compiles while the map
+  // and the textures load below, nothing waits for one until it is used
+  chrono::steady_clock::time_point compile_start = chrono::steady_clock::now();
+  Shader::enableParallelCompile();
+  Shader skyboxShader;
+  skyboxShader.startCompile("shaders/skybox.vs", "shaders/skybox.fs");
+  // world shaders, one program per material feature set
+  ShaderVariants world_shaders("shaders/vertex.vs", "shaders/fragment.fs");
+  world_shaders.startAll();
 
   //   load skybox texture
   vector<string> faces_fnames{
@@ -218,7 +389,10 @@ int main(int argc, char *argv[]) {
 
   // load game map
   GameMap *game_map = new GameMap();
-  game_map->init_map("scenes/map1.txt");
+  if (use_mdi) {
+    game_map->set_draw_backend(BACKEND_INDIRECT); // starts its programs too
+  }
+  game_map->init_map(scene_file);
   GLuint floorTex_ = load_texture("textures/brick.bmp");
 
   game_map->set_cube_map_texture(faces_fnames);
@@ -228,17 +402,55 @@ int main(int argc, char *argv[]) {
 
   GLuint vao;
   glGenVertexArrays(1, &vao); // Create a VAO
-  glBindVertexArray(vao); // Bind the above created VAO to the current context
+  gl_state().bind_vertex_array(vao); // Bind the above created VAO to the current context
   GLuint vbo[1];
   glGenBuffers(1, vbo); // Create 1 buffer called vbo
-  glBindBuffer(GL_ARRAY_BUFFER,
+  gl_state().bind_buffer(GL_ARRAY_BUFFER,
                vbo[0]); // Set the vbo as the active array buffer (Only one
                         // buffer can be active at a time)
   glBufferData(GL_ARRAY_BUFFER, total_verts * 8 * sizeof(float), modelData,
                GL_STATIC_DRAW); // upload vertices to vbo
 
-  shader.initShaderAttribs8Verts();
-  glBindVertexArray(0);
+  // attribute slots are the same in every variant
+  Shader::initShaderAttribs8Verts();
+  gl_state().bind_vertex_array(0);
+  game_map->set_vertex_array(vao);
+
+  // positions split out of the 8 float layout for the depth pre-pass, a third
+  // of the bytes per vertex
+  float *positionData = new float[total_verts * 3];
+  for (int i = 0; i < total_verts; i++) {
+    positionData[i * 3 + 0] = modelData[i * 8 + 0];
+    positionData[i * 3 + 1] = modelData[i * 8 + 1];
+    positionData[i * 3 + 2] = modelData[i * 8 + 2];
+  }
+  GLuint depthVao, depthVbo;
+  glGenVertexArrays(1, &depthVao);
+  gl_state().bind_vertex_array(depthVao);
+  glGenBuffers(1, &depthVbo);
+  gl_state().bind_buffer(GL_ARRAY_BUFFER, depthVbo);
+  glBufferData(GL_ARRAY_BUFFER, total_verts * 3 * sizeof(float), positionData,
+               GL_STATIC_DRAW);
+  glVertexAttribPointer(ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float),
+                        (void *)0);
+  glEnableVertexAttribArray(ATTRIB_POSITION);
+  gl_state().bind_vertex_array(0);
+  delete[] positionData;
+  game_map->set_depth_vertex_array(depthVao);
+  if (use_prepass) {
+    game_map->set_depth_prepass(true);
+  }
+  if (use_shadows) {
+    game_map->set_shadows(true);
+  }
+  if (query_mode != QUERIES_OFF) {
+    game_map->set_occlusion_queries(query_mode);
+  }
+  game_map->set_impostor_pixels(impostor_pixels);
+  if (use_impostors) {
+    game_map->set_impostors(true);
+  }
+  game_map->set_list_threads(list_threads);
 
 //   GLuint floorVao_ = game_map->load_floor_model();
 
@@ -264,13 +476,14 @@ int main(int argc, char *argv[]) {
 
   GLuint skyboxVAO, skyboxVBO;
   glGenVertexArrays(1, &skyboxVAO);
-  glBindVertexArray(skyboxVAO);
+  gl_state().bind_vertex_array(skyboxVAO);
   glGenBuffers(1, &skyboxVBO);
-  glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
+  gl_state().bind_buffer(GL_ARRAY_BUFFER, skyboxVBO);
   glBufferData(GL_ARRAY_BUFFER, skyVerts * 3 * sizeof(float), skyData,
                GL_STATIC_DRAW);
+  skyboxShader.finishCompile();
   skyboxShader.initShaderAttribs3Verts();
-  glBindVertexArray(0);
+  gl_state().bind_vertex_array(0);
 
   // initialize camera
   camera_t global_cam =
@@ -282,20 +495,61 @@ int main(int argc, char *argv[]) {
   GLint skyboxViewLoc = glGetUniformLocation(skyboxShader.getShader(), "view");
   GLint skyboxProjLoc = glGetUniformLocation(skyboxShader.getShader(), "proj");
 
-  glEnable(GL_DEPTH_TEST);
+  gl_state().enable(GL_DEPTH_TEST);
+
+  // world pass at a scale that holds the gpu budget, off unless asked for
+  DynamicResolution dynres;
+  dynres.set_target_ms(dynres_target_ms);
+  dynres.set_bounds(dynres_min, dynres_max);
+  if (use_dynres && dynres.init(screenWidth, screenHeight)) {
+    dynres.set_enabled(true);
+  }
+  // rebuilt every frame, keeps its pool of targets
+  RenderGraph graph;
+
+  // whatever is still compiling gets waited for on its first draw
+  printf("startup took %lld ms, %d world programs still compiling\n",
+         (long long)chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() -
+                                                                 compile_start)
+             .count(),
+         world_shaders.numPending());
+  startup_zone.end();
 
   bool quit = false;
   bool pick_up = false;
 
   float move, turn_angle, speed = 1.3f;
 
+  if (headless) {
+    save_output = false; // just the last frame, after the loop
+  }
+  vector<float> frame_ms;
+  int frames_drawn = 0;
+  // frames left out of the benchmark summaries, shader compiles and first
+  // uploads land in them
+  int warmup_frames = min(10, headless_frames / 10);
+  if (null_device) {
+    render_device().reset_totals(); // drops the uploads done while loading
+  }
+  // the game clock, current_time counts from here
+  chrono::steady_clock::time_point clock_start = chrono::steady_clock::now();
+
+#ifndef NO_SDL
   SDL_Event event;
+#endif
   while (!quit) {
+    PROFILE_ZONE("frame");
+    chrono::steady_clock::time_point frame_start = chrono::steady_clock::now();
+    ProfileZone input_zone("input");
 
     move = 0.0f;
     turn_angle = 0.0f;
+    if (headless) {
+      turn_angle = glm::radians(360.0f) / headless_frames;
+    }
 
-    while (SDL_PollEvent(&event)) {
+#ifndef NO_SDL
+    while (!headless && SDL_PollEvent(&event)) {
       // handle user input
 
       if (event.type == SDL_EVENT_QUIT) {
@@ -324,6 +578,92 @@ int main(int argc, char *argv[]) {
          if (event.key.key == SDLK_3) {
           game_map->set_cube_map_texture(faces_fnames);
         }
+
+        if (event.key.key == SDLK_P) {
+          if (profiler().capturing()) {
+            snprintf(trace_fname, sizeof(trace_fname), "out/trace_%04d.json",
+                     trace_counter++);
+            profiler().write_trace(trace_fname);
+          } else {
+            profiler().start();
+          }
+        }
+
+        if (event.key.key == SDLK_I) {
+          print_gl_stats = !print_gl_stats;
+        }
+
+        if (event.key.key == SDLK_C) {
+          game_map->set_occlusion_culling(!game_map->get_occlusion_culling());
+        }
+
+        if (event.key.key == SDLK_Z) {
+          game_map->set_depth_prepass(!game_map->get_depth_prepass());
+        }
+
+        if (event.key.key == SDLK_B) {
+          game_map->set_backface_culling(!game_map->get_backface_culling());
+        }
+
+        if (event.key.key == SDLK_V) {
+          game_map->set_overdraw_stats(!game_map->get_overdraw_stats());
+        }
+
+        if (event.key.key == SDLK_H) {
+          game_map->set_shadows(!game_map->get_shadows());
+        }
+
+        if (event.key.key == SDLK_K) {
+          // cycles the sun, every change rebuilds the static shadow map once
+          static const glm::vec3 suns[4] = {
+              glm::vec3(-1, 1, -1), glm::vec3(0.6f, -1, 0.4f),
+              glm::vec3(-0.5f, -1, -0.8f), glm::vec3(1, -0.4f, -0.2f)};
+          static int sun = 0;
+          sun = (sun + 1) % 4;
+          game_map->set_sun_direction(suns[sun]);
+        }
+
+        if (event.key.key == SDLK_SPACE) {
+          // muzzle flash, a bright point light just in front of the camera
+          game_map->add_flash(global_cam.pos + global_cam.fwd_dir * 0.3f,
+                              glm::vec3(2.0f, 1.6f, 1.0f), 4.0f, 0.15f);
+        }
+
+        if (event.key.key == SDLK_R) {
+          if (!dynres.enabled()) {
+            dynres.init(screenWidth, screenHeight);
+          }
+          dynres.set_enabled(!dynres.enabled());
+        }
+
+        if (event.key.key == SDLK_Q) {
+          // off, no wait, wait, by region
+          game_map->set_occlusion_queries((occlusion_query_mode_t)(
+              (game_map->get_occlusion_queries() + 1) % NUM_QUERY_MODES));
+        }
+
+        if (event.key.key == SDLK_N) {
+          game_map->set_impostors(!game_map->get_impostors());
+        }
+
+        if (event.key.key == SDLK_L) {
+          game_map->set_lightmap(!game_map->get_lightmap());
+        }
+
+        if (event.key.key == SDLK_M) {
+          game_map->set_draw_backend(game_map->get_draw_backend() == BACKEND_DIRECT
+                                         ? BACKEND_INDIRECT
+                                         : BACKEND_DIRECT);
+        }
+
+        if (event.key.key == SDLK_O) {
+          // debug view of the software occlusion buffer
+          static int dump_counter = 0;
+          char dump_fname[64];
+          snprintf(dump_fname, sizeof(dump_fname), "out/occlusion_%04d.png",
+                   dump_counter++);
+          game_map->dump_occlusion_buffer(dump_fname);
+        }
       }
 
       if (event.type == SDL_EVENT_KEY_DOWN) {
@@ -357,6 +697,7 @@ int main(int argc, char *argv[]) {
         }
       }
     }
+#endif
 
     if (turn_angle) {
       turn_camera(global_cam, turn_angle);
@@ -383,58 +724,240 @@ int main(int argc, char *argv[]) {
     }
 
 
+    input_zone.end();
+
+    // camera is final for this frame, start culling while we set up. it
+    // needs no gl, so it also runs through the ring wait below
+    game_map->begin_frame(global_cam);
+
+    // per frame buffer data goes into the next third of the ring, waits if
+    // the gpu is still reading it from three frames ago
+    {
+      PROFILE_ZONE("ring wait");
+      frame_ring().begin_frame();
+    }
+
     // update_camera(global_cam);
     last_time = current_time;
-    current_time = SDL_GetTicks() / 1000.0f; // convert to seconds
+    // headless steps a fixed 60 Hz so runs animate the same
+    current_time =
+        headless ? frames_drawn / 60.0f
+                 : chrono::duration<float>(chrono::steady_clock::now() - clock_start).count();
     delta_time = current_time - last_time;
 
-    glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    shader.useShader();
-    shader.setTexNum("TexID", 0);
-
-    glBindTexture(GL_TEXTURE_2D, floorTex_);
     // game_map->draw_floor(shader, floorVao_);
    
+    // settles this frame's scale, with dynamic resolution the world only
+    // fills that part of the scene target
+    dynres.begin_frame();
+    int world_width = dynres.enabled() ? dynres.scaled_width() : screenWidth;
+    int world_height = dynres.enabled() ? dynres.scaled_height() : screenHeight;
+    game_map->prepare(world_shaders, global_cam, delta_time, world_width, world_height);
+
+    // the frame as passes, see RenderGraph. the world goes straight to the
+    // window, or with dynamic resolution to a scene target that gets upscaled
+    graph.reset();
+    rg_handle_t window_target = graph.import_target(
+        "window", gl_state().window_framebuffer(), screenWidth, screenHeight);
+    graph.mark_output(window_target);
+    rg_handle_t shadow_maps = graph.import_resource("shadow maps");
+    rg_handle_t scene_color = window_target, scene_depth = window_target;
+    if (dynres.enabled()) {
+      scene_color = graph.create_texture("scene color", screenWidth, screenHeight, RG_RGBA8);
+      scene_depth =
+          graph.create_texture("scene depth", screenWidth, screenHeight, RG_DEPTH24_STENCIL8);
+    }
 
-    glBindVertexArray(vao);
-    game_map->draw(shader, global_cam, delta_time);
-    glBindVertexArray(0);
-
-    // draw skybox as last
-    glDepthFunc(GL_LEQUAL);
+    // culled unless the world reads the maps
+    graph.add_pass("shadows", [&]() { game_map->draw_shadows(); })
+        .write(shadow_maps);
+
+    bool prepass = game_map->get_depth_prepass();
+    if (prepass) {
+      rg_state_t depth_only;
+      depth_only.color_write = false;
+      graph.add_pass("depth prepass", [&]() { game_map->draw_depth(); })
+          .color(scene_color, RG_LOAD_CLEAR)
+          .depth(scene_depth, RG_LOAD_CLEAR)
+          .clear_color(0.1f, 0.1f, 0.1f, 1.0f)
+          .viewport(world_width, world_height)
+          .state(depth_only);
+    }
 
-    skyboxShader.useShader();
-    skyboxShader.setTexNum("skybox", 0);
+    // after the pre-pass only the closest fragment passes, once
+    rg_state_t world_state;
+    if (prepass) {
+      world_state.depth_write = false;
+      world_state.depth_func = GL_EQUAL;
+    }
+    rg_load_t world_load = prepass ? RG_LOAD_KEEP : RG_LOAD_CLEAR;
+    RenderGraph::PassBuilder world_pass =
+        graph.add_pass("world", [&]() {
+          gl_state().bind_texture(0, GL_TEXTURE_2D, floorTex_);
+          game_map->draw_world();
+        })
+            .color(scene_color, world_load)
+            .depth(scene_depth, world_load)
+            .clear_color(0.1f, 0.1f, 0.1f, 1.0f)
+            .viewport(world_width, world_height)
+            .state(world_state);
+    if (game_map->get_shadows()) {
+      world_pass.read(shadow_maps);
+    }
 
-    glm::mat4 view = get_view_matrix(global_cam);
-    glm::mat4 proj = glm::perspective(global_cam.fov, global_cam.aspect_ratio,
-                                      global_cam.near, global_cam.far);
+    // far props as quads. they write their own depth, so after the world
+    // whatever its depth test was
+    if (game_map->get_impostors()) {
+      rg_state_t impostor_state;
+      impostor_state.cull = false;
+      RenderGraph::PassBuilder impostor_pass =
+          graph.add_pass("impostors", [&]() { game_map->draw_impostors(); })
+              .color(scene_color, RG_LOAD_KEEP)
+              .depth(scene_depth, RG_LOAD_KEEP)
+              .viewport(world_width, world_height)
+              .state(impostor_state);
+      if (game_map->get_shadows()) {
+        impostor_pass.read(shadow_maps);
+      }
+    }
 
-    // so that if the player moves, the skybox still looks all encompssing
-    skyboxShader.setUniformMat("view", glm::mat4(glm::mat3(view)));
-    skyboxShader.setUniformMat("proj", proj);
+    // boxes of the expensive objects against what the world left in the
+    // depth buffer, their draws next frame depend on the results
+    if (game_map->get_occlusion_queries() != QUERIES_OFF) {
+      rg_state_t box_state;
+      box_state.depth_write = false;
+      box_state.depth_func = GL_LEQUAL;
+      box_state.color_write = false;
+      box_state.cull = false;
+      graph.add_pass("occlusion queries", [&]() { game_map->draw_occlusion_queries(); })
+          .color(scene_color, RG_LOAD_KEEP)
+          .depth(scene_depth, RG_LOAD_KEEP)
+          .viewport(world_width, world_height)
+          .state(box_state)
+          .side_effect();
+    }
 
-    glBindVertexArray(skyboxVAO);
-    GLuint game_map_cubemap = game_map->get_cube_map_texture();
-    drawEnviornmentMap(skyboxShader, 0, skyVerts, game_map_cubemap);
-    glBindVertexArray(0);
-    glDepthFunc(GL_LESS); // set depth function back to default
+    // draw skybox as last, it is seen from the inside
+    rg_state_t sky_state;
+    sky_state.depth_write = false;
+    sky_state.depth_func = GL_LEQUAL;
+    sky_state.cull = false;
+    graph.add_pass("skybox", [&]() {
+      skyboxShader.useShader();
+      skyboxShader.setTexNum("skybox", 0);
+
+      glm::mat4 view = get_view_matrix(global_cam);
+      glm::mat4 proj = glm::perspective(global_cam.fov, global_cam.aspect_ratio,
+                                        global_cam.near, global_cam.far);
+
+      // so that if the player moves, the skybox still looks all encompssing
+      skyboxShader.setUniformMat("view", glm::mat4(glm::mat3(view)));
+      skyboxShader.setUniformMat("proj", proj);
+
+      gl_state().bind_vertex_array(skyboxVAO);
+      GLuint game_map_cubemap = game_map->get_cube_map_texture();
+      drawEnviornmentMap(skyboxShader, 0, skyVerts, game_map_cubemap);
+      gl_state().bind_vertex_array(0);
+    })
+        .color(scene_color, RG_LOAD_KEEP)
+        .depth(scene_depth, RG_LOAD_KEEP)
+        .viewport(world_width, world_height)
+        .state(sky_state);
+
+    // back to the window, anything drawn after this stays at native size
+    if (dynres.enabled()) {
+      rg_state_t no_depth;
+      no_depth.depth_test = false;
+      no_depth.depth_write = false;
+      graph.add_pass("upscale", [&]() { dynres.end_frame(graph.texture(scene_color)); })
+          .read(scene_color)
+          .color(window_target, RG_LOAD_DONT_CARE)
+          .state(no_depth);
+    }
 
     if (save_output) {
-      Win2PPM(screenWidth, screenHeight);
+      graph.add_pass("save frame", [&]() { Win2PPM(screenWidth, screenHeight); })
+          .color(window_target, RG_LOAD_KEEP)
+          .side_effect();
       // save_output = false;
     }
+    graph.execute();
+
+    gl_state().end_frame();
+    frame_ring().end_frame();
+    render_device().end_frame();
+    if (print_gl_stats) {
+      gl_state_stats_t stats = gl_state().stats();
+      printf("gl state calls: %d issued, %d elided, frame %.2f ms\n",
+             stats.issued, stats.elided, delta_time * 1000.0f);
+      game_map->print_light_stats();
+      if (game_map->get_occlusion_queries() != QUERIES_OFF) {
+        game_map->print_query_stats();
+      }
+      if (game_map->get_impostors()) {
+        game_map->print_impostor_stats();
+      }
+      printf("frame ring: %d KB this frame, waited %.2f ms\n",
+             (int)(frame_ring().frame_bytes() >> 10), frame_ring().wait_ms());
+      graph.print_stats();
+      if (dynres.enabled()) {
+        printf("dynamic resolution: scale %.2f, world pass %.2f ms\n", dynres.scale(),
+               dynres.gpu_ms());
+      }
+      render_device().print_stats();
+    }
 
-    SDL_GL_SwapWindow(window); // Double buffering
+    {
+      PROFILE_ZONE("swap");
+      if (headless) {
+        headless_context.present();
+      } else {
+#ifndef NO_SDL
+        SDL_GL_SwapWindow(window); // Double buffering
+#endif
+      }
+    }
+    profiler().end_frame();
+    frame_ms.push_back(
+        chrono::duration<float, milli>(chrono::steady_clock::now() - frame_start).count());
+    frames_drawn++;
+    if (null_device && frames_drawn == warmup_frames) {
+      render_device().reset_totals(); // same frames as the frame times
+    }
+    if (headless && frames_drawn >= headless_frames) {
+      quit = true;
+    }
+  }
+
+  if (headless) {
+    print_frame_times(frame_ms, warmup_frames);
+    if (null_device) {
+      render_device().print_stats(); // nothing was drawn, no frame to save
+    } else {
+      Win2PPM(screenWidth, screenHeight);
+    }
+  }
+
+  if (profiler().capturing()) {
+    snprintf(trace_fname, sizeof(trace_fname), "out/trace_%04d.json", trace_counter++);
+    profiler().write_trace(trace_fname);
   }
 
   // clean up
-  shader.cleanUpShader();
+  game_map->cleanup();
+  dynres.cleanup();
+  graph.cleanup();
+  frame_ring().cleanup();
+  world_shaders.cleanUpShaders();
   skyboxShader.cleanUpShader();
-  SDL_GL_DestroyContext(context);
-  SDL_Quit();
+  if (headless) {
+    headless_context.destroy();
+  } else {
+#ifndef NO_SDL
+    SDL_GL_DestroyContext(context);
+    SDL_Quit();
+#endif
+  }
   return 0;
 }
 
@@ -459,7 +982,10 @@ void Win2PPM(int width, int height) {
   }
 
   /* Copy the image into our buffer */
-  glReadBuffer(GL_BACK);
+  // headless draws into a framebuffer object that stands in for the window
+  GLuint window_fbo = gl_state().window_framebuffer();
+  gl_state().bind_framebuffer(window_fbo);
+  glReadBuffer(window_fbo != 0 ? GL_COLOR_ATTACHMENT0 : GL_BACK);
   glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, image);
 
   /* Write the PPM file */
@@ -0,0 +1,114 @@
+#include "mesh_check.h"
+
+#include "glm/glm.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+static const int kStride = 8;
+static const int kNormalOffset = 5;
+
+static glm::vec3 position(const float *data, int v) {
+    return glm::vec3(data[v * kStride], data[v * kStride + 1], data[v * kStride + 2]);
+}
+
+static glm::vec3 normal(const float *data, int v) {
+    const float *n = data + v * kStride + kNormalOffset;
+    return glm::vec3(n[0], n[1], n[2]);
+}
+
+static void swap_vertices(float *data, int a, int b) {
+    swap_ranges(data + a * kStride, data + (a + 1) * kStride, data + b * kStride);
+}
+
+// positions are welded on a 1e-4 grid, models repeat a corner for every
+// triangle that uses it and the copies don't always match to the last bit
+static uint64_t weld(const glm::vec3 &p) {
+    uint64_t key = 0;
+    for (int i = 0; i < 3; i++) {
+        int64_t q = (int64_t)llroundf(p[i] * 1e4f);
+        key = key * 2097152ull + (uint64_t)(q & 0x1FFFFF); // 21 bits each
+    }
+    return key;
+}
+
+struct edge_hash_t {
+    size_t operator()(const pair<uint64_t, uint64_t> &e) const {
+        return (size_t)(e.first * 1099511628211ull ^ e.second);
+    }
+};
+
+mesh_report_t validate_mesh(float *data, int num_vertices) {
+    mesh_report_t report = {};
+    int num_triangles = num_vertices / 3;
+    report.num_triangles = num_triangles;
+
+    // winding against the normals
+    vector<char> skip(num_triangles, 0);
+    for (int t = 0; t < num_triangles; t++) {
+        int v = t * 3;
+        glm::vec3 a = position(data, v), b = position(data, v + 1), c = position(data, v + 2);
+        glm::vec3 face = glm::cross(b - a, c - a);
+        if (glm::dot(face, face) < 1e-20f) {
+            report.degenerate++;
+            skip[t] = 1;
+            continue;
+        }
+        glm::vec3 n = normal(data, v) + normal(data, v + 1) + normal(data, v + 2);
+        if (glm::dot(face, n) < 0.0f) {
+            swap_vertices(data, v + 1, v + 2);
+            report.flipped++;
+        }
+    }
+
+    // every directed edge needs exactly one partner going the other way
+    unordered_map<pair<uint64_t, uint64_t>, int, edge_hash_t> edges;
+    edges.reserve(num_triangles * 3);
+    for (int t = 0; t < num_triangles; t++) {
+        if (skip[t]) {
+            continue;
+        }
+        uint64_t k[3];
+        for (int i = 0; i < 3; i++) {
+            k[i] = weld(position(data, t * 3 + i));
+        }
+        for (int i = 0; i < 3; i++) {
+            edges[make_pair(k[i], k[(i + 1) % 3])]++;
+        }
+    }
+    for (auto it = edges.begin(); it != edges.end(); ++it) {
+        auto opposite = edges.find(make_pair(it->first.second, it->first.first));
+        if (it->second != 1 || opposite == edges.end() || opposite->second != 1) {
+            report.open_edges++;
+        }
+    }
+    report.closed = report.open_edges == 0 && report.degenerate < num_triangles;
+
+    // signed volume, negative means the consistent winding faces inwards
+    if (report.closed) {
+        double volume = 0.0;
+        for (int t = 0; t < num_triangles; t++) {
+            int v = t * 3;
+            glm::vec3 a = position(data, v), b = position(data, v + 1), c = position(data, v + 2);
+            volume += glm::dot(a, glm::cross(b, c));
+        }
+        if (volume < 0.0) {
+            report.inverted = true;
+            for (int v = 0; v < num_triangles * 3; v += 3) {
+                swap_vertices(data, v + 1, v + 2);
+            }
+            for (int v = 0; v < num_vertices; v++) {
+                float *n = data + v * kStride + kNormalOffset;
+                n[0] = -n[0];
+                n[1] = -n[1];
+                n[2] = -n[2];
+            }
+        }
+    }
+    return report;
+}
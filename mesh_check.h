@@ -0,0 +1,22 @@
+#ifndef MESH_CHECK_H
+#define MESH_CHECK_H
+
+// what validate_mesh() found and fixed
+typedef struct mesh_report_t {
+  int num_triangles;
+  int flipped;     // triangles whose winding disagreed with their normals
+  int degenerate;  // zero area, left alone
+  int open_edges;  // edges without a matching opposite edge
+  bool inverted;   // closed mesh that was inside out, flipped as a whole
+  bool closed;     // watertight and consistently wound, safe to back face cull
+} mesh_report_t;
+
+// load time check of a non-indexed triangle list in the 8 float layout
+// (pos 3, tex 2, normal 3). every triangle is made counter clockwise as seen
+// from the side its vertex normals point to, then the edges are matched up to
+// see if the mesh is closed. a closed mesh with negative volume had its
+// normals pointing inwards, it is turned inside out (winding and normals) so
+// culling keeps the outside. fixes data in place
+mesh_report_t validate_mesh(float *data, int num_vertices);
+
+#endif // MESH_CHECK_H
@@ -0,0 +1,381 @@
+#include "occlusion.h"
+#include "profiler.h"
+
+#include "glm/gtc/matrix_transform.hpp"
+#include "stb_image_write.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define OCCLUSION_SSE 1
+#endif
+
+using namespace std;
+
+// only walls this close to the camera (in cells) are rasterized, anything
+// further away covers too few pixels of the small buffer to hide much
+static const float kOccluderRange = 24.0f;
+
+OcclusionCuller::~OcclusionCuller() {
+    {
+        lock_guard<mutex> lock(mutex_);
+        quit_ = true;
+    }
+    cv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+void OcclusionCuller::build_occluders(const vector<char> &grid, int w, int h) {
+    occluders_.clear();
+    // outside of the map is open space here, the outer walls face the skybox
+    auto wall = [&](int x, int z) {
+        return x >= 0 && x < w && z >= 0 && z < h && grid[z * w + x] == 'W';
+    };
+    // same cell -> world mapping as GameMap, walls go from y = 0 to y = 1
+    auto world = [&](float x, float y, float z) {
+        return glm::vec3(x - w / 2.0f, y, z - h);
+    };
+
+    // faces on the vertical grid lines x = const, merged along z
+    for (int x = 0; x <= w; x++) {
+        int run_start = -1;
+        for (int z = 0; z <= h; z++) {
+            bool face = z < h && wall(x - 1, z) != wall(x, z);
+            if (face && run_start < 0) {
+                run_start = z;
+            } else if (!face && run_start >= 0) {
+                occluder_quad_t quad;
+                quad.corners[0] = world(x, 0, run_start);
+                quad.corners[1] = world(x, 0, z);
+                quad.corners[2] = world(x, 1, z);
+                quad.corners[3] = world(x, 1, run_start);
+                occluders_.push_back(quad);
+                run_start = -1;
+            }
+        }
+    }
+
+    // faces on the horizontal grid lines z = const, merged along x
+    for (int z = 0; z <= h; z++) {
+        int run_start = -1;
+        for (int x = 0; x <= w; x++) {
+            bool face = x < w && wall(x, z - 1) != wall(x, z);
+            if (face && run_start < 0) {
+                run_start = x;
+            } else if (!face && run_start >= 0) {
+                occluder_quad_t quad;
+                quad.corners[0] = world(run_start, 0, z);
+                quad.corners[1] = world(x, 0, z);
+                quad.corners[2] = world(x, 1, z);
+                quad.corners[3] = world(run_start, 1, z);
+                occluders_.push_back(quad);
+                run_start = -1;
+            }
+        }
+    }
+    printf("merged wall faces into %d occluder quads\n", (int)occluders_.size());
+}
+
+void OcclusionCuller::kick(camera_t &cam, const vector<aabb_t> &boxes) {
+    wait(); // one job at a time
+
+    if (!worker_.joinable()) {
+        worker_ = thread(&OcclusionCuller::worker_loop, this);
+    }
+
+    glm::mat4 view = glm::lookAt(cam.pos, cam.pos + cam.fwd_dir, cam.up);
+    glm::mat4 proj = glm::perspective(cam.fov, cam.aspect_ratio, cam.near, cam.far);
+    {
+        lock_guard<mutex> lock(mutex_);
+        view_proj_ = proj * view;
+        cam_pos_ = cam.pos;
+        boxes_ = boxes;
+        has_job_ = true;
+    }
+    cv_.notify_all();
+}
+
+const vector<char> &OcclusionCuller::wait() {
+    unique_lock<mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return !has_job_; });
+    return visible_;
+}
+
+void OcclusionCuller::worker_loop() {
+    profiler().set_thread_name("occlusion");
+    unique_lock<mutex> lock(mutex_);
+    while (true) {
+        cv_.wait(lock, [this]() { return has_job_ || quit_; });
+        if (quit_) {
+            return;
+        }
+        lock.unlock();
+        run_job();
+        lock.lock();
+        has_job_ = false;
+        cv_.notify_all();
+    }
+}
+
+void OcclusionCuller::run_job() {
+    PROFILE_ZONE("occlusion cull");
+    clear_depth();
+    for (size_t i = 0; i < occluders_.size(); i++) {
+        const occluder_quad_t &quad = occluders_[i];
+        // distance from the camera to the quad's bounding box
+        glm::vec3 lo = glm::min(quad.corners[0], quad.corners[2]);
+        glm::vec3 hi = glm::max(quad.corners[0], quad.corners[2]);
+        glm::vec3 closest = glm::clamp(cam_pos_, lo, hi);
+        if (glm::length(closest - cam_pos_) < kOccluderRange) {
+            rasterize_quad(quad);
+        }
+    }
+    build_pyramid();
+
+    visible_.resize(boxes_.size());
+    num_culled_ = 0;
+    for (size_t i = 0; i < boxes_.size(); i++) {
+        visible_[i] = test_box(boxes_[i]);
+        if (!visible_[i]) {
+            num_culled_++;
+        }
+    }
+}
+
+void OcclusionCuller::clear_depth() {
+    int lw = kWidth, lh = kHeight;
+    num_levels_ = 0;
+    while (num_levels_ < kMaxLevels) {
+        level_w_[num_levels_] = lw;
+        level_h_[num_levels_] = lh;
+        levels_[num_levels_].assign(lw * lh, 1.0f);
+        num_levels_++;
+        if (lw == 1 || lh == 1) {
+            break;
+        }
+        lw = (lw + 1) / 2;
+        lh = (lh + 1) / 2;
+    }
+}
+
+// clips the quad against the near plane, projects it and splits it into a fan
+void OcclusionCuller::rasterize_quad(const occluder_quad_t &quad) {
+    glm::vec4 in[4], out[8];
+    for (int i = 0; i < 4; i++) {
+        in[i] = view_proj_ * glm::vec4(quad.corners[i], 1.0f);
+    }
+
+    // sutherland-hodgman against z >= -w
+    int num_out = 0;
+    for (int i = 0; i < 4; i++) {
+        const glm::vec4 &p = in[i];
+        const glm::vec4 &q = in[(i + 1) % 4];
+        float dp = p.z + p.w, dq = q.z + q.w;
+        if (dp >= 0) {
+            out[num_out++] = p;
+        }
+        if ((dp >= 0) != (dq >= 0)) {
+            out[num_out++] = p + (q - p) * (dp / (dp - dq));
+        }
+    }
+    if (num_out < 3) {
+        return;
+    }
+
+    glm::vec3 screen[8];
+    for (int i = 0; i < num_out; i++) {
+        float inv_w = 1.0f / max(out[i].w, 1e-6f);
+        screen[i] = glm::vec3((out[i].x * inv_w * 0.5f + 0.5f) * kWidth,
+                              (out[i].y * inv_w * 0.5f + 0.5f) * kHeight,
+                              out[i].z * inv_w * 0.5f + 0.5f);
+    }
+    for (int i = 1; i + 1 < num_out; i++) {
+        rasterize_triangle(screen[0], screen[i], screen[i + 1]);
+    }
+}
+
+// edge function rasterizer writing the nearest depth, 4 pixels at a time
+void OcclusionCuller::rasterize_triangle(const glm::vec3 &a, const glm::vec3 &b0,
+                                         const glm::vec3 &c0) {
+    glm::vec3 b = b0, c = c0;
+    float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+    if (fabsf(area) < 1e-8f) {
+        return;
+    }
+    if (area < 0) {
+        swap(b, c);
+        area = -area;
+    }
+
+    int min_x = max(0, (int)floorf(min(a.x, min(b.x, c.x))));
+    int max_x = min(kWidth - 1, (int)ceilf(max(a.x, max(b.x, c.x))));
+    int min_y = max(0, (int)floorf(min(a.y, min(b.y, c.y))));
+    int max_y = min(kHeight - 1, (int)ceilf(max(a.y, max(b.y, c.y))));
+    if (min_x > max_x || min_y > max_y) {
+        return;
+    }
+    min_x &= ~3; // start on a 4 pixel boundary
+
+    // edge i is inside when e_a[i] * x + e_b[i] * y + e_c[i] >= 0
+    const glm::vec3 *v[3] = {&a, &b, &c};
+    float e_a[3], e_b[3], e_c[3];
+    for (int i = 0; i < 3; i++) {
+        const glm::vec3 &p = *v[i];
+        const glm::vec3 &q = *v[(i + 1) % 3];
+        e_a[i] = -(q.y - p.y);
+        e_b[i] = q.x - p.x;
+        e_c[i] = -(e_a[i] * p.x + e_b[i] * p.y);
+    }
+
+    // depth plane
+    float dzdx = ((b.z - a.z) * (c.y - a.y) - (c.z - a.z) * (b.y - a.y)) / area;
+    float dzdy = ((c.z - a.z) * (b.x - a.x) - (b.z - a.z) * (c.x - a.x)) / area;
+    float z_origin = a.z - dzdx * a.x - dzdy * a.y;
+
+    float *depth = levels_[0].data();
+    for (int py = min_y; py <= max_y; py++) {
+        float yc = py + 0.5f;
+        float row[3];
+        for (int i = 0; i < 3; i++) {
+            row[i] = e_b[i] * yc + e_c[i];
+        }
+        float z_row = z_origin + dzdy * yc;
+        float *line = depth + py * kWidth;
+
+#ifdef OCCLUSION_SSE
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 lane = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        for (int px = min_x; px <= max_x; px += 4) {
+            __m128 xs = _mm_add_ps(_mm_set1_ps((float)px), lane);
+            __m128 mask = _mm_cmpge_ps(
+                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e_a[0]), xs), _mm_set1_ps(row[0])), zero);
+            mask = _mm_and_ps(mask, _mm_cmpge_ps(
+                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e_a[1]), xs), _mm_set1_ps(row[1])), zero));
+            mask = _mm_and_ps(mask, _mm_cmpge_ps(
+                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e_a[2]), xs), _mm_set1_ps(row[2])), zero));
+            if (_mm_movemask_ps(mask) == 0) {
+                continue;
+            }
+            __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(dzdx), xs), _mm_set1_ps(z_row));
+            z = _mm_min_ps(_mm_max_ps(z, zero), one);
+            __m128 old_z = _mm_loadu_ps(line + px);
+            __m128 new_z = _mm_min_ps(old_z, z);
+            _mm_storeu_ps(line + px, _mm_or_ps(_mm_and_ps(mask, new_z),
+                                               _mm_andnot_ps(mask, old_z)));
+        }
+#else
+        for (int px = min_x; px <= max_x; px++) {
+            float xc = px + 0.5f;
+            if (e_a[0] * xc + row[0] < 0 || e_a[1] * xc + row[1] < 0 ||
+                e_a[2] * xc + row[2] < 0) {
+                continue;
+            }
+            float z = min(max(dzdx * xc + z_row, 0.0f), 1.0f);
+            line[px] = min(line[px], z);
+        }
+#endif
+    }
+}
+
+void OcclusionCuller::build_pyramid() {
+    for (int l = 1; l < num_levels_; l++) {
+        const vector<float> &src = levels_[l - 1];
+        int sw = level_w_[l - 1], sh = level_h_[l - 1];
+        for (int y = 0; y < level_h_[l]; y++) {
+            int y0 = 2 * y, y1 = min(2 * y + 1, sh - 1);
+            for (int x = 0; x < level_w_[l]; x++) {
+                int x0 = 2 * x, x1 = min(2 * x + 1, sw - 1);
+                float farthest = max(max(src[y0 * sw + x0], src[y0 * sw + x1]),
+                                     max(src[y1 * sw + x0], src[y1 * sw + x1]));
+                levels_[l][y * level_w_[l] + x] = farthest;
+            }
+        }
+    }
+}
+
+bool OcclusionCuller::test_box(const aabb_t &box) const {
+    glm::vec3 ndc_min(1e30f), ndc_max(-1e30f);
+    for (int i = 0; i < 8; i++) {
+        glm::vec4 corner((i & 1) ? box.max.x : box.min.x,
+                         (i & 2) ? box.max.y : box.min.y,
+                         (i & 4) ? box.max.z : box.min.z, 1.0f);
+        glm::vec4 clip = view_proj_ * corner;
+        if (clip.z < -clip.w || clip.w <= 1e-6f) {
+            return true; // crosses the near plane, can't say anything
+        }
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        ndc_min = glm::min(ndc_min, ndc);
+        ndc_max = glm::max(ndc_max, ndc);
+    }
+
+    // outside the frustum
+    if (ndc_max.x < -1 || ndc_min.x > 1 || ndc_max.y < -1 || ndc_min.y > 1 ||
+        ndc_min.z > 1) {
+        return false;
+    }
+
+    int x0 = max(0, min(kWidth - 1, (int)floorf((ndc_min.x * 0.5f + 0.5f) * kWidth)));
+    int x1 = max(0, min(kWidth - 1, (int)floorf((ndc_max.x * 0.5f + 0.5f) * kWidth)));
+    int y0 = max(0, min(kHeight - 1, (int)floorf((ndc_min.y * 0.5f + 0.5f) * kHeight)));
+    int y1 = max(0, min(kHeight - 1, (int)floorf((ndc_max.y * 0.5f + 0.5f) * kHeight)));
+    float box_z = ndc_min.z * 0.5f + 0.5f;
+
+    // go up the pyramid until the rectangle covers at most 2x2 texels
+    int l = 0;
+    while (l + 1 < num_levels_ && ((x1 >> l) - (x0 >> l) > 1 || (y1 >> l) - (y0 >> l) > 1)) {
+        l++;
+    }
+    const vector<float> &level = levels_[l];
+    for (int y = y0 >> l; y <= (y1 >> l); y++) {
+        for (int x = x0 >> l; x <= (x1 >> l); x++) {
+            if (box_z <= level[y * level_w_[l] + x]) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool OcclusionCuller::dump_depth(const char *fname) const {
+    if (num_levels_ == 0) {
+        printf("occlusion buffer is empty, nothing to dump\n");
+        return false;
+    }
+    // level 0 on the left, the rest of the pyramid stacked on the right
+    int img_w = kWidth + level_w_[min(1, num_levels_ - 1)];
+    int img_h = kHeight;
+    vector<unsigned char> image(img_w * img_h, 0);
+
+    int offset_y = 0;
+    for (int l = 0; l < num_levels_; l++) {
+        int offset_x = l == 0 ? 0 : kWidth;
+        for (int y = 0; y < level_h_[l]; y++) {
+            for (int x = 0; x < level_w_[l]; x++) {
+                // depth is very non linear, stretch it so close walls are bright
+                float d = levels_[l][y * level_w_[l] + x];
+                unsigned char v = d >= 1.0f ? 0 : (unsigned char)(255 * (1.0f - powf(d, 64.0f)));
+                int iy = img_h - 1 - (offset_y + y); // png rows go top down
+                if (iy >= 0 && offset_x + x < img_w) {
+                    image[iy * img_w + offset_x + x] = v;
+                }
+            }
+        }
+        if (l > 0) {
+            offset_y += level_h_[l];
+        }
+    }
+
+    if (!stbi_write_png(fname, img_w, img_h, 1, image.data(), img_w)) {
+        printf("can't write occlusion buffer to %s\n", fname);
+        return false;
+    }
+    printf("wrote occlusion buffer to %s (%d of %d boxes culled)\n", fname,
+           num_culled_, (int)boxes_.size());
+    return true;
+}
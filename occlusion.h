@@ -0,0 +1,81 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include "game_types.h"
+#include "glm/glm.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// one merged wall face, corners in world space
+typedef struct occluder_quad_t {
+  glm::vec3 corners[4];
+} occluder_quad_t;
+
+// software occlusion culler.
+// rasterizes the merged wall faces around the camera into a small depth
+// buffer, builds a hierarchical-z (farthest depth) pyramid on top of it and
+// tests bounding boxes against that. the work runs on its own thread: kick()
+// it as soon as the camera for the frame is known and wait() for the result
+// right before submitting, the gl thread keeps going in between
+class OcclusionCuller {
+public:
+  static const int kWidth = 256;
+  static const int kHeight = 160;
+  static const int kMaxLevels = 8;
+
+  OcclusionCuller() = default;
+  ~OcclusionCuller();
+
+  // merges the wall faces of the grid into as few quads as possible
+  void build_occluders(const vector<char> &grid, int w, int h);
+
+  // starts rasterizing and testing boxes on the worker thread
+  void kick(camera_t &cam, const vector<aabb_t> &boxes);
+  // blocks until the last kick() is done. visible[i] is the result for boxes[i]
+  const vector<char> &wait();
+
+  int num_occluders() const { return (int)occluders_.size(); }
+  int num_culled() const { return num_culled_; }
+
+  // debug view, writes the depth buffer and its pyramid side by side as a png.
+  // only call it after wait()
+  bool dump_depth(const char *fname) const;
+
+private:
+  vector<occluder_quad_t> occluders_;
+
+  // level 0 is the depth buffer, every next level keeps the farthest depth of
+  // a 2x2 block. depth is window z in [0, 1], cleared to 1 (nothing there)
+  vector<float> levels_[kMaxLevels];
+  int level_w_[kMaxLevels], level_h_[kMaxLevels];
+  int num_levels_ = 0;
+
+  // job in flight, only touched by the worker between kick() and wait()
+  glm::mat4 view_proj_;
+  glm::vec3 cam_pos_;
+  vector<aabb_t> boxes_;
+  vector<char> visible_;
+  int num_culled_ = 0;
+
+  thread worker_;
+  mutex mutex_;
+  condition_variable cv_;
+  bool has_job_ = false;
+  bool quit_ = false;
+
+  void worker_loop();
+  void run_job();
+  void clear_depth();
+  void rasterize_quad(const occluder_quad_t &quad);
+  void rasterize_triangle(const glm::vec3 &a, const glm::vec3 &b,
+                          const glm::vec3 &c);
+  void build_pyramid();
+  bool test_box(const aabb_t &box) const;
+};
+
+#endif // OCCLUSION_H
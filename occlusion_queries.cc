@@ -0,0 +1,203 @@
+#include "occlusion_queries.h"
+
+#include "gl_state.h"
+#include "glm/gtc/type_ptr.hpp"
+
+#include <cstdio>
+
+using namespace std;
+
+const int OcclusionQueries::kMinVertices;
+constexpr float OcclusionQueries::kBoxMargin;
+
+bool OcclusionQueries::is_supported() {
+    // conditional render is 3.0, any samples passed 3.3
+    return GLAD_GL_VERSION_3_3 || GLAD_GL_ARB_occlusion_query2;
+}
+
+const char *OcclusionQueries::mode_name(occlusion_query_mode_t mode) {
+    switch (mode) {
+    case QUERIES_NO_WAIT:
+        return "no wait";
+    case QUERIES_WAIT:
+        return "wait";
+    case QUERIES_BY_REGION:
+        return "by region";
+    default:
+        return "off";
+    }
+}
+
+bool OcclusionQueries::init() {
+    if (ready_) {
+        return true;
+    }
+    if (!is_supported()) {
+        printf("no occlusion queries, conditional rendering not available\n");
+        return false;
+    }
+    box_shader_ = Shader("shaders/occlusion_box.vs", "shaders/occlusion_box.fs");
+    GLuint program = box_shader_.getShader();
+    view_loc_ = glGetUniformLocation(program, "view");
+    proj_loc_ = glGetUniformLocation(program, "proj");
+    min_loc_ = glGetUniformLocation(program, "boxMin");
+    max_loc_ = glGetUniformLocation(program, "boxMax");
+    glGenVertexArrays(1, &vao_);
+    ready_ = true;
+    return true;
+}
+
+void OcclusionQueries::cleanup() {
+    for (size_t i = 0; i < objects_.size(); i++) {
+        glDeleteQueries(2, objects_[i].queries);
+    }
+    objects_.clear();
+    added_.clear();
+    tested_.clear();
+    if (vao_ != 0) {
+        gl_state().forget_vertex_array(vao_);
+        glDeleteVertexArrays(1, &vao_);
+        vao_ = 0;
+    }
+    if (ready_) {
+        box_shader_.cleanUpShader();
+    }
+    ready_ = false;
+}
+
+OcclusionQueries::occludee_t &OcclusionQueries::object(int id) {
+    while ((int)objects_.size() <= id) {
+        occludee_t object;
+        object.queries[0] = object.queries[1] = 0;
+        object.issued[0] = object.issued[1] = -1;
+        object.added = -1;
+        object.testable = false;
+        object.condition = false;
+        objects_.push_back(object);
+    }
+    occludee_t &object = objects_[id];
+    if (object.queries[0] == 0) {
+        glGenQueries(2, object.queries);
+    }
+    return object;
+}
+
+void OcclusionQueries::begin_frame(const glm::vec3 &cam_pos, float near) {
+    // what the gpu made of last frame's conditional draws, their queries are
+    // about to be written again
+    int current = (frame_ + 1) & 1;
+    for (size_t i = 0; i < tested_.size(); i++) {
+        GLuint query = objects_[tested_[i]].queries[current];
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            frame_stats_.pending++;
+            continue;
+        }
+        GLuint passed = 0;
+        glGetQueryObjectuiv(query, GL_QUERY_RESULT, &passed);
+        if (!passed) {
+            frame_stats_.skipped++;
+            total_skipped_++;
+        }
+    }
+    tested_.clear();
+    last_frame_ = frame_stats_;
+    frame_stats_ = {0, 0, 0, 0};
+
+    frame_++;
+    added_.clear();
+    cam_pos_ = cam_pos;
+    near_ = near;
+}
+
+void OcclusionQueries::add(int object_id, const aabb_t &bounds) {
+    if (!ready_ || !enabled()) {
+        return;
+    }
+    occludee_t &occludee = object(object_id);
+    if (occludee.added == frame_) {
+        return;
+    }
+    occludee.added = frame_;
+    occludee.bounds.min = bounds.min - glm::vec3(kBoxMargin);
+    occludee.bounds.max = bounds.max + glm::vec3(kBoxMargin);
+    added_.push_back(object_id);
+    frame_stats_.objects++;
+
+    // from inside, or with the near plane cutting into it, the box says
+    // nothing about what is behind it
+    glm::vec3 lo = occludee.bounds.min - glm::vec3(near_ * 2.0f);
+    glm::vec3 hi = occludee.bounds.max + glm::vec3(near_ * 2.0f);
+    occludee.testable = !(glm::all(glm::greaterThan(cam_pos_, lo)) &&
+                          glm::all(glm::lessThan(cam_pos_, hi)));
+
+    int previous = (frame_ - 1) & 1;
+    occludee.condition = occludee.testable && occludee.issued[previous] == frame_ - 1;
+    if (occludee.condition && mode_ != QUERIES_WAIT) {
+        // the gpu would draw anyway while the result isn't in. decide it
+        // here so the depth pre-pass and the lit pass can't disagree
+        GLint available = 0;
+        glGetQueryObjectiv(occludee.queries[previous], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            occludee.condition = false;
+            frame_stats_.pending++;
+        }
+    }
+    if (occludee.condition) {
+        tested_.push_back(object_id);
+        frame_stats_.conditional++;
+        total_conditional_++;
+    }
+}
+
+bool OcclusionQueries::has_condition(int object_id) const {
+    return object_id >= 0 && object_id < (int)objects_.size() &&
+           objects_[object_id].added == frame_ && objects_[object_id].condition;
+}
+
+bool OcclusionQueries::begin_conditional(int object_id) {
+    if (!has_condition(object_id)) {
+        return false;
+    }
+    static const GLenum kModes[NUM_QUERY_MODES] = {GL_QUERY_NO_WAIT, GL_QUERY_NO_WAIT,
+                                                   GL_QUERY_WAIT, GL_QUERY_BY_REGION_NO_WAIT};
+    glBeginConditionalRender(objects_[object_id].queries[(frame_ - 1) & 1], kModes[mode_]);
+    return true;
+}
+
+void OcclusionQueries::end_conditional() {
+    glEndConditionalRender();
+}
+
+void OcclusionQueries::issue(const glm::mat4 &view, const glm::mat4 &proj) {
+    if (!ready_ || added_.empty()) {
+        return;
+    }
+    gl_state().use_program(box_shader_.getShader());
+    glUniformMatrix4fv(view_loc_, 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(proj_loc_, 1, GL_FALSE, glm::value_ptr(proj));
+    gl_state().bind_vertex_array(vao_);
+    int current = frame_ & 1;
+    for (size_t i = 0; i < added_.size(); i++) {
+        occludee_t &occludee = objects_[added_[i]];
+        if (!occludee.testable) {
+            continue;
+        }
+        glUniform3fv(min_loc_, 1, glm::value_ptr(occludee.bounds.min));
+        glUniform3fv(max_loc_, 1, glm::value_ptr(occludee.bounds.max));
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, occludee.queries[current]);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 14);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        occludee.issued[current] = frame_;
+    }
+    gl_state().bind_vertex_array(0);
+}
+
+void OcclusionQueries::print_stats() const {
+    printf("occlusion queries (%s): %d expensive objects, %d conditional, %d skipped by the "
+           "gpu, %d results late. %.1f%% skipped over the run\n",
+           mode_name(mode_), last_frame_.objects, last_frame_.conditional, last_frame_.skipped,
+           last_frame_.pending,
+           total_conditional_ ? 100.0 * total_skipped_ / total_conditional_ : 0.0);
+}
@@ -0,0 +1,114 @@
+#ifndef OCCLUSION_QUERIES_H
+#define OCCLUSION_QUERIES_H
+
+#include "game_types.h"
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+#include "shader.h"
+
+#include <vector>
+
+using namespace std;
+
+// how a draw waits for the query it is conditional on
+typedef enum occlusion_query_mode_t {
+  QUERIES_OFF = 0,
+  // a result that isn't in yet doesn't hold anything up, the draw goes ahead
+  QUERIES_NO_WAIT = 1,
+  // the gpu waits for last frame's result, which is nearly always in anyway
+  QUERIES_WAIT = 2,
+  // like no wait, the driver may also decide per screen region
+  QUERIES_BY_REGION = 3,
+  NUM_QUERY_MODES
+} occlusion_query_mode_t;
+
+// one frame. skipped is only known once the gpu is done with the frame, it
+// trails the other counts by a frame
+typedef struct occlusion_query_stats_t {
+  int objects;     // expensive objects queued
+  int conditional; // drawn under last frame's query
+  int skipped;     // of those, dropped by the gpu
+  int pending;     // results that weren't in when they were checked
+} occlusion_query_stats_t;
+
+// hardware occlusion queries for the few expensive meshes (teapot, knot).
+// after the world pass every such object has its bounding box drawn, color
+// and depth writes off, inside a GL_ANY_SAMPLES_PASSED query. next frame its
+// draws run inside glBeginConditionalRender on that query, so the gpu drops
+// them when the box was hidden without the cpu reading anything back. the
+// result is a frame old: an object that comes out from behind a wall shows
+// up a frame late. a box the camera is in (or nearly) can't be tested, the
+// object is then drawn unconditionally.
+// objects are named by the caller (the grid cell). each has two queries
+// that take turns, one being written this frame and one being tested
+class OcclusionQueries {
+public:
+  // meshes with fewer vertices are cheaper to draw than to query
+  static const int kMinVertices = 3000;
+  // boxes grow by this much, so faces that touch a wall don't z-fight it
+  static constexpr float kBoxMargin = 0.01f;
+
+  OcclusionQueries() = default;
+  ~OcclusionQueries() = default;
+
+  // true if the current context has any samples passed queries (gl 3.3)
+  static bool is_supported();
+  static const char *mode_name(occlusion_query_mode_t mode);
+
+  // creates the box program, false if not supported
+  bool init();
+  // frees the queries and the program, call while the context is still alive
+  void cleanup();
+
+  void set_mode(occlusion_query_mode_t mode) { mode_ = mode; }
+  occlusion_query_mode_t mode() const { return mode_; }
+  bool enabled() const { return mode_ != QUERIES_OFF; }
+
+  // new frame seen from cam_pos, reads back the results of the frame before
+  // for the stats
+  void begin_frame(const glm::vec3 &cam_pos, float near);
+  // an expensive object drawn this frame, world space bounds
+  void add(int object, const aabb_t &bounds);
+  // true if the draws of object this frame depend on last frame's query
+  bool has_condition(int object) const;
+  // wrap the draws of object, begin returns false (and end isn't needed)
+  // if it is drawn unconditionally
+  bool begin_conditional(int object);
+  void end_conditional();
+  // draws this frame's boxes against the depth buffer, after the world
+  void issue(const glm::mat4 &view, const glm::mat4 &proj);
+
+  occlusion_query_stats_t stats() const { return last_frame_; }
+  void print_stats() const;
+
+private:
+  typedef struct occludee_t {
+    GLuint queries[2];    // frame & 1 is the one written this frame
+    int issued[2];        // frame each was last issued in, -1 = never
+    int added;            // frame of the last add()
+    bool testable;        // this frame, the camera is outside the box
+    bool condition;       // this frame, drawn under last frame's query
+    aabb_t bounds;
+  } occludee_t;
+
+  bool ready_ = false;
+  occlusion_query_mode_t mode_ = QUERIES_OFF;
+  Shader box_shader_;
+  GLuint vao_ = 0; // empty, the box comes from gl_VertexID
+  GLint view_loc_ = -1, proj_loc_ = -1, min_loc_ = -1, max_loc_ = -1;
+
+  vector<occludee_t> objects_; // by object id, grown on demand
+  vector<int> added_;          // ids added this frame
+  vector<int> tested_;         // ids drawn under a condition last frame
+  int frame_ = 0;
+  glm::vec3 cam_pos_;
+  float near_ = 0.1f;
+
+  occlusion_query_stats_t frame_stats_ = {0, 0, 0, 0};
+  occlusion_query_stats_t last_frame_ = {0, 0, 0, 0};
+  long long total_conditional_ = 0, total_skipped_ = 0;
+
+  occludee_t &object(int id);
+};
+
+#endif // OCCLUSION_QUERIES_H
@@ -0,0 +1,134 @@
+#include "probe_grid.h"
+
+#include "frame_ring.h"
+#include "gl_state.h"
+#include "shader.h"
+
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+const int ProbeGrid::kLayers;
+const int ProbeGrid::kCoeffs;
+constexpr float ProbeGrid::kLayerHeight;
+
+// the 27 coefficients go into 7 rgba texels, lined up as 7 blocks of w
+// texels along x of one 3d texture (layers along y, rows along z)
+static const int kBlocks = (ProbeGrid::kCoeffs + 3) / 4;
+
+// cache layout: "PRB1", w, h, layers, grid hash, sun direction (3 floats),
+// coefficients (kCoeffs halfs per probe)
+bool ProbeGrid::save(const char *fname) const {
+    FILE *fp = fopen(fname, "wb");
+    if (fp == NULL) {
+        printf("can't write probes %s\n", fname);
+        return false;
+    }
+    int32_t header[3] = {data_.w, data_.h, kLayers};
+    fwrite("PRB1", 1, 4, fp);
+    fwrite(header, sizeof(int32_t), 3, fp);
+    fwrite(&data_.grid_hash, sizeof(uint64_t), 1, fp);
+    fwrite(&data_.sun_dir[0], sizeof(float), 3, fp);
+    fwrite(data_.coeffs.data(), sizeof(uint16_t), data_.coeffs.size(), fp);
+    fclose(fp);
+    return true;
+}
+
+bool ProbeGrid::load(const char *fname, uint64_t grid_hash) {
+    FILE *fp = fopen(fname, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+
+    char magic[4];
+    int32_t header[3];
+    probe_grid_data_t data;
+    bool ok = fread(magic, 1, 4, fp) == 4 && memcmp(magic, "PRB1", 4) == 0 &&
+              fread(header, sizeof(int32_t), 3, fp) == 3 &&
+              fread(&data.grid_hash, sizeof(uint64_t), 1, fp) == 1 &&
+              data.grid_hash == grid_hash &&
+              fread(&data.sun_dir[0], sizeof(float), 3, fp) == 3 &&
+              header[0] > 0 && header[1] > 0 && header[2] == kLayers;
+    if (ok) {
+        data.w = header[0];
+        data.h = header[1];
+        data.coeffs.resize((size_t)data.w * data.h * kLayers * kCoeffs);
+        ok = fread(data.coeffs.data(), sizeof(uint16_t), data.coeffs.size(), fp) ==
+             data.coeffs.size();
+    }
+    fclose(fp);
+
+    if (!ok) {
+        printf("probes %s are stale or corrupt, ignoring them (rebake with --bake-lightmap)\n",
+               fname);
+        return false;
+    }
+    data_ = data;
+    return true;
+}
+
+void ProbeGrid::upload() {
+    if (empty() || tex_ != 0) {
+        return;
+    }
+    int w = data_.w, h = data_.h;
+    vector<uint16_t> texels((size_t)kBlocks * 4 * w * kLayers * h, 0);
+    for (int z = 0; z < h; z++) {
+        for (int layer = 0; layer < kLayers; layer++) {
+            for (int x = 0; x < w; x++) {
+                const uint16_t *probe =
+                    &data_.coeffs[((size_t)(z * kLayers + layer) * w + x) * kCoeffs];
+                for (int c = 0; c < kCoeffs; c++) {
+                    size_t texel = ((size_t)z * kLayers + layer) * kBlocks * w + (c / 4) * w + x;
+                    texels[texel * 4 + c % 4] = probe[c];
+                }
+            }
+        }
+    }
+
+    glGenTextures(1, &tex_);
+    gl_state().bind_texture(UNIT_PROBES, GL_TEXTURE_3D, tex_);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, kBlocks * w, kLayers, h, 0, GL_RGBA,
+                 GL_HALF_FLOAT, texels.data());
+    // trilinear between the probes, the shader keeps x inside one block
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+}
+
+void ProbeGrid::cleanup() {
+    if (tex_ == 0) {
+        return;
+    }
+    gl_state().forget_texture(tex_);
+    glDeleteTextures(1, &tex_);
+    tex_ = 0;
+}
+
+void ProbeGrid::bind(const glm::vec3 &sun_dir) {
+    if (tex_ == 0) {
+        return;
+    }
+    // Probes block in fragment.fs (std140)
+    struct {
+        int32_t grid[4];
+        float origin[4];
+    } params;
+    bool on = glm::dot(sun_dir, data_.sun_dir) > 0.9999f;
+    params.grid[0] = data_.w;
+    params.grid[1] = kLayers;
+    params.grid[2] = data_.h;
+    params.grid[3] = on ? 1 : 0;
+    params.origin[0] = -data_.w / 2.0f;
+    params.origin[1] = -(float)data_.h;
+    params.origin[2] = kLayerHeight;
+    params.origin[3] = (float)kBlocks;
+    ring_chunk_t chunk = frame_ring().upload(&params, sizeof(params), frame_ring().uniform_align());
+    gl_state().bind_buffer_range(GL_UNIFORM_BUFFER, BLOCK_PROBES, chunk.buffer, chunk.offset,
+                                 chunk.size);
+
+    gl_state().bind_texture(UNIT_PROBES, GL_TEXTURE_3D, tex_);
+}
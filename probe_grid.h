@@ -0,0 +1,55 @@
+#ifndef PROBE_GRID_H
+#define PROBE_GRID_H
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// baked irradiance for the things that aren't in the lightmap (the goal,
+// props). one probe in the middle of every cell at kLayers heights, each one
+// an L2 spherical harmonic of the sky and bounce light (9 coefficients per
+// channel, already convolved to irradiance) in half floats, 54 bytes a
+// probe. the sun itself stays a runtime light so the dynamic shadows still
+// work. the world shaders interpolate between the 8 probes around a fragment
+// in hardware, see PROBE_LIT in fragment.fs
+typedef struct probe_grid_data_t {
+  int w, h;           // grid the probes were baked for
+  uint64_t grid_hash;
+  glm::vec3 sun_dir;  // direction the sunlight travels when baked
+  // kCoeffs halfs per probe, coefficient major (r, g, b of the first, ...).
+  // probe (x, layer, z) is at index (z * kLayers + layer) * w + x
+  vector<uint16_t> coeffs;
+} probe_grid_data_t;
+
+class ProbeGrid {
+public:
+  static const int kLayers = 2;
+  static constexpr float kLayerHeight = 0.5f; // probes at 0.25 and 0.75
+  static const int kCoeffs = 27;
+
+  ProbeGrid() = default;
+  ~ProbeGrid() = default;
+
+  // cache next to the scene as <scene>.probes, only used if baked from this grid
+  bool load(const char *fname, uint64_t grid_hash);
+  bool save(const char *fname) const;
+  bool empty() const { return data_.coeffs.empty(); }
+  void set_data(const probe_grid_data_t &data) { data_ = data; }
+
+  // gl side, call with the context current. upload() is a no-op when empty
+  void upload();
+  void cleanup();
+  // binds the probe texture and fills the Probes block. like the lightmap the
+  // bounce light only holds for the sun it was baked with
+  void bind(const glm::vec3 &sun_dir);
+
+private:
+  probe_grid_data_t data_;
+  GLuint tex_ = 0;
+};
+
+#endif // PROBE_GRID_H
@@ -0,0 +1,228 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+using namespace std;
+
+const int Profiler::kEventsPerThread;
+const int Profiler::kGpuZones;
+const int Profiler::kGpuTid;
+
+Profiler &profiler() {
+    static Profiler instance;
+    return instance;
+}
+
+// ring of the calling thread, registered on its first zone
+static thread_local profile_thread_t *t_thread = nullptr;
+
+Profiler::Profiler() : capturing_(false), generation_(0) {
+    epoch_ns_ = chrono::duration_cast<chrono::nanoseconds>(
+                    chrono::steady_clock::now().time_since_epoch())
+                    .count();
+}
+
+int64_t Profiler::now_ns() const {
+    return chrono::duration_cast<chrono::nanoseconds>(
+               chrono::steady_clock::now().time_since_epoch())
+               .count() -
+           epoch_ns_;
+}
+
+profile_thread_t *Profiler::add_thread(const char *name, int tid) {
+    lock_guard<mutex> lock(threads_mutex_);
+    unique_ptr<profile_thread_t> t(new profile_thread_t());
+    if (tid < 0) {
+        tid = next_tid_++;
+    }
+    t->tid = tid;
+    if (name != nullptr) {
+        t->name = name;
+    } else {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "thread %d", tid);
+        t->name = buf;
+    }
+    t->written.store(0);
+    t->generation = generation_.load();
+    t->depth = 0;
+    threads_.push_back(move(t));
+    return threads_.back().get();
+}
+
+profile_thread_t *Profiler::current_thread() {
+    if (t_thread == nullptr) {
+        t_thread = add_thread(nullptr, -1);
+    }
+    return t_thread;
+}
+
+void Profiler::set_thread_name(const char *name) {
+    profile_thread_t *t = current_thread();
+    lock_guard<mutex> lock(threads_mutex_);
+    t->name = name;
+}
+
+void Profiler::push(profile_thread_t *t, unsigned generation, const profile_event_t &event) {
+    if (t->generation != generation) {
+        // first event of a new capture, the old ones go
+        t->written.store(0, memory_order_relaxed);
+        t->generation = generation;
+    }
+    if (t->events.empty()) {
+        t->events.resize(kEventsPerThread);
+    }
+    uint64_t n = t->written.load(memory_order_relaxed);
+    t->events[n % kEventsPerThread] = event;
+    t->written.store(n + 1, memory_order_release);
+}
+
+int Profiler::begin_zone() {
+    return current_thread()->depth++;
+}
+
+void Profiler::end_zone(const char *name, int64_t start_ns, int depth) {
+    profile_thread_t *t = current_thread();
+    t->depth = depth;
+    profile_event_t event = {name, start_ns, now_ns(), depth};
+    push(t, generation_.load(memory_order_relaxed), event);
+}
+
+void Profiler::start() {
+    // anything still in flight belongs to the last capture
+    collect_gpu(true);
+    generation_.fetch_add(1);
+    capturing_.store(true);
+    printf("profiler capturing\n");
+}
+
+void Profiler::stop() {
+    if (!capturing()) {
+        return;
+    }
+    capturing_.store(false);
+    collect_gpu(true);
+}
+
+bool Profiler::init_gpu() {
+    if (gpu_checked_) {
+        return gpu_ok_;
+    }
+    gpu_checked_ = true;
+    gpu_ok_ = GLAD_GL_VERSION_3_3 || GLAD_GL_ARB_timer_query;
+    if (!gpu_ok_) {
+        printf("no timer queries, profiler captures cpu zones only\n");
+        return false;
+    }
+    for (int i = 0; i < kGpuZones; i++) {
+        glGenQueries(2, gpu_zones_[i].queries);
+        gpu_zones_[i].pending = false;
+    }
+    // both clocks now, the gpu one counts from whenever the driver likes
+    GLint64 gpu_now = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+    gpu_offset_ns_ = now_ns() - gpu_now;
+    gpu_track_ = add_thread("gpu", kGpuTid);
+    return true;
+}
+
+int Profiler::begin_gpu_zone(const char *name, int depth) {
+    if (!init_gpu()) {
+        return -1;
+    }
+    gpu_zone_t &zone = gpu_zones_[next_gpu_];
+    if (zone.pending) {
+        collect_gpu(false);
+    }
+    if (zone.pending) {
+        return -1; // gpu too far behind, drop the zone rather than wait
+    }
+    glQueryCounter(zone.queries[0], GL_TIMESTAMP);
+    zone.name = name;
+    zone.depth = depth;
+    int slot = next_gpu_;
+    next_gpu_ = (next_gpu_ + 1) % kGpuZones;
+    return slot;
+}
+
+void Profiler::end_gpu_zone(int slot) {
+    glQueryCounter(gpu_zones_[slot].queries[1], GL_TIMESTAMP);
+    gpu_zones_[slot].pending = true;
+}
+
+void Profiler::collect_gpu(bool wait) {
+    if (!gpu_ok_) {
+        return;
+    }
+    unsigned generation = generation_.load(memory_order_relaxed);
+    // oldest first, next_gpu_ was started longest ago
+    for (int i = 0; i < kGpuZones; i++) {
+        gpu_zone_t &zone = gpu_zones_[(next_gpu_ + i) % kGpuZones];
+        if (!zone.pending) {
+            continue;
+        }
+        if (!wait) {
+            GLint available = 0;
+            glGetQueryObjectiv(zone.queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) {
+                break;
+            }
+        }
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(zone.queries[0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(zone.queries[1], GL_QUERY_RESULT, &end);
+        zone.pending = false;
+        profile_event_t event = {zone.name, (int64_t)begin + gpu_offset_ns_,
+                                 (int64_t)end + gpu_offset_ns_, zone.depth};
+        push(gpu_track_, generation, event);
+    }
+}
+
+void Profiler::end_frame() {
+    if (capturing()) {
+        collect_gpu(false);
+    }
+}
+
+bool Profiler::write_trace(const char *fname) {
+    stop();
+    FILE *fp = fopen(fname, "w");
+    if (fp == NULL) {
+        printf("can't write trace %s\n", fname);
+        return false;
+    }
+
+    // chrome trace event format: complete events ("X") in microseconds, one
+    // track per tid. the names are our own literals, nothing to escape
+    lock_guard<mutex> lock(threads_mutex_);
+    unsigned generation = generation_.load();
+    int num_events = 0;
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (size_t i = 0; i < threads_.size(); i++) {
+        profile_thread_t *t = threads_[i].get();
+        fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                    "\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", t->tid, t->name.c_str());
+        first = false;
+        if (t->generation != generation) {
+            continue;
+        }
+        uint64_t written = t->written.load(memory_order_acquire);
+        uint64_t count = min<uint64_t>(written, kEventsPerThread);
+        for (uint64_t n = written - count; n < written; n++) {
+            const profile_event_t &e = t->events[n % kEventsPerThread];
+            fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+                        "\"dur\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"depth\":%d}}",
+                    e.name, t->tid == kGpuTid ? "gpu" : "cpu", e.start_ns / 1000.0,
+                    (e.end_ns - e.start_ns) / 1000.0, t->tid, e.depth);
+            num_events++;
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+    printf("wrote trace %s (%d zones)\n", fname, num_events);
+    return true;
+}
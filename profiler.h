@@ -0,0 +1,160 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "glad/glad.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// one finished zone. name is a string literal and never copied
+typedef struct profile_event_t {
+  const char *name;
+  int64_t start_ns; // since the profiler was created
+  int64_t end_ns;
+  int depth;        // zones open around it on the same thread
+} profile_event_t;
+
+// events of one thread (or the gpu), a ring that keeps the newest
+// kEventsPerThread. only the owning thread writes, written is published
+// after the event so the exporter never reads a half written one
+typedef struct profile_thread_t {
+  int tid;
+  string name;
+  vector<profile_event_t> events;
+  atomic<uint64_t> written;
+  unsigned generation; // capture the ring belongs to, stale rings restart
+  int depth;
+} profile_thread_t;
+
+// a gpu zone in flight, two GL_TIMESTAMP queries
+typedef struct gpu_zone_t {
+  const char *name;
+  GLuint queries[2];
+  int depth;
+  bool pending;
+} gpu_zone_t;
+
+// scoped cpu / gpu timing zones for captures that open in chrome://tracing
+// or perfetto. capturing is off by default; then a zone is one relaxed load
+// and a branch. build with -DNO_PROFILER to compile the zones out entirely.
+// cpu zones work on any thread, each one gets its own ring on first use.
+// gpu zones put timestamp queries around the gl calls of a cpu zone on the
+// gl thread and are collected a few frames later without waiting
+class Profiler {
+public:
+  static const int kEventsPerThread = 1 << 16;
+  static const int kGpuZones = 512; // query pairs in flight
+  static const int kGpuTid = 1000;  // track of the gpu zones in the trace
+
+  Profiler();
+  ~Profiler() = default;
+
+  bool capturing() const { return capturing_.load(memory_order_relaxed); }
+  // start() drops whatever was captured before. call both from the gl thread
+  void start();
+  void stop();
+  // stops the capture and writes it as chrome trace json
+  bool write_trace(const char *fname);
+
+  // names the calling thread in the trace
+  void set_thread_name(const char *name);
+
+  int64_t now_ns() const;
+  // used by the zone classes below
+  int begin_zone();
+  void end_zone(const char *name, int64_t start_ns, int depth);
+  int begin_gpu_zone(const char *name, int depth);
+  void end_gpu_zone(int slot);
+
+  // collects the gpu zones that finished, once per frame on the gl thread
+  void end_frame();
+
+private:
+  atomic<bool> capturing_;
+  atomic<unsigned> generation_;
+  int64_t epoch_ns_;
+
+  mutex threads_mutex_;
+  vector<unique_ptr<profile_thread_t>> threads_; // kept after a thread exits
+  int next_tid_ = 1;
+
+  // gpu side, gl thread only
+  bool gpu_checked_ = false, gpu_ok_ = false;
+  int64_t gpu_offset_ns_ = 0; // gpu timestamp + offset = our clock
+  gpu_zone_t gpu_zones_[kGpuZones];
+  int next_gpu_ = 0;
+  profile_thread_t *gpu_track_ = nullptr;
+
+  profile_thread_t *current_thread();
+  profile_thread_t *add_thread(const char *name, int tid);
+  static void push(profile_thread_t *t, unsigned generation, const profile_event_t &event);
+  bool init_gpu();
+  // reads back finished zones, with wait also the ones still in flight
+  void collect_gpu(bool wait);
+};
+
+// the profiler is shared by every thread of the game
+Profiler &profiler();
+
+// times its scope on the calling thread, end() closes it early
+class ProfileZone {
+public:
+  explicit ProfileZone(const char *name) : name_(name), active_(profiler().capturing()) {
+    if (active_) {
+      depth_ = profiler().begin_zone();
+      start_ns_ = profiler().now_ns();
+    }
+  }
+  ~ProfileZone() { end(); }
+  void end() {
+    if (active_) {
+      profiler().end_zone(name_, start_ns_, depth_);
+      active_ = false;
+    }
+  }
+
+protected:
+  const char *name_;
+  bool active_;
+  int depth_ = 0;
+  int64_t start_ns_ = 0;
+};
+
+// cpu zone plus the gpu time of the gl calls issued inside it. gl thread only
+class GpuProfileZone : public ProfileZone {
+public:
+  explicit GpuProfileZone(const char *name) : ProfileZone(name) {
+    if (active_) {
+      slot_ = profiler().begin_gpu_zone(name, depth_);
+    }
+  }
+  ~GpuProfileZone() { end(); }
+  void end() {
+    if (slot_ >= 0) {
+      profiler().end_gpu_zone(slot_);
+      slot_ = -1;
+    }
+    ProfileZone::end();
+  }
+
+private:
+  int slot_ = -1;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#ifdef NO_PROFILER
+#define PROFILE_ZONE(name)
+#define PROFILE_GPU_ZONE(name)
+#else
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#define PROFILE_GPU_ZONE(name) GpuProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#endif
+
+#endif // PROFILER_H
@@ -0,0 +1,464 @@
+#include "pvs.h"
+
+#include "profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <utility>
+
+using namespace std;
+
+// inset of the sample points from the cell borders so segments never start
+// exactly on a grid line
+static const float kSampleInset = 0.01f;
+
+uint64_t Pvs::hash_grid(const vector<char> &grid, int w, int h) {
+    // fnv-1a over the size and the cell characters
+    uint64_t hash = 1469598103934665603ull;
+    int dims[2] = {w, h};
+    const unsigned char *bytes = (const unsigned char *)dims;
+    for (size_t i = 0; i < sizeof(dims); i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    for (size_t i = 0; i < grid.size(); i++) {
+        hash = (hash ^ (unsigned char)grid[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// walks the cells under the segment (grid units, cell (x, z) covers
+// [x, x + 1) x [z, z + 1)) and returns false as soon as one of them is a wall
+bool Pvs::segment_clear(const vector<char> &grid, int w, int h, float x0,
+                        float z0, float x1, float z1) {
+    int cx = (int)floorf(x0), cz = (int)floorf(z0);
+    int ex = (int)floorf(x1), ez = (int)floorf(z1);
+    float dx = x1 - x0, dz = z1 - z0;
+    int sx = dx > 0 ? 1 : (dx < 0 ? -1 : 0);
+    int sz = dz > 0 ? 1 : (dz < 0 ? -1 : 0);
+
+    // parametric distance to the next vertical / horizontal grid line
+    float t_max_x = sx != 0 ? ((sx > 0 ? cx + 1 - x0 : x0 - cx) / fabsf(dx)) : 2.f;
+    float t_max_z = sz != 0 ? ((sz > 0 ? cz + 1 - z0 : z0 - cz) / fabsf(dz)) : 2.f;
+    float t_delta_x = sx != 0 ? 1.f / fabsf(dx) : 2.f;
+    float t_delta_z = sz != 0 ? 1.f / fabsf(dz) : 2.f;
+
+    while (true) {
+        if (is_wall(grid, w, h, cx, cz)) {
+            return false;
+        }
+        if ((cx == ex && cz == ez) || (t_max_x > 1.f && t_max_z > 1.f)) {
+            return true;
+        }
+        if (t_max_x < t_max_z) {
+            cx += sx;
+            t_max_x += t_delta_x;
+        } else if (t_max_z < t_max_x) {
+            cz += sz;
+            t_max_z += t_delta_z;
+        } else {
+            // going exactly through a grid corner. a wall on either side
+            // may be one of a pair that pins the line, so it counts as
+            // blocked and the exact test gets the final say
+            if (is_wall(grid, w, h, cx + sx, cz) || is_wall(grid, w, h, cx, cz + sz)) {
+                return false;
+            }
+            cx += sx;
+            cz += sz;
+            t_max_x += t_delta_x;
+            t_max_z += t_delta_z;
+        }
+    }
+}
+
+// the exact test runs in integer grid units times kExactScale, with every
+// wall grown by kWallGrow on each side. a gap narrower than that, e.g. two
+// walls touching diagonally or a line grazing walls on alternate sides,
+// counts as closed; a sightline that thin can't show anything anyway
+static const long long kExactScale = 1024;
+static const long long kWallGrow = 1;
+
+// true if (x, z), in exact units times scale, is strictly inside a grown
+// wall. outside the map counts as wall
+static bool point_in_walls(const vector<char> &grid, int w, int h, long long x, long long z,
+                           long long scale) {
+    auto floor_div = [](long long a, long long b) { return a >= 0 ? a / b : -((-a + b - 1) / b); };
+    const long long cell = kExactScale * scale, grow = kWallGrow * scale;
+    for (long long cz = floor_div(z - grow, cell); cz <= floor_div(z + grow, cell); cz++) {
+        for (long long cx = floor_div(x - grow, cell); cx <= floor_div(x + grow, cell); cx++) {
+            bool wall = cx < 0 || cx >= w || cz < 0 || cz >= h || grid[cz * w + cx] == 'W';
+            if (wall && x > cx * cell - grow && x < (cx + 1) * cell + grow &&
+                z > cz * cell - grow && z < (cz + 1) * cell + grow) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// does the line through u and v (exact units) run from cell a to cell b
+// without entering a grown wall? grazing one is fine. exact: with
+// d = |dx| * |dz| every parameter where the line crosses a cell or wall
+// border is an integer multiple of 1 / d
+bool Pvs::line_connects(const vector<char> &grid, int w, int h, int ax, int az, int bx, int bz,
+                        long long ux, long long uz, long long vx, long long vz) {
+    long long dx = vx - ux, dz = vz - uz;
+    long long d = max(1LL, llabs(dx)) * max(1LL, llabs(dz));
+
+    // parameters (times d) where the line is inside the closed cell (cx, cz)
+    auto clip = [&](int cx, int cz, long long &lo, long long &hi) {
+        lo = LLONG_MIN;
+        hi = LLONG_MAX;
+        const long long p[2] = {ux, uz}, dp[2] = {dx, dz};
+        const long long c[2] = {cx * kExactScale, cz * kExactScale};
+        for (int axis = 0; axis < 2; axis++) {
+            if (dp[axis] == 0) {
+                if (p[axis] < c[axis] || p[axis] > c[axis] + kExactScale) {
+                    return false;
+                }
+                continue;
+            }
+            long long t0 = (c[axis] - p[axis]) * d / dp[axis];
+            long long t1 = (c[axis] + kExactScale - p[axis]) * d / dp[axis];
+            lo = max(lo, min(t0, t1));
+            hi = min(hi, max(t0, t1));
+        }
+        return lo <= hi;
+    };
+    long long a_lo, a_hi, b_lo, b_hi;
+    if (!clip(ax, az, a_lo, a_hi) || !clip(bx, bz, b_lo, b_hi)) {
+        return false;
+    }
+    if (a_hi >= b_lo && b_hi >= a_lo) {
+        return true; // neighbours, the caller has ruled out a squeeze
+    }
+    long long g0 = a_hi < b_lo ? a_hi : b_hi;
+    long long g1 = a_hi < b_lo ? b_lo : a_lo;
+
+    // the stretch between the cells, cut where it crosses a grown wall's
+    // border. every piece is inside or outside each wall as a whole, its
+    // midpoint decides it
+    vector<long long> cuts = {g0, g1};
+    const long long lo[2] = {min(ax, bx), min(az, bz)};
+    const long long hi[2] = {max(ax, bx) + 1, max(az, bz) + 1};
+    const long long p[2] = {ux, uz}, dp[2] = {dx, dz};
+    for (int axis = 0; axis < 2; axis++) {
+        for (long long k = lo[axis]; dp[axis] != 0 && k <= hi[axis]; k++) {
+            for (int s = -1; s <= 1; s += 2) {
+                long long t = (k * kExactScale + s * kWallGrow - p[axis]) * d / dp[axis];
+                if (t > g0 && t < g1) {
+                    cuts.push_back(t);
+                }
+            }
+        }
+    }
+    sort(cuts.begin(), cuts.end());
+    for (size_t i = 0; i + 1 < cuts.size(); i++) {
+        if (cuts[i] == cuts[i + 1]) {
+            continue;
+        }
+        long long mid = cuts[i] + cuts[i + 1]; // times 2d
+        if (point_in_walls(grid, w, h, 2 * ux * d + dx * mid, 2 * uz * d + dz * mid, 2 * d)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// two cells see each other if some segment from a point of one to a point
+// of the other stays out of the walls. the segments between a few sample
+// points catch most pairs cheaply. the rest is exact: if such a segment
+// exists it can be slid and turned until its line runs through two corners
+// (of the cells or of the grown walls in between) without ever entering a
+// wall, so trying every line through two of those corners finds it
+bool Pvs::cells_see_each_other(const vector<char> &grid, int w, int h, int ax,
+                               int az, int bx, int bz) {
+    if (abs(ax - bx) == 1 && abs(az - bz) == 1 && is_wall(grid, w, h, ax, bz) &&
+        is_wall(grid, w, h, bx, az)) {
+        return false; // diagonal neighbours that only meet at a squeeze
+    }
+    const float lo = kSampleInset, hi = 1.f - kSampleInset;
+    const float offsets[9][2] = {{0.5f, 0.5f}, {lo, lo},   {hi, lo},
+                                 {lo, hi},     {hi, hi},   {0.5f, lo},
+                                 {0.5f, hi},   {lo, 0.5f}, {hi, 0.5f}};
+
+    for (int i = 0; i < 9; i++) {
+        float x0 = ax + offsets[i][0], z0 = az + offsets[i][1];
+        for (int j = 0; j < 9; j++) {
+            float x1 = bx + offsets[j][0], z1 = bz + offsets[j][1];
+            if (segment_clear(grid, w, h, x0, z0, x1, z1)) {
+                return true;
+            }
+        }
+    }
+
+    // corners of the two cells and of the walls that reach into their
+    // convex hull, i.e. within half a cell of the line between the centers.
+    // of a wall only the convex corners count, a line can't pivot on one
+    // that a neighbouring wall covers without entering that wall
+    vector<pair<long long, long long>> corners;
+    auto add_corners = [&](int cx, int cz, long long grow) {
+        for (int k = 0; k < 4; k++) {
+            int sx = (k & 1) ? 1 : -1, sz = (k >> 1) ? 1 : -1;
+            if (grow != 0 && (is_wall(grid, w, h, cx + sx, cz) || is_wall(grid, w, h, cx, cz + sz) ||
+                              is_wall(grid, w, h, cx + sx, cz + sz))) {
+                continue;
+            }
+            long long x = (cx + (k & 1)) * kExactScale + sx * grow;
+            long long z = (cz + (k >> 1)) * kExactScale + sz * grow;
+            corners.push_back(make_pair(x, z));
+        }
+    };
+    add_corners(ax, az, 0);
+    add_corners(bx, bz, 0);
+    float px = ax + 0.5f, pz = az + 0.5f;
+    float qx = bx + 0.5f, qz = bz + 0.5f;
+    // one ring past the cells too, grown walls reach a little into the hull
+    for (int z = min(az, bz) - 1; z <= max(az, bz) + 1; z++) {
+        for (int x = min(ax, bx) - 1; x <= max(ax, bx) + 1; x++) {
+            if (!is_wall(grid, w, h, x, z)) {
+                continue;
+            }
+            // center segment against the wall grown by half a cell (and a
+            // bit), slab test
+            float t0 = 0.f, t1 = 1.f;
+            const float p[2] = {px, pz}, dp[2] = {qx - px, qz - pz};
+            const float box_lo[2] = {x - 0.5f - kSampleInset, z - 0.5f - kSampleInset};
+            const float box_hi[2] = {x + 1.5f + kSampleInset, z + 1.5f + kSampleInset};
+            for (int axis = 0; axis < 2 && t0 <= t1; axis++) {
+                if (dp[axis] == 0.f) {
+                    if (p[axis] < box_lo[axis] || p[axis] > box_hi[axis]) {
+                        t0 = 2.f;
+                    }
+                    continue;
+                }
+                float ta = (box_lo[axis] - p[axis]) / dp[axis];
+                float tb = (box_hi[axis] - p[axis]) / dp[axis];
+                t0 = max(t0, min(ta, tb));
+                t1 = min(t1, max(ta, tb));
+            }
+            if (t0 <= t1) {
+                add_corners(x, z, kWallGrow);
+            }
+        }
+    }
+    sort(corners.begin(), corners.end());
+    corners.erase(unique(corners.begin(), corners.end()), corners.end());
+
+    for (size_t i = 0; i < corners.size(); i++) {
+        for (size_t j = i + 1; j < corners.size(); j++) {
+            if (line_connects(grid, w, h, ax, az, bx, bz, corners[i].first, corners[i].second,
+                              corners[j].first, corners[j].second)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// flood fill out of the source cell. a cell can only be visible if one of its
+// neighbours is (a sightline reaches it through the closure of an open
+// neighbour, which the same sightline sees), so we only ever test the rim of
+// the region found so far instead of the whole map. the test is exact up to
+// kWallGrow, so the open cells found are everything that can be seen
+// through a gap wider than that
+void Pvs::bake_cell(const vector<char> &grid, int w, int h, int src,
+                    vector<int> &out) {
+    enum { UNTESTED = 0, VISIBLE, HIDDEN };
+    vector<unsigned char> state(w * h, UNTESTED);
+    vector<int> queue;
+    queue.reserve(w * h);
+
+    int sx = src % w, sz = src / w;
+    state[src] = VISIBLE;
+    queue.push_back(src);
+
+    for (size_t head = 0; head < queue.size(); head++) {
+        int cx = queue[head] % w, cz = queue[head] / w;
+        for (int dz = -1; dz <= 1; dz++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                int nx = cx + dx, nz = cz + dz;
+                if (nx < 0 || nx >= w || nz < 0 || nz >= h) {
+                    continue;
+                }
+                int n = nz * w + nx;
+                if (state[n] != UNTESTED || is_wall(grid, w, h, nx, nz)) {
+                    continue;
+                }
+                if (cells_see_each_other(grid, w, h, sx, sz, nx, nz)) {
+                    state[n] = VISIBLE;
+                    queue.push_back(n);
+                } else {
+                    state[n] = HIDDEN;
+                }
+            }
+        }
+    }
+
+    // grow the visible open cells by one ring, which picks up every wall
+    // face that borders them
+    vector<unsigned char> in_set(w * h, 0);
+    for (size_t i = 0; i < queue.size(); i++) {
+        int cx = queue[i] % w, cz = queue[i] / w;
+        for (int dz = -1; dz <= 1; dz++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                int nx = cx + dx, nz = cz + dz;
+                if (nx >= 0 && nx < w && nz >= 0 && nz < h) {
+                    in_set[nz * w + nx] = 1;
+                }
+            }
+        }
+    }
+
+    out.clear();
+    for (int i = 0; i < w * h; i++) {
+        if (in_set[i]) {
+            out.push_back(i);
+        }
+    }
+}
+
+void Pvs::bake(const vector<char> &grid, int w, int h, int num_threads) {
+    if (num_threads <= 0) {
+        num_threads = (int)thread::hardware_concurrency();
+        if (num_threads <= 0) {
+            num_threads = 1;
+        }
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    vector<vector<int>> sets(w * h);
+    atomic<int> next_cell(0);
+    auto worker = [&]() {
+        PROFILE_ZONE("pvs bake cells");
+        while (true) {
+            int cell = next_cell++;
+            if (cell >= w * h) {
+                break;
+            }
+            if (!is_wall(grid, w, h, cell % w, cell / w)) {
+                bake_cell(grid, w, h, cell, sets[cell]);
+            }
+        }
+    };
+
+    vector<thread> workers;
+    for (int i = 1; i < num_threads; i++) {
+        workers.push_back(thread(worker));
+    }
+    worker(); // this thread helps out too
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+
+    // flatten into one array
+    w_ = w;
+    h_ = h;
+    grid_hash_ = hash_grid(grid, w, h);
+    offsets_.assign(w * h + 1, 0);
+    cells_.clear();
+    for (int i = 0; i < w * h; i++) {
+        offsets_[i] = (int)cells_.size();
+        cells_.insert(cells_.end(), sets[i].begin(), sets[i].end());
+    }
+    offsets_[w * h] = (int)cells_.size();
+
+    float secs = chrono::duration<float>(chrono::steady_clock::now() - start).count();
+    printf("baked PVS for %dx%d map in %.2fs on %d threads (avg %.1f cells per set)\n",
+           w, h, secs, num_threads, cells_.size() / (float)max(1, w * h));
+}
+
+// cache layout: "PVS2", w, h, grid hash, number of cells in all sets,
+// offsets (w * h + 1 ints), cells
+bool Pvs::save(const char *fname) const {
+    FILE *fp = fopen(fname, "wb");
+    if (fp == NULL) {
+        printf("can't write PVS cache %s\n", fname);
+        return false;
+    }
+    int32_t header[3] = {w_, h_, (int32_t)cells_.size()};
+    fwrite("PVS2", 1, 4, fp);
+    fwrite(header, sizeof(int32_t), 3, fp);
+    fwrite(&grid_hash_, sizeof(uint64_t), 1, fp);
+    fwrite(offsets_.data(), sizeof(int), offsets_.size(), fp);
+    fwrite(cells_.data(), sizeof(int), cells_.size(), fp);
+    fclose(fp);
+    return true;
+}
+
+bool Pvs::load(const char *fname, uint64_t grid_hash) {
+    FILE *fp = fopen(fname, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+
+    char magic[4];
+    int32_t header[3];
+    uint64_t hash = 0;
+    bool ok = fread(magic, 1, 4, fp) == 4 && memcmp(magic, "PVS2", 4) == 0 &&
+              fread(header, sizeof(int32_t), 3, fp) == 3 &&
+              fread(&hash, sizeof(uint64_t), 1, fp) == 1 && hash == grid_hash &&
+              header[0] > 0 && header[1] > 0 && header[2] >= 0 &&
+              (int64_t)header[0] * header[1] < INT_MAX;
+    if (ok) {
+        w_ = header[0];
+        h_ = header[1];
+        offsets_.resize(w_ * h_ + 1);
+        cells_.resize(header[2]);
+        ok = fread(offsets_.data(), sizeof(int), offsets_.size(), fp) == offsets_.size() &&
+             fread(cells_.data(), sizeof(int), cells_.size(), fp) == cells_.size();
+    }
+    fclose(fp);
+
+    // the hash only says the map matches, the sets themselves still have to
+    // hold together before visible_cells() indexes with them
+    if (ok) {
+        ok = offsets_[0] == 0 && offsets_.back() == (int)cells_.size();
+        for (size_t i = 1; ok && i < offsets_.size(); i++) {
+            ok = offsets_[i - 1] <= offsets_[i];
+        }
+        for (size_t i = 0; ok && i < cells_.size(); i++) {
+            ok = cells_[i] >= 0 && cells_[i] < w_ * h_;
+        }
+    }
+
+    if (!ok) {
+        printf("PVS cache %s is stale or corrupt, ignoring it\n", fname);
+        offsets_.clear();
+        cells_.clear();
+        return false;
+    }
+    grid_hash_ = hash;
+    return true;
+}
+
+bool Pvs::load_or_bake(const char *scene_file, const vector<char> &grid, int w,
+                       int h, int num_threads) {
+    string cache_file = string(scene_file) + ".pvs";
+    if (load(cache_file.c_str(), hash_grid(grid, w, h)) && w_ == w && h_ == h) {
+        printf("loaded PVS cache %s\n", cache_file.c_str());
+        return false;
+    }
+    bake(grid, w, h, num_threads);
+    save(cache_file.c_str());
+    return true;
+}
+
+bool Pvs::visible_cells(int x, int z, const int *&cells, int &count) const {
+    if (empty() || x < 0 || x >= w_ || z < 0 || z >= h_) {
+        return false;
+    }
+    int idx = z * w_ + x;
+    count = offsets_[idx + 1] - offsets_[idx];
+    if (count == 0) {
+        return false; // walls don't get a set
+    }
+    cells = cells_.data() + offsets_[idx];
+    return true;
+}
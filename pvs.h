@@ -0,0 +1,62 @@
+#ifndef PVS_H
+#define PVS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// potentially visible sets for grid mazes.
+// for every open cell we keep the list of cells (walls included) that can
+// possibly be seen from anywhere inside that cell. the sets are baked once and
+// cached next to the scene file as <scene>.pvs
+class Pvs {
+public:
+  Pvs() = default;
+  ~Pvs() = default;
+
+  // loads <scene_file>.pvs if it was baked from the same grid, otherwise bakes
+  // the sets and writes the cache back out. returns true if it had to bake
+  bool load_or_bake(const char *scene_file, const vector<char> &grid, int w,
+                    int h, int num_threads = 0);
+
+  // num_threads = 0 uses every core
+  void bake(const vector<char> &grid, int w, int h, int num_threads = 0);
+  bool load(const char *fname, uint64_t grid_hash);
+  bool save(const char *fname) const;
+
+  bool empty() const { return offsets_.empty(); }
+
+  // cells visible from cell (x, z) as indices z * w + x.
+  // returns false if there is no set for that cell (wall or outside the map)
+  bool visible_cells(int x, int z, const int *&cells, int &count) const;
+
+  static uint64_t hash_grid(const vector<char> &grid, int w, int h);
+
+private:
+  int w_ = 0, h_ = 0;
+  uint64_t grid_hash_ = 0;
+  // set of cell i is cells_[offsets_[i] .. offsets_[i + 1]), empty for walls
+  vector<int> offsets_;
+  vector<int> cells_;
+
+  static bool is_wall(const vector<char> &grid, int w, int h, int x, int z) {
+    if (x < 0 || x >= w || z < 0 || z >= h) {
+      return true; // outside the map counts as solid
+    }
+    return grid[z * w + x] == 'W';
+  }
+
+  static bool segment_clear(const vector<char> &grid, int w, int h, float x0,
+                            float z0, float x1, float z1);
+  static bool line_connects(const vector<char> &grid, int w, int h, int ax,
+                            int az, int bx, int bz, long long ux, long long uz,
+                            long long vx, long long vz);
+  static bool cells_see_each_other(const vector<char> &grid, int w, int h,
+                                   int ax, int az, int bx, int bz);
+  static void bake_cell(const vector<char> &grid, int w, int h, int src,
+                        vector<int> &out);
+};
+
+#endif // PVS_H
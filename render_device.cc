@@ -0,0 +1,1679 @@
+#include "render_device.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+const int RenderDevice::kMaxPrintedErrors;
+
+RenderDevice &render_device() {
+    static RenderDevice device;
+    return device;
+}
+
+bool RenderDevice::load_gl(GLADloadproc proc) {
+    if (!gladLoadGLLoader(proc)) {
+        return false;
+    }
+    backend_ = DEVICE_GL;
+    proc_ = proc;
+    return true;
+}
+
+void *RenderDevice::proc_address(const char *name) const {
+    return proc_ != nullptr ? proc_(name) : nullptr;
+}
+
+// ---- null backend ----
+
+namespace {
+
+typedef enum null_kind_t {
+    KIND_NONE = 0,
+    KIND_DELETED,
+    KIND_BUFFER,
+    KIND_TEXTURE,
+    KIND_VERTEX_ARRAY,
+    KIND_FRAMEBUFFER,
+    KIND_RENDERBUFFER,
+    KIND_QUERY,
+    KIND_SHADER,
+    KIND_PROGRAM,
+    KIND_SYNC
+} null_kind_t;
+
+// anything gl hands out a name for. one counter for all kinds, so a name is
+// never reused and never means two things
+typedef struct null_object_t {
+    null_kind_t kind;
+    GLenum target; // textures and queries: what it was first used as, else 0
+    // buffer contents, kept so maps and indirect draws have something to read
+    vector<unsigned char> data;
+    bool immutable;
+    int width, height, depth; // level 0 of a texture
+    bool linked;
+    map<string, GLint> uniforms, blocks, attribs;
+} null_object_t;
+
+// where a texture binds on a unit
+enum null_texture_slot_t {
+    SLOT_2D,
+    SLOT_CUBE_MAP,
+    SLOT_2D_ARRAY,
+    SLOT_3D,
+    SLOT_BUFFER,
+    SLOT_2D_MULTISAMPLE,
+    NUM_TEXTURE_SLOTS
+};
+
+const int kMaxUnits = 32;
+const int kMaxAttribs = 16;
+
+const GLenum kBufferTargets[] = {GL_ARRAY_BUFFER,          GL_ELEMENT_ARRAY_BUFFER,
+                                 GL_UNIFORM_BUFFER,        GL_TEXTURE_BUFFER,
+                                 GL_DRAW_INDIRECT_BUFFER,  GL_SHADER_STORAGE_BUFFER,
+                                 GL_COPY_READ_BUFFER,      GL_COPY_WRITE_BUFFER,
+                                 GL_PIXEL_PACK_BUFFER,     GL_PIXEL_UNPACK_BUFFER};
+const int kNumBufferTargets = sizeof(kBufferTargets) / sizeof(kBufferTargets[0]);
+
+const GLenum kQueryTargets[] = {GL_SAMPLES_PASSED, GL_ANY_SAMPLES_PASSED,
+                                GL_ANY_SAMPLES_PASSED_CONSERVATIVE, GL_TIME_ELAPSED,
+                                GL_PRIMITIVES_GENERATED};
+const int kNumQueryTargets = sizeof(kQueryTargets) / sizeof(kQueryTargets[0]);
+
+// what a 4.3 driver without buffer storage would list, only the ones the
+// engine looks for
+const char *kExtensions[] = {"GL_ARB_base_instance",
+                             "GL_ARB_invalidate_subdata",
+                             "GL_ARB_multi_draw_indirect",
+                             "GL_ARB_occlusion_query2",
+                             "GL_ARB_shader_draw_parameters",
+                             "GL_ARB_shader_storage_buffer_object",
+                             "GL_ARB_texture_buffer_range",
+                             "GL_ARB_timer_query"};
+const int kNumExtensions = sizeof(kExtensions) / sizeof(kExtensions[0]);
+
+typedef struct null_state_t {
+    vector<null_object_t> objects; // by name, 0 is never handed out
+    device_stats_t frame;
+    int total_errors;
+    GLenum error; // for glGetError, the first since the last call
+
+    GLuint buffers[kNumBufferTargets];
+    GLuint textures[kMaxUnits][NUM_TEXTURE_SLOTS];
+    int unit;
+    GLuint program, vertex_array, draw_framebuffer, read_framebuffer, renderbuffer;
+    GLuint queries[kNumQueryTargets];
+    bool conditional;
+    GLint viewport[4];
+} null_state_t;
+
+null_state_t null_state;
+
+void reset_null() {
+    null_state.objects.assign(1, null_object_t());
+    null_state.objects[0].kind = KIND_NONE;
+    null_state.frame = {};
+    null_state.total_errors = 0;
+    null_state.error = GL_NO_ERROR;
+    memset(null_state.buffers, 0, sizeof(null_state.buffers));
+    memset(null_state.textures, 0, sizeof(null_state.textures));
+    memset(null_state.queries, 0, sizeof(null_state.queries));
+    null_state.unit = 0;
+    null_state.program = null_state.vertex_array = 0;
+    null_state.draw_framebuffer = null_state.read_framebuffer = null_state.renderbuffer = 0;
+    null_state.conditional = false;
+    memset(null_state.viewport, 0, sizeof(null_state.viewport));
+}
+
+// every entry point starts here
+null_state_t &call() {
+    null_state.frame.calls++;
+    return null_state;
+}
+
+// a call real gl would have rejected. the first few get printed with what
+// was wrong, all of them are counted
+void fail(GLenum error, const char *func, const char *fmt, ...) {
+    null_state.frame.errors++;
+    if (null_state.error == GL_NO_ERROR) {
+        null_state.error = error;
+    }
+    if (null_state.total_errors++ < RenderDevice::kMaxPrintedErrors) {
+        char what[256];
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(what, sizeof(what), fmt, args);
+        va_end(args);
+        printf("null device: %s: %s\n", func, what);
+        if (null_state.total_errors == RenderDevice::kMaxPrintedErrors) {
+            printf("null device: not printing any more errors, counting them only\n");
+        }
+    }
+}
+
+GLuint new_name(null_kind_t kind) {
+    GLuint name = (GLuint)null_state.objects.size();
+    null_state.objects.push_back(null_object_t());
+    null_object_t &object = null_state.objects.back();
+    object.kind = kind;
+    object.target = 0;
+    object.immutable = false;
+    object.width = object.height = object.depth = 0;
+    object.linked = false;
+    return name;
+}
+
+bool is(GLuint name, null_kind_t kind) {
+    return name < null_state.objects.size() && null_state.objects[name].kind == kind;
+}
+
+// 0 or a name of the kind, else an error
+bool known(GLuint name, null_kind_t kind, const char *func, const char *what) {
+    if (name == 0 || is(name, kind)) {
+        return true;
+    }
+    if (is(name, KIND_DELETED)) {
+        fail(GL_INVALID_OPERATION, func, "%s %u was deleted", what, name);
+    } else {
+        fail(GL_INVALID_OPERATION, func, "%u is not a %s name", name, what);
+    }
+    return false;
+}
+
+void gen_names(GLsizei n, GLuint *names, null_kind_t kind, const char *func) {
+    if (n < 0) {
+        fail(GL_INVALID_VALUE, func, "n = %d", n);
+        return;
+    }
+    for (GLsizei i = 0; i < n; i++) {
+        names[i] = new_name(kind);
+    }
+}
+
+// the bound names that gl resets on delete are cleared by the caller
+void delete_names(GLsizei n, const GLuint *names, null_kind_t kind, const char *func) {
+    if (n < 0) {
+        fail(GL_INVALID_VALUE, func, "n = %d", n);
+        return;
+    }
+    for (GLsizei i = 0; i < n; i++) {
+        if (is(names[i], kind)) {
+            null_object_t &object = null_state.objects[names[i]];
+            object.kind = KIND_DELETED;
+            vector<unsigned char>().swap(object.data);
+        }
+    }
+}
+
+int buffer_slot(GLenum target) {
+    for (int i = 0; i < kNumBufferTargets; i++) {
+        if (kBufferTargets[i] == target) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int texture_slot(GLenum target) {
+    switch (target) {
+    case GL_TEXTURE_2D:
+        return SLOT_2D;
+    case GL_TEXTURE_CUBE_MAP:
+    case GL_TEXTURE_CUBE_MAP_POSITIVE_X:
+    case GL_TEXTURE_CUBE_MAP_NEGATIVE_X:
+    case GL_TEXTURE_CUBE_MAP_POSITIVE_Y:
+    case GL_TEXTURE_CUBE_MAP_NEGATIVE_Y:
+    case GL_TEXTURE_CUBE_MAP_POSITIVE_Z:
+    case GL_TEXTURE_CUBE_MAP_NEGATIVE_Z:
+        return SLOT_CUBE_MAP;
+    case GL_TEXTURE_2D_ARRAY:
+        return SLOT_2D_ARRAY;
+    case GL_TEXTURE_3D:
+        return SLOT_3D;
+    case GL_TEXTURE_BUFFER:
+        return SLOT_BUFFER;
+    case GL_TEXTURE_2D_MULTISAMPLE:
+        return SLOT_2D_MULTISAMPLE;
+    default:
+        return -1;
+    }
+}
+
+int query_slot(GLenum target) {
+    for (int i = 0; i < kNumQueryTargets; i++) {
+        if (kQueryTargets[i] == target) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// the buffer bound to target, nullptr (and an error) if there is none
+null_object_t *bound_buffer(GLenum target, const char *func) {
+    int slot = buffer_slot(target);
+    if (slot < 0) {
+        fail(GL_INVALID_ENUM, func, "buffer target 0x%x", target);
+        return nullptr;
+    }
+    if (null_state.buffers[slot] == 0) {
+        fail(GL_INVALID_OPERATION, func, "no buffer bound to 0x%x", target);
+        return nullptr;
+    }
+    return &null_state.objects[null_state.buffers[slot]];
+}
+
+bool in_range(const null_object_t &buffer, GLintptr offset, GLsizeiptr size, const char *func) {
+    if (offset < 0 || size < 0 || offset + size > (GLintptr)buffer.data.size()) {
+        fail(GL_INVALID_VALUE, func, "range %lld + %lld, the buffer has %lld bytes",
+             (long long)offset, (long long)size, (long long)buffer.data.size());
+        return false;
+    }
+    return true;
+}
+
+// the texture bound to target on the active unit
+null_object_t *bound_texture(GLenum target, const char *func) {
+    int slot = texture_slot(target);
+    if (slot < 0) {
+        fail(GL_INVALID_ENUM, func, "texture target 0x%x", target);
+        return nullptr;
+    }
+    GLuint texture = null_state.textures[null_state.unit][slot];
+    if (texture == 0) {
+        fail(GL_INVALID_OPERATION, func, "no texture bound to 0x%x on unit %d", target,
+             null_state.unit);
+        return nullptr;
+    }
+    return &null_state.objects[texture];
+}
+
+long long pixel_bytes(GLenum format, GLenum type) {
+    long long components = 4;
+    switch (format) {
+    case GL_RED:
+    case GL_RED_INTEGER:
+    case GL_DEPTH_COMPONENT:
+    case GL_STENCIL_INDEX:
+    case GL_DEPTH_STENCIL:
+        components = 1;
+        break;
+    case GL_RG:
+    case GL_RG_INTEGER:
+        components = 2;
+        break;
+    case GL_RGB:
+    case GL_BGR:
+    case GL_RGB_INTEGER:
+        components = 3;
+        break;
+    }
+    switch (type) {
+    case GL_UNSIGNED_BYTE:
+    case GL_BYTE:
+        return components;
+    case GL_UNSIGNED_SHORT:
+    case GL_SHORT:
+    case GL_HALF_FLOAT:
+        return components * 2;
+    default: // float, int, the packed 32 bit types
+        return components * 4;
+    }
+}
+
+// draws need a linked program and a vertex array, like core profile gl
+bool can_draw(const char *func) {
+    if (null_state.program == 0) {
+        fail(GL_INVALID_OPERATION, func, "no program bound");
+        return false;
+    }
+    if (!null_state.objects[null_state.program].linked) {
+        fail(GL_INVALID_OPERATION, func, "program %u is not linked", null_state.program);
+        return false;
+    }
+    if (null_state.vertex_array == 0) {
+        fail(GL_INVALID_OPERATION, func, "no vertex array bound");
+        return false;
+    }
+    return true;
+}
+
+bool has_program(const char *func) {
+    if (null_state.program == 0) {
+        fail(GL_INVALID_OPERATION, func, "no program bound");
+        return false;
+    }
+    return true;
+}
+
+// ---- strings and queries of the device itself ----
+
+const GLubyte *APIENTRY null_get_string(GLenum name) {
+    call();
+    switch (name) {
+    case GL_VENDOR:
+        return (const GLubyte *)"null device";
+    case GL_RENDERER:
+        return (const GLubyte *)"null renderer (validates and counts, draws nothing)";
+    case GL_VERSION:
+        return (const GLubyte *)"4.3 null device";
+    case GL_SHADING_LANGUAGE_VERSION:
+        return (const GLubyte *)"4.30 null device";
+    default:
+        // GL_EXTENSIONS is gone in core, glGetStringi lists them
+        fail(GL_INVALID_ENUM, "glGetString", "name 0x%x", name);
+        return nullptr;
+    }
+}
+
+const GLubyte *APIENTRY null_get_stringi(GLenum name, GLuint index) {
+    call();
+    if (name != GL_EXTENSIONS || index >= (GLuint)kNumExtensions) {
+        fail(GL_INVALID_VALUE, "glGetStringi", "name 0x%x index %u", name, index);
+        return nullptr;
+    }
+    return (const GLubyte *)kExtensions[index];
+}
+
+GLenum APIENTRY null_get_error() {
+    call();
+    GLenum error = null_state.error;
+    null_state.error = GL_NO_ERROR;
+    return error;
+}
+
+void APIENTRY null_get_integerv(GLenum pname, GLint *data) {
+    call();
+    switch (pname) {
+    case GL_NUM_EXTENSIONS:
+        *data = kNumExtensions;
+        break;
+    case GL_NUM_PROGRAM_BINARY_FORMATS:
+        *data = 0; // no binary cache, every run compiles the same
+        break;
+    case GL_MAJOR_VERSION:
+        *data = 4;
+        break;
+    case GL_MINOR_VERSION:
+        *data = 3;
+        break;
+    case GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT:
+        *data = 256;
+        break;
+    case GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT:
+    case GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT:
+        *data = 16;
+        break;
+    case GL_VIEWPORT:
+        memcpy(data, null_state.viewport, sizeof(null_state.viewport));
+        break;
+    case GL_DRAW_FRAMEBUFFER_BINDING:
+        *data = (GLint)null_state.draw_framebuffer;
+        break;
+    case GL_READ_FRAMEBUFFER_BINDING:
+        *data = (GLint)null_state.read_framebuffer;
+        break;
+    case GL_CURRENT_PROGRAM:
+        *data = (GLint)null_state.program;
+        break;
+    case GL_VERTEX_ARRAY_BINDING:
+        *data = (GLint)null_state.vertex_array;
+        break;
+    case GL_MAX_TEXTURE_SIZE:
+    case GL_MAX_RENDERBUFFER_SIZE:
+        *data = 16384;
+        break;
+    case GL_MAX_ARRAY_TEXTURE_LAYERS:
+        *data = 2048;
+        break;
+    case GL_MAX_TEXTURE_IMAGE_UNITS:
+    case GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS:
+        *data = kMaxUnits;
+        break;
+    case GL_MAX_VERTEX_ATTRIBS:
+        *data = kMaxAttribs;
+        break;
+    case GL_MAX_UNIFORM_BLOCK_SIZE:
+        *data = 65536;
+        break;
+    case GL_MAX_TEXTURE_BUFFER_SIZE:
+        *data = 1 << 27;
+        break;
+    default:
+        // limits nobody asks for yet, zero rather than garbage
+        *data = 0;
+        break;
+    }
+}
+
+void APIENTRY null_get_integer64v(GLenum pname, GLint64 *data) {
+    call();
+    *data = 0; // GL_TIMESTAMP, the gpu clock never moves
+}
+
+// ---- state ----
+
+void APIENTRY null_enable(GLenum cap) {
+    call().frame.state_changes++;
+}
+
+void APIENTRY null_disable(GLenum cap) {
+    call().frame.state_changes++;
+}
+
+void APIENTRY null_depth_func(GLenum func) {
+    call().frame.state_changes++;
+}
+
+void APIENTRY null_depth_mask(GLboolean flag) {
+    call().frame.state_changes++;
+}
+
+void APIENTRY null_color_mask(GLboolean r, GLboolean g, GLboolean b, GLboolean a) {
+    call().frame.state_changes++;
+}
+
+void APIENTRY null_blend_func(GLenum src, GLenum dst) {
+    call().frame.state_changes++;
+}
+
+void APIENTRY null_cull_face(GLenum mode) {
+    call().frame.state_changes++;
+}
+
+void APIENTRY null_polygon_offset(GLfloat factor, GLfloat units) {
+    call().frame.state_changes++;
+}
+
+void APIENTRY null_stencil_func(GLenum func, GLint ref, GLuint mask) {
+    call().frame.state_changes++;
+}
+
+void APIENTRY null_stencil_op(GLenum sfail, GLenum zfail, GLenum zpass) {
+    call().frame.state_changes++;
+}
+
+void APIENTRY null_clear_color(GLfloat r, GLfloat g, GLfloat b, GLfloat a) {
+    call().frame.state_changes++;
+}
+
+void APIENTRY null_clear_stencil(GLint s) {
+    call().frame.state_changes++;
+}
+
+void APIENTRY null_pixel_storei(GLenum pname, GLint param) {
+    call().frame.state_changes++;
+}
+
+void APIENTRY null_viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+    call().frame.state_changes++;
+    if (width < 0 || height < 0) {
+        fail(GL_INVALID_VALUE, "glViewport", "%d x %d", width, height);
+        return;
+    }
+    null_state.viewport[0] = x;
+    null_state.viewport[1] = y;
+    null_state.viewport[2] = width;
+    null_state.viewport[3] = height;
+}
+
+void APIENTRY null_clear(GLbitfield mask) {
+    call();
+}
+
+void APIENTRY null_flush() {
+    call();
+}
+
+// ---- buffers ----
+
+void APIENTRY null_gen_buffers(GLsizei n, GLuint *buffers) {
+    call();
+    gen_names(n, buffers, KIND_BUFFER, "glGenBuffers");
+}
+
+void APIENTRY null_delete_buffers(GLsizei n, const GLuint *buffers) {
+    call();
+    for (GLsizei i = 0; i < n; i++) {
+        for (int slot = 0; slot < kNumBufferTargets; slot++) {
+            if (buffers[i] != 0 && null_state.buffers[slot] == buffers[i]) {
+                null_state.buffers[slot] = 0;
+            }
+        }
+    }
+    delete_names(n, buffers, KIND_BUFFER, "glDeleteBuffers");
+}
+
+void bind_buffer(GLenum target, GLuint buffer, const char *func) {
+    int slot = buffer_slot(target);
+    if (slot < 0) {
+        fail(GL_INVALID_ENUM, func, "buffer target 0x%x", target);
+        return;
+    }
+    if (known(buffer, KIND_BUFFER, func, "buffer")) {
+        null_state.buffers[slot] = buffer;
+    }
+}
+
+void APIENTRY null_bind_buffer(GLenum target, GLuint buffer) {
+    call().frame.state_changes++;
+    bind_buffer(target, buffer, "glBindBuffer");
+}
+
+void APIENTRY null_bind_buffer_base(GLenum target, GLuint index, GLuint buffer) {
+    call().frame.state_changes++;
+    bind_buffer(target, buffer, "glBindBufferBase");
+}
+
+void APIENTRY null_bind_buffer_range(GLenum target, GLuint index, GLuint buffer,
+                                     GLintptr offset, GLsizeiptr size) {
+    call().frame.state_changes++;
+    bind_buffer(target, buffer, "glBindBufferRange");
+    if (buffer != 0 && is(buffer, KIND_BUFFER)) {
+        if (size <= 0) {
+            fail(GL_INVALID_VALUE, "glBindBufferRange", "size %lld", (long long)size);
+        } else {
+            in_range(null_state.objects[buffer], offset, size, "glBindBufferRange");
+        }
+    }
+}
+
+void APIENTRY null_buffer_data(GLenum target, GLsizeiptr size, const void *data,
+                               GLenum usage) {
+    call();
+    null_object_t *buffer = bound_buffer(target, "glBufferData");
+    if (buffer == nullptr) {
+        return;
+    }
+    if (buffer->immutable) {
+        fail(GL_INVALID_OPERATION, "glBufferData", "buffer has immutable storage");
+        return;
+    }
+    if (size < 0) {
+        fail(GL_INVALID_VALUE, "glBufferData", "size %lld", (long long)size);
+        return;
+    }
+    buffer->data.assign((size_t)size, 0);
+    if (data != nullptr) {
+        memcpy(buffer->data.data(), data, (size_t)size);
+        null_state.frame.bytes_uploaded += size;
+    }
+}
+
+void APIENTRY null_buffer_storage(GLenum target, GLsizeiptr size, const void *data,
+                                  GLbitfield flags) {
+    call();
+    null_object_t *buffer = bound_buffer(target, "glBufferStorage");
+    if (buffer == nullptr) {
+        return;
+    }
+    if (buffer->immutable) {
+        fail(GL_INVALID_OPERATION, "glBufferStorage", "buffer has immutable storage");
+        return;
+    }
+    if (size <= 0) {
+        fail(GL_INVALID_VALUE, "glBufferStorage", "size %lld", (long long)size);
+        return;
+    }
+    buffer->data.assign((size_t)size, 0);
+    buffer->immutable = true;
+    if (data != nullptr) {
+        memcpy(buffer->data.data(), data, (size_t)size);
+        null_state.frame.bytes_uploaded += size;
+    }
+}
+
+void APIENTRY null_buffer_sub_data(GLenum target, GLintptr offset, GLsizeiptr size,
+                                   const void *data) {
+    call();
+    null_object_t *buffer = bound_buffer(target, "glBufferSubData");
+    if (buffer == nullptr || !in_range(*buffer, offset, size, "glBufferSubData")) {
+        return;
+    }
+    memcpy(buffer->data.data() + offset, data, (size_t)size);
+    null_state.frame.bytes_uploaded += size;
+}
+
+// the buffer's cpu copy. writes through it aren't counted as uploads, the
+// engine only maps persistent buffers and those need buffer storage, which
+// the null device doesn't offer
+void *APIENTRY null_map_buffer_range(GLenum target, GLintptr offset, GLsizeiptr length,
+                                     GLbitfield access) {
+    call();
+    null_object_t *buffer = bound_buffer(target, "glMapBufferRange");
+    if (buffer == nullptr || !in_range(*buffer, offset, length, "glMapBufferRange")) {
+        return nullptr;
+    }
+    return buffer->data.data() + offset;
+}
+
+// ---- textures ----
+
+void APIENTRY null_gen_textures(GLsizei n, GLuint *textures) {
+    call();
+    gen_names(n, textures, KIND_TEXTURE, "glGenTextures");
+}
+
+void APIENTRY null_delete_textures(GLsizei n, const GLuint *textures) {
+    call();
+    for (GLsizei i = 0; i < n; i++) {
+        for (int unit = 0; unit < kMaxUnits; unit++) {
+            for (int slot = 0; slot < NUM_TEXTURE_SLOTS; slot++) {
+                if (textures[i] != 0 && null_state.textures[unit][slot] == textures[i]) {
+                    null_state.textures[unit][slot] = 0;
+                }
+            }
+        }
+    }
+    delete_names(n, textures, KIND_TEXTURE, "glDeleteTextures");
+}
+
+void APIENTRY null_active_texture(GLenum texture) {
+    call().frame.state_changes++;
+    int unit = (int)texture - GL_TEXTURE0;
+    if (unit < 0 || unit >= kMaxUnits) {
+        fail(GL_INVALID_ENUM, "glActiveTexture", "unit 0x%x", texture);
+        return;
+    }
+    null_state.unit = unit;
+}
+
+void APIENTRY null_bind_texture(GLenum target, GLuint texture) {
+    call().frame.state_changes++;
+    int slot = texture_slot(target);
+    if (slot < 0 || (target != GL_TEXTURE_CUBE_MAP && slot == SLOT_CUBE_MAP)) {
+        fail(GL_INVALID_ENUM, "glBindTexture", "target 0x%x", target);
+        return;
+    }
+    if (!known(texture, KIND_TEXTURE, "glBindTexture", "texture")) {
+        return;
+    }
+    if (texture != 0) {
+        // a texture's target is fixed by its first bind
+        null_object_t &object = null_state.objects[texture];
+        if (object.target == 0) {
+            object.target = target;
+        } else if (object.target != target) {
+            fail(GL_INVALID_OPERATION, "glBindTexture", "texture %u is 0x%x, bound as 0x%x",
+                 texture, object.target, target);
+            return;
+        }
+    }
+    null_state.textures[null_state.unit][slot] = texture;
+}
+
+void set_level_size(null_object_t &texture, GLint level, int width, int height, int depth) {
+    if (level == 0) {
+        texture.width = width;
+        texture.height = height;
+        texture.depth = depth;
+    }
+}
+
+void APIENTRY null_tex_image_2d(GLenum target, GLint level, GLint internalformat,
+                                GLsizei width, GLsizei height, GLint border, GLenum format,
+                                GLenum type, const void *pixels) {
+    call();
+    null_object_t *texture = bound_texture(target, "glTexImage2D");
+    if (texture == nullptr) {
+        return;
+    }
+    if (width < 0 || height < 0 || level < 0) {
+        fail(GL_INVALID_VALUE, "glTexImage2D", "level %d, %d x %d", level, width, height);
+        return;
+    }
+    set_level_size(*texture, level, width, height, 1);
+    if (pixels != nullptr) {
+        null_state.frame.bytes_uploaded += (long long)width * height * pixel_bytes(format, type);
+    }
+}
+
+void APIENTRY null_tex_image_3d(GLenum target, GLint level, GLint internalformat,
+                                GLsizei width, GLsizei height, GLsizei depth, GLint border,
+                                GLenum format, GLenum type, const void *pixels) {
+    call();
+    null_object_t *texture = bound_texture(target, "glTexImage3D");
+    if (texture == nullptr) {
+        return;
+    }
+    if (width < 0 || height < 0 || depth < 0 || level < 0) {
+        fail(GL_INVALID_VALUE, "glTexImage3D", "level %d, %d x %d x %d", level, width, height,
+             depth);
+        return;
+    }
+    set_level_size(*texture, level, width, height, depth);
+    if (pixels != nullptr) {
+        null_state.frame.bytes_uploaded +=
+            (long long)width * height * depth * pixel_bytes(format, type);
+    }
+}
+
+void APIENTRY null_tex_sub_image_2d(GLenum target, GLint level, GLint xoffset, GLint yoffset,
+                                    GLsizei width, GLsizei height, GLenum format, GLenum type,
+                                    const void *pixels) {
+    call();
+    null_object_t *texture = bound_texture(target, "glTexSubImage2D");
+    if (texture == nullptr) {
+        return;
+    }
+    if (level == 0 && (xoffset < 0 || yoffset < 0 || xoffset + width > texture->width ||
+                       yoffset + height > texture->height)) {
+        fail(GL_INVALID_VALUE, "glTexSubImage2D", "%d x %d at %d, %d, the texture is %d x %d",
+             width, height, xoffset, yoffset, texture->width, texture->height);
+        return;
+    }
+    null_state.frame.bytes_uploaded += (long long)width * height * pixel_bytes(format, type);
+}
+
+void APIENTRY null_tex_parameteri(GLenum target, GLenum pname, GLint param) {
+    call().frame.state_changes++;
+    bound_texture(target, "glTexParameteri");
+}
+
+void APIENTRY null_tex_parameterfv(GLenum target, GLenum pname, const GLfloat *params) {
+    call().frame.state_changes++;
+    bound_texture(target, "glTexParameterfv");
+}
+
+void APIENTRY null_generate_mipmap(GLenum target) {
+    call();
+    bound_texture(target, "glGenerateMipmap");
+}
+
+void APIENTRY null_tex_buffer(GLenum target, GLenum internalformat, GLuint buffer) {
+    call().frame.state_changes++;
+    if (bound_texture(target, "glTexBuffer") != nullptr) {
+        known(buffer, KIND_BUFFER, "glTexBuffer", "buffer");
+    }
+}
+
+void APIENTRY null_tex_buffer_range(GLenum target, GLenum internalformat, GLuint buffer,
+                                    GLintptr offset, GLsizeiptr size) {
+    call().frame.state_changes++;
+    if (bound_texture(target, "glTexBufferRange") == nullptr ||
+        !known(buffer, KIND_BUFFER, "glTexBufferRange", "buffer") || buffer == 0) {
+        return;
+    }
+    in_range(null_state.objects[buffer], offset, size, "glTexBufferRange");
+}
+
+void APIENTRY null_get_tex_image(GLenum target, GLint level, GLenum format, GLenum type,
+                                 void *pixels) {
+    call();
+    null_object_t *texture = bound_texture(target, "glGetTexImage");
+    if (texture == nullptr) {
+        return;
+    }
+    // nothing was ever drawn into it
+    long long width = max(texture->width >> level, 1);
+    long long height = max(texture->height >> level, 1);
+    long long depth = max(texture->depth >> level, 1);
+    memset(pixels, 0, (size_t)(width * height * depth * pixel_bytes(format, type)));
+}
+
+void APIENTRY null_invalidate_tex_image(GLuint texture, GLint level) {
+    call();
+    known(texture, KIND_TEXTURE, "glInvalidateTexImage", "texture");
+}
+
+// ---- vertex arrays ----
+
+void APIENTRY null_gen_vertex_arrays(GLsizei n, GLuint *arrays) {
+    call();
+    gen_names(n, arrays, KIND_VERTEX_ARRAY, "glGenVertexArrays");
+}
+
+void APIENTRY null_delete_vertex_arrays(GLsizei n, const GLuint *arrays) {
+    call();
+    for (GLsizei i = 0; i < n; i++) {
+        if (arrays[i] != 0 && arrays[i] == null_state.vertex_array) {
+            null_state.vertex_array = 0;
+        }
+    }
+    delete_names(n, arrays, KIND_VERTEX_ARRAY, "glDeleteVertexArrays");
+}
+
+void APIENTRY null_bind_vertex_array(GLuint array) {
+    call().frame.state_changes++;
+    if (known(array, KIND_VERTEX_ARRAY, "glBindVertexArray", "vertex array")) {
+        null_state.vertex_array = array;
+    }
+}
+
+void APIENTRY null_vertex_attrib_pointer(GLuint index, GLint size, GLenum type,
+                                         GLboolean normalized, GLsizei stride,
+                                         const void *pointer) {
+    call();
+    if (index >= (GLuint)kMaxAttribs) {
+        fail(GL_INVALID_VALUE, "glVertexAttribPointer", "attribute %d", (int)index);
+    } else if (null_state.vertex_array == 0) {
+        fail(GL_INVALID_OPERATION, "glVertexAttribPointer", "no vertex array bound");
+    } else if (null_state.buffers[buffer_slot(GL_ARRAY_BUFFER)] == 0) {
+        fail(GL_INVALID_OPERATION, "glVertexAttribPointer", "no array buffer bound");
+    }
+}
+
+void APIENTRY null_enable_vertex_attrib_array(GLuint index) {
+    call();
+    if (index >= (GLuint)kMaxAttribs) {
+        fail(GL_INVALID_VALUE, "glEnableVertexAttribArray", "attribute %d", (int)index);
+    } else if (null_state.vertex_array == 0) {
+        fail(GL_INVALID_OPERATION, "glEnableVertexAttribArray", "no vertex array bound");
+    }
+}
+
+// ---- draws ----
+
+void APIENTRY null_draw_arrays(GLenum mode, GLint first, GLsizei count) {
+    call();
+    if (!can_draw("glDrawArrays")) {
+        return;
+    }
+    if (first < 0 || count < 0) {
+        fail(GL_INVALID_VALUE, "glDrawArrays", "first %d, count %d", first, count);
+        return;
+    }
+    null_state.frame.draws++;
+    null_state.frame.commands++;
+    null_state.frame.vertices += count;
+}
+
+void APIENTRY null_multi_draw_arrays_indirect(GLenum mode, const void *indirect,
+                                              GLsizei drawcount, GLsizei stride) {
+    call();
+    const char *func = "glMultiDrawArraysIndirect";
+    if (!can_draw(func)) {
+        return;
+    }
+    null_object_t *buffer = bound_buffer(GL_DRAW_INDIRECT_BUFFER, func);
+    if (buffer == nullptr) {
+        return;
+    }
+    // count, instance count, first, base instance
+    const GLsizeiptr kCommandSize = 4 * sizeof(GLuint);
+    if (stride == 0) {
+        stride = (GLsizei)kCommandSize;
+    }
+    GLintptr offset = (GLintptr)(uintptr_t)indirect;
+    if (drawcount < 0 || stride < kCommandSize || offset % 4 != 0) {
+        fail(GL_INVALID_VALUE, func, "drawcount %d, stride %d, offset %lld", drawcount, stride,
+             (long long)offset);
+        return;
+    }
+    if (drawcount == 0) {
+        return;
+    }
+    if (!in_range(*buffer, offset, (GLsizeiptr)(drawcount - 1) * stride + kCommandSize, func)) {
+        return;
+    }
+    for (GLsizei i = 0; i < drawcount; i++) {
+        GLuint command[4];
+        memcpy(command, buffer->data.data() + offset + (GLintptr)i * stride, sizeof(command));
+        null_state.frame.vertices += (long long)command[0] * command[1];
+    }
+    null_state.frame.draws++;
+    null_state.frame.commands += drawcount;
+}
+
+// ---- framebuffers ----
+
+void APIENTRY null_gen_framebuffers(GLsizei n, GLuint *framebuffers) {
+    call();
+    gen_names(n, framebuffers, KIND_FRAMEBUFFER, "glGenFramebuffers");
+}
+
+void APIENTRY null_delete_framebuffers(GLsizei n, const GLuint *framebuffers) {
+    call();
+    for (GLsizei i = 0; i < n; i++) {
+        if (framebuffers[i] == 0) {
+            continue;
+        }
+        if (framebuffers[i] == null_state.draw_framebuffer) {
+            null_state.draw_framebuffer = 0;
+        }
+        if (framebuffers[i] == null_state.read_framebuffer) {
+            null_state.read_framebuffer = 0;
+        }
+    }
+    delete_names(n, framebuffers, KIND_FRAMEBUFFER, "glDeleteFramebuffers");
+}
+
+void APIENTRY null_bind_framebuffer(GLenum target, GLuint framebuffer) {
+    call().frame.state_changes++;
+    if (!known(framebuffer, KIND_FRAMEBUFFER, "glBindFramebuffer", "framebuffer")) {
+        return;
+    }
+    if (target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER) {
+        null_state.draw_framebuffer = framebuffer;
+    }
+    if (target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER) {
+        null_state.read_framebuffer = framebuffer;
+    }
+}
+
+// the framebuffer an attach call changes
+bool attachable(GLenum target, const char *func) {
+    GLuint framebuffer =
+        target == GL_READ_FRAMEBUFFER ? null_state.read_framebuffer : null_state.draw_framebuffer;
+    if (framebuffer == 0) {
+        fail(GL_INVALID_OPERATION, func, "the window framebuffer takes no attachments");
+        return false;
+    }
+    return true;
+}
+
+void APIENTRY null_framebuffer_texture_2d(GLenum target, GLenum attachment, GLenum textarget,
+                                          GLuint texture, GLint level) {
+    call();
+    if (attachable(target, "glFramebufferTexture2D")) {
+        known(texture, KIND_TEXTURE, "glFramebufferTexture2D", "texture");
+    }
+}
+
+void APIENTRY null_framebuffer_renderbuffer(GLenum target, GLenum attachment,
+                                            GLenum renderbuffertarget, GLuint renderbuffer) {
+    call();
+    if (attachable(target, "glFramebufferRenderbuffer")) {
+        known(renderbuffer, KIND_RENDERBUFFER, "glFramebufferRenderbuffer", "renderbuffer");
+    }
+}
+
+GLenum APIENTRY null_check_framebuffer_status(GLenum target) {
+    call();
+    return GL_FRAMEBUFFER_COMPLETE;
+}
+
+void APIENTRY null_draw_buffer(GLenum buf) {
+    call().frame.state_changes++;
+}
+
+void APIENTRY null_read_buffer(GLenum src) {
+    call().frame.state_changes++;
+}
+
+void APIENTRY null_invalidate_framebuffer(GLenum target, GLsizei num_attachments,
+                                          const GLenum *attachments) {
+    call();
+    if (num_attachments < 0) {
+        fail(GL_INVALID_VALUE, "glInvalidateFramebuffer", "%d attachments", num_attachments);
+    }
+}
+
+void APIENTRY null_read_pixels(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format,
+                               GLenum type, void *pixels) {
+    call();
+    if (width < 0 || height < 0) {
+        fail(GL_INVALID_VALUE, "glReadPixels", "%d x %d", width, height);
+        return;
+    }
+    memset(pixels, 0, (size_t)((long long)width * height * pixel_bytes(format, type)));
+}
+
+void APIENTRY null_gen_renderbuffers(GLsizei n, GLuint *renderbuffers) {
+    call();
+    gen_names(n, renderbuffers, KIND_RENDERBUFFER, "glGenRenderbuffers");
+}
+
+void APIENTRY null_delete_renderbuffers(GLsizei n, const GLuint *renderbuffers) {
+    call();
+    for (GLsizei i = 0; i < n; i++) {
+        if (renderbuffers[i] != 0 && renderbuffers[i] == null_state.renderbuffer) {
+            null_state.renderbuffer = 0;
+        }
+    }
+    delete_names(n, renderbuffers, KIND_RENDERBUFFER, "glDeleteRenderbuffers");
+}
+
+void APIENTRY null_bind_renderbuffer(GLenum target, GLuint renderbuffer) {
+    call().frame.state_changes++;
+    if (known(renderbuffer, KIND_RENDERBUFFER, "glBindRenderbuffer", "renderbuffer")) {
+        null_state.renderbuffer = renderbuffer;
+    }
+}
+
+void APIENTRY null_renderbuffer_storage(GLenum target, GLenum internalformat, GLsizei width,
+                                        GLsizei height) {
+    call();
+    if (null_state.renderbuffer == 0) {
+        fail(GL_INVALID_OPERATION, "glRenderbufferStorage", "no renderbuffer bound");
+    } else if (width < 0 || height < 0) {
+        fail(GL_INVALID_VALUE, "glRenderbufferStorage", "%d x %d", width, height);
+    }
+}
+
+// ---- queries and fences ----
+
+void APIENTRY null_gen_queries(GLsizei n, GLuint *ids) {
+    call();
+    gen_names(n, ids, KIND_QUERY, "glGenQueries");
+}
+
+void APIENTRY null_delete_queries(GLsizei n, const GLuint *ids) {
+    call();
+    for (GLsizei i = 0; i < n; i++) {
+        for (int slot = 0; slot < kNumQueryTargets; slot++) {
+            if (ids[i] != 0 && null_state.queries[slot] == ids[i]) {
+                fail(GL_INVALID_OPERATION, "glDeleteQueries", "query %u is still active",
+                     ids[i]);
+                null_state.queries[slot] = 0;
+            }
+        }
+    }
+    delete_names(n, ids, KIND_QUERY, "glDeleteQueries");
+}
+
+bool active_query(GLuint id) {
+    for (int slot = 0; slot < kNumQueryTargets; slot++) {
+        if (null_state.queries[slot] == id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void APIENTRY null_begin_query(GLenum target, GLuint id) {
+    call();
+    int slot = query_slot(target);
+    if (slot < 0) {
+        fail(GL_INVALID_ENUM, "glBeginQuery", "target 0x%x", target);
+        return;
+    }
+    if (id == 0 || !known(id, KIND_QUERY, "glBeginQuery", "query")) {
+        if (id == 0) {
+            fail(GL_INVALID_OPERATION, "glBeginQuery", "query 0");
+        }
+        return;
+    }
+    if (null_state.queries[slot] != 0) {
+        fail(GL_INVALID_OPERATION, "glBeginQuery", "0x%x already has query %u active", target,
+             null_state.queries[slot]);
+        return;
+    }
+    null_state.objects[id].target = target;
+    null_state.queries[slot] = id;
+}
+
+void APIENTRY null_end_query(GLenum target) {
+    call();
+    int slot = query_slot(target);
+    if (slot < 0 || null_state.queries[slot] == 0) {
+        fail(GL_INVALID_OPERATION, "glEndQuery", "no query active on 0x%x", target);
+        return;
+    }
+    null_state.queries[slot] = 0;
+}
+
+void APIENTRY null_query_counter(GLuint id, GLenum target) {
+    call();
+    if (id == 0 || !is(id, KIND_QUERY)) {
+        fail(GL_INVALID_OPERATION, "glQueryCounter", "%u is not a query name", id);
+        return;
+    }
+    null_state.objects[id].target = target;
+}
+
+// results are in at once. samples passed is 1, everything is visible, so
+// conditional draws happen the same as without queries; times are 0
+bool query_result(GLuint id, GLenum pname, GLuint64 *result, const char *func) {
+    if (id == 0 || !is(id, KIND_QUERY)) {
+        fail(GL_INVALID_OPERATION, func, "%u is not a query name", id);
+        return false;
+    }
+    if (active_query(id)) {
+        fail(GL_INVALID_OPERATION, func, "query %u is still active", id);
+        return false;
+    }
+    GLenum target = null_state.objects[id].target;
+    if (pname == GL_QUERY_RESULT_AVAILABLE) {
+        *result = 1;
+    } else if (target == GL_TIME_ELAPSED || target == GL_TIMESTAMP) {
+        *result = 0;
+    } else {
+        *result = 1;
+    }
+    return true;
+}
+
+void APIENTRY null_get_query_objectiv(GLuint id, GLenum pname, GLint *params) {
+    call();
+    GLuint64 result = 0;
+    if (query_result(id, pname, &result, "glGetQueryObjectiv")) {
+        *params = (GLint)result;
+    }
+}
+
+void APIENTRY null_get_query_objectuiv(GLuint id, GLenum pname, GLuint *params) {
+    call();
+    GLuint64 result = 0;
+    if (query_result(id, pname, &result, "glGetQueryObjectuiv")) {
+        *params = (GLuint)result;
+    }
+}
+
+void APIENTRY null_get_query_objectui64v(GLuint id, GLenum pname, GLuint64 *params) {
+    call();
+    query_result(id, pname, params, "glGetQueryObjectui64v");
+}
+
+void APIENTRY null_begin_conditional_render(GLuint id, GLenum mode) {
+    call();
+    if (null_state.conditional) {
+        fail(GL_INVALID_OPERATION, "glBeginConditionalRender", "already rendering conditionally");
+        return;
+    }
+    if (id == 0 || !is(id, KIND_QUERY) || null_state.objects[id].target == 0) {
+        fail(GL_INVALID_OPERATION, "glBeginConditionalRender", "%u is not a query with a result",
+             id);
+        return;
+    }
+    if (active_query(id)) {
+        fail(GL_INVALID_OPERATION, "glBeginConditionalRender", "query %u is still active", id);
+        return;
+    }
+    null_state.conditional = true;
+}
+
+void APIENTRY null_end_conditional_render() {
+    call();
+    if (!null_state.conditional) {
+        fail(GL_INVALID_OPERATION, "glEndConditionalRender", "not rendering conditionally");
+    }
+    null_state.conditional = false;
+}
+
+GLsync APIENTRY null_fence_sync(GLenum condition, GLbitfield flags) {
+    call();
+    return (GLsync)(uintptr_t)new_name(KIND_SYNC);
+}
+
+GLenum APIENTRY null_client_wait_sync(GLsync sync, GLbitfield flags, GLuint64 timeout) {
+    call();
+    if (!is((GLuint)(uintptr_t)sync, KIND_SYNC)) {
+        fail(GL_INVALID_VALUE, "glClientWaitSync", "not a sync object");
+        return GL_WAIT_FAILED;
+    }
+    return GL_ALREADY_SIGNALED;
+}
+
+void APIENTRY null_delete_sync(GLsync sync) {
+    call();
+    GLuint name = (GLuint)(uintptr_t)sync;
+    if (name != 0 && !is(name, KIND_SYNC)) {
+        fail(GL_INVALID_VALUE, "glDeleteSync", "not a sync object");
+        return;
+    }
+    delete_names(1, &name, KIND_SYNC, "glDeleteSync");
+}
+
+// ---- shaders and programs ----
+
+GLuint APIENTRY null_create_shader(GLenum type) {
+    call();
+    GLuint shader = new_name(KIND_SHADER);
+    null_state.objects[shader].target = type;
+    return shader;
+}
+
+void APIENTRY null_delete_shader(GLuint shader) {
+    call();
+    if (known(shader, KIND_SHADER, "glDeleteShader", "shader")) {
+        delete_names(1, &shader, KIND_SHADER, "glDeleteShader");
+    }
+}
+
+void APIENTRY null_shader_source(GLuint shader, GLsizei count, const GLchar *const *string,
+                                 const GLint *length) {
+    call();
+    if (shader == 0 || !known(shader, KIND_SHADER, "glShaderSource", "shader")) {
+        return;
+    }
+    if (count < 0) {
+        fail(GL_INVALID_VALUE, "glShaderSource", "count %d", count);
+    }
+}
+
+void APIENTRY null_compile_shader(GLuint shader) {
+    call();
+    if (shader == 0 || !is(shader, KIND_SHADER)) {
+        fail(GL_INVALID_VALUE, "glCompileShader", "%u is not a shader name", shader);
+    }
+}
+
+void APIENTRY null_get_shaderiv(GLuint shader, GLenum pname, GLint *params) {
+    call();
+    if (shader == 0 || !is(shader, KIND_SHADER)) {
+        fail(GL_INVALID_VALUE, "glGetShaderiv", "%u is not a shader name", shader);
+        return;
+    }
+    switch (pname) {
+    case GL_COMPILE_STATUS:
+        *params = GL_TRUE;
+        break;
+    case GL_SHADER_TYPE:
+        *params = (GLint)null_state.objects[shader].target;
+        break;
+    default: // info log length
+        *params = 0;
+        break;
+    }
+}
+
+void APIENTRY null_get_shader_info_log(GLuint shader, GLsizei buf_size, GLsizei *length,
+                                       GLchar *info_log) {
+    call();
+    if (length != nullptr) {
+        *length = 0;
+    }
+    if (buf_size > 0) {
+        info_log[0] = '\0';
+    }
+}
+
+GLuint APIENTRY null_create_program() {
+    call();
+    return new_name(KIND_PROGRAM);
+}
+
+void APIENTRY null_delete_program(GLuint program) {
+    call();
+    if (known(program, KIND_PROGRAM, "glDeleteProgram", "program")) {
+        // gl keeps the current program alive until it is replaced, the
+        // engine never deletes one in use so that isn't modeled
+        if (program != 0 && program == null_state.program) {
+            null_state.program = 0;
+        }
+        delete_names(1, &program, KIND_PROGRAM, "glDeleteProgram");
+    }
+}
+
+bool is_program(GLuint program, const char *func) {
+    if (program == 0 || !is(program, KIND_PROGRAM)) {
+        fail(GL_INVALID_VALUE, func, "%u is not a program name", program);
+        return false;
+    }
+    return true;
+}
+
+void APIENTRY null_attach_shader(GLuint program, GLuint shader) {
+    call();
+    if (is_program(program, "glAttachShader") && (shader == 0 || !is(shader, KIND_SHADER))) {
+        fail(GL_INVALID_VALUE, "glAttachShader", "%u is not a shader name", shader);
+    }
+}
+
+void APIENTRY null_detach_shader(GLuint program, GLuint shader) {
+    call();
+    is_program(program, "glDetachShader");
+}
+
+void APIENTRY null_bind_attrib_location(GLuint program, GLuint index, const GLchar *name) {
+    call();
+    if (!is_program(program, "glBindAttribLocation")) {
+        return;
+    }
+    if (index >= (GLuint)kMaxAttribs) {
+        fail(GL_INVALID_VALUE, "glBindAttribLocation", "attribute %d", (int)index);
+        return;
+    }
+    null_state.objects[program].attribs[name] = (GLint)index;
+}
+
+void APIENTRY null_link_program(GLuint program) {
+    call();
+    if (is_program(program, "glLinkProgram")) {
+        null_state.objects[program].linked = true;
+    }
+}
+
+void APIENTRY null_program_parameteri(GLuint program, GLenum pname, GLint value) {
+    call();
+    is_program(program, "glProgramParameteri");
+}
+
+// there are no binary formats, a binary never links
+void APIENTRY null_program_binary(GLuint program, GLenum binary_format, const void *binary,
+                                  GLsizei length) {
+    call();
+    if (is_program(program, "glProgramBinary")) {
+        null_state.objects[program].linked = false;
+        fail(GL_INVALID_ENUM, "glProgramBinary", "format 0x%x", binary_format);
+    }
+}
+
+void APIENTRY null_get_program_binary(GLuint program, GLsizei buf_size, GLsizei *length,
+                                      GLenum *binary_format, void *binary) {
+    call();
+    if (length != nullptr) {
+        *length = 0;
+    }
+    is_program(program, "glGetProgramBinary");
+}
+
+void APIENTRY null_get_programiv(GLuint program, GLenum pname, GLint *params) {
+    call();
+    if (!is_program(program, "glGetProgramiv")) {
+        return;
+    }
+    switch (pname) {
+    case GL_LINK_STATUS:
+        *params = null_state.objects[program].linked ? GL_TRUE : GL_FALSE;
+        break;
+    case GL_COMPLETION_STATUS_ARB:
+        *params = GL_TRUE;
+        break;
+    default: // info log and binary length
+        *params = 0;
+        break;
+    }
+}
+
+void APIENTRY null_get_program_info_log(GLuint program, GLsizei buf_size, GLsizei *length,
+                                        GLchar *info_log) {
+    call();
+    if (length != nullptr) {
+        *length = 0;
+    }
+    if (buf_size > 0) {
+        info_log[0] = '\0';
+    }
+}
+
+// a stable id per name and program, handed out in the order they are asked for
+GLint name_id(map<string, GLint> &ids, const GLchar *name) {
+    map<string, GLint>::iterator it = ids.find(name);
+    if (it != ids.end()) {
+        return it->second;
+    }
+    GLint id = (GLint)ids.size();
+    ids[name] = id;
+    return id;
+}
+
+bool is_linked(GLuint program, const char *func) {
+    if (!is_program(program, func)) {
+        return false;
+    }
+    if (!null_state.objects[program].linked) {
+        fail(GL_INVALID_OPERATION, func, "program %u is not linked", program);
+        return false;
+    }
+    return true;
+}
+
+GLint APIENTRY null_get_uniform_location(GLuint program, const GLchar *name) {
+    call();
+    if (!is_linked(program, "glGetUniformLocation")) {
+        return -1;
+    }
+    return name_id(null_state.objects[program].uniforms, name);
+}
+
+GLuint APIENTRY null_get_uniform_block_index(GLuint program, const GLchar *name) {
+    call();
+    if (!is_linked(program, "glGetUniformBlockIndex")) {
+        return GL_INVALID_INDEX;
+    }
+    return (GLuint)name_id(null_state.objects[program].blocks, name);
+}
+
+// the bound location, else 0 like a program with that one input
+GLint APIENTRY null_get_attrib_location(GLuint program, const GLchar *name) {
+    call();
+    if (!is_linked(program, "glGetAttribLocation")) {
+        return -1;
+    }
+    map<string, GLint> &attribs = null_state.objects[program].attribs;
+    map<string, GLint>::iterator it = attribs.find(name);
+    return it != attribs.end() ? it->second : 0;
+}
+
+void APIENTRY null_uniform_block_binding(GLuint program, GLuint block_index, GLuint binding) {
+    call();
+    if (is_linked(program, "glUniformBlockBinding") &&
+        block_index >= null_state.objects[program].blocks.size()) {
+        fail(GL_INVALID_VALUE, "glUniformBlockBinding", "block %u", block_index);
+    }
+}
+
+void APIENTRY null_use_program(GLuint program) {
+    call().frame.state_changes++;
+    if (program != 0 && !is_linked(program, "glUseProgram")) {
+        return;
+    }
+    null_state.program = program;
+}
+
+void uniform(const char *func) {
+    null_state.frame.uniforms++;
+    has_program(func);
+}
+
+void APIENTRY null_uniform1f(GLint location, GLfloat v0) {
+    call();
+    uniform("glUniform1f");
+}
+
+void APIENTRY null_uniform1i(GLint location, GLint v0) {
+    call();
+    uniform("glUniform1i");
+}
+
+void APIENTRY null_uniform3fv(GLint location, GLsizei count, const GLfloat *value) {
+    call();
+    uniform("glUniform3fv");
+}
+
+void APIENTRY null_uniform4f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3) {
+    call();
+    uniform("glUniform4f");
+}
+
+void APIENTRY null_uniform_matrix3fv(GLint location, GLsizei count, GLboolean transpose,
+                                     const GLfloat *value) {
+    call();
+    uniform("glUniformMatrix3fv");
+}
+
+void APIENTRY null_uniform_matrix4fv(GLint location, GLsizei count, GLboolean transpose,
+                                     const GLfloat *value) {
+    call();
+    uniform("glUniformMatrix4fv");
+}
+
+// ---- the table glad loads from ----
+
+typedef struct null_proc_t {
+    const char *name;
+    void *proc;
+} null_proc_t;
+
+#define NULL_PROC(gl_name, fn) {gl_name, (void *)fn}
+
+const null_proc_t kNullProcs[] = {
+    NULL_PROC("glActiveTexture", null_active_texture),
+    NULL_PROC("glAttachShader", null_attach_shader),
+    NULL_PROC("glBeginConditionalRender", null_begin_conditional_render),
+    NULL_PROC("glBeginQuery", null_begin_query),
+    NULL_PROC("glBindAttribLocation", null_bind_attrib_location),
+    NULL_PROC("glBindBuffer", null_bind_buffer),
+    NULL_PROC("glBindBufferBase", null_bind_buffer_base),
+    NULL_PROC("glBindBufferRange", null_bind_buffer_range),
+    NULL_PROC("glBindFramebuffer", null_bind_framebuffer),
+    NULL_PROC("glBindRenderbuffer", null_bind_renderbuffer),
+    NULL_PROC("glBindTexture", null_bind_texture),
+    NULL_PROC("glBindVertexArray", null_bind_vertex_array),
+    NULL_PROC("glBlendFunc", null_blend_func),
+    NULL_PROC("glBufferData", null_buffer_data),
+    NULL_PROC("glBufferStorage", null_buffer_storage),
+    NULL_PROC("glBufferSubData", null_buffer_sub_data),
+    NULL_PROC("glCheckFramebufferStatus", null_check_framebuffer_status),
+    NULL_PROC("glClear", null_clear),
+    NULL_PROC("glClearColor", null_clear_color),
+    NULL_PROC("glClearStencil", null_clear_stencil),
+    NULL_PROC("glClientWaitSync", null_client_wait_sync),
+    NULL_PROC("glColorMask", null_color_mask),
+    NULL_PROC("glCompileShader", null_compile_shader),
+    NULL_PROC("glCreateProgram", null_create_program),
+    NULL_PROC("glCreateShader", null_create_shader),
+    NULL_PROC("glCullFace", null_cull_face),
+    NULL_PROC("glDeleteBuffers", null_delete_buffers),
+    NULL_PROC("glDeleteFramebuffers", null_delete_framebuffers),
+    NULL_PROC("glDeleteProgram", null_delete_program),
+    NULL_PROC("glDeleteQueries", null_delete_queries),
+    NULL_PROC("glDeleteRenderbuffers", null_delete_renderbuffers),
+    NULL_PROC("glDeleteShader", null_delete_shader),
+    NULL_PROC("glDeleteSync", null_delete_sync),
+    NULL_PROC("glDeleteTextures", null_delete_textures),
+    NULL_PROC("glDeleteVertexArrays", null_delete_vertex_arrays),
+    NULL_PROC("glDepthFunc", null_depth_func),
+    NULL_PROC("glDepthMask", null_depth_mask),
+    NULL_PROC("glDetachShader", null_detach_shader),
+    NULL_PROC("glDisable", null_disable),
+    NULL_PROC("glDrawArrays", null_draw_arrays),
+    NULL_PROC("glDrawBuffer", null_draw_buffer),
+    NULL_PROC("glEnable", null_enable),
+    NULL_PROC("glEnableVertexAttribArray", null_enable_vertex_attrib_array),
+    NULL_PROC("glEndConditionalRender", null_end_conditional_render),
+    NULL_PROC("glEndQuery", null_end_query),
+    NULL_PROC("glFenceSync", null_fence_sync),
+    NULL_PROC("glFlush", null_flush),
+    NULL_PROC("glFramebufferRenderbuffer", null_framebuffer_renderbuffer),
+    NULL_PROC("glFramebufferTexture2D", null_framebuffer_texture_2d),
+    NULL_PROC("glGenBuffers", null_gen_buffers),
+    NULL_PROC("glGenFramebuffers", null_gen_framebuffers),
+    NULL_PROC("glGenQueries", null_gen_queries),
+    NULL_PROC("glGenRenderbuffers", null_gen_renderbuffers),
+    NULL_PROC("glGenTextures", null_gen_textures),
+    NULL_PROC("glGenVertexArrays", null_gen_vertex_arrays),
+    NULL_PROC("glGenerateMipmap", null_generate_mipmap),
+    NULL_PROC("glGetAttribLocation", null_get_attrib_location),
+    NULL_PROC("glGetError", null_get_error),
+    NULL_PROC("glGetInteger64v", null_get_integer64v),
+    NULL_PROC("glGetIntegerv", null_get_integerv),
+    NULL_PROC("glGetProgramBinary", null_get_program_binary),
+    NULL_PROC("glGetProgramInfoLog", null_get_program_info_log),
+    NULL_PROC("glGetProgramiv", null_get_programiv),
+    NULL_PROC("glGetQueryObjectiv", null_get_query_objectiv),
+    NULL_PROC("glGetQueryObjectui64v", null_get_query_objectui64v),
+    NULL_PROC("glGetQueryObjectuiv", null_get_query_objectuiv),
+    NULL_PROC("glGetShaderInfoLog", null_get_shader_info_log),
+    NULL_PROC("glGetShaderiv", null_get_shaderiv),
+    NULL_PROC("glGetString", null_get_string),
+    NULL_PROC("glGetStringi", null_get_stringi),
+    NULL_PROC("glGetTexImage", null_get_tex_image),
+    NULL_PROC("glGetUniformBlockIndex", null_get_uniform_block_index),
+    NULL_PROC("glGetUniformLocation", null_get_uniform_location),
+    NULL_PROC("glInvalidateFramebuffer", null_invalidate_framebuffer),
+    NULL_PROC("glInvalidateTexImage", null_invalidate_tex_image),
+    NULL_PROC("glLinkProgram", null_link_program),
+    NULL_PROC("glMapBufferRange", null_map_buffer_range),
+    NULL_PROC("glMultiDrawArraysIndirect", null_multi_draw_arrays_indirect),
+    NULL_PROC("glPixelStorei", null_pixel_storei),
+    NULL_PROC("glPolygonOffset", null_polygon_offset),
+    NULL_PROC("glProgramBinary", null_program_binary),
+    NULL_PROC("glProgramParameteri", null_program_parameteri),
+    NULL_PROC("glQueryCounter", null_query_counter),
+    NULL_PROC("glReadBuffer", null_read_buffer),
+    NULL_PROC("glReadPixels", null_read_pixels),
+    NULL_PROC("glRenderbufferStorage", null_renderbuffer_storage),
+    NULL_PROC("glShaderSource", null_shader_source),
+    NULL_PROC("glStencilFunc", null_stencil_func),
+    NULL_PROC("glStencilOp", null_stencil_op),
+    NULL_PROC("glTexBuffer", null_tex_buffer),
+    NULL_PROC("glTexBufferRange", null_tex_buffer_range),
+    NULL_PROC("glTexImage2D", null_tex_image_2d),
+    NULL_PROC("glTexImage3D", null_tex_image_3d),
+    NULL_PROC("glTexParameterfv", null_tex_parameterfv),
+    NULL_PROC("glTexParameteri", null_tex_parameteri),
+    NULL_PROC("glTexSubImage2D", null_tex_sub_image_2d),
+    NULL_PROC("glUniform1f", null_uniform1f),
+    NULL_PROC("glUniform1i", null_uniform1i),
+    NULL_PROC("glUniform3fv", null_uniform3fv),
+    NULL_PROC("glUniform4f", null_uniform4f),
+    NULL_PROC("glUniformBlockBinding", null_uniform_block_binding),
+    NULL_PROC("glUniformMatrix3fv", null_uniform_matrix3fv),
+    NULL_PROC("glUniformMatrix4fv", null_uniform_matrix4fv),
+    NULL_PROC("glUseProgram", null_use_program),
+    NULL_PROC("glVertexAttribPointer", null_vertex_attrib_pointer),
+    NULL_PROC("glViewport", null_viewport),
+};
+
+#undef NULL_PROC
+
+// everything else stays a null pointer, calling it crashes right at the
+// call site. an engine change that needs a new entry point adds it above
+void *null_proc(const char *name) {
+    for (size_t i = 0; i < sizeof(kNullProcs) / sizeof(kNullProcs[0]); i++) {
+        if (strcmp(kNullProcs[i].name, name) == 0) {
+            return kNullProcs[i].proc;
+        }
+    }
+    return nullptr;
+}
+
+} // namespace
+
+bool RenderDevice::load_null() {
+    reset_null();
+    if (!gladLoadGLLoader((GLADloadproc)null_proc)) {
+        printf("null device: glad refused the null entry points\n");
+        return false;
+    }
+    backend_ = DEVICE_NULL;
+    proc_ = (GLADloadproc)null_proc;
+    last_frame_ = totals_ = {};
+    frames_ = 0;
+    printf("null device: gl calls are validated and counted, nothing is drawn\n");
+    return true;
+}
+
+void RenderDevice::end_frame() {
+    if (backend_ != DEVICE_NULL) {
+        return;
+    }
+    last_frame_ = null_state.frame;
+    null_state.frame = {};
+    totals_.calls += last_frame_.calls;
+    totals_.draws += last_frame_.draws;
+    totals_.commands += last_frame_.commands;
+    totals_.vertices += last_frame_.vertices;
+    totals_.state_changes += last_frame_.state_changes;
+    totals_.uniforms += last_frame_.uniforms;
+    totals_.bytes_uploaded += last_frame_.bytes_uploaded;
+    totals_.errors += last_frame_.errors;
+    frames_++;
+}
+
+void RenderDevice::reset_totals() {
+    int errors = totals_.errors + null_state.frame.errors;
+    // whatever ran since the last frame ended (loading, first uploads) goes too
+    null_state.frame = {};
+    totals_ = {};
+    totals_.errors = errors;
+    frames_ = 0;
+}
+
+void RenderDevice::print_stats() const {
+    if (backend_ != DEVICE_NULL) {
+        return;
+    }
+    const device_stats_t &s = last_frame_;
+    printf("null device: %d draws (%d commands, %lld vertices), %d state changes, %d uniforms, "
+           "%lld KB uploaded, %d gl calls, %d errors\n",
+           s.draws, s.commands, s.vertices, s.state_changes, s.uniforms, s.bytes_uploaded >> 10,
+           s.calls, s.errors);
+    if (frames_ > 0) {
+        printf("null device over %d frames: %.1f draws, %.0f vertices, %.1f state changes, "
+               "%.1f KB uploaded per frame, %d errors\n",
+               frames_, (double)totals_.draws / frames_, (double)totals_.vertices / frames_,
+               (double)totals_.state_changes / frames_,
+               (double)totals_.bytes_uploaded / frames_ / 1024.0, totals_.errors);
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef RENDER_DEVICE_H
+#define RENDER_DEVICE_H
+
+#include "glad/glad.h"
+
+using namespace std;
+
+typedef enum device_backend_t {
+  DEVICE_NONE = 0,
+  DEVICE_GL = 1,  // the driver's entry points, a context has to be current
+  DEVICE_NULL = 2 // validates and counts, draws nothing, needs no context
+} device_backend_t;
+
+// what the null device saw in one frame
+typedef struct device_stats_t {
+  int calls;                // gl entry points called
+  int draws;                // draw calls, a multi draw counts once
+  int commands;             // draws plus the commands inside multi draws
+  long long vertices;       // vertices the draws would have run, instances included
+  int state_changes;        // binds, toggles, viewport, ...
+  int uniforms;             // glUniform* calls
+  long long bytes_uploaded; // buffer and texture data handed to gl
+  int errors;               // calls real gl would have rejected
+} device_stats_t;
+
+// where the gl calls go. everything in the engine (Entity, GameMap, Shader,
+// the passes in main) calls gl through glad's function pointers, so the
+// device is the table behind them: load_gl() fills it from the driver like
+// before, load_null() with the null backend. the null backend keeps names,
+// bindings and buffer contents on the cpu, checks every call against them
+// and counts draws, vertices, state changes and uploads, but never touches
+// a gpu. that leaves the engine's own cost, culling, sorting and submission
+// included, to measure on any box and at any map size, the same every run.
+// it reports gl 4.3 without buffer storage, so per frame data goes through
+// glBufferSubData and shows up as uploads
+class RenderDevice {
+public:
+  static const int kMaxPrintedErrors = 8;
+
+  RenderDevice() = default;
+  ~RenderDevice() = default;
+
+  // loads the entry points of the current context through proc
+  bool load_gl(GLADloadproc proc);
+  // points every entry point at the null backend
+  bool load_null();
+
+  // an entry point glad doesn't know, from the loader the table was filled
+  // with. nullptr if there is none
+  void *proc_address(const char *name) const;
+
+  device_backend_t backend() const { return backend_; }
+  bool is_null() const { return backend_ == DEVICE_NULL; }
+
+  // closes the frame's counters, stats() returns the frame that just ended.
+  // zeros unless the null backend is loaded
+  void end_frame();
+  device_stats_t stats() const { return last_frame_; }
+  device_stats_t totals() const { return totals_; }
+  // starts the totals over from the next frame, e.g. once warmup is done.
+  // errors are kept, a call rejected during startup still has to show
+  void reset_totals();
+  int num_frames() const { return frames_; }
+
+  void print_stats() const;
+
+private:
+  device_backend_t backend_ = DEVICE_NONE;
+  GLADloadproc proc_ = nullptr;
+  device_stats_t last_frame_ = {};
+  device_stats_t totals_ = {};
+  int frames_ = 0;
+};
+
+RenderDevice &render_device();
+
+#endif // RENDER_DEVICE_H
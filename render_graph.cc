@@ -0,0 +1,533 @@
+#include "render_graph.h"
+
+#include "gl_state.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+
+using namespace std;
+
+const int RenderGraph::kKeepFrames;
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::color(rg_handle_t target, rg_load_t load) {
+    graph_->passes_[pass_].color.target = target;
+    graph_->passes_[pass_].color.load = load;
+    return *this;
+}
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::depth(rg_handle_t target, rg_load_t load) {
+    graph_->passes_[pass_].depth.target = target;
+    graph_->passes_[pass_].depth.load = load;
+    return *this;
+}
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::read(rg_handle_t resource) {
+    graph_->passes_[pass_].reads.push_back(resource);
+    return *this;
+}
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::write(rg_handle_t resource) {
+    graph_->passes_[pass_].writes.push_back(resource);
+    return *this;
+}
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::state(const rg_state_t &state) {
+    graph_->passes_[pass_].state = state;
+    return *this;
+}
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::clear_color(float r, float g, float b,
+                                                                float a) {
+    float *clear = graph_->passes_[pass_].clear;
+    clear[0] = r;
+    clear[1] = g;
+    clear[2] = b;
+    clear[3] = a;
+    return *this;
+}
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::viewport(int width, int height) {
+    graph_->passes_[pass_].viewport_w = width;
+    graph_->passes_[pass_].viewport_h = height;
+    return *this;
+}
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::side_effect() {
+    graph_->passes_[pass_].side_effect = true;
+    return *this;
+}
+
+void RenderGraph::reset() {
+    resources_.clear();
+    passes_.clear();
+    order_.clear();
+}
+
+void RenderGraph::cleanup() {
+    while (!pool_.empty()) {
+        destroy_physical((int)pool_.size() - 1);
+    }
+    reset();
+}
+
+rg_handle_t RenderGraph::add_resource(const char *name, bool imported) {
+    rg_resource_t resource;
+    resource.name = name;
+    resource.imported = imported;
+    resource.output = false;
+    resource.fbo = 0;
+    resource.width = resource.height = 0;
+    resource.format = RG_RGBA8;
+    resource.texture = 0;
+    resource.first_use = resource.last_use = -1;
+    resources_.push_back(resource);
+    return (rg_handle_t)resources_.size() - 1;
+}
+
+rg_handle_t RenderGraph::create_texture(const char *name, int width, int height,
+                                        rg_format_t format) {
+    rg_handle_t handle = add_resource(name, false);
+    resources_[handle].width = width;
+    resources_[handle].height = height;
+    resources_[handle].format = format;
+    return handle;
+}
+
+rg_handle_t RenderGraph::import_target(const char *name, GLuint fbo, int width, int height) {
+    rg_handle_t handle = add_resource(name, true);
+    resources_[handle].fbo = fbo;
+    resources_[handle].width = width;
+    resources_[handle].height = height;
+    return handle;
+}
+
+rg_handle_t RenderGraph::import_resource(const char *name) {
+    return add_resource(name, true);
+}
+
+void RenderGraph::mark_output(rg_handle_t resource) {
+    resources_[resource].output = true;
+}
+
+RenderGraph::PassBuilder RenderGraph::add_pass(const char *name,
+                                               const function<void()> &execute) {
+    rg_pass_t pass;
+    pass.name = name;
+    pass.execute = execute;
+    pass.color.target = pass.depth.target = -1;
+    pass.color.load = pass.depth.load = RG_LOAD_KEEP;
+    pass.clear[0] = pass.clear[1] = pass.clear[2] = 0.0f;
+    pass.clear[3] = 1.0f;
+    pass.viewport_w = pass.viewport_h = 0;
+    pass.side_effect = false;
+    pass.needed = false;
+    passes_.push_back(pass);
+    return PassBuilder(this, (int)passes_.size() - 1);
+}
+
+// an attachment that is kept is read before it is drawn over
+bool RenderGraph::reads(const rg_pass_t &pass, rg_handle_t resource) {
+    if ((pass.color.target == resource && pass.color.load == RG_LOAD_KEEP) ||
+        (pass.depth.target == resource && pass.depth.load == RG_LOAD_KEEP)) {
+        return true;
+    }
+    return find(pass.reads.begin(), pass.reads.end(), resource) != pass.reads.end();
+}
+
+bool RenderGraph::writes(const rg_pass_t &pass, rg_handle_t resource) {
+    if (pass.color.target == resource || pass.depth.target == resource) {
+        return true;
+    }
+    return find(pass.writes.begin(), pass.writes.end(), resource) != pass.writes.end();
+}
+
+void RenderGraph::execute() {
+    cull();
+    schedule();
+    allocate();
+    for (size_t i = 0; i < order_.size(); i++) {
+        const rg_pass_t &pass = passes_[order_[i]];
+        GpuProfileZone zone(pass.name);
+        begin_pass(pass);
+        pass.execute();
+        end_pass(pass, (int)i);
+    }
+}
+
+// walks the passes backwards from what is wanted after the frame: a pass is
+// needed if it is a side effect or writes something a later needed pass
+// reads. an attachment that gets cleared or dropped (not kept) hides every
+// earlier write to it, plain write()s may be partial (a shadow map that is
+// only redrawn when dirty) and don't
+void RenderGraph::cull() {
+    vector<char> live(resources_.size(), 0);
+    for (size_t r = 0; r < resources_.size(); r++) {
+        live[r] = resources_[r].output;
+    }
+    num_culled_ = 0;
+    for (int p = (int)passes_.size() - 1; p >= 0; p--) {
+        rg_pass_t &pass = passes_[p];
+        pass.needed = pass.side_effect;
+        for (size_t r = 0; r < resources_.size() && !pass.needed; r++) {
+            pass.needed = live[r] && writes(pass, (rg_handle_t)r);
+        }
+        if (!pass.needed) {
+            num_culled_++;
+            continue;
+        }
+        const rg_attachment_t *attachments[2] = {&pass.color, &pass.depth};
+        for (int a = 0; a < 2; a++) {
+            if (attachments[a]->target >= 0 && attachments[a]->load != RG_LOAD_KEEP) {
+                live[attachments[a]->target] = 0;
+            }
+        }
+        for (size_t r = 0; r < resources_.size(); r++) {
+            if (reads(pass, (rg_handle_t)r)) {
+                live[r] = 1;
+            }
+        }
+    }
+}
+
+// the passes were declared in an order that works, the edges keep what
+// matters of it: a read waits for the last write before it, a write for the
+// last write and every read since. among the passes that are free to go
+// the one drawing to the same target as the pass before goes first (no
+// framebuffer switch), then declaration order
+void RenderGraph::schedule() {
+    int n = (int)passes_.size();
+    vector<vector<int> > next(n);
+    vector<int> waiting(n, 0);
+    for (size_t r = 0; r < resources_.size(); r++) {
+        int last_write = -1;
+        vector<int> readers;
+        for (int p = 0; p < n; p++) {
+            const rg_pass_t &pass = passes_[p];
+            if (!pass.needed) {
+                continue;
+            }
+            bool r_read = reads(pass, (rg_handle_t)r);
+            bool r_write = writes(pass, (rg_handle_t)r);
+            vector<int> after;
+            if ((r_read || r_write) && last_write >= 0) {
+                after.push_back(last_write);
+            }
+            if (r_write) {
+                after.insert(after.end(), readers.begin(), readers.end());
+            }
+            for (size_t i = 0; i < after.size(); i++) {
+                if (after[i] != p) {
+                    next[after[i]].push_back(p);
+                    waiting[p]++;
+                }
+            }
+            if (r_write) {
+                last_write = p;
+                readers.clear();
+            } else if (r_read) {
+                readers.push_back(p);
+            }
+        }
+    }
+
+    order_.clear();
+    vector<char> done(n, 0);
+    rg_handle_t last_target = -1;
+    while (true) {
+        int pick = -1;
+        for (int p = 0; p < n; p++) {
+            if (!passes_[p].needed || done[p] || waiting[p] > 0) {
+                continue;
+            }
+            if (pick < 0) {
+                pick = p;
+            }
+            rg_handle_t target =
+                passes_[p].color.target >= 0 ? passes_[p].color.target : passes_[p].depth.target;
+            if (target >= 0 && target == last_target) {
+                pick = p;
+                break;
+            }
+        }
+        if (pick < 0) {
+            break;
+        }
+        done[pick] = 1;
+        order_.push_back(pick);
+        const rg_pass_t &pass = passes_[pick];
+        if (pass.color.target >= 0 || pass.depth.target >= 0) {
+            last_target = pass.color.target >= 0 ? pass.color.target : pass.depth.target;
+        }
+        for (size_t i = 0; i < next[pick].size(); i++) {
+            waiting[next[pick][i]]--;
+        }
+    }
+    num_run_ = (int)order_.size();
+}
+
+long long RenderGraph::bytes_of(int width, int height, rg_format_t format) {
+    (void)format; // both formats are 4 bytes a pixel
+    return (long long)width * height * 4;
+}
+
+// first fit over the pool: same size and format, and whoever had it this
+// frame is done before this one starts. creates a texture if none fits
+int RenderGraph::find_physical(const rg_resource_t &resource) {
+    for (size_t i = 0; i < pool_.size(); i++) {
+        rg_physical_t &physical = pool_[i];
+        if (physical.width == resource.width && physical.height == resource.height &&
+            physical.format == resource.format && physical.busy_until < resource.first_use) {
+            return (int)i;
+        }
+    }
+
+    rg_physical_t physical;
+    physical.width = resource.width;
+    physical.height = resource.height;
+    physical.format = resource.format;
+    physical.busy_until = -1;
+    physical.unused_frames = 0;
+    glGenTextures(1, &physical.texture);
+    gl_state().bind_texture(0, GL_TEXTURE_2D, physical.texture);
+    if (resource.format == RG_DEPTH24_STENCIL8) {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, resource.width, resource.height, 0,
+                     GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    } else {
+        // linear, the upscale samples it bilinear
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, resource.width, resource.height, 0, GL_RGBA,
+                     GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    pool_.push_back(physical);
+    printf("render graph: new %dx%d %s texture for %s\n", resource.width, resource.height,
+           resource.format == RG_DEPTH24_STENCIL8 ? "depth" : "color", resource.name);
+    return (int)pool_.size() - 1;
+}
+
+// a transient lives from the first to the last pass (execution order) that
+// touches it. they are placed by first use, so a texture handed back by one
+// that ended can go straight to the next
+void RenderGraph::allocate() {
+    for (size_t r = 0; r < resources_.size(); r++) {
+        resources_[r].first_use = resources_[r].last_use = -1;
+    }
+    for (size_t i = 0; i < order_.size(); i++) {
+        const rg_pass_t &pass = passes_[order_[i]];
+        for (size_t r = 0; r < resources_.size(); r++) {
+            if (reads(pass, (rg_handle_t)r) || writes(pass, (rg_handle_t)r)) {
+                rg_resource_t &resource = resources_[r];
+                if (resource.first_use < 0) {
+                    resource.first_use = (int)i;
+                }
+                resource.last_use = (int)i;
+            }
+        }
+    }
+
+    vector<int> transients;
+    for (size_t r = 0; r < resources_.size(); r++) {
+        rg_resource_t &resource = resources_[r];
+        if (!resource.imported && resource.first_use >= 0) {
+            if (resource.output) {
+                resource.last_use = (int)order_.size();
+            }
+            transients.push_back((int)r);
+        }
+    }
+    sort(transients.begin(), transients.end(), [this](int a, int b) {
+        return resources_[a].first_use < resources_[b].first_use;
+    });
+
+    for (size_t i = 0; i < pool_.size(); i++) {
+        pool_[i].busy_until = -1;
+    }
+    vector<char> used;
+    num_transients_ = (int)transients.size();
+    transient_bytes_ = physical_bytes_ = 0;
+    for (size_t i = 0; i < transients.size(); i++) {
+        rg_resource_t &resource = resources_[transients[i]];
+        int index = find_physical(resource);
+        used.resize(pool_.size(), 0);
+        pool_[index].busy_until = resource.last_use;
+        resource.texture = pool_[index].texture;
+        transient_bytes_ += bytes_of(resource.width, resource.height, resource.format);
+        if (!used[index]) {
+            used[index] = 1;
+            physical_bytes_ += bytes_of(resource.width, resource.height, resource.format);
+        }
+    }
+    used.resize(pool_.size(), 0);
+    num_physical_ = 0;
+    for (size_t i = 0; i < pool_.size(); i++) {
+        pool_[i].unused_frames = used[i] ? 0 : pool_[i].unused_frames + 1;
+        num_physical_ += used[i];
+    }
+    release_unused();
+}
+
+// targets that stop being used (dynamic resolution off, a window resize)
+// are kept a while in case they come back
+void RenderGraph::release_unused() {
+    for (int i = (int)pool_.size() - 1; i >= 0; i--) {
+        if (pool_[i].unused_frames > kKeepFrames) {
+            destroy_physical(i);
+        }
+    }
+}
+
+void RenderGraph::destroy_physical(int index) {
+    GLuint texture = pool_[index].texture;
+    size_t kept = 0;
+    for (size_t i = 0; i < framebuffers_.size(); i++) {
+        rg_framebuffer_t &framebuffer = framebuffers_[i];
+        if (framebuffer.color == texture || framebuffer.depth == texture) {
+            gl_state().forget_framebuffer(framebuffer.fbo);
+            glDeleteFramebuffers(1, &framebuffer.fbo);
+        } else {
+            framebuffers_[kept++] = framebuffer;
+        }
+    }
+    framebuffers_.resize(kept);
+    gl_state().forget_texture(texture);
+    glDeleteTextures(1, &texture);
+    pool_.erase(pool_.begin() + index);
+}
+
+GLuint RenderGraph::texture(rg_handle_t resource) const {
+    return resources_[resource].texture;
+}
+
+// imported targets bring their framebuffer, transients get one per pair of
+// textures, made the first time the pair shows up
+GLuint RenderGraph::framebuffer_for(const rg_pass_t &pass, int &width, int &height) {
+    const rg_resource_t *color =
+        pass.color.target >= 0 ? &resources_[pass.color.target] : nullptr;
+    const rg_resource_t *depth =
+        pass.depth.target >= 0 ? &resources_[pass.depth.target] : nullptr;
+    const rg_resource_t *any = color != nullptr ? color : depth;
+    width = any->width;
+    height = any->height;
+    if (any->imported) {
+        if (color != nullptr && depth != nullptr && color != depth) {
+            printf("render graph: %s mixes %s with %s, only %s is bound\n", pass.name,
+                   color->name, depth->name, any->name);
+        }
+        return any->fbo;
+    }
+
+    GLuint color_tex = color != nullptr ? color->texture : 0;
+    GLuint depth_tex = depth != nullptr ? depth->texture : 0;
+    for (size_t i = 0; i < framebuffers_.size(); i++) {
+        if (framebuffers_[i].color == color_tex && framebuffers_[i].depth == depth_tex) {
+            return framebuffers_[i].fbo;
+        }
+    }
+    rg_framebuffer_t framebuffer;
+    framebuffer.color = color_tex;
+    framebuffer.depth = depth_tex;
+    glGenFramebuffers(1, &framebuffer.fbo);
+    gl_state().bind_framebuffer(framebuffer.fbo);
+    if (color_tex != 0) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color_tex, 0);
+    } else {
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+    }
+    if (depth_tex != 0) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D,
+                               depth_tex, 0);
+    }
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        printf("render graph: framebuffer for %s incomplete\n", pass.name);
+    }
+    framebuffers_.push_back(framebuffer);
+    return framebuffer.fbo;
+}
+
+// contents nobody will look at again. lets a tiler skip the store / load and
+// a driver skip a copy, where gl 4.3 / ARB_invalidate_subdata is around
+void RenderGraph::invalidate_target(rg_handle_t target, GLenum attachment) {
+    if (!GLAD_GL_ARB_invalidate_subdata) {
+        return;
+    }
+    const rg_resource_t &resource = resources_[target];
+    if (!resource.imported) {
+        glInvalidateTexImage(resource.texture, 0);
+        return;
+    }
+    // the window has its own names for its buffers
+    GLenum attachments[2] = {attachment, GL_NONE};
+    int count = 1;
+    if (resource.fbo == 0) {
+        if (attachment == GL_COLOR_ATTACHMENT0) {
+            attachments[0] = GL_COLOR;
+        } else {
+            attachments[0] = GL_DEPTH;
+            attachments[1] = GL_STENCIL;
+            count = 2;
+        }
+    }
+    glInvalidateFramebuffer(GL_FRAMEBUFFER, count, attachments);
+}
+
+void RenderGraph::begin_pass(const rg_pass_t &pass) {
+    if (pass.color.target >= 0 || pass.depth.target >= 0) {
+        int width, height;
+        gl_state().bind_framebuffer(framebuffer_for(pass, width, height));
+        gl_state().viewport(0, 0, pass.viewport_w > 0 ? pass.viewport_w : width,
+                            pass.viewport_h > 0 ? pass.viewport_h : height);
+
+        GLbitfield clear = 0;
+        if (pass.color.target >= 0) {
+            if (pass.color.load == RG_LOAD_CLEAR) {
+                gl_state().color_mask(true);
+                glClearColor(pass.clear[0], pass.clear[1], pass.clear[2], pass.clear[3]);
+                clear |= GL_COLOR_BUFFER_BIT;
+            } else if (pass.color.load == RG_LOAD_DONT_CARE) {
+                invalidate_target(pass.color.target, GL_COLOR_ATTACHMENT0);
+            }
+        }
+        if (pass.depth.target >= 0) {
+            if (pass.depth.load == RG_LOAD_CLEAR) {
+                gl_state().depth_mask(true);
+                clear |= GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT;
+            } else if (pass.depth.load == RG_LOAD_DONT_CARE) {
+                invalidate_target(pass.depth.target, GL_DEPTH_STENCIL_ATTACHMENT);
+            }
+        }
+        if (clear != 0) {
+            glClear(clear); // the whole target, not just the viewport
+        }
+    }
+
+    const rg_state_t &state = pass.state;
+    gl_state().set_enabled(GL_DEPTH_TEST, state.depth_test);
+    gl_state().depth_mask(state.depth_write);
+    gl_state().depth_func(state.depth_func);
+    gl_state().color_mask(state.color_write);
+    gl_state().set_enabled(GL_CULL_FACE, state.cull);
+}
+
+// transients this pass was the last to touch are dead
+void RenderGraph::end_pass(const rg_pass_t &pass, int position) {
+    for (size_t r = 0; r < resources_.size(); r++) {
+        const rg_resource_t &resource = resources_[r];
+        if (!resource.imported && resource.last_use == position &&
+            (reads(pass, (rg_handle_t)r) || writes(pass, (rg_handle_t)r))) {
+            invalidate_target((rg_handle_t)r, GL_NONE);
+        }
+    }
+}
+
+void RenderGraph::print_stats() const {
+    printf("render graph: %d passes run, %d culled, %d transients in %d textures, "
+           "%d KB (%d KB without aliasing), %d pooled\n",
+           num_run_, num_culled_, num_transients_, num_physical_,
+           (int)(physical_bytes_ >> 10), (int)(transient_bytes_ >> 10), (int)pool_.size());
+}
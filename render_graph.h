@@ -0,0 +1,172 @@
+#ifndef RENDER_GRAPH_H
+#define RENDER_GRAPH_H
+
+#include "glad/glad.h"
+
+#include <functional>
+#include <vector>
+
+using namespace std;
+
+// resource of the graph being built, -1 = none
+typedef int rg_handle_t;
+
+typedef enum rg_format_t {
+  RG_RGBA8 = 0,            // color, filterable
+  RG_DEPTH24_STENCIL8 = 1  // depth + stencil
+} rg_format_t;
+
+// what an attachment holds when its pass starts
+typedef enum rg_load_t {
+  RG_LOAD_KEEP = 0,     // whatever the pass before left (a read)
+  RG_LOAD_CLEAR = 1,    // cleared to the pass's clear values
+  RG_LOAD_DONT_CARE = 2 // every pixel gets written, old contents are dropped
+} rg_load_t;
+
+// fixed function state a pass starts with. every pass states all of it, so
+// no pass depends on what the one before left behind; GlState drops the
+// calls that don't change anything
+typedef struct rg_state_t {
+  bool depth_test = true;
+  bool depth_write = true;
+  GLenum depth_func = GL_LESS;
+  bool color_write = true;
+  bool cull = true;
+} rg_state_t;
+
+// declarative frame. every frame the passes are added with what they read
+// and write, then execute() culls the passes nothing consumes, orders the
+// rest, gives the transient textures memory and runs them.
+// transient textures only exist between their first and last use; ones
+// that are never alive at the same time share a texture (same size and
+// format), and the textures are pooled across frames. imported targets
+// (the window) and resources (shadow maps) live outside the graph.
+// between passes the graph binds the pass's framebuffer and viewport,
+// clears, drops dead attachments with glInvalidateFramebuffer where gl
+// has it, and applies the pass's rg_state_t; nothing else
+class RenderGraph {
+public:
+  static const int kKeepFrames = 60; // an unused pooled texture goes after this
+
+  // fills in a pass after add_pass()
+  class PassBuilder {
+  public:
+    PassBuilder(RenderGraph *graph, int pass) : graph_(graph), pass_(pass) {}
+    PassBuilder &color(rg_handle_t target, rg_load_t load);
+    PassBuilder &depth(rg_handle_t target, rg_load_t load);
+    // textures and resources used outside the attachments
+    PassBuilder &read(rg_handle_t resource);
+    PassBuilder &write(rg_handle_t resource);
+    PassBuilder &state(const rg_state_t &state);
+    PassBuilder &clear_color(float r, float g, float b, float a);
+    // part of the target to draw to, the whole target by default
+    PassBuilder &viewport(int width, int height);
+    // never culled (readbacks, presenting)
+    PassBuilder &side_effect();
+
+  private:
+    RenderGraph *graph_;
+    int pass_;
+  };
+
+  RenderGraph() = default;
+  ~RenderGraph() = default;
+
+  // drops the last frame's passes and resources, the pool stays
+  void reset();
+  // frees the pool, call while the context is still alive
+  void cleanup();
+
+  rg_handle_t create_texture(const char *name, int width, int height, rg_format_t format);
+  // a framebuffer that lives outside the graph, 0 = the window. the same
+  // handle serves as the color and the depth attachment
+  rg_handle_t import_target(const char *name, GLuint fbo, int width, int height);
+  // anything else written and read outside the graph's attachments (shadow
+  // maps), only there to connect the passes
+  rg_handle_t import_resource(const char *name);
+  // contents are wanted after the frame, passes that feed it are kept
+  void mark_output(rg_handle_t resource);
+
+  // name has to be a string literal, it names the pass's profiler zone
+  PassBuilder add_pass(const char *name, const function<void()> &execute);
+
+  void execute();
+
+  // the texture behind a transient, valid while the passes run
+  GLuint texture(rg_handle_t resource) const;
+
+  void print_stats() const;
+
+private:
+  typedef struct rg_resource_t {
+    const char *name;
+    bool imported;
+    bool output;
+    GLuint fbo; // imported targets
+    int width, height;
+    rg_format_t format;
+    GLuint texture;          // of a transient, from the pool in execute()
+    int first_use, last_use; // positions in the execution order, -1 = unused
+  } rg_resource_t;
+
+  typedef struct rg_attachment_t {
+    rg_handle_t target;
+    rg_load_t load;
+  } rg_attachment_t;
+
+  typedef struct rg_pass_t {
+    const char *name;
+    function<void()> execute;
+    rg_attachment_t color, depth;
+    vector<rg_handle_t> reads, writes;
+    rg_state_t state;
+    float clear[4];
+    int viewport_w, viewport_h; // 0 = the target's size
+    bool side_effect;
+    bool needed;
+  } rg_pass_t;
+
+  // a texture in the pool. busy_until is the last use (execution order) of
+  // the transient that has it this frame, -1 = free
+  typedef struct rg_physical_t {
+    int width, height;
+    rg_format_t format;
+    GLuint texture;
+    int busy_until;
+    int unused_frames;
+  } rg_physical_t;
+
+  typedef struct rg_framebuffer_t {
+    GLuint color, depth; // textures
+    GLuint fbo;
+  } rg_framebuffer_t;
+
+  vector<rg_resource_t> resources_;
+  vector<rg_pass_t> passes_;
+  vector<int> order_; // passes to run, in order
+
+  vector<rg_physical_t> pool_;
+  vector<rg_framebuffer_t> framebuffers_;
+
+  // last frame, for print_stats()
+  int num_run_ = 0, num_culled_ = 0;
+  int num_transients_ = 0, num_physical_ = 0;
+  long long transient_bytes_ = 0, physical_bytes_ = 0;
+
+  rg_handle_t add_resource(const char *name, bool imported);
+  void cull();
+  void schedule();
+  void allocate();
+  int find_physical(const rg_resource_t &resource);
+  GLuint framebuffer_for(const rg_pass_t &pass, int &width, int &height);
+  void begin_pass(const rg_pass_t &pass);
+  void end_pass(const rg_pass_t &pass, int position);
+  void invalidate_target(rg_handle_t target, GLenum attachment);
+  void release_unused();
+  void destroy_physical(int index);
+  static bool reads(const rg_pass_t &pass, rg_handle_t resource);
+  static bool writes(const rg_pass_t &pass, rg_handle_t resource);
+  static long long bytes_of(int width, int height, rg_format_t format);
+};
+
+#endif // RENDER_GRAPH_H
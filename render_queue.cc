@@ -0,0 +1,246 @@
+#include "render_queue.h"
+
+#include "gl_state.h"
+#include "occlusion_queries.h"
+#include "shader.h"
+#include "glm/gtc/type_ptr.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+using namespace std;
+
+uint64_t RenderQueue::make_key(int pass, int program, int material, int mesh,
+                               float depth01) {
+    depth01 = min(max(depth01, 0.0f), 1.0f);
+    uint64_t depth = (uint64_t)(depth01 * ((1 << kDepthBits) - 1));
+    if (pass == PASS_TRANSPARENT) {
+        depth = ((1 << kDepthBits) - 1) - depth; // back to front
+    }
+
+    uint64_t key = (uint64_t)pass & ((1 << kPassBits) - 1);
+    key = (key << kProgramBits) | ((uint64_t)program & ((1 << kProgramBits) - 1));
+    key = (key << kMaterialBits) | ((uint64_t)material & ((1 << kMaterialBits) - 1));
+    key = (key << kMeshBits) | ((uint64_t)mesh & ((1 << kMeshBits) - 1));
+    key = (key << kDepthBits) | depth;
+    return key;
+}
+
+glm::mat3 RenderQueue::normal_matrix(const glm::mat4 &model_view) {
+    glm::mat3 m(model_view);
+    float xx = glm::dot(m[0], m[0]);
+    float yy = glm::dot(m[1], m[1]);
+    float zz = glm::dot(m[2], m[2]);
+    const float eps = 1e-4f * xx;
+    if (fabsf(glm::dot(m[0], m[1])) < eps && fabsf(glm::dot(m[0], m[2])) < eps &&
+        fabsf(glm::dot(m[1], m[2])) < eps && fabsf(xx - yy) < eps &&
+        fabsf(xx - zz) < eps && xx > 0.0f) {
+        // m = s * R, so inverse(transpose(m)) = R / s = m / s^2
+        return m * (1.0f / xx);
+    }
+    return glm::transpose(glm::inverse(m));
+}
+
+GLsizeiptr RenderQueue::object_stride() {
+    GLsizeiptr align = frame_ring().uniform_align();
+    return (sizeof(object_block_t) + align - 1) & ~(align - 1);
+}
+
+int RenderQueue::program_id(GLuint program) {
+    for (size_t i = 0; i < programs_.size(); i++) {
+        if (programs_[i] == program) {
+            return (int)i;
+        }
+    }
+    programs_.push_back(program);
+    return (int)programs_.size() - 1;
+}
+
+int RenderQueue::mesh_id(int start) {
+    for (size_t i = 0; i < meshes_.size(); i++) {
+        if (meshes_[i] == start) {
+            return (int)i;
+        }
+    }
+    meshes_.push_back(start);
+    return (int)meshes_.size() - 1;
+}
+
+int RenderQueue::material_id(int tex_id, const glm::vec3 &color, bool cull) {
+    for (size_t i = 0; i < materials_.size(); i++) {
+        if (materials_[i].tex_id == tex_id && materials_[i].color == color &&
+            materials_[i].cull == cull) {
+            return (int)i;
+        }
+    }
+    material_key_t material;
+    material.tex_id = tex_id;
+    material.color = color;
+    material.cull = cull;
+    materials_.push_back(material);
+    return (int)materials_.size() - 1;
+}
+
+void RenderQueue::begin(const glm::mat4 &view, const glm::mat4 &proj,
+                        const glm::vec3 &cam_pos, float far) {
+    view_ = view;
+    proj_ = proj;
+    cam_pos_ = cam_pos;
+    far_ = far;
+    packets_.clear();
+    keys_.clear();
+    order_.clear();
+    objects_written_ = false;
+}
+
+void RenderQueue::push(render_pass_t pass, const draw_packet_t &packet) {
+    // textured materials don't use the color, don't let it split them up
+    glm::vec3 color = packet.tex_id == -1 ? packet.color : glm::vec3(0.0f);
+    float depth = glm::length(glm::vec3(packet.model[3]) - cam_pos_) / far_;
+    bool cull = packet.cull && culling_;
+
+    keys_.push_back(make_key(pass, program_id(packet.program),
+                             material_id(packet.tex_id, color, cull),
+                             mesh_id(packet.start), depth));
+    order_.push_back((int)packets_.size());
+    packets_.push_back(packet);
+    packets_.back().cull = cull;
+}
+
+// lsd radix sort, 16 bits per pass. passes where every key has the same digit
+// (usually the pass and program bits) are skipped
+void RenderQueue::sort() {
+    size_t n = keys_.size();
+    keys_tmp_.resize(n);
+    order_tmp_.resize(n);
+
+    static const int kRadixBits = 16;
+    static const int kBuckets = 1 << kRadixBits;
+    vector<int> &counts = counts_;
+    counts.resize(kBuckets);
+
+    for (int shift = 0; shift < 64; shift += kRadixBits) {
+        fill(counts.begin(), counts.end(), 0);
+        for (size_t i = 0; i < n; i++) {
+            counts[(keys_[i] >> shift) & (kBuckets - 1)]++;
+        }
+        if (n == 0 || counts[(keys_[0] >> shift) & (kBuckets - 1)] == (int)n) {
+            continue;
+        }
+
+        int sum = 0;
+        for (int b = 0; b < kBuckets; b++) {
+            int c = counts[b];
+            counts[b] = sum;
+            sum += c;
+        }
+        for (size_t i = 0; i < n; i++) {
+            int dst = counts[(keys_[i] >> shift) & (kBuckets - 1)]++;
+            keys_tmp_[dst] = keys_[i];
+            order_tmp_[dst] = order_[i];
+        }
+        keys_.swap(keys_tmp_);
+        order_.swap(order_tmp_);
+    }
+    objects_written_ = false;
+}
+
+// straight into the ring, one block per draw at the uniform buffer offset
+// alignment, so a draw only has to move the Object binding
+void RenderQueue::write_objects() {
+    if (objects_written_) {
+        return;
+    }
+    GLsizeiptr stride = object_stride();
+    objects_ = frame_ring().alloc(stride * (GLsizeiptr)order_.size(),
+                                  frame_ring().uniform_align());
+    char *dst = (char *)objects_.ptr;
+    for (size_t i = 0; i < order_.size(); i++) {
+        const draw_packet_t &packet = packets_[order_[i]];
+        object_block_t *object = (object_block_t *)(dst + i * stride);
+        object->model = packet.model;
+        glm::mat3 normal = normal_matrix(view_ * packet.model);
+        for (int c = 0; c < 3; c++) {
+            object->normal[c] = glm::vec4(normal[c], 0.0f);
+        }
+        object->color = glm::vec4(packet.color, 1.0f);
+    }
+    frame_ring().commit(objects_);
+    objects_written_ = true;
+}
+
+void RenderQueue::bind_object(int i) {
+    gl_state().bind_buffer_range(GL_UNIFORM_BUFFER, BLOCK_OBJECT, objects_.buffer,
+                                 objects_.offset + i * object_stride(),
+                                 sizeof(object_block_t));
+}
+
+void RenderQueue::submit_depth(GLuint program, GLuint vao, OcclusionQueries *conditions) {
+    write_objects();
+    gl_state().use_program(program);
+    gl_state().bind_vertex_array(vao);
+    glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE,
+                       glm::value_ptr(view_));
+    glUniformMatrix4fv(glGetUniformLocation(program, "proj"), 1, GL_FALSE,
+                       glm::value_ptr(proj_));
+    for (size_t i = 0; i < order_.size(); i++) {
+        const draw_packet_t &packet = packets_[order_[i]];
+        gl_state().set_enabled(GL_CULL_FACE, packet.cull);
+        bind_object((int)i);
+        bool conditional =
+            conditions != nullptr && conditions->begin_conditional(packet.occlusion_id);
+        glDrawArrays(GL_TRIANGLES, packet.start, packet.num_vertices);
+        if (conditional) {
+            conditions->end_conditional();
+        }
+    }
+}
+
+void RenderQueue::submit(OcclusionQueries *conditions) {
+    num_program_changes_ = 0;
+    num_material_changes_ = 0;
+    num_vao_changes_ = 0;
+    write_objects();
+
+    GLuint current_program = 0;
+    GLuint current_vao = 0;
+    uint64_t current_material = ~0ull;
+
+    const int material_shift = kDepthBits + kMeshBits;
+    for (size_t i = 0; i < order_.size(); i++) {
+        const draw_packet_t &packet = packets_[order_[i]];
+
+        if (packet.program != current_program) {
+            current_program = packet.program;
+            gl_state().use_program(current_program);
+            glUniformMatrix4fv(glGetUniformLocation(current_program, "view"), 1,
+                               GL_FALSE, glm::value_ptr(view_));
+            glUniformMatrix4fv(glGetUniformLocation(current_program, "proj"), 1,
+                               GL_FALSE, glm::value_ptr(proj_));
+            current_material = ~0ull;
+            num_program_changes_++;
+        }
+
+        uint64_t material = (keys_[i] >> material_shift) & ((1 << kMaterialBits) - 1);
+        if (material != current_material) {
+            current_material = material;
+            gl_state().set_enabled(GL_CULL_FACE, packet.cull);
+            num_material_changes_++;
+        }
+
+        if (packet.vao != current_vao) {
+            current_vao = packet.vao;
+            gl_state().bind_vertex_array(current_vao);
+            num_vao_changes_++;
+        }
+
+        bind_object((int)i);
+        bool conditional =
+            conditions != nullptr && conditions->begin_conditional(packet.occlusion_id);
+        glDrawArrays(GL_TRIANGLES, packet.start, packet.num_vertices);
+        if (conditional) {
+            conditions->end_conditional();
+        }
+    }
+}
@@ -0,0 +1,127 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include "frame_ring.h"
+#include "game_types.h"
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+class OcclusionQueries;
+
+typedef enum render_pass_t {
+  PASS_OPAQUE = 0,     // front to back
+  PASS_TRANSPARENT = 1 // back to front
+} render_pass_t;
+
+// everything needed to replay one draw call
+typedef struct draw_packet_t {
+  GLuint program;
+  GLuint vao;
+  int start, num_vertices; // vertex range in the vao
+  int tex_id;              // -1 = untextured, else which sampler
+  unsigned features;       // shader_feature_t bits of the program variant
+  bool cull;               // back faces can be culled (closed mesh)
+  int occlusion_id;        // object of its OcclusionQueries condition, -1 = none
+  glm::vec3 color;
+  glm::mat4 model;
+} draw_packet_t;
+
+// the "Object" uniform block of vertex.vs / depth.vs, std140. one per draw,
+// written into the frame ring
+typedef struct object_block_t {
+  glm::mat4 model;
+  glm::vec4 normal[3]; // normal matrix, a mat3 is three vec4 columns in std140
+  glm::vec4 color;
+} object_block_t;
+
+// per frame list of draws. systems push packets in any order, the queue
+// sorts them by a 64-bit key (pass | program | material | mesh | depth) and
+// replays them touching gl state only when it actually changes
+class RenderQueue {
+public:
+  // key layout, most significant bits first
+  static const int kDepthBits = 24;
+  static const int kMeshBits = 12;
+  static const int kMaterialBits = 12;
+  static const int kProgramBits = 8;
+  static const int kPassBits = 2;
+
+  RenderQueue() = default;
+  ~RenderQueue() = default;
+
+  // starts a new frame, drops everything pushed so far
+  void begin(const glm::mat4 &view, const glm::mat4 &proj,
+             const glm::vec3 &cam_pos, float far);
+  void push(render_pass_t pass, const draw_packet_t &packet);
+  // off = every packet is drawn double sided, whatever it asked for
+  void set_culling(bool enabled) { culling_ = enabled; }
+  // radix sorts the keys
+  void sort();
+  // issues the draws in key order. with conditions, packets that have an
+  // occlusion_id are drawn under its query
+  void submit(OcclusionQueries *conditions = nullptr);
+  // same draws with one program and the same object blocks, for depth only
+  // passes. vao has to hold the same vertices as the packets' vaos
+  void submit_depth(GLuint program, GLuint vao, OcclusionQueries *conditions = nullptr);
+
+  int size() const { return (int)packets_.size(); }
+  // i-th packet in key order, valid after sort()
+  const draw_packet_t &sorted_packet(int i) const { return packets_[order_[i]]; }
+  const glm::mat4 &view() const { return view_; }
+  const glm::mat4 &proj() const { return proj_; }
+  int num_program_changes() const { return num_program_changes_; }
+  int num_material_changes() const { return num_material_changes_; }
+  int num_vao_changes() const { return num_vao_changes_; }
+
+  static uint64_t make_key(int pass, int program, int material, int mesh,
+                           float depth01);
+  // inverse transpose of the upper 3x3 of model_view. rigid and uniform scale
+  // transforms (walls, props) skip the inverse
+  static glm::mat3 normal_matrix(const glm::mat4 &model_view);
+  // object blocks of one draw are this far apart in the ring
+  static GLsizeiptr object_stride();
+
+private:
+  glm::mat4 view_, proj_;
+  glm::vec3 cam_pos_;
+  float far_ = 100.0f;
+  bool culling_ = true;
+
+  vector<draw_packet_t> packets_;
+  // (key, packet index) pairs, sorted in place
+  vector<uint64_t> keys_, keys_tmp_;
+  vector<int> order_, order_tmp_;
+  vector<int> counts_; // radix histogram
+
+  // object blocks of this frame's draws in key order, written by the first
+  // submit and reused by the rest (depth pre-pass, main pass)
+  ring_chunk_t objects_ = {};
+  bool objects_written_ = false;
+
+  // small ids for the key fields, kept across frames so keys stay stable
+  vector<GLuint> programs_;
+  vector<int> meshes_; // start vertex of every mesh seen so far
+  typedef struct material_key_t {
+    int tex_id;
+    glm::vec3 color;
+    bool cull;
+  } material_key_t;
+  vector<material_key_t> materials_;
+
+  int num_program_changes_ = 0;
+  int num_material_changes_ = 0;
+  int num_vao_changes_ = 0;
+
+  int program_id(GLuint program);
+  int mesh_id(int start);
+  int material_id(int tex_id, const glm::vec3 &color, bool cull);
+  void write_objects();
+  void bind_object(int i);
+};
+
+#endif // RENDER_QUEUE_H
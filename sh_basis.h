@@ -0,0 +1,32 @@
+#ifndef SH_BASIS_H
+#define SH_BASIS_H
+
+// real spherical harmonics up to band 2, the 9 coefficients the sky ambient
+// and the lightmap baker's probes project onto. the order and constants
+// have to match shBasis() in fragment.fs, which evaluates what they bake
+static const float kShBand0 = 0.282095f;     // 1 / (2 sqrt(pi))
+static const float kShBand1 = 0.488603f;     // sqrt(3) / (2 sqrt(pi))
+static const float kShBand2 = 1.092548f;     // sqrt(15) / (2 sqrt(pi))
+static const float kShBand2Zonal = 0.315392f; // sqrt(5) / (4 sqrt(pi))
+static const float kShBand2Diff = 0.546274f;  // sqrt(15) / (4 sqrt(pi))
+
+// convolution with the clamped cosine per coefficient (pi, 2 pi / 3,
+// pi / 4 per band), turns radiance into irradiance
+static const float kShCosineLobe[9] = {3.141593f, 2.094395f, 2.094395f,
+                                       2.094395f, 0.785398f, 0.785398f,
+                                       0.785398f, 0.785398f, 0.785398f};
+
+// the basis for the unit direction (x, y, z)
+inline void sh_basis(float x, float y, float z, float *basis) {
+  basis[0] = kShBand0;
+  basis[1] = kShBand1 * y;
+  basis[2] = kShBand1 * z;
+  basis[3] = kShBand1 * x;
+  basis[4] = kShBand2 * x * y;
+  basis[5] = kShBand2 * y * z;
+  basis[6] = kShBand2Zonal * (3.0f * z * z - 1.0f);
+  basis[7] = kShBand2 * x * z;
+  basis[8] = kShBand2Diff * (x * x - y * y);
+}
+
+#endif // SH_BASIS_H
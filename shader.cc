@@ -1,25 +1,314 @@
 #include "shader.h"
 
-Shader::Shader(const char *vShaderFileName, const char *fShaderFileName, const char *gShaderFileName) {
-  shaderProgram_ = InitShader(vShaderFileName, fShaderFileName);
+#include "gl_state.h"
+#include "profiler.h"
+#include "render_device.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+Shader::Shader(const char *vShaderFileName, const char *fShaderFileName, const char *gShaderFileName,
+               const std::string &defines) {
+  startCompile(vShaderFileName, fShaderFileName, gShaderFileName, defines);
+  finishCompile();
+}
+
+typedef void (*max_compiler_threads_proc_t)(GLuint count);
+
+static bool parallel_compile = false;
+
+void Shader::enableParallelCompile() {
+  // the arb and khr versions share the entry point signature and enums,
+  // glad only knows the arb one
+  max_compiler_threads_proc_t max_threads = NULL;
+  if (GLAD_GL_ARB_parallel_shader_compile) {
+    max_threads = glMaxShaderCompilerThreadsARB;
+  } else {
+    GLint num_extensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
+    for (int i = 0; i < num_extensions; i++) {
+      const char *name = (const char *)glGetStringi(GL_EXTENSIONS, i);
+      if (strcmp(name, "GL_KHR_parallel_shader_compile") == 0) {
+        // through whatever loaded the context, sdl or egl
+        max_threads = (max_compiler_threads_proc_t)render_device().proc_address(
+            "glMaxShaderCompilerThreadsKHR");
+        break;
+      }
+    }
+  }
+  if (max_threads == NULL) {
+    printf("no parallel shader compile, programs build one at a time\n");
+    return;
+  }
+  max_threads(0xFFFFFFFFu); // as many as the driver wants
+  parallel_compile = true;
+}
+
+bool Shader::parallelCompileSupported() { return parallel_compile; }
+
+char *Shader::addDefines(char *source, const std::string &defines) {
+  if (source == NULL || defines.empty()) {
+    return source;
+  }
+  // #version has to stay the first line
+  std::string text(source);
+  size_t at = 0;
+  if (text.compare(0, 8, "#version") == 0) {
+    at = text.find('\n');
+    at = at == std::string::npos ? text.size() : at + 1;
+  }
+  text.insert(at, defines);
+  delete[] source;
+
+  char *result = new char[text.size() + 1];
+  copy(text.begin(), text.end(), result);
+  result[text.size()] = '\0';
+  return result;
 }
 
+// fnv-1a, same as the pvs cache
+static uint64_t hash_bytes(uint64_t hash, const char *bytes, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ (unsigned char)bytes[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+static uint64_t hash_string(uint64_t hash, const char *str) {
+  // the terminator goes in too so "ab" + "c" != "a" + "bc"
+  return hash_bytes(hash, str ? str : "", (str ? strlen(str) : 0) + 1);
+}
+
+bool Shader::binaryCacheSupported() {
+  static int supported = -1;
+  if (supported < 0) {
+    supported = 0;
+    if (GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 1) ||
+        GLAD_GL_ARB_get_program_binary) {
+      GLint formats = 0;
+      glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+      supported = formats > 0;
+    }
+  }
+  return supported != 0;
+}
+
+std::string Shader::binaryCacheFile(const char *vShaderFileName, const char *fShaderFileName,
+                                    const char *gShaderFileName, const std::string &defines) {
+  uint64_t hash = 1469598103934665603ull;
+  hash = hash_string(hash, vShaderFileName);
+  hash = hash_string(hash, fShaderFileName);
+  hash = hash_string(hash, gShaderFileName);
+  hash = hash_string(hash, defines.c_str());
+  char fname[512];
+  snprintf(fname, sizeof(fname), "%s.%016llx.bin", vShaderFileName, (unsigned long long)hash);
+  return fname;
+}
+
+std::string Shader::binaryCacheKey(const char *vs_text, const char *fs_text, const char *gs_text) {
+  uint64_t hash = 1469598103934665603ull;
+  hash = hash_string(hash, vs_text);
+  hash = hash_string(hash, fs_text);
+  hash = hash_string(hash, gs_text);
+  char hex[32];
+  snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+
+  std::string key = hex;
+  key += "\n";
+  key += (const char *)glGetString(GL_VENDOR);
+  key += "\n";
+  key += (const char *)glGetString(GL_RENDERER);
+  key += "\n";
+  key += (const char *)glGetString(GL_VERSION);
+  return key;
+}
+
+// cache layout: "PRG1", key length, key, binary format, binary length, binary
+GLuint Shader::loadProgramBinary(const std::string &fname, const std::string &key) {
+  FILE *fp = fopen(fname.c_str(), "rb");
+  if (fp == NULL) {
+    return 0;
+  }
 
-void Shader::useShader() { glUseProgram(shaderProgram_); }
+  char magic[4];
+  uint32_t key_len = 0;
+  bool ok = fread(magic, 1, 4, fp) == 4 && memcmp(magic, "PRG1", 4) == 0 &&
+            fread(&key_len, sizeof(key_len), 1, fp) == 1 && key_len == key.size();
+  std::string file_key(key_len, '\0');
+  ok = ok && fread(&file_key[0], 1, key_len, fp) == key_len && file_key == key;
+
+  GLenum format = 0;
+  int32_t length = 0;
+  ok = ok && fread(&format, sizeof(format), 1, fp) == 1 &&
+       fread(&length, sizeof(length), 1, fp) == 1 && length > 0;
+  std::string binary(ok ? length : 0, '\0');
+  ok = ok && fread(&binary[0], 1, length, fp) == (size_t)length;
+  fclose(fp);
+  if (!ok) {
+    printf("program cache %s is stale, recompiling\n", fname.c_str());
+    return 0;
+  }
+
+  // the driver can still refuse it (e.g. an update that kept the version)
+  GLuint program = glCreateProgram();
+  glProgramBinary(program, format, binary.data(), length);
+  GLint linked = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  if (!linked) {
+    printf("driver rejected program cache %s, recompiling\n", fname.c_str());
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
+void Shader::saveProgramBinary(GLuint program, const std::string &fname, const std::string &key) {
+  GLint linked = GL_FALSE, length = 0;
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (!linked || length <= 0) {
+    return;
+  }
+  std::string binary(length, '\0');
+  GLenum format = 0;
+  glGetProgramBinary(program, length, &length, &format, &binary[0]);
+
+  FILE *fp = fopen(fname.c_str(), "wb");
+  if (fp == NULL) {
+    printf("can't write program cache %s\n", fname.c_str());
+    return;
+  }
+  uint32_t key_len = (uint32_t)key.size();
+  int32_t len = length;
+  fwrite("PRG1", 1, 4, fp);
+  fwrite(&key_len, sizeof(key_len), 1, fp);
+  fwrite(key.data(), 1, key_len, fp);
+  fwrite(&format, sizeof(format), 1, fp);
+  fwrite(&len, sizeof(len), 1, fp);
+  fwrite(binary.data(), 1, length, fp);
+  fclose(fp);
+}
+
+ShaderVariants::ShaderVariants(const char *vShaderFileName, const char *fShaderFileName)
+    : vShaderFileName_(vShaderFileName), fShaderFileName_(fShaderFileName) {}
+
+std::string ShaderVariants::definesFor(unsigned features) {
+  std::string defines;
+  if (features & (FEATURE_TEXTURED | FEATURE_TEX1)) {
+    defines += "#define TEXTURED\n";
+    defines += (features & FEATURE_TEX1) ? "#define TEXTURE_SAMPLER tex1\n"
+                                         : "#define TEXTURE_SAMPLER tex0\n";
+  }
+  if (features & FEATURE_REFLECTIVE) {
+    defines += "#define REFLECTIVE\n";
+  }
+  if (features & FEATURE_LIGHTMAPPED) {
+    defines += "#define LIGHTMAPPED\n";
+  }
+  if (features & FEATURE_PROBE_LIT) {
+    defines += "#define PROBE_LIT\n";
+  }
+  if (features & FEATURE_IMPOSTOR) {
+    defines += "#define IMPOSTOR\n";
+  }
+  return defines;
+}
+
+void ShaderVariants::start(unsigned features) {
+  if (variants_.count(features) == 0) {
+    variants_[features].startCompile(vShaderFileName_.c_str(), fShaderFileName_.c_str(),
+                                     nullptr, definesFor(features));
+  }
+}
+
+void ShaderVariants::startAll() {
+  const unsigned textures[3] = {0, FEATURE_TEXTURED, FEATURE_TEXTURED | FEATURE_TEX1};
+  for (int t = 0; t < 3; t++) {
+    start(textures[t]);
+    start(textures[t] | FEATURE_REFLECTIVE);
+  }
+  // the walls and the floor when the level has a lightmap, goal and props
+  // when it has probes
+  start(FEATURE_TEXTURED | FEATURE_LIGHTMAPPED);
+  start(FEATURE_TEXTURED | FEATURE_TEX1 | FEATURE_LIGHTMAPPED);
+  start(FEATURE_PROBE_LIT);
+  start(FEATURE_PROBE_LIT | FEATURE_REFLECTIVE);
+}
+
+int ShaderVariants::numPending() const {
+  int pending = 0;
+  for (std::map<unsigned, Shader>::const_iterator it = variants_.begin(); it != variants_.end(); ++it) {
+    if (!it->second.isReady()) {
+      pending++;
+    }
+  }
+  return pending;
+}
+
+Shader &ShaderVariants::get(unsigned features) {
+  start(features);
+  Shader &variant = variants_[features];
+  if (variant.isPending()) {
+    variant.finishCompile();
+  }
+  if (units_set_.insert(features).second) {
+    // sampler units never change, set them once (programs loaded from the
+    // binary cache never were pending, so not just after a compile). both 2d
+    // samplers stay on unit 0 like before, the skybox cube map is read from
+    // unit 1, the light clusters, shadow maps and baked lighting from the
+    // units after that
+    variant.useShader();
+    variant.setTexNum("tex0", 0);
+    variant.setTexNum("tex1", 0);
+    variant.setTexNum("skybox", 1);
+    variant.setTexNum("lightData", UNIT_LIGHT_DATA);
+    variant.setTexNum("clusterGrid", UNIT_CLUSTER_GRID);
+    variant.setTexNum("lightIndices", UNIT_LIGHT_INDICES);
+    variant.setTexNum("staticShadow", UNIT_STATIC_SHADOW);
+    variant.setTexNum("dynamicShadow", UNIT_DYNAMIC_SHADOW);
+    variant.setTexNum("lightmap", UNIT_LIGHTMAP);
+    variant.setTexNum("lightmapFaces", UNIT_LIGHTMAP_FACES);
+    variant.setTexNum("probes", UNIT_PROBES);
+    variant.setTexNum("impostorColor", UNIT_IMPOSTOR_COLOR);
+    variant.setTexNum("impostorNormal", UNIT_IMPOSTOR_NORMAL);
+    variant.setBlockBinding("LightClusters", BLOCK_LIGHT_CLUSTERS);
+    variant.setBlockBinding("Shadows", BLOCK_SHADOWS);
+    variant.setBlockBinding("Lightmap", BLOCK_LIGHTMAP);
+    variant.setBlockBinding("Probes", BLOCK_PROBES);
+    variant.setBlockBinding("SkyAmbient", BLOCK_SKY_AMBIENT);
+    variant.setBlockBinding("Object", BLOCK_OBJECT);
+  }
+  return variant;
+}
+
+void ShaderVariants::cleanUpShaders() {
+  for (std::map<unsigned, Shader>::iterator it = variants_.begin(); it != variants_.end(); ++it) {
+    it->second.cleanUpShader();
+  }
+  variants_.clear();
+  units_set_.clear();
+}
+
+
+void Shader::useShader() { gl_state().use_program(shaderProgram_); }
 
 // 
 void Shader::initShaderAttribs8Verts() {
   	//Tell OpenGL how to set fragment shader input 
-	GLint posAttrib = glGetAttribLocation(shaderProgram_, "position");
+	// fixed slots (startCompile() binds them), a variant that doesn't read an
+	// attribute would report -1 for it otherwise, and the variants may still
+	// be compiling at this point
+	GLint posAttrib = ATTRIB_POSITION;
 	glVertexAttribPointer(posAttrib, 3, GL_FLOAT, GL_FALSE, 8*sizeof(float), 0);
 	  //Attribute, vals/attrib., type, isNormalized, stride, offset
 	glEnableVertexAttribArray(posAttrib);
 	
-	GLint normAttrib = glGetAttribLocation(shaderProgram_, "inNormal");
+	GLint normAttrib = ATTRIB_NORMAL;
 	glVertexAttribPointer(normAttrib, 3, GL_FLOAT, GL_FALSE, 8*sizeof(float), (void*)(5*sizeof(float)));
 	glEnableVertexAttribArray(normAttrib);
 	
-	GLint texAttrib = glGetAttribLocation(shaderProgram_, "inTexcoord");
+	GLint texAttrib = ATTRIB_TEXCOORD;
 	glEnableVertexAttribArray(texAttrib);
 	glVertexAttribPointer(texAttrib, 2, GL_FLOAT, GL_FALSE, 8*sizeof(float), (void*)(3*sizeof(float)));
 }
@@ -45,65 +334,23 @@ void Shader::initShaderAttribs5Verts() {
 
 
 
-GLuint Shader::InitShader(const char *vShaderFileName,
-                          const char *fShaderFileName, const char *gShaderFileName) {
-  GLuint vertex_shader, fragment_shader;
+void Shader::startCompile(const char *vShaderFileName, const char *fShaderFileName,
+                          const char *gShaderFileName, const std::string &defines) {
+  PROFILE_ZONE("shader compile start");
   GLchar *vs_text, *fs_text;
-  GLuint program;
 
   // check GLSL version
   printf("GLSL version: %s\n\n", glGetString(GL_SHADING_LANGUAGE_VERSION));
 
-  // Create shader handlers
-  vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-  fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-
   // Read source code from shader files
-  vs_text = readShaderSource(vShaderFileName);
-  fs_text = readShaderSource(fShaderFileName);
+  vs_text = addDefines(readShaderSource(vShaderFileName), defines);
+  fs_text = addDefines(readShaderSource(fShaderFileName), defines);
   // if geometry shader filename is present, read it too
-  
-  GLuint geometry_shader;
+  GLchar *gs_text = NULL;
   if (gShaderFileName != nullptr) {
-    geometry_shader = glCreateShader(GL_GEOMETRY_SHADER);
-    GLchar *gs_text = readShaderSource(gShaderFileName);
-
-    // error check
-    if (gs_text == NULL) {
-      printf("Failed to read from geometry shader file %s\n", gShaderFileName);
-      exit(1);
-    } else if (DEBUG_ON) {
-      printf("\nGeometry Shader:\n=====================\n");
-      printf("%s\n", gs_text);
-      printf("=====================\n\n");
-    }
-
-    // compile geometry shader and add to program
-    const char *gg = gs_text;
-    glShaderSource(geometry_shader, 1, &gg, NULL);
-    glCompileShader(geometry_shader);
-
-
-    GLint compiled;
-    glGetShaderiv(geometry_shader, GL_COMPILE_STATUS, &compiled);
-    if (!compiled) {
-      printf("Geometry shader failed to compile\n");
-      if (DEBUG_ON) {
-        GLint logMaxSize, logLength;
-        glGetShaderiv(geometry_shader, GL_INFO_LOG_LENGTH, &logMaxSize);
-        printf("printing error message of %d bytes\n", logMaxSize);
-        char *logMsg = new char[logMaxSize];
-        glGetShaderInfoLog(geometry_shader, logMaxSize, &logLength, logMsg);
-        printf("%d bytes retrieved\n", logLength);
-        printf("error message: %s\n", logMsg);
-        delete[] logMsg;
-      }
-      exit(1);
-    }
+    gs_text = addDefines(readShaderSource(gShaderFileName), defines);
   }
 
-
-
   // error check
   if (vs_text == NULL) {
     printf("Failed to read from vertex shader file %s\n", vShaderFileName);
@@ -121,70 +368,133 @@ GLuint Shader::InitShader(const char *vShaderFileName,
     printf("%s\n", fs_text);
     printf("=====================\n\n");
   }
-
-  // Load Vertex Shader
-  const char *vv = vs_text;
-  glShaderSource(vertex_shader, 1, &vv, NULL); // Read source
-  glCompileShader(vertex_shader);              // Compile shaders
-
-  // Check for errors
-  GLint compiled;
-  glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &compiled);
-  if (!compiled) {
-    printf("Vertex shader failed to compile:\n");
-    if (DEBUG_ON) {
-      GLint logMaxSize, logLength;
-      glGetShaderiv(vertex_shader, GL_INFO_LOG_LENGTH, &logMaxSize);
-      printf("printing error message of %d bytes\n", logMaxSize);
-      char *logMsg = new char[logMaxSize];
-      glGetShaderInfoLog(vertex_shader, logMaxSize, &logLength, logMsg);
-      printf("%d bytes retrieved\n", logLength);
-      printf("error message: %s\n", logMsg);
-      delete[] logMsg;
+  if (gShaderFileName != nullptr) {
+    if (gs_text == NULL) {
+      printf("Failed to read from geometry shader file %s\n", gShaderFileName);
+      exit(1);
+    } else if (DEBUG_ON) {
+      printf("\nGeometry Shader:\n=====================\n");
+      printf("%s\n", gs_text);
+      printf("=====================\n\n");
     }
-    exit(1);
   }
 
-  // Load Fragment Shader
-  const char *ff = fs_text;
-  glShaderSource(fragment_shader, 1, &ff, NULL);
-  glCompileShader(fragment_shader);
-  glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &compiled);
-
-  // Check for Errors
-  if (!compiled) {
-    printf("Fragment shader failed to compile\n");
-    if (DEBUG_ON) {
-      GLint logMaxSize, logLength;
-      glGetShaderiv(fragment_shader, GL_INFO_LOG_LENGTH, &logMaxSize);
-      printf("printing error message of %d bytes\n", logMaxSize);
-      char *logMsg = new char[logMaxSize];
-      glGetShaderInfoLog(fragment_shader, logMaxSize, &logLength, logMsg);
-      printf("%d bytes retrieved\n", logLength);
-      printf("error message: %s\n", logMsg);
-      delete[] logMsg;
+  // skip the compile if the cache has this exact program for this driver
+  use_cache_ = binaryCacheSupported();
+  if (use_cache_) {
+    cache_file_ = binaryCacheFile(vShaderFileName, fShaderFileName, gShaderFileName, defines);
+    cache_key_ = binaryCacheKey(vs_text, fs_text, gs_text);
+    shaderProgram_ = loadProgramBinary(cache_file_, cache_key_);
+    if (shaderProgram_ != 0) {
+      delete[] vs_text;
+      delete[] fs_text;
+      delete[] gs_text;
+      numStages_ = 0;
+      pending_ = false;
+      return;
     }
-    exit(1);
   }
 
-  // Create the program
-  program = glCreateProgram();
+  // queue up the compiles and the link without asking for any status, a
+  // status query makes the driver finish the work right there
+  const GLenum types[3] = {GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_GEOMETRY_SHADER};
+  const char *texts[3] = {vs_text, fs_text, gs_text};
+  numStages_ = gShaderFileName != nullptr ? 3 : 2;
+  shaderProgram_ = glCreateProgram();
+  for (int i = 0; i < numStages_; i++) {
+    stages_[i] = glCreateShader(types[i]);
+    glShaderSource(stages_[i], 1, &texts[i], NULL);
+    glCompileShader(stages_[i]);
+    glAttachShader(shaderProgram_, stages_[i]);
+  }
+  delete[] vs_text;
+  delete[] fs_text;
+  delete[] gs_text;
 
-  // Attach shaders to program
-  glAttachShader(program, vertex_shader);
-  glAttachShader(program, fragment_shader);
+  // same attribute slots in every program
+  glBindAttribLocation(shaderProgram_, ATTRIB_POSITION, "position");
+  glBindAttribLocation(shaderProgram_, ATTRIB_NORMAL, "inNormal");
+  glBindAttribLocation(shaderProgram_, ATTRIB_TEXCOORD, "inTexcoord");
 
-  // if geometry shader is present, attach it too
-  if (gShaderFileName != nullptr) {
-    glAttachShader(program, geometry_shader);
+  // Link and set program to use
+  if (use_cache_) {
+    glProgramParameteri(shaderProgram_, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
   }
+  glLinkProgram(shaderProgram_);
+  pending_ = true;
+}
 
-  // Link and set program to use
-  glLinkProgram(program);
+bool Shader::isReady() const {
+  if (!pending_) {
+    return true;
+  }
+  if (!parallelCompileSupported()) {
+    return true; // nothing to poll, finishCompile() just waits
+  }
+  GLint done = GL_FALSE;
+  glGetProgramiv(shaderProgram_, GL_COMPLETION_STATUS_ARB, &done);
+  return done == GL_TRUE;
+}
 
-  return program;
+void Shader::printLog(GLuint object, bool program) const {
+  if (!DEBUG_ON) {
+    return;
+  }
+  GLint logMaxSize, logLength;
+  if (program) {
+    glGetProgramiv(object, GL_INFO_LOG_LENGTH, &logMaxSize);
+  } else {
+    glGetShaderiv(object, GL_INFO_LOG_LENGTH, &logMaxSize);
+  }
+  printf("printing error message of %d bytes\n", logMaxSize);
+  char *logMsg = new char[logMaxSize + 1];
+  if (program) {
+    glGetProgramInfoLog(object, logMaxSize + 1, &logLength, logMsg);
+  } else {
+    glGetShaderInfoLog(object, logMaxSize + 1, &logLength, logMsg);
+  }
+  printf("%d bytes retrieved\n", logLength);
+  printf("error message: %s\n", logMsg);
+  delete[] logMsg;
+}
+
+void Shader::finishCompile() {
+  if (!pending_) {
+    return;
+  }
+  PROFILE_ZONE("shader compile finish");
+  pending_ = false;
+
+  static const char *names[3] = {"Vertex", "Fragment", "Geometry"};
+  GLint status;
+  for (int i = 0; i < numStages_; i++) {
+    glGetShaderiv(stages_[i], GL_COMPILE_STATUS, &status);
+    if (!status) {
+      printf("%s shader failed to compile\n", names[i]);
+      printLog(stages_[i], false);
+      exit(1);
+    }
+  }
+  glGetProgramiv(shaderProgram_, GL_LINK_STATUS, &status);
+  if (!status) {
+    printf("Shader program failed to link\n");
+    printLog(shaderProgram_, true);
+    exit(1);
+  }
+
+  // the program keeps what it needs
+  for (int i = 0; i < numStages_; i++) {
+    glDetachShader(shaderProgram_, stages_[i]);
+    glDeleteShader(stages_[i]);
+  }
+  numStages_ = 0;
+
+  if (use_cache_) {
+    saveProgramBinary(shaderProgram_, cache_file_, cache_key_);
+  }
 }
 
 void Shader::cleanUpShader() {
+  gl_state().forget_program(shaderProgram_);
   glDeleteProgram(shaderProgram_);
 }
\ No newline at end of file
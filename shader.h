@@ -3,20 +3,82 @@
 
 #include "glad/glad.h"
 #include "glm/glm.hpp"
-#include <SDL3/SDL_opengl.h>
 #include <cstdio>
 #include <fstream>
+#include <map>
+#include <set>
+#include <string>
+
+// fixed attribute slots, bound before linking so every program can read the
+// same vertex arrays
+enum shader_attrib_t {
+  ATTRIB_POSITION = 0,  // "position"
+  ATTRIB_NORMAL = 1,    // "inNormal"
+  ATTRIB_TEXCOORD = 2   // "inTexcoord"
+};
+
+// texture units and uniform block bindings of the clustered lights (see
+// ClusteredLights), the sun shadows (ShadowMaps) and the baked lighting
+// (Lightmap, ProbeGrid), wired up once per variant in ShaderVariants::get()
+enum shader_binding_t {
+  UNIT_LIGHT_DATA = 2,      // "lightData"
+  UNIT_CLUSTER_GRID = 3,    // "clusterGrid"
+  UNIT_LIGHT_INDICES = 4,   // "lightIndices"
+  UNIT_STATIC_SHADOW = 5,   // "staticShadow"
+  UNIT_DYNAMIC_SHADOW = 6,  // "dynamicShadow"
+  UNIT_LIGHTMAP = 7,        // "lightmap"
+  UNIT_LIGHTMAP_FACES = 8,  // "lightmapFaces"
+  UNIT_PROBES = 9,          // "probes"
+  UNIT_IMPOSTOR_COLOR = 10, // "impostorColor"
+  UNIT_IMPOSTOR_NORMAL = 11, // "impostorNormal"
+  BLOCK_LIGHT_CLUSTERS = 0, // "LightClusters" uniform block
+  BLOCK_SHADOWS = 1,        // "Shadows" uniform block
+  BLOCK_LIGHTMAP = 2,       // "Lightmap" uniform block
+  BLOCK_PROBES = 3,         // "Probes" uniform block
+  BLOCK_SKY_AMBIENT = 4,    // "SkyAmbient" uniform block
+  BLOCK_OBJECT = 5          // "Object" uniform block, moved for every draw
+};
+
+// compile time features of a shader variant, each one turns into a #define
+// in front of the source
+enum shader_feature_t {
+  FEATURE_TEXTURED = 1 << 0,   // TEXTURED, samples tex0
+  FEATURE_TEX1 = 1 << 1,       // TEXTURE_SAMPLER tex1 instead of tex0
+  FEATURE_REFLECTIVE = 1 << 2, // REFLECTIVE, mixes in the skybox reflection
+  FEATURE_LIGHTMAPPED = 1 << 3, // LIGHTMAPPED, sun and ambient come from the lightmap
+  FEATURE_PROBE_LIT = 1 << 4,   // PROBE_LIT, ambient comes from the irradiance probes
+  FEATURE_IMPOSTOR = 1 << 5     // IMPOSTOR, surface comes from an impostor atlas (impostor.vs)
+};
 
 class Shader {
 public:
   Shader() = default;
-  Shader(const char *vShaderFileName, const char *fShaderFileName, const char *gShaderFileName = nullptr);
+  // defines is pasted in right after the #version line of every stage
+  Shader(const char *vShaderFileName, const char *fShaderFileName, const char *gShaderFileName = nullptr,
+         const std::string &defines = "");
   ~Shader() = default;
   GLuint getShader() const { return shaderProgram_; }
   void useShader();
 
-  // shader attributes for 8 float per vertex (3 pos, 3 normal, 2 texcoord)
-  void initShaderAttribs8Verts();
+  // two step build for compiling many programs at once. startCompile() hands
+  // the sources to the driver and returns without waiting, isReady() polls
+  // (always true without parallel compile support) and finishCompile()
+  // blocks until the program is linked, checks it and caches the binary.
+  // the constructor does both steps back to back
+  void startCompile(const char *vShaderFileName, const char *fShaderFileName,
+                    const char *gShaderFileName = nullptr, const std::string &defines = "");
+  bool isReady() const;
+  bool isPending() const { return pending_; }
+  void finishCompile();
+
+  // turns on KHR/ARB_parallel_shader_compile if the driver has it, call once
+  // after the context is up
+  static void enableParallelCompile();
+  static bool parallelCompileSupported();
+
+  // shader attributes for 8 float per vertex (3 pos, 3 normal, 2 texcoord).
+  // uses the fixed slots, so it works before any program is built
+  static void initShaderAttribs8Verts();
   void initShaderAttribs3Verts();
   void initShaderAttribs5Verts();
 
@@ -32,15 +94,50 @@ public:
     glUniform1i(glGetUniformLocation(shaderProgram_, name.c_str()), value);
   }
 
+  void setBlockBinding(const std::string &name, GLuint binding) const {
+    GLuint index = glGetUniformBlockIndex(shaderProgram_, name.c_str());
+    if (index != GL_INVALID_INDEX) {
+      glUniformBlockBinding(shaderProgram_, index, binding);
+    }
+  }
+
   void setUniformMat(const std::string &name, const glm::mat4 &mat) const {
     glUniformMatrix4fv(glGetUniformLocation(shaderProgram_, name.c_str()), 1,
                        GL_FALSE, &mat[0][0]);
   }
 
+  void setUniformMat3(const std::string &name, const glm::mat3 &mat) const {
+    glUniformMatrix3fv(glGetUniformLocation(shaderProgram_, name.c_str()), 1,
+                       GL_FALSE, &mat[0][0]);
+  }
+
 private:
-  GLuint shaderProgram_;
+  GLuint shaderProgram_ = 0;
   bool DEBUG_ON = false;
-  GLuint InitShader(const char *vShaderFileName, const char *fShaderFileName, const char *gShaderFileName = nullptr);
+
+  // compile in flight, see startCompile()
+  bool pending_ = false;
+  GLuint stages_[3];
+  int numStages_ = 0;
+  bool use_cache_ = false;
+  std::string cache_file_, cache_key_;
+
+  void printLog(GLuint object, bool program) const;
+  // returns a new[] copy of source with defines inserted after the #version line
+  static char *addDefines(char *source, const std::string &defines);
+
+  // program binary cache. linked programs are saved next to the vertex shader
+  // as <vs>.<hash of file names + defines>.bin. the file stores a key made of
+  // a hash of the final sources and the driver's vendor / renderer / version
+  // strings; if any of them changed the binary is ignored, the program is
+  // compiled from source and the file rewritten
+  static bool binaryCacheSupported();
+  static std::string binaryCacheFile(const char *vShaderFileName, const char *fShaderFileName,
+                                     const char *gShaderFileName, const std::string &defines);
+  static std::string binaryCacheKey(const char *vs_text, const char *fs_text, const char *gs_text);
+  // 0 if there is no usable binary
+  static GLuint loadProgramBinary(const std::string &fname, const std::string &key);
+  static void saveProgramBinary(GLuint program, const std::string &fname, const std::string &key);
   // Create a NULL-terminated string by reading the provided file
   static char *readShaderSource(const char *shaderFile) {
     FILE *fp;
@@ -78,4 +175,30 @@ private:
   }
 };
 
+// one source pair compiled once per feature set. variants are built on first
+// use (or all up front with startAll()) and kept by their feature bits, so
+// materials just ask for the bits they need and branch free programs come back
+class ShaderVariants {
+public:
+  ShaderVariants(const char *vShaderFileName, const char *fShaderFileName);
+  ~ShaderVariants() = default;
+
+  // finishes the variant's compile if it is still running
+  Shader &get(unsigned features);
+  // starts compiling a variant / every feature combination without waiting
+  void start(unsigned features);
+  void startAll();
+  // variants still compiling
+  int numPending() const;
+  // deletes every variant built so far
+  void cleanUpShaders();
+
+  static std::string definesFor(unsigned features);
+
+private:
+  std::string vShaderFileName_, fShaderFileName_;
+  std::map<unsigned, Shader> variants_;
+  std::set<unsigned> units_set_; // variants whose sampler units are wired up
+};
+
 #endif // SHADER_H
\ No newline at end of file
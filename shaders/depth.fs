@@ -0,0 +1,6 @@
+#version 150 core
+
+// depth only, color writes are masked off during the pre-pass
+
+void main() {
+}
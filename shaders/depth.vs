@@ -0,0 +1,23 @@
+#version 150 core
+
+// depth pre-pass, reads the position only stream. gl_Position has to come
+// out bit for bit the same as in vertex.vs so the main pass can test with
+// GL_EQUAL, hence the invariant and the identical expression
+
+in vec3 position;
+
+uniform mat4 view;
+uniform mat4 proj;
+
+// same block as vertex.vs, only the model matrix is used
+layout(std140) uniform Object {
+  mat4 model;
+  mat3 normalMatrix;
+  vec4 inColor;
+};
+
+invariant gl_Position;
+
+void main() {
+   gl_Position = proj * view * model * vec4(position,1.0);
+}
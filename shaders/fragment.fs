@@ -1,52 +1,342 @@
 #version 150 core
 
+// variants (see ShaderVariants):
+//   TEXTURED         color comes from TEXTURE_SAMPLER (tex0 or tex1)
+//   REFLECTIVE       mixes in the skybox reflection
+//   LIGHTMAPPED      sun and ambient come from the baked lightmap while it
+//                    matches the sun (walls and floor, see Lightmap)
+//   PROBE_LIT        ambient comes from the baked irradiance probes while
+//                    they match the sun (goal and props, see ProbeGrid)
+//   IMPOSTOR         drawn from impostor.vs, color, normal and position come
+//                    from the impostor atlas instead (see Impostors)
+// every variant adds the point lights of its cluster (see ClusteredLights)
+// and takes its ambient from the skybox sh (see SkyAmbient) unless baked
+
+#ifdef IMPOSTOR
+in vec3 lightDir;
+in vec3 objectPos;
+flat in vec3 objectEye;
+// the quad only carries the eye ray, main() fills these in from the atlas
+// before anything reads them
+vec3 Color;
+vec3 vertNormal;
+vec3 pos;
+vec2 texcoord;
+vec3 staticShadowCoord;
+vec3 dynamicShadowCoord;
+vec3 worldPos;
+vec3 worldNormal;
+#else
 in vec3 Color;
 in vec3 vertNormal;
 in vec3 pos;
 in vec3 lightDir;
 in vec2 texcoord;
+in vec3 staticShadowCoord;
+in vec3 dynamicShadowCoord;
+in vec3 worldPos;
+in vec3 worldNormal;
+#endif
 
 out vec4 outColor;
 
-uniform sampler2D tex0;
-uniform sampler2D tex1;
+#ifdef TEXTURED
+uniform sampler2D TEXTURE_SAMPLER;
+#endif
 
-uniform int texID;
+#if defined(REFLECTIVE) || defined(IMPOSTOR)
+uniform mat4 view;
+#endif
 
+#ifdef REFLECTIVE
 uniform samplerCube skybox;
+const float reflectivity = .6;
+#endif
+
+// clustered point lights, filled in by ClusteredLights
+uniform samplerBuffer lightData;     // 2 texels per light: pos + radius, color
+uniform usamplerBuffer clusterGrid;  // offset, count per cluster
+uniform usamplerBuffer lightIndices; // light lists
+layout(std140) uniform LightClusters {
+  ivec4 clusterDims;  // tiles x, tiles y, slices, number of lights
+  vec4 clusterScale;  // tiles per pixel x, y, slice scale, slice bias
+};
+
+// only the lights binned into this fragment's cluster
+vec3 pointLights(vec3 color, vec3 normal, vec3 viewDir) {
+  ivec3 cell = ivec3(gl_FragCoord.xy * clusterScale.xy,
+                     log(max(-pos.z, 1e-4)) * clusterScale.z - clusterScale.w);
+  cell = clamp(cell, ivec3(0), clusterDims.xyz - 1);
+  int cluster = (cell.z * clusterDims.y + cell.y) * clusterDims.x + cell.x;
+  uvec2 range = texelFetch(clusterGrid, cluster).rg;
+
+  vec3 sum = vec3(0);
+  vec3 reflectDir = reflect(viewDir, normal);
+  for (uint i = 0u; i < range.y; i++) {
+    int light = int(texelFetch(lightIndices, int(range.x + i)).r);
+    vec4 posRadius = texelFetch(lightData, 2 * light);
+    vec3 toLight = posRadius.xyz - pos;
+    float dist2 = dot(toLight, toLight);
+    float radius2 = posRadius.w * posRadius.w;
+    if (dist2 >= radius2)
+      continue;
+    vec3 l = toLight * inversesqrt(dist2);
+    float falloff = 1.0 - dist2 / radius2;
+    falloff *= falloff;
+    float diffuse = max(dot(l, normal), 0.0);
+    float spec = diffuse > 0.0 ? pow(max(dot(reflectDir, -l), 0.0), 4) : 0.0;
+    vec3 lightColor = texelFetch(lightData, 2 * light + 1).rgb;
+    sum += falloff * lightColor * (color * diffuse + .5 * spec);
+  }
+  return sum;
+}
+
+uniform sampler2DShadow staticShadow;
+uniform sampler2DShadow dynamicShadow;
+layout(std140) uniform Shadows {
+  mat4 staticShadowMatrix;
+  mat4 dynamicShadowMatrix;
+  vec4 sunDir;
+  vec4 shadowParams; // x: static map on, y: dynamic map on
+};
+
+// how much of the sun reaches this fragment, the darker of the two maps
+float sunVisibility() {
+  float lit = texture(staticShadow, staticShadowCoord);
+  if (shadowParams.y != 0.0)
+    lit = min(lit, texture(dynamicShadow, dynamicShadowCoord));
+  return lit;
+}
+
+#ifdef LIGHTMAPPED
+// baked by LightmapBaker, filled in by Lightmap
+uniform sampler2D lightmap;
+uniform usamplerBuffer lightmapFaces; // atlas texel of every wall face slot
+layout(std140) uniform Lightmap {
+  ivec4 lightmapGrid;   // map w, h, texels per unit, on
+  vec4 lightmapAtlas;   // 1 / atlas size, floor chart texel
+  vec4 lightmapOrigin;  // world x, z of the grid corner, value scale
+};
+
+// sun and ambient light of this fragment from the lightmap (r) and how much
+// of the sun it sees (a). false where nothing was baked (tops of the walls,
+// outer faces), those keep the runtime lighting
+bool bakedLight(out vec2 light) {
+  light = vec2(0.0);
+  if (lightmapGrid.w == 0)
+    return false;
+  vec3 a = abs(worldNormal);
+  vec2 g = vec2(worldPos.x, worldPos.z) - lightmapOrigin.xy; // grid units
+  float texels = float(lightmapGrid.z);
+  vec2 texel;
+  if (a.y > a.x && a.y > a.z) {
+    if (worldNormal.y < 0.0 || worldPos.y > 0.01)
+      return false;
+    texel = lightmapAtlas.zw + g * texels;
+  } else {
+    // face slot numbering as in Lightmap::x_face_slot() / z_face_slot()
+    int w = lightmapGrid.x, h = lightmapGrid.y;
+    bool xFace = a.x > a.z;
+    int line = int(floor((xFace ? g.x : g.y) + 0.5));
+    float along = xFace ? g.y : g.x;
+    int cell = int(floor(along));
+    int side = (xFace ? worldNormal.x : worldNormal.z) > 0.0 ? 1 : 0;
+    if (cell < 0 || cell >= (xFace ? h : w) || line < 0 || line > (xFace ? w : h))
+      return false;
+    int slot = xFace ? (side * h + cell) * (w + 1) + line
+                     : 2 * (w + 1) * h + (side * w + cell) * (h + 1) + line;
+    uvec2 corner = texelFetch(lightmapFaces, slot).rg;
+    if (corner.x == 0xFFFFu)
+      return false;
+    texel = vec2(corner) + vec2(along - float(cell), clamp(worldPos.y, 0.0, 1.0)) * texels;
+  }
+  light = texture(lightmap, texel * lightmapAtlas.xy).ra * vec2(lightmapOrigin.z, 1.0);
+  return true;
+}
+#endif
+
+// l2 spherical harmonics for the unit normal n, same order and constants as
+// sh_basis() in sh_basis.h that the probes and the sky ambient are baked with
+void shBasis(vec3 n, out float basis[9]) {
+  basis[0] = 0.282095;
+  basis[1] = 0.488603 * n.y;
+  basis[2] = 0.488603 * n.z;
+  basis[3] = 0.488603 * n.x;
+  basis[4] = 1.092548 * n.x * n.y;
+  basis[5] = 1.092548 * n.y * n.z;
+  basis[6] = 0.315392 * (3.0 * n.z * n.z - 1.0);
+  basis[7] = 1.092548 * n.x * n.z;
+  basis[8] = 0.546274 * (n.x * n.x - n.y * n.y);
+}
+
+#ifdef PROBE_LIT
+// baked by LightmapBaker::bake_probes(), filled in by ProbeGrid. 7 blocks of
+// w texels along x, each holding 4 of the 27 coefficients of every probe
+uniform sampler3D probes;
+layout(std140) uniform Probes {
+  ivec4 probeGrid;   // map w, layers, h, on
+  vec4 probeOrigin;  // world x, z of the grid corner, layer height, blocks
+};
+
+// irradiance sh of the 8 probes around the fragment, trilinear in hardware,
+// evaluated for the normal
+vec3 probeIrradiance(vec3 n) {
+  vec3 size = vec3(probeGrid.xyz);
+  vec3 g = vec3(worldPos.x - probeOrigin.x, worldPos.y / probeOrigin.z,
+                worldPos.z - probeOrigin.y);
+  // probes sit on texel centers, stay inside the block so x never blends
+  // into the next one
+  g = clamp(g, vec3(0.5), size - 0.5);
+  float c[28];
+  for (int b = 0; b < 7; b++) {
+    vec4 t = texture(probes, vec3((g.x + float(b) * size.x) / (probeOrigin.w * size.x),
+                                  g.y / size.y, g.z / size.z));
+    c[b * 4] = t.x;
+    c[b * 4 + 1] = t.y;
+    c[b * 4 + 2] = t.z;
+    c[b * 4 + 3] = t.w;
+  }
+  n = normalize(n);
+  float basis[9];
+  shBasis(n, basis);
+  vec3 e = vec3(0);
+  for (int i = 0; i < 9; i++)
+    e += basis[i] * vec3(c[i * 3], c[i * 3 + 1], c[i * 3 + 2]);
+  return max(e, vec3(0));
+}
+#endif
+
+// irradiance sh of the skybox, 9 rgb coefficients. skySH[0].w is 0 until a
+// cube map was projected, then the flat ambient below is used instead
+layout(std140) uniform SkyAmbient {
+  vec4 skySH[9];
+};
+
+vec3 skyAmbient(vec3 n) {
+  float basis[9];
+  shBasis(normalize(n), basis);
+  vec3 e = vec3(0);
+  for (int i = 0; i < 9; i++)
+    e += basis[i] * skySH[i].rgb;
+  return max(e, vec3(0));
+}
+
+#ifdef IMPOSTOR
+// baked by Impostors::bake(), kFrames x kFrames views on an octahedral grid
+uniform sampler2D impostorColor;  // albedo, coverage
+uniform sampler2D impostorNormal; // object space normal, depth across the sphere
+uniform vec4 impostorSphere;      // object space center, radius
+uniform float impostorFrames;
+uniform mat4 model;
+uniform mat4 proj;
+
+// same mapping as oct_decode() / frame_basis() in impostors.cc
+vec3 octDecode(vec2 uv) {
+  vec2 p = uv * 2.0 - 1.0;
+  vec3 d = vec3(p, 1.0 - abs(p.x) - abs(p.y));
+  if (d.z < 0.0)
+    d.xy = (1.0 - abs(p.yx)) * vec2(p.x >= 0.0 ? 1.0 : -1.0, p.y >= 0.0 ? 1.0 : -1.0);
+  return normalize(d);
+}
+
+vec2 octEncode(vec3 d) {
+  vec2 p = d.xy / (abs(d.x) + abs(d.y) + abs(d.z));
+  if (d.z < 0.0)
+    p = (1.0 - abs(p.yx)) * vec2(p.x >= 0.0 ? 1.0 : -1.0, p.y >= 0.0 ? 1.0 : -1.0);
+  return p * 0.5 + 0.5;
+}
+
+// texel of object space point p in the view at frame, which looks back
+// along v. inside is 0 if p is off the view
+vec2 impostorUV(vec2 frame, vec3 p, vec3 right, vec3 up, vec2 inset, out float inside) {
+  vec3 d = p - impostorSphere.xyz;
+  vec2 st = vec2(dot(d, right), dot(d, up)) / (2.0 * impostorSphere.w) + 0.5;
+  inside = all(greaterThanEqual(st, vec2(0))) && all(lessThanEqual(st, vec2(1))) ? 1.0 : 0.0;
+  return (frame + clamp(st, inset, 1.0 - inset)) / impostorFrames;
+}
+
+// the eye ray through the four views around the eye direction. in each
+// view the ray first meets the plane through the center, then steps to the
+// depth the view has there, so thin parts (spout, handle) line up between
+// views. blended by how close each view is and how much of it the ray
+// hits. object space albedo, normal and surface point, false where the ray
+// misses the mesh
+bool impostorSurface(out vec3 albedo, out vec3 normal, out vec3 surface) {
+  vec3 center = impostorSphere.xyz;
+  float radius = impostorSphere.w;
+  vec3 ray = normalize(objectPos - objectEye);
+  float last = impostorFrames - 1.0;
+  vec2 g = octEncode(normalize(objectEye - center)) * last;
+  vec2 g0 = min(floor(g), vec2(last - 1.0));
+  vec2 f = g - g0;
+  // half a texel in from the view's edge, so filtering stays inside it
+  vec2 inset = vec2(0.5 * impostorFrames / float(textureSize(impostorColor, 0).x));
+
+  vec3 albedoSum = vec3(0), normalSum = vec3(0), surfaceSum = vec3(0);
+  float coverage = 0.0;
+  for (int k = 0; k < 4; k++) {
+    vec2 frame = g0 + vec2(k & 1, k >> 1);
+    vec2 bilinear = mix(1.0 - f, f, vec2(k & 1, k >> 1));
+    vec3 v = octDecode(frame / last);
+    vec3 upRef = abs(v.z) > 0.999 ? vec3(0, 1, 0) : vec3(0, 0, 1);
+    vec3 right = normalize(cross(upRef, v));
+    vec3 up = cross(v, right);
+    float toCenter = dot(center - objectEye, v);
+    float along = min(dot(ray, v), -1e-3);
+    float inside;
+    vec2 uv = impostorUV(frame, objectEye + ray * (toCenter / along), right, up, inset, inside);
+    float depth = texture(impostorNormal, uv).a;
+    vec3 h = objectEye + ray * ((toCenter + (1.0 - 2.0 * depth) * radius) / along);
+    uv = impostorUV(frame, h, right, up, inset, inside);
+    vec4 c = texture(impostorColor, uv);
+    vec4 nd = texture(impostorNormal, uv);
+    float w = bilinear.x * bilinear.y * inside * c.a;
+    albedoSum += w * c.rgb;
+    normalSum += w * (nd.rgb * 2.0 - 1.0);
+    surfaceSum += w * (h + v * ((1.0 - 2.0 * nd.a) * radius - dot(h - center, v)));
+    coverage += w;
+  }
+  if (coverage < 0.5)
+    return false;
+  albedo = albedoSum / coverage;
+  normal = normalize(normalSum);
+  surface = surfaceSum / coverage;
+  return true;
+}
+#endif
+
 const float ambient = .3;
 void main() {
-  // vec3 color;
-  // if(texID == 1) {
-  //     outColor = vec4(texture(tex1, texcoord).rgb, 1.0);
-  //     return;
-  // } else {
-  //     color = Color;
-  // }
-
-  // vec3 normal = normalize(vertNormal);
-  // vec3 viewDir = normalize(-pos);
-  // vec3 reflectDir = reflect(viewDir, normal);
-  // vec3 refDir = refract(viewDir, normal, 1/1.52);
-  // vec3 envC = texture(skybox, refDir).rgb;
-
-  // outColor = vec4(envC, 1.0);
-
-  vec3 color;
-  if (texID == -1)
-    color = Color;
-  else if (texID == 0)
-    color = texture(tex0, texcoord).rgb;
-  else if (texID == 1)
-    color = texture(tex1, texcoord).rgb;
-  else {
-    outColor = vec4(1, 0, 0, 1);
-    return; // This was an error, stop lighting!
-  }
+#ifdef IMPOSTOR
+  vec3 albedo, objectNormal, surface;
+  if (!impostorSurface(albedo, objectNormal, surface))
+    discard;
+  // what vertex.vs would have handed over for that point of the mesh. the
+  // props are scaled uniformly, so model works for the normal too
+  vec4 world = model * vec4(surface, 1.0);
+  Color = albedo;
+  worldPos = world.xyz;
+  pos = (view * world).xyz;
+  worldNormal = mat3(model) * objectNormal;
+  vertNormal = normalize(mat3(view) * worldNormal);
+  staticShadowCoord = (staticShadowMatrix * world).xyz;
+  dynamicShadowCoord = (dynamicShadowMatrix * world).xyz;
+  vec4 clip = proj * vec4(pos, 1.0);
+  gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+#endif
+#ifdef TEXTURED
+  vec3 color = texture(TEXTURE_SAMPLER, texcoord).rgb;
+#else
+  vec3 color = Color;
+#endif
 
   vec3 normal = normalize(vertNormal);
   vec3 diffuseC = color * max(dot(-lightDir, normal), 0.0);
-  vec3 ambC = color * ambient;
+  vec3 ambC = color * (skySH[0].w != 0.0 ? skyAmbient(worldNormal) : vec3(ambient));
+#ifdef PROBE_LIT
+  if (probeGrid.w != 0)
+    ambC = color * probeIrradiance(worldNormal);
+#endif
   vec3 viewDir =
       normalize(-pos); // We know the eye is at (0,0)! (Do you know why?)
   vec3 reflectDir = reflect(viewDir, normal);
@@ -54,6 +344,26 @@ void main() {
   if (dot(-lightDir, normal) <= 0.0)
     spec = 0; // No highlight if we are not facing the light
   vec3 specC = .8 * vec3(1.0, 1.0, 1.0) * pow(spec, 4);
+  if (shadowParams.x != 0.0) {
+    float sun = sunVisibility();
+    diffuseC *= sun;
+    specC *= sun;
+  }
   vec3 oColor = ambC + diffuseC + specC;
+#ifdef LIGHTMAPPED
+  vec2 baked;
+  if (bakedLight(baked))
+    oColor = color * baked.x + specC * baked.y;
+#endif
+  if (clusterDims.w > 0)
+    oColor += pointLights(color, normal, viewDir);
+
+#ifdef REFLECTIVE
+  // reflect the eye ray in view space, the cube map wants a world direction
+  // (view is rigid, so its inverse rotation is the transpose)
+  vec3 eyeReflect = reflect(-viewDir, normal);
+  vec3 envC = texture(skybox, transpose(mat3(view)) * eyeReflect).rgb;
+  oColor = mix(oColor, envC, reflectivity);
+#endif
   outColor = vec4(oColor, 1);
-}
\ No newline at end of file
+}
@@ -0,0 +1,44 @@
+#version 150 core
+
+// camera facing quad of an impostor (see Impostors), no vertex buffer. the
+// quad covers the bounding sphere as seen from the camera, fragment.fs
+// (IMPOSTOR) finds the surface behind every pixel from the atlas
+
+uniform mat4 view;
+uniform mat4 proj;
+uniform mat4 model;
+uniform vec4 impostorSphere; // object space center, radius
+
+out vec3 lightDir;
+out vec3 objectPos;      // the quad, object space
+flat out vec3 objectEye; // the camera, object space
+
+// same block as vertex.vs, only the sun is used
+layout(std140) uniform Shadows {
+  mat4 staticShadowMatrix;
+  mat4 dynamicShadowMatrix;
+  vec4 sunDir;
+  vec4 shadowParams;
+};
+
+void main() {
+  vec3 eye = inverse(view)[3].xyz;
+  vec3 center = (model * vec4(impostorSphere.xyz, 1.0)).xyz;
+  float radius = impostorSphere.w * length(model[0].xyz); // uniform scale
+  vec3 toEye = eye - center;
+  float dist = length(toEye);
+  vec3 n = toEye / dist;
+  vec3 upRef = abs(n.y) > 0.999 ? vec3(0, 0, 1) : vec3(0, 1, 0);
+  vec3 right = normalize(cross(upRef, n));
+  vec3 up = cross(n, right);
+  // the sphere's outline is a bit wider than its radius up close
+  float size = radius * dist / sqrt(max(dist * dist - radius * radius, 1e-6));
+  vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+  vec3 world = center + (right * corner.x + up * corner.y) * size;
+  gl_Position = proj * view * vec4(world, 1.0);
+
+  mat4 toObject = inverse(model);
+  objectPos = (toObject * vec4(world, 1.0)).xyz;
+  objectEye = (toObject * vec4(eye, 1.0)).xyz;
+  lightDir = (view * vec4(sunDir.xyz, 0.0)).xyz;
+}
@@ -0,0 +1,18 @@
+#version 150 core
+
+// without NORMAL_DEPTH: albedo and coverage, with it: object space normal
+// and the depth across the bounding sphere
+
+in vec3 normal;
+
+uniform vec3 albedo;
+
+out vec4 outColor;
+
+void main() {
+#ifdef NORMAL_DEPTH
+  outColor = vec4(normalize(normal) * 0.5 + 0.5, gl_FragCoord.z);
+#else
+  outColor = vec4(albedo, 1.0);
+#endif
+}
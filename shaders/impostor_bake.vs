@@ -0,0 +1,16 @@
+#version 150 core
+
+// one view of an impostor bake (see Impostors::bake()), object space in,
+// the view's ortho camera out
+
+in vec3 position;
+in vec3 inNormal;
+
+uniform mat4 viewProj;
+
+out vec3 normal;
+
+void main() {
+  normal = inNormal;
+  gl_Position = viewProj * vec4(position, 1.0);
+}
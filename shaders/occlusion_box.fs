@@ -0,0 +1,6 @@
+#version 150 core
+
+// only counts samples, color and depth writes are off
+
+void main() {
+}
@@ -0,0 +1,14 @@
+#version 150 core
+
+// bounding box of an occlusion query, no vertex buffer. the 14 vertex strip
+// that covers all six faces of the unit cube, picked out by bit masks
+uniform mat4 view;
+uniform mat4 proj;
+uniform vec3 boxMin;
+uniform vec3 boxMax;
+
+void main() {
+  int b = 1 << gl_VertexID;
+  vec3 corner = vec3((0x287a & b) != 0, (0x02af & b) != 0, (0x31e3 & b) != 0);
+  gl_Position = proj * view * vec4(mix(boxMin, boxMax, corner), 1.0);
+}
@@ -0,0 +1,31 @@
+#version 150 core
+
+// stretches the world pass of DynamicResolution over the window. bilinear
+// plus an unsharp mask against the blur of the stretch, clamped to the
+// neighbours so edges don't ring
+
+in vec2 uv;
+
+out vec4 outColor;
+
+uniform sampler2D scene;
+uniform vec4 region; // used part of the target (u, v), sharpen amount
+
+void main() {
+  vec2 texel = 1.0 / vec2(textureSize(scene, 0));
+  // keep the taps inside the rendered part, the rest of the target is stale
+  vec2 lo = 0.5 * texel, hi = region.xy - 0.5 * texel;
+  vec2 p = clamp(uv * region.xy, lo, hi);
+  vec3 c = texture(scene, p).rgb;
+  if (region.z > 0.0) {
+    vec3 n = texture(scene, clamp(p + vec2(0.0, texel.y), lo, hi)).rgb;
+    vec3 s = texture(scene, clamp(p - vec2(0.0, texel.y), lo, hi)).rgb;
+    vec3 e = texture(scene, clamp(p + vec2(texel.x, 0.0), lo, hi)).rgb;
+    vec3 w = texture(scene, clamp(p - vec2(texel.x, 0.0), lo, hi)).rgb;
+    vec3 sharp = c + region.z * (4.0 * c - n - s - e - w);
+    vec3 lowest = min(c, min(min(n, s), min(e, w)));
+    vec3 highest = max(c, max(max(n, s), max(e, w)));
+    c = clamp(sharp, lowest, highest);
+  }
+  outColor = vec4(c, 1.0);
+}
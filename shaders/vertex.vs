@@ -4,7 +4,6 @@ in vec3 position;
 //in vec3 inColor;
 
 //const vec3 inColor = vec3(0.f,0.7f,0.f);
-const vec3 inLightDir = normalize(vec3(-1,1,-1));
 in vec3 inNormal;
 in vec2 inTexcoord;
 
@@ -13,18 +12,42 @@ out vec3 vertNormal;
 out vec3 pos;
 out vec3 lightDir;
 out vec2 texcoord;
+out vec3 staticShadowCoord;
+out vec3 dynamicShadowCoord;
+out vec3 worldPos;    // for the lightmap lookup
+out vec3 worldNormal;
+
+// must match depth.vs, see the depth pre-pass
+invariant gl_Position;
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 proj;
-uniform vec3 inColor;
+
+// per draw, RenderQueue writes one per packet into the frame ring
+layout(std140) uniform Object {
+  mat4 model;
+  mat3 normalMatrix; // inverse transpose of view * model, from the cpu
+  vec4 inColor;
+};
+
+// sun direction and shadow map transforms, filled in by ShadowMaps
+layout(std140) uniform Shadows {
+  mat4 staticShadowMatrix;  // world -> static map texture space
+  mat4 dynamicShadowMatrix; // world -> dynamic map texture space
+  vec4 sunDir;              // direction the sunlight travels, world space
+  vec4 shadowParams;        // x: static map on, y: dynamic map on
+};
 
 void main() {
-Color = inColor;
+Color = inColor.rgb;
    gl_Position = proj * view * model * vec4(position,1.0);
    pos = (view * model * vec4(position,1.0)).xyz;
-   lightDir = (view * vec4(inLightDir,0.0)).xyz; //It's a vector!
-   vec4 norm4 = transpose(inverse(view*model)) * vec4(inNormal,0.0);
-   vertNormal = normalize(norm4.xyz);
+   lightDir = (view * vec4(sunDir.xyz,0.0)).xyz; //It's a vector!
+   vec4 world = model * vec4(position,1.0);
+   staticShadowCoord = (staticShadowMatrix * world).xyz; // ortho, w = 1
+   dynamicShadowCoord = (dynamicShadowMatrix * world).xyz;
+   worldPos = world.xyz;
+   worldNormal = mat3(model) * inNormal;
+   vertNormal = normalize(normalMatrix * inNormal);
    texcoord = inTexcoord;
 }
\ No newline at end of file
@@ -0,0 +1,62 @@
+#version 430 core
+#extension GL_ARB_shader_draw_parameters : require
+
+// vertex.vs for the multi draw indirect path, the per draw values come out
+// of an ssbo instead of uniforms. one record per instance, a command's
+// records start at its base instance
+
+in vec3 position;
+
+in vec3 inNormal;
+in vec2 inTexcoord;
+
+out vec3 Color;
+out vec3 vertNormal;
+out vec3 pos;
+out vec3 lightDir;
+out vec2 texcoord;
+out vec3 staticShadowCoord;
+out vec3 dynamicShadowCoord;
+out vec3 worldPos;    // for the lightmap lookup
+out vec3 worldNormal;
+
+// must match depth.vs, see the depth pre-pass
+invariant gl_Position;
+
+// indirect_draw_data_t in indirect_draw.h
+struct draw_data_t {
+  mat4 model;
+  mat3 normal; // inverse transpose of view * model
+  vec4 color;
+};
+
+layout(std430, binding = 0) readonly buffer DrawData {
+  draw_data_t draws[];
+};
+
+uniform mat4 view;
+uniform mat4 proj;
+
+// sun direction and shadow map transforms, filled in by ShadowMaps
+layout(std140) uniform Shadows {
+  mat4 staticShadowMatrix;  // world -> static map texture space
+  mat4 dynamicShadowMatrix; // world -> dynamic map texture space
+  vec4 sunDir;              // direction the sunlight travels, world space
+  vec4 shadowParams;        // x: static map on, y: dynamic map on
+};
+
+void main() {
+   draw_data_t draw = draws[gl_BaseInstanceARB + gl_InstanceID];
+   mat4 model = draw.model;
+   Color = draw.color.rgb;
+   gl_Position = proj * view * model * vec4(position,1.0);
+   pos = (view * model * vec4(position,1.0)).xyz;
+   lightDir = (view * vec4(sunDir.xyz,0.0)).xyz; //It's a vector!
+   vec4 world = model * vec4(position,1.0);
+   staticShadowCoord = (staticShadowMatrix * world).xyz; // ortho, w = 1
+   dynamicShadowCoord = (dynamicShadowMatrix * world).xyz;
+   worldPos = world.xyz;
+   worldNormal = mat3(model) * inNormal;
+   vertNormal = normalize(draw.normal * inNormal);
+   texcoord = inTexcoord;
+}
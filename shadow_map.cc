@@ -0,0 +1,179 @@
+#include "shadow_map.h"
+
+#include "frame_ring.h"
+#include "gl_state.h"
+#include "shader.h"
+
+#include "glm/gtc/matrix_transform.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+using namespace std;
+
+// texture space = ndc * 0.5 + 0.5
+static const glm::mat4 kBias(0.5f, 0.0f, 0.0f, 0.0f,
+                             0.0f, 0.5f, 0.0f, 0.0f,
+                             0.0f, 0.0f, 0.5f, 0.0f,
+                             0.5f, 0.5f, 0.5f, 1.0f);
+
+void ShadowMaps::init() {
+    if (ready_) {
+        return;
+    }
+    // the maps themselves are only made once shadows are first rendered,
+    // the block goes into the frame ring every frame
+    ready_ = true;
+}
+
+GLuint ShadowMaps::create_map(int size, GLuint &fbo) {
+    GLuint tex;
+    glGenTextures(1, &tex);
+    gl_state().bind_texture(UNIT_STATIC_SHADOW, GL_TEXTURE_2D, tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0,
+                 GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    // hardware 2x2 pcf, and everything outside the map is lit
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    const float border[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+    glGenFramebuffers(1, &fbo);
+    gl_state().bind_framebuffer(fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, tex, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        printf("shadow map framebuffer incomplete\n");
+    }
+    return tex;
+}
+
+void ShadowMaps::cleanup() {
+    if (!ready_) {
+        return;
+    }
+    GLuint textures[2] = {static_tex_, dynamic_tex_};
+    GLuint fbos[2] = {static_fbo_, dynamic_fbo_};
+    for (int i = 0; i < 2; i++) {
+        gl_state().forget_texture(textures[i]);
+        gl_state().forget_framebuffer(fbos[i]);
+    }
+    glDeleteTextures(2, textures);
+    glDeleteFramebuffers(2, fbos);
+    static_tex_ = dynamic_tex_ = static_fbo_ = dynamic_fbo_ = 0;
+    static_dirty_ = true;
+    ready_ = false;
+}
+
+void ShadowMaps::set_level_bounds(const aabb_t &bounds) {
+    glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+    float radius = glm::length(bounds.max - bounds.min) * 0.5f;
+    if (center != center_ || radius != radius_) {
+        center_ = center;
+        radius_ = radius;
+        static_dirty_ = true;
+    }
+}
+
+void ShadowMaps::set_sun_direction(const glm::vec3 &dir) {
+    glm::vec3 d = glm::normalize(dir);
+    if (d != sun_dir_) {
+        sun_dir_ = d;
+        static_dirty_ = true;
+    }
+}
+
+glm::mat4 ShadowMaps::light_view() const {
+    glm::vec3 up = fabsf(sun_dir_.y) > 0.99f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
+    return glm::lookAt(light_pos(), center_, up);
+}
+
+glm::mat4 ShadowMaps::static_proj() const {
+    // the bounding sphere of the level fits in any direction
+    return glm::ortho(-radius_, radius_, -radius_, radius_, 0.0f, light_range());
+}
+
+glm::mat4 ShadowMaps::fit_dynamic(const aabb_t &bounds) {
+    glm::mat4 view = light_view();
+    glm::vec2 lo(1e30f), hi(-1e30f);
+    for (int i = 0; i < 8; i++) {
+        glm::vec3 corner((i & 1) ? bounds.max.x : bounds.min.x,
+                         (i & 2) ? bounds.max.y : bounds.min.y,
+                         (i & 4) ? bounds.max.z : bounds.min.z);
+        glm::vec2 p = glm::vec2(view * glm::vec4(corner, 1.0f));
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p);
+    }
+    // a little margin so the pcf taps at the edge still land inside. depth
+    // covers the same range as the static map, receivers anywhere in the
+    // level compare against it
+    glm::vec2 margin = (hi - lo) * 0.05f + 0.01f;
+    lo -= margin;
+    hi += margin;
+    dynamic_proj_ = glm::ortho(lo.x, hi.x, lo.y, hi.y, 0.0f, light_range());
+    dynamic_used_ = true;
+    return dynamic_proj_;
+}
+
+void ShadowMaps::render(RenderQueue &casters, GLuint program, GLuint vao,
+                        GLuint fbo, int size) {
+    // leaves the map's framebuffer and viewport bound, the render graph
+    // binds the next pass's target anyway
+    gl_state().bind_framebuffer(fbo);
+    gl_state().viewport(0, 0, size, size);
+    gl_state().depth_mask(true);
+    gl_state().depth_func(GL_LESS);
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+    // slope scaled offset against acne on the lit faces
+    gl_state().enable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);
+    casters.submit_depth(program, vao);
+    gl_state().disable(GL_POLYGON_OFFSET_FILL);
+}
+
+void ShadowMaps::render_static(RenderQueue &casters, GLuint program, GLuint vao) {
+    if (static_tex_ == 0) {
+        static_tex_ = create_map(kStaticSize, static_fbo_);
+    }
+    render(casters, program, vao, static_fbo_, kStaticSize);
+    static_dirty_ = false;
+    num_static_rebuilds_++;
+}
+
+void ShadowMaps::render_dynamic(RenderQueue &casters, GLuint program, GLuint vao) {
+    if (dynamic_tex_ == 0) {
+        dynamic_tex_ = create_map(kDynamicSize, dynamic_fbo_);
+    }
+    render(casters, program, vao, dynamic_fbo_, kDynamicSize);
+}
+
+void ShadowMaps::bind(bool enabled) {
+    // Shadows block in the world shaders (std140)
+    struct {
+        glm::mat4 static_matrix;
+        glm::mat4 dynamic_matrix;
+        glm::vec4 sun_dir;
+        glm::vec4 params;
+    } params;
+    glm::mat4 view = light_view();
+    params.static_matrix = kBias * static_proj() * view;
+    params.dynamic_matrix = kBias * dynamic_proj_ * view;
+    params.sun_dir = glm::vec4(sun_dir_, 0.0f);
+    params.params = glm::vec4(enabled && static_tex_ != 0 ? 1.0f : 0.0f,
+                              enabled && dynamic_used_ ? 1.0f : 0.0f, 0.0f, 0.0f);
+    ring_chunk_t chunk = frame_ring().upload(&params, sizeof(params), frame_ring().uniform_align());
+    gl_state().bind_buffer_range(GL_UNIFORM_BUFFER, BLOCK_SHADOWS, chunk.buffer, chunk.offset,
+                                 chunk.size);
+
+    if (enabled) {
+        gl_state().bind_texture(UNIT_STATIC_SHADOW, GL_TEXTURE_2D, static_tex_);
+        gl_state().bind_texture(UNIT_DYNAMIC_SHADOW, GL_TEXTURE_2D, dynamic_tex_);
+    }
+}
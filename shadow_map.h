@@ -0,0 +1,77 @@
+#ifndef SHADOW_MAP_H
+#define SHADOW_MAP_H
+
+#include "game_types.h"
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+#include "render_queue.h"
+
+using namespace std;
+
+// directional light (sun) shadows from two depth maps.
+// the static map holds the level (walls, props, lamps). it is rendered once
+// and kept until invalidate_static(), which the map calls when the level or
+// the sun direction changes. the dynamic map is small, refitted every frame
+// around whatever moves (the goal) and only holds those casters. the world
+// shaders take the darker of the two lookups, so a frame costs one small
+// render instead of the whole maze
+class ShadowMaps {
+public:
+  static const int kStaticSize = 2048;
+  static const int kDynamicSize = 512;
+
+  ShadowMaps() = default;
+  ~ShadowMaps() = default;
+
+  // creates the maps and their framebuffers, call with the context current
+  void init();
+  bool ready() const { return ready_; }
+  void cleanup();
+
+  // world box the static map has to cover, invalidates it if it changed
+  void set_level_bounds(const aabb_t &bounds);
+  // direction the sunlight travels, world space
+  void set_sun_direction(const glm::vec3 &dir);
+  const glm::vec3 &sun_direction() const { return sun_dir_; }
+  void invalidate_static() { static_dirty_ = true; }
+  bool static_dirty() const { return static_dirty_; }
+
+  // light space transforms to begin() the caster queues with
+  glm::mat4 light_view() const;
+  glm::vec3 light_pos() const { return center_ - sun_dir_ * radius_; }
+  float light_range() const { return 2.0f * radius_; }
+  glm::mat4 static_proj() const;
+  // fits the dynamic map around the casters' world bounds
+  glm::mat4 fit_dynamic(const aabb_t &bounds);
+
+  // draw the (sorted) caster queue into the map with a depth only program.
+  // vao has to hold the same vertices as the packets' vaos
+  void render_static(RenderQueue &casters, GLuint program, GLuint vao);
+  void render_dynamic(RenderQueue &casters, GLuint program, GLuint vao);
+  // no dynamic casters this frame, the shaders skip the second lookup
+  void clear_dynamic() { dynamic_used_ = false; }
+
+  // uploads the Shadows block and binds both maps for the world shaders.
+  // with enabled off the shaders skip the lookups entirely
+  void bind(bool enabled);
+
+  int num_static_rebuilds() const { return num_static_rebuilds_; }
+
+private:
+  bool ready_ = false;
+  GLuint static_tex_ = 0, static_fbo_ = 0;
+  GLuint dynamic_tex_ = 0, dynamic_fbo_ = 0;
+
+  glm::vec3 sun_dir_ = glm::normalize(glm::vec3(-1, 1, -1));
+  glm::vec3 center_ = glm::vec3(0.0f);
+  float radius_ = 1.0f;
+  bool static_dirty_ = true;
+  bool dynamic_used_ = false;
+  glm::mat4 dynamic_proj_;
+  int num_static_rebuilds_ = 0;
+
+  GLuint create_map(int size, GLuint &fbo);
+  void render(RenderQueue &casters, GLuint program, GLuint vao, GLuint fbo, int size);
+};
+
+#endif // SHADOW_MAP_H
@@ -0,0 +1,215 @@
+#include "sky_ambient.h"
+
+#include "gl_state.h"
+#include "sh_basis.h"
+#include "shader.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SKY_SSE 1
+#endif
+
+using namespace std;
+
+constexpr float SkyAmbient::kAmbient;
+
+// direction of face texel (s, t) in [-1, 1], per axis which of 1 / s / t
+// (0 / 1 / 2) it is and the sign. same layout as the gl cube map lookup
+static const int kFaceAxes[6][3][2] = {
+    {{0, 1}, {2, -1}, {1, -1}},  // +x: ( 1, -t, -s)
+    {{0, -1}, {2, -1}, {1, 1}},  // -x: (-1, -t,  s)
+    {{1, 1}, {0, 1}, {2, 1}},    // +y: ( s,  1,  t)
+    {{1, 1}, {0, -1}, {2, -1}},  // -y: ( s, -1, -t)
+    {{1, 1}, {2, -1}, {0, 1}},   // +z: ( s, -t,  1)
+    {{1, -1}, {2, -1}, {0, -1}}  // -z: (-s, -t, -1)
+};
+
+void SkyAmbient::begin() {
+    memset(sums_, 0, sizeof(sums_));
+    weight_ = 0.0;
+}
+
+void SkyAmbient::add_face(int face, const unsigned char *pixels, int w, int h, int channels) {
+    if (pixels == nullptr || face < 0 || face >= 6 || channels < 3) {
+        return;
+    }
+    const int(*axes)[2] = kFaceAxes[face];
+    const float kToUnit = 1.0f / 255.0f;
+    for (int y = 0; y < h; y++) {
+        const unsigned char *row = pixels + (size_t)y * w * channels;
+        float t = 2.0f * (y + 0.5f) / h - 1.0f;
+        float row_sums[9][3] = {};
+        float row_weight = 0.0f;
+        int x = 0;
+
+#ifdef SKY_SSE
+        // 4 texels of the row at a time. the solid angle of a texel goes
+        // with 1 / |dir|^3, everything is normalized by the total at the end
+        __m128 acc[9][3];
+        for (int c = 0; c < 9; c++) {
+            acc[c][0] = acc[c][1] = acc[c][2] = _mm_setzero_ps();
+        }
+        __m128 acc_weight = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 tv = _mm_set1_ps(t);
+        const __m128 step = _mm_set1_ps(2.0f / w);
+        const __m128 lanes = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+        for (; x + 4 <= w; x += 4) {
+            __m128 s = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(_mm_set1_ps((float)x), lanes), step), one);
+            __m128 src[3] = {one, s, tv};
+            __m128 d[3];
+            for (int k = 0; k < 3; k++) {
+                d[k] = _mm_mul_ps(src[axes[k][0]], _mm_set1_ps((float)axes[k][1]));
+            }
+            __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(s, s), _mm_mul_ps(tv, tv)), one);
+            __m128 inv = _mm_div_ps(one, _mm_sqrt_ps(len2));
+            __m128 weight = _mm_mul_ps(_mm_mul_ps(inv, inv), inv);
+            __m128 dx = _mm_mul_ps(d[0], inv), dy = _mm_mul_ps(d[1], inv);
+            __m128 dz = _mm_mul_ps(d[2], inv);
+
+            __m128 basis[9];
+            // sh_basis(), 4 directions at a time
+            const __m128 band1 = _mm_set1_ps(kShBand1), band2 = _mm_set1_ps(kShBand2);
+            basis[0] = _mm_set1_ps(kShBand0);
+            basis[1] = _mm_mul_ps(band1, dy);
+            basis[2] = _mm_mul_ps(band1, dz);
+            basis[3] = _mm_mul_ps(band1, dx);
+            basis[4] = _mm_mul_ps(band2, _mm_mul_ps(dx, dy));
+            basis[5] = _mm_mul_ps(band2, _mm_mul_ps(dy, dz));
+            basis[6] = _mm_mul_ps(_mm_set1_ps(kShBand2Zonal),
+                                  _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(3.0f), _mm_mul_ps(dz, dz)), one));
+            basis[7] = _mm_mul_ps(band2, _mm_mul_ps(dx, dz));
+            basis[8] = _mm_mul_ps(_mm_set1_ps(kShBand2Diff),
+                                  _mm_sub_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+
+            const unsigned char *p = row + x * channels;
+            __m128 color[3];
+            for (int ch = 0; ch < 3; ch++) {
+                color[ch] = _mm_mul_ps(_mm_set_ps(p[3 * channels + ch], p[2 * channels + ch],
+                                                  p[channels + ch], p[ch]),
+                                       _mm_mul_ps(weight, _mm_set1_ps(kToUnit)));
+            }
+            for (int c = 0; c < 9; c++) {
+                for (int ch = 0; ch < 3; ch++) {
+                    acc[c][ch] = _mm_add_ps(acc[c][ch], _mm_mul_ps(basis[c], color[ch]));
+                }
+            }
+            acc_weight = _mm_add_ps(acc_weight, weight);
+        }
+        float lanes_out[4];
+        for (int c = 0; c < 9; c++) {
+            for (int ch = 0; ch < 3; ch++) {
+                _mm_storeu_ps(lanes_out, acc[c][ch]);
+                row_sums[c][ch] += lanes_out[0] + lanes_out[1] + lanes_out[2] + lanes_out[3];
+            }
+        }
+        _mm_storeu_ps(lanes_out, acc_weight);
+        row_weight += lanes_out[0] + lanes_out[1] + lanes_out[2] + lanes_out[3];
+#endif
+
+        // the rest of the row (all of it without sse)
+        for (; x < w; x++) {
+            float s = 2.0f * (x + 0.5f) / w - 1.0f;
+            float src[3] = {1.0f, s, t};
+            float d[3];
+            for (int k = 0; k < 3; k++) {
+                d[k] = src[axes[k][0]] * axes[k][1];
+            }
+            float inv = 1.0f / sqrtf(s * s + t * t + 1.0f);
+            float weight = inv * inv * inv;
+            float basis[9];
+            sh_basis(d[0] * inv, d[1] * inv, d[2] * inv, basis);
+            const unsigned char *p = row + x * channels;
+            for (int c = 0; c < 9; c++) {
+                for (int ch = 0; ch < 3; ch++) {
+                    row_sums[c][ch] += basis[c] * p[ch] * kToUnit * weight;
+                }
+            }
+            row_weight += weight;
+        }
+
+        // rows go into doubles, a 2k face is too much for one float sum
+        for (int c = 0; c < 9; c++) {
+            for (int ch = 0; ch < 3; ch++) {
+                sums_[c][ch] += row_sums[c][ch];
+            }
+        }
+        weight_ += row_weight;
+    }
+}
+
+void SkyAmbient::finish() {
+    if (weight_ <= 0.0) {
+        return;
+    }
+    // radiance coefficients (the weights add up to the whole sphere, 4 pi),
+    // convolved with the clamped cosine: pi, 2 pi / 3, pi / 4 per band
+    for (int c = 0; c < 9; c++) {
+        for (int ch = 0; ch < 3; ch++) {
+            coeffs_[c][ch] =
+                (float)(sums_[c][ch] * 4.0 * 3.14159265358979 / weight_) * kShCosineLobe[c];
+        }
+    }
+    // the average irradiance over all normals is the first band alone
+    glm::vec3 average = coeffs_[0] * kShBand0;
+    float gray = (average.r + average.g + average.b) / 3.0f;
+    if (gray <= 0.0f) {
+        return;
+    }
+    for (int c = 0; c < 9; c++) {
+        coeffs_[c] *= kAmbient / gray;
+    }
+    ready_ = true;
+    dirty_ = true;
+    glm::vec3 up = irradiance(glm::vec3(0, 1, 0)), down = irradiance(glm::vec3(0, -1, 0));
+    printf("sky ambient: up (%.2f %.2f %.2f) down (%.2f %.2f %.2f)\n", up.r, up.g, up.b,
+           down.r, down.g, down.b);
+}
+
+glm::vec3 SkyAmbient::irradiance(const glm::vec3 &n) const {
+    float basis[9];
+    sh_basis(n.x, n.y, n.z, basis);
+    glm::vec3 e(0.0f);
+    for (int c = 0; c < 9; c++) {
+        e += coeffs_[c] * basis[c];
+    }
+    return glm::max(e, glm::vec3(0.0f));
+}
+
+void SkyAmbient::bind() {
+    if (!ready_) {
+        return;
+    }
+    if (buffer_ == 0) {
+        glGenBuffers(1, &buffer_);
+    }
+    if (dirty_) {
+        // SkyAmbient block in fragment.fs (std140, vec4 per coefficient),
+        // w of the first one marks it as filled in
+        float block[9][4];
+        for (int c = 0; c < 9; c++) {
+            block[c][0] = coeffs_[c].r;
+            block[c][1] = coeffs_[c].g;
+            block[c][2] = coeffs_[c].b;
+            block[c][3] = c == 0 ? 1.0f : 0.0f;
+        }
+        gl_state().bind_buffer(GL_UNIFORM_BUFFER, buffer_);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(block), block, GL_STATIC_DRAW);
+        dirty_ = false;
+    }
+    gl_state().bind_buffer_base(GL_UNIFORM_BUFFER, BLOCK_SKY_AMBIENT, buffer_);
+}
+
+void SkyAmbient::cleanup() {
+    if (buffer_ == 0) {
+        return;
+    }
+    gl_state().forget_buffer(buffer_);
+    glDeleteBuffers(1, &buffer_);
+    buffer_ = 0;
+    dirty_ = ready_;
+}
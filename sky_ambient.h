@@ -0,0 +1,45 @@
+#ifndef SKY_AMBIENT_H
+#define SKY_AMBIENT_H
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+
+using namespace std;
+
+// image based ambient light from the skybox. the faces of the cube map are
+// projected onto L2 spherical harmonics on the cpu while they load (4 texels
+// at a time with sse), convolved to irradiance and scaled so the average
+// over all directions stays the old constant ambient, so switching skies
+// changes the tint and direction of the fill light and not the exposure.
+// the world shaders evaluate the 9 coefficients for their normal, a few
+// multiply adds instead of sampling the cube map per fragment
+class SkyAmbient {
+public:
+  static constexpr float kAmbient = 0.3f; // average, same as fragment.fs
+
+  SkyAmbient() = default;
+  ~SkyAmbient() = default;
+
+  // begin(), one add_face() per face in gl order (+x, -x, +y, -y, +z, -z),
+  // then finish() computes the coefficients
+  void begin();
+  void add_face(int face, const unsigned char *pixels, int w, int h, int channels);
+  void finish();
+  // irradiance for a world space normal, what the shaders compute
+  glm::vec3 irradiance(const glm::vec3 &n) const;
+
+  // uploads the SkyAmbient block and binds it for the world shaders, call
+  // with the context current
+  void bind();
+  void cleanup();
+
+private:
+  double sums_[9][3];
+  double weight_ = 0.0;
+  glm::vec3 coeffs_[9];
+  bool ready_ = false;
+  bool dirty_ = false;
+  GLuint buffer_ = 0;
+};
+
+#endif // SKY_AMBIENT_H